@@ -469,20 +469,23 @@ dump_spacemap(objset_t *os, space_map_obj_t *smo, space_map_t *sm)
 }
 
 static void
-dump_metaslab(metaslab_t *msp)
+dump_metaslab(metaslab_t *msp, uint64_t condensed, hrtime_t load_time)
 {
-	char freebuf[5];
+	char freebuf[5], sizebuf[5], condbuf[5];
 	space_map_obj_t *smo = &msp->ms_smo;
 	vdev_t *vd = msp->ms_group->mg_vd;
 	spa_t *spa = vd->vdev_spa;
 
 	nicenum(msp->ms_map.sm_size - smo->smo_alloc, freebuf);
+	nicenum(smo->smo_objsize, sizebuf);
+	nicenum(condensed, condbuf);
 
 	if (dump_opt['d'] <= 5) {
-		(void) printf("\t%10llx   %10llu   %5s\n",
+		(void) printf("\t%10llx   %10llu   %5s   %5s   %5s   %8llu\n",
 		    (u_longlong_t)msp->ms_map.sm_start,
 		    (u_longlong_t)smo->smo_object,
-		    freebuf);
+		    freebuf, sizebuf, condbuf,
+		    (u_longlong_t)(load_time / (NANOSEC / MICROSEC)));
 		return;
 	}
 
@@ -490,19 +493,96 @@ dump_metaslab(metaslab_t *msp)
 	    "\tvdev %llu   offset %08llx   spacemap %4llu   free %5s\n",
 	    (u_longlong_t)vd->vdev_id, (u_longlong_t)msp->ms_map.sm_start,
 	    (u_longlong_t)smo->smo_object, freebuf);
+	(void) printf("\tspacemap size %5s   condensed %5s   load %llu us\n",
+	    sizebuf, condbuf,
+	    (u_longlong_t)(load_time / (NANOSEC / MICROSEC)));
 
 	ASSERT(msp->ms_map.sm_size == (1ULL << vd->vdev_ms_shift));
 
 	dump_spacemap(spa->spa_meta_objset, smo, &msp->ms_map);
 }
 
+/*
+ * Load the free map of a metaslab, timing the load, and add its free
+ * segment histogram to 'histo', which is indexed by log2 of the segment
+ * size.  Sets '*condensed' to the size its space map would be condensed
+ * to and returns the load time.
+ */
+static hrtime_t
+dump_metaslab_load(metaslab_t *msp, uint64_t *histo, uint64_t *condensed)
+{
+	space_map_t *sm = &msp->ms_map;
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+	hrtime_t load_time;
+	int loaded, b;
+
+	*condensed = 0;
+
+	mutex_enter(&msp->ms_lock);
+	loaded = sm->sm_loaded;
+	load_time = gethrtime();
+	if (space_map_load(sm, NULL, SM_FREE, &msp->ms_smo,
+	    spa->spa_meta_objset) == 0) {
+		load_time = loaded ? 0 : gethrtime() - load_time;
+		for (b = 0; b < SPACE_MAP_HISTOGRAM_SIZE; b++)
+			histo[b + sm->sm_shift] += sm->sm_histogram[b];
+		*condensed = space_map_condensed_size(sm);
+		if (!loaded)
+			space_map_unload(sm);
+	} else {
+		load_time = 0;
+	}
+	mutex_exit(&msp->ms_lock);
+
+	return (load_time);
+}
+
+static void
+dump_metaslab_histogram(uint64_t *histo)
+{
+	char sizebuf[6];
+	int i;
+	int minidx = 63;
+	int maxidx = 0;
+	uint64_t max = 0;
+
+	for (i = 0; i < 64; i++) {
+		if (histo[i] > max)
+			max = histo[i];
+		if (histo[i] > 0 && i > maxidx)
+			maxidx = i;
+		if (histo[i] > 0 && i < minidx)
+			minidx = i;
+	}
+
+	if (max == 0)
+		return;
+
+	if (max < dump_zap_width)
+		max = dump_zap_width;
+
+	(void) printf("\n    Free segment sizes:\n\n");
+	for (i = minidx; i <= maxidx; i++) {
+		nicenum(1ULL << i, sizebuf);
+		(void) printf("\t%5s: %8llu %s\n", sizebuf,
+		    (u_longlong_t)histo[i],
+		    &dump_zap_stars[(max - histo[i]) * dump_zap_width / max]);
+	}
+}
+
 static void
 dump_metaslabs(spa_t *spa)
 {
 	vdev_t *rvd = spa->spa_root_vdev;
 	vdev_t *vd;
+	uint64_t histo[64];
+	uint64_t condensed, objsize = 0, condsize = 0;
+	hrtime_t load_time, total_time = 0, max_time = 0;
+	char sizebuf[5], condbuf[5];
 	int c, m;
 
+	bzero(histo, sizeof (histo));
+
 	(void) printf("\nMetaslabs:\n");
 
 	for (c = 0; c < rvd->vdev_children; c++) {
@@ -514,15 +594,35 @@ dump_metaslabs(spa_t *spa)
 		spa_config_exit(spa, FTAG);
 
 		if (dump_opt['d'] <= 5) {
-			(void) printf("\t%10s   %10s   %5s\n",
-			    "offset", "spacemap", "free");
-			(void) printf("\t%10s   %10s   %5s\n",
-			    "------", "--------", "----");
+			(void) printf("\t%10s   %10s   %5s   %5s   %5s   %8s\n",
+			    "offset", "spacemap", "free", "size", "cond",
+			    "load us");
+			(void) printf("\t%10s   %10s   %5s   %5s   %5s   %8s\n",
+			    "------", "--------", "----", "----", "----",
+			    "-------");
+		}
+		for (m = 0; m < vd->vdev_ms_count; m++) {
+			metaslab_t *msp = vd->vdev_ms[m];
+
+			load_time = dump_metaslab_load(msp, histo, &condensed);
+			dump_metaslab(msp, condensed, load_time);
+
+			objsize += msp->ms_smo.smo_objsize;
+			condsize += condensed;
+			total_time += load_time;
+			max_time = MAX(max_time, load_time);
 		}
-		for (m = 0; m < vd->vdev_ms_count; m++)
-			dump_metaslab(vd->vdev_ms[m]);
 		(void) printf("\n");
 	}
+
+	nicenum(objsize, sizebuf);
+	nicenum(condsize, condbuf);
+	(void) printf("    Space maps: %s on disk, %s condensed, "
+	    "load %llu ms total, %llu ms max\n", sizebuf, condbuf,
+	    (u_longlong_t)(total_time / (NANOSEC / MILLISEC)),
+	    (u_longlong_t)(max_time / (NANOSEC / MILLISEC)));
+
+	dump_metaslab_histogram(histo);
 }
 
 static void
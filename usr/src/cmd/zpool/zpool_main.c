@@ -37,6 +37,7 @@
 #include <libintl.h>
 #include <libuutil.h>
 #include <locale.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -91,6 +92,7 @@ static int zpool_do_export(int, char **);
 static int zpool_do_upgrade(int, char **);
 
 static int zpool_do_history(int, char **);
+static int zpool_do_txgs(int, char **);
 
 static int zpool_do_get(int, char **);
 static int zpool_do_set(int, char **);
@@ -129,6 +131,7 @@ typedef enum {
 	HELP_REMOVE,
 	HELP_SCRUB,
 	HELP_STATUS,
+	HELP_TXGS,
 	HELP_UPGRADE,
 	HELP_GET,
 	HELP_SET
@@ -176,6 +179,7 @@ static zpool_command_t command_table[] = {
 	{ "upgrade",	zpool_do_upgrade,	HELP_UPGRADE		},
 	{ NULL },
 	{ "history",	zpool_do_history,	HELP_HISTORY		},
+	{ "txgs",	zpool_do_txgs,		HELP_TXGS		},
 	{ "get",	zpool_do_get,		HELP_GET		},
 	{ "set",	zpool_do_set,		HELP_SET		},
 };
@@ -213,7 +217,7 @@ get_usage(zpool_help_t idx) {
 		    "\timport [-p property=value] [-d dir] [-D] [-f] \n"
 		    "\t    [-o opts] [-R root ] <pool | id> [newpool]\n"));
 	case HELP_IOSTAT:
-		return (gettext("\tiostat [-v] [pool] ... [interval "
+		return (gettext("\tiostat [-vw] [pool] ... [interval "
 		    "[count]]\n"));
 	case HELP_LIST:
 		return (gettext("\tlist [-H] [-o field[,...]] [pool] ...\n"));
@@ -230,6 +234,8 @@ get_usage(zpool_help_t idx) {
 		return (gettext("\tscrub [-s] <pool> ...\n"));
 	case HELP_STATUS:
 		return (gettext("\tstatus [-vx] [pool] ...\n"));
+	case HELP_TXGS:
+		return (gettext("\ttxgs [-v] [pool] ...\n"));
 	case HELP_UPGRADE:
 		return (gettext("\tupgrade\n"
 		    "\tupgrade -v\n"
@@ -627,8 +633,8 @@ zpool_do_add(int argc, char **argv)
  * zpool remove <pool> <vdev>
  *
  * Removes the given vdev from the pool.  Currently, this only supports removing
- * spares from the pool.  Eventually, we'll want to support removing leaf vdevs
- * (as an alias for 'detach') as well as toplevel vdevs.
+ * spares and cache devices from the pool.  Eventually, we'll want to support
+ * removing leaf vdevs (as an alias for 'detach') as well as toplevel vdevs.
  */
 int
 zpool_do_remove(int argc, char **argv)
@@ -763,7 +769,10 @@ zpool_do_create(int argc, char **argv)
 	if (nvroot == NULL)
 		return (1);
 
-	/* make_root_vdev() allows 0 toplevel children if there are spares */
+	/*
+	 * make_root_vdev() allows 0 toplevel children if there are spares or
+	 * cache devices
+	 */
 	verify(nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
 	    &child, &children) == 0);
 	if (children == 0) {
@@ -1040,6 +1049,14 @@ max_width(zpool_handle_t *zhp, nvlist_t *nv, int depth, int max)
 				max = ret;
 	}
 
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_L2CACHE,
+	    &child, &children) == 0) {
+		for (c = 0; c < children; c++)
+			if ((ret = max_width(zhp, child[c], depth + 2,
+			    max)) > max)
+				max = ret;
+	}
+
 	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
 	    &child, &children) == 0) {
 		for (c = 0; c < children; c++)
@@ -1125,6 +1142,16 @@ print_import_config(const char *name, nvlist_t *nv, int namewidth, int depth,
 		free(vname);
 	}
 
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_L2CACHE,
+	    &child, &children) == 0) {
+		(void) printf(gettext("\tcache\n"));
+		for (c = 0; c < children; c++) {
+			vname = zpool_vdev_name(g_zfs, NULL, child[c]);
+			(void) printf("\t  %s\n", vname);
+			free(vname);
+		}
+	}
+
 	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_SPARES,
 	    &child, &children) != 0)
 		return;
@@ -1706,6 +1733,7 @@ error:
 typedef struct iostat_cbdata {
 	zpool_list_t *cb_list;
 	int cb_verbose;
+	int cb_histo;
 	int cb_iteration;
 	int cb_namewidth;
 } iostat_cbdata_t;
@@ -1823,6 +1851,123 @@ print_vdev_stats(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
 	}
 }
 
+/*
+ * Latency histogram view (zpool iostat -w). For each vdev, show how many
+ * I/Os fell into each power-of-two latency bucket since the last interval:
+ * time spent on the device, by type, and time spent in the vdev queue, for
+ * synchronous and asynchronous I/O. Scrub and resilver I/O is shown apart.
+ */
+static void
+print_iostat_histo_header(iostat_cbdata_t *cb, const char *name, int depth)
+{
+	int i;
+
+	(void) printf("%*s%-*s   disk_wait    syncq_wait   asyncq_wait"
+	    "    scrub_wait\n", depth, "", cb->cb_namewidth - depth, name);
+	(void) printf("%-*s   read  write   read  write   read  write"
+	    "  queue   disk\n", cb->cb_namewidth, "latency");
+	for (i = 0; i < cb->cb_namewidth; i++)
+		(void) printf("-");
+	(void) printf("  -----  -----  -----  -----  -----  -----"
+	    "  -----  -----\n");
+}
+
+static void
+format_latency(int bucket, char *buf, size_t len)
+{
+	u_longlong_t ns = 1ULL << bucket;
+
+	if (ns < 1000)
+		(void) snprintf(buf, len, "%lluns", ns);
+	else if (ns < 1000000)
+		(void) snprintf(buf, len, "%lluus", ns / 1000);
+	else if (ns < NANOSEC)
+		(void) snprintf(buf, len, "%llums", ns / 1000000);
+	else
+		(void) snprintf(buf, len, "%llus", ns / NANOSEC);
+}
+
+#define	IOSTAT_HISTO_COLUMNS	8
+
+static void
+print_vdev_histo(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
+    nvlist_t *newnv, iostat_cbdata_t *cb, int depth)
+{
+	static const vdev_lat_stat_t zerovls = { 0 };
+	const vdev_lat_stat_t *oldvls, *newvls;
+	nvlist_t **oldchild, **newchild;
+	uint64_t row[VDEV_LAT_BUCKETS][IOSTAT_HISTO_COLUMNS];
+	uint_t c, children;
+	int b, col, first, last;
+	char buf[16];
+	char *vname;
+
+	if (nvlist_lookup_uint64_array(newnv, ZPOOL_CONFIG_LAT_STATS,
+	    (uint64_t **)&newvls, &c) != 0) {
+		(void) fprintf(stderr, gettext("latency histograms are not "
+		    "available for '%s'\n"), name);
+		return;
+	}
+	if (oldnv == NULL || nvlist_lookup_uint64_array(oldnv,
+	    ZPOOL_CONFIG_LAT_STATS, (uint64_t **)&oldvls, &c) != 0)
+		oldvls = &zerovls;
+
+#define	LAT_DELTA(field, class)	\
+	(newvls->field[class][b] - oldvls->field[class][b])
+
+	first = VDEV_LAT_BUCKETS;
+	last = -1;
+	for (b = 0; b < VDEV_LAT_BUCKETS; b++) {
+		row[b][0] = LAT_DELTA(vls_disk, VDEV_LAT_SYNC_READ) +
+		    LAT_DELTA(vls_disk, VDEV_LAT_ASYNC_READ);
+		row[b][1] = LAT_DELTA(vls_disk, VDEV_LAT_SYNC_WRITE) +
+		    LAT_DELTA(vls_disk, VDEV_LAT_ASYNC_WRITE);
+		row[b][2] = LAT_DELTA(vls_queue, VDEV_LAT_SYNC_READ);
+		row[b][3] = LAT_DELTA(vls_queue, VDEV_LAT_SYNC_WRITE);
+		row[b][4] = LAT_DELTA(vls_queue, VDEV_LAT_ASYNC_READ);
+		row[b][5] = LAT_DELTA(vls_queue, VDEV_LAT_ASYNC_WRITE);
+		row[b][6] = LAT_DELTA(vls_queue, VDEV_LAT_SCRUB);
+		row[b][7] = LAT_DELTA(vls_disk, VDEV_LAT_SCRUB);
+		for (col = 0; col < IOSTAT_HISTO_COLUMNS; col++) {
+			if (row[b][col] != 0) {
+				if (first > b)
+					first = b;
+				last = b;
+			}
+		}
+	}
+
+#undef	LAT_DELTA
+
+	print_iostat_histo_header(cb, name, depth);
+	for (b = first; b <= last; b++) {
+		format_latency(b, buf, sizeof (buf));
+		(void) printf("%-*s", cb->cb_namewidth, buf);
+		for (col = 0; col < IOSTAT_HISTO_COLUMNS; col++)
+			print_one_stat(row[b][col]);
+		(void) printf("\n");
+	}
+	(void) printf("\n");
+
+	if (!cb->cb_verbose)
+		return;
+
+	if (nvlist_lookup_nvlist_array(newnv, ZPOOL_CONFIG_CHILDREN,
+	    &newchild, &children) != 0)
+		return;
+
+	if (oldnv && nvlist_lookup_nvlist_array(oldnv, ZPOOL_CONFIG_CHILDREN,
+	    &oldchild, &c) != 0)
+		return;
+
+	for (c = 0; c < children; c++) {
+		vname = zpool_vdev_name(g_zfs, zhp, newchild[c]);
+		print_vdev_histo(zhp, vname, oldnv ? oldchild[c] : NULL,
+		    newchild[c], cb, depth + 2);
+		free(vname);
+	}
+}
+
 static int
 refresh_iostat(zpool_handle_t *zhp, void *data)
 {
@@ -1868,6 +2013,12 @@ print_iostat(zpool_handle_t *zhp, void *data)
 	/*
 	 * Print out the statistics for the pool.
 	 */
+	if (cb->cb_histo) {
+		print_vdev_histo(zhp, zpool_get_name(zhp), oldnvroot,
+		    newnvroot, cb, 0);
+		return (0);
+	}
+
 	print_vdev_stats(zhp, zpool_get_name(zhp), oldnvroot, newnvroot, cb, 0);
 
 	if (cb->cb_verbose)
@@ -1919,9 +2070,10 @@ get_namewidth(zpool_handle_t *zhp, void *data)
 }
 
 /*
- * zpool iostat [-v] [pool] ... [interval [count]]
+ * zpool iostat [-vw] [pool] ... [interval [count]]
  *
  *	-v	Display statistics for individual vdevs
+ *	-w	Display latency histograms instead of throughput
  *
  * This command can be tricky because we want to be able to deal with pool
  * creation/destruction as well as vdev configuration changes.  The bulk of this
@@ -1938,15 +2090,19 @@ zpool_do_iostat(int argc, char **argv)
 	unsigned long interval = 0, count = 0;
 	zpool_list_t *list;
 	boolean_t verbose = B_FALSE;
+	boolean_t histo = B_FALSE;
 	iostat_cbdata_t cb;
 	int columns;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "v")) != -1) {
+	while ((c = getopt(argc, argv, "vw")) != -1) {
 		switch (c) {
 		case 'v':
 			verbose = B_TRUE;
 			break;
+		case 'w':
+			histo = B_TRUE;
+			break;
 		case '?':
 			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
 			    optopt);
@@ -2037,6 +2193,7 @@ zpool_do_iostat(int argc, char **argv)
 	 */
 	cb.cb_list = list;
 	cb.cb_verbose = verbose;
+	cb.cb_histo = histo;
 	cb.cb_iteration = 0;
 	cb.cb_namewidth = 0;
 
@@ -2074,7 +2231,7 @@ zpool_do_iostat(int argc, char **argv)
 		/*
 		 * If it's the first time, or verbose mode, print the header.
 		 */
-		if (++cb.cb_iteration == 1 || verbose)
+		if ((++cb.cb_iteration == 1 || verbose) && !histo)
 			print_iostat_header(&cb);
 
 		(void) pool_list_iter(list, B_FALSE, print_iostat, &cb);
@@ -2083,10 +2240,10 @@ zpool_do_iostat(int argc, char **argv)
 		 * If there's more than one pool, and we're not in verbose mode
 		 * (which prints a separator for us), then print a separator.
 		 */
-		if (npools > 1 && !verbose)
+		if (npools > 1 && !verbose && !histo)
 			print_iostat_separator(&cb);
 
-		if (verbose)
+		if (verbose && !histo)
 			(void) printf("\n");
 
 		/*
@@ -2784,14 +2941,17 @@ typedef struct status_cbdata {
  * Print out detailed scrub status.
  */
 void
-print_scrub_status(nvlist_t *nvroot)
+print_scrub_status(nvlist_t *config, nvlist_t *nvroot)
 {
 	vdev_stat_t *vs;
-	uint_t vsc;
+	pool_scrub_position_t *psp = NULL;
+	uint_t vsc, pspc;
 	time_t start, end, now;
 	double fraction_done;
-	uint64_t examined, total, minutes_left;
+	uint64_t examined, issued, total, minutes_left, elapsed, done;
+	uint64_t resumed = 0;
 	char *scrub_type;
+	char ebuf[6], ibuf[6], rbuf[6], lbuf[6], pbuf[6];
 
 	verify(nvlist_lookup_uint64_array(nvroot, ZPOOL_CONFIG_STATS,
 	    (uint64_t **)&vs, &vsc) == 0);
@@ -2813,6 +2973,26 @@ print_scrub_status(nvlist_t *nvroot)
 	examined = vs->vs_scrub_examined;
 	total = vs->vs_alloc;
 
+	/*
+	 * A sorted scrub finds blocks well ahead of reading them, so base
+	 * progress on what has been read back, if the kernel reports it.
+	 */
+	if (vsc * sizeof (uint64_t) > offsetof(vdev_stat_t, vs_scrub_issued))
+		issued = vs->vs_scrub_issued;
+	else
+		issued = examined;
+
+	/*
+	 * A scrub resumed after export counts what it examined before;
+	 * leave that out of the rate.
+	 */
+	if (nvlist_lookup_uint64_array(config, ZPOOL_CONFIG_SCRUB_RESUMED,
+	    (uint64_t **)&psp, &pspc) == 0 &&
+	    pspc * sizeof (uint64_t) >= sizeof (pool_scrub_position_t))
+		resumed = psp->psp_examined;
+	else
+		psp = NULL;
+
 	if (end != 0) {
 		(void) printf(gettext("%s %s with %llu errors on %s"),
 		    scrub_type, vs->vs_scrub_complete ? "completed" : "stopped",
@@ -2820,18 +3000,39 @@ print_scrub_status(nvlist_t *nvroot)
 		return;
 	}
 
-	if (examined == 0)
-		examined = 1;
-	if (examined > total)
-		total = examined;
+	zfs_nicenum(examined, ebuf, sizeof (ebuf));
+	zfs_nicenum(issued, ibuf, sizeof (ibuf));
+	zfs_nicenum(total > examined ? total - examined : 0, lbuf,
+	    sizeof (lbuf));
+	elapsed = (now > start) ? now - start : 1;
+	done = (issued > resumed) ? issued - resumed : 0;
+	zfs_nicenum(done / elapsed, rbuf, sizeof (rbuf));
+
+	if (issued == 0)
+		issued = 1;
+	if (issued > total)
+		total = issued;
+	if (done == 0)
+		done = 1;
 
-	fraction_done = (double)examined / total;
-	minutes_left = (uint64_t)((now - start) *
-	    (1 - fraction_done) / fraction_done / 60);
+	fraction_done = (double)issued / total;
+	minutes_left = (uint64_t)((double)elapsed * (total - issued) /
+	    done / 60);
 
 	(void) printf(gettext("%s in progress, %.2f%% done, %lluh%um to go\n"),
 	    scrub_type, 100 * fraction_done,
 	    (u_longlong_t)(minutes_left / 60), (uint_t)(minutes_left % 60));
+	(void) printf(gettext("        %s examined, %s to examine, "
+	    "%s read back at %s/s\n"), ebuf, lbuf, ibuf, rbuf);
+	if (psp != NULL) {
+		zfs_nicenum(resumed, pbuf, sizeof (pbuf));
+		(void) printf(gettext("        resumed at <0x%llx>:<0x%llx>:"
+		    "%lld:%llu with %s already examined\n"),
+		    (u_longlong_t)psp->psp_objset,
+		    (u_longlong_t)psp->psp_object,
+		    (longlong_t)psp->psp_level,
+		    (u_longlong_t)psp->psp_blkid, pbuf);
+	}
 }
 
 typedef struct spare_cbdata {
@@ -3056,6 +3257,26 @@ print_spares(zpool_handle_t *zhp, nvlist_t **spares, uint_t nspares,
 	}
 }
 
+static void
+print_l2cache(zpool_handle_t *zhp, nvlist_t **l2cache, uint_t nl2cache,
+    int namewidth)
+{
+	uint_t i;
+	char *name;
+
+	if (nl2cache == 0)
+		return;
+
+	(void) printf(gettext("\tcache\n"));
+
+	for (i = 0; i < nl2cache; i++) {
+		name = zpool_vdev_name(g_zfs, zhp, l2cache[i]);
+		print_status_config(zhp, name, l2cache[i],
+		    namewidth, 2, B_FALSE, B_FALSE);
+		free(name);
+	}
+}
+
 /*
  * Display a summary of pool status.  Displays a summary such as:
  *
@@ -3247,12 +3468,12 @@ status_callback(zpool_handle_t *zhp, void *data)
 	if (config != NULL) {
 		int namewidth;
 		uint64_t nerr;
-		nvlist_t **spares;
-		uint_t nspares;
+		nvlist_t **spares, **l2cache;
+		uint_t nspares, nl2cache;
 
 
 		(void) printf(gettext(" scrub: "));
-		print_scrub_status(nvroot);
+		print_scrub_status(config, nvroot);
 
 		namewidth = max_width(zhp, nvroot, 0, 0);
 		if (namewidth < 10)
@@ -3267,6 +3488,10 @@ status_callback(zpool_handle_t *zhp, void *data)
 			print_status_config(zhp, "logs", nvroot, namewidth, 0,
 			    B_FALSE, B_TRUE);
 
+		if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
+		    &l2cache, &nl2cache) == 0)
+			print_l2cache(zhp, l2cache, nl2cache, namewidth);
+
 		if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES,
 		    &spares, &nspares) == 0)
 			print_spares(zhp, spares, nspares, namewidth);
@@ -3764,6 +3989,149 @@ zpool_do_history(int argc, char **argv)
 	return (ret);
 }
 
+typedef struct txgs_cbdata {
+	boolean_t first;
+	int verbose;
+} txgs_cbdata_t;
+
+/*
+ * Column headings for the spa_sync_phase_t entries of a txg record.
+ */
+static const char *txgs_phase_table[SPA_SYNC_PHASES] = {
+	"DEFER",
+	"CONFIG",
+	"DATA",
+	"MOS",
+	"VDEVS",
+	"UBER",
+	"CLEAN",
+};
+
+#define	NS2MS(ns)	((double)(ns) / 1000000.0)
+
+/*
+ * Print the recently synced txgs of a specific pool.
+ */
+static int
+get_txgs_one(zpool_handle_t *zhp, void *data)
+{
+	txgs_cbdata_t *cb = (txgs_cbdata_t *)data;
+	nvlist_t *nvtxgs;
+	nvlist_t **records;
+	uint_t numrecords;
+	uint64_t txg, when, total, passes, written, freed;
+	uint64_t *phase, *pass;
+	uint_t nphase, npass;
+	char wbuf[6];
+	time_t tsec;
+	struct tm t;
+	char tbuf[30];
+	int ret, i, p;
+
+	if (!cb->first)
+		(void) printf("\n");
+	cb->first = B_FALSE;
+
+	(void) printf(gettext("Synced txgs for '%s':\n"), zpool_get_name(zhp));
+
+	if ((ret = zpool_get_txg_history(zhp, &nvtxgs)) != 0)
+		return (ret);
+
+	if (nvlist_lookup_nvlist_array(nvtxgs, ZPOOL_TXG_RECORD,
+	    &records, &numrecords) != 0) {
+		nvlist_free(nvtxgs);
+		return (0);
+	}
+
+	(void) printf("%-10s %-8s %9s %6s", "TXG", "TIME", "TOTAL", "PASSES");
+	for (p = 0; p < SPA_SYNC_PHASES; p++)
+		(void) printf(" %8s", txgs_phase_table[p]);
+	(void) printf(" %7s %7s\n", "WRITTEN", "FREED");
+
+	for (i = 0; i < numrecords; i++) {
+		verify(nvlist_lookup_uint64(records[i], ZPOOL_TXG_TXG,
+		    &txg) == 0);
+		verify(nvlist_lookup_uint64(records[i], ZPOOL_TXG_TIME,
+		    &when) == 0);
+		verify(nvlist_lookup_uint64(records[i], ZPOOL_TXG_TOTAL,
+		    &total) == 0);
+		verify(nvlist_lookup_uint64(records[i], ZPOOL_TXG_PASSES,
+		    &passes) == 0);
+		verify(nvlist_lookup_uint64(records[i], ZPOOL_TXG_WRITTEN,
+		    &written) == 0);
+		verify(nvlist_lookup_uint64(records[i], ZPOOL_TXG_FREED,
+		    &freed) == 0);
+		verify(nvlist_lookup_uint64_array(records[i],
+		    ZPOOL_TXG_PHASE_NS, &phase, &nphase) == 0);
+		verify(nvlist_lookup_uint64_array(records[i],
+		    ZPOOL_TXG_PASS_NS, &pass, &npass) == 0);
+
+		tsec = when;
+		(void) localtime_r(&tsec, &t);
+		(void) strftime(tbuf, sizeof (tbuf), "%T", &t);
+		zfs_nicenum(written, wbuf, sizeof (wbuf));
+
+		(void) printf("%-10llu %-8s %9.2f %6llu", (u_longlong_t)txg,
+		    tbuf, NS2MS(total), (u_longlong_t)passes);
+		for (p = 0; p < SPA_SYNC_PHASES; p++) {
+			(void) printf(" %8.2f",
+			    p < nphase ? NS2MS(phase[p]) : 0.0);
+		}
+		(void) printf(" %7s %7llu\n", wbuf, (u_longlong_t)freed);
+
+		if (!cb->verbose)
+			continue;
+		for (p = 0; p < npass; p++) {
+			(void) printf(gettext("    pass %d%s %9.2f ms\n"),
+			    p + 1, p + 1 == npass && passes > npass ? "+" : " ",
+			    NS2MS(pass[p]));
+		}
+	}
+	nvlist_free(nvtxgs);
+
+	return (ret);
+}
+
+/*
+ * zpool txgs [-v] [pool] ...
+ *
+ * Displays how long each recently synced txg took, broken down by
+ * spa_sync() phase, with the bytes written and blocks freed.  All times
+ * are in milliseconds.  With -v, also display the time of each pass.
+ */
+int
+zpool_do_txgs(int argc, char **argv)
+{
+	txgs_cbdata_t cbdata = { 0 };
+	int ret;
+	int c;
+
+	cbdata.first = B_TRUE;
+	/* check options */
+	while ((c = getopt(argc, argv, "v")) != -1) {
+		switch (c) {
+		case 'v':
+			cbdata.verbose = 1;
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	ret = for_each_pool(argc, argv, B_FALSE, NULL, get_txgs_one, &cbdata);
+
+	if (argc == 0 && cbdata.first == B_TRUE) {
+		(void) printf(gettext("no pools available\n"));
+		return (0);
+	}
+
+	return (ret);
+}
+
 static int
 get_callback(zpool_handle_t *zhp, void *data)
 {
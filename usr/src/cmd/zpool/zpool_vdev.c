@@ -42,13 +42,16 @@
  *
  * 	Hot spares
  *
+ * 	Cache devices
+ *
  * While the underlying implementation supports it, group vdevs cannot contain
  * other group vdevs.  All userland verification of devices is contained within
  * this file.  If successful, the nvlist returned can be passed directly to the
  * kernel; we've done as much verification as possible in userland.
  *
  * Hot spares are a special case, and passed down as an array of disk vdevs, at
- * the same level as the root of the vdev tree.
+ * the same level as the root of the vdev tree.  Cache devices for the level 2
+ * ARC are passed down the same way.
  *
  * The only function exported by this file is 'make_root_vdev'.  The
  * function performs several passes:
@@ -351,12 +354,17 @@ check_file(const char *file, boolean_t force, boolean_t isspare)
 			return (0);
 
 		if (state == POOL_STATE_ACTIVE ||
-		    state == POOL_STATE_SPARE || !force) {
+		    state == POOL_STATE_SPARE ||
+		    state == POOL_STATE_L2CACHE || !force) {
 			switch (state) {
 			case POOL_STATE_SPARE:
 				vdev_error(gettext("%s is reserved as a hot "
 				    "spare for pool %s\n"), file, name);
 				break;
+			case POOL_STATE_L2CACHE:
+				vdev_error(gettext("%s is in use as a cache "
+				    "device for pool %s\n"), file, name);
+				break;
 			default:
 				vdev_error(gettext("%s is part of %s pool "
 				    "'%s'\n"), file, desc, name);
@@ -852,8 +860,8 @@ check_replication(nvlist_t *config, nvlist_t *newroot)
 			return (0);
 	}
 	/*
-	 * for spares there may be no children, and therefore no
-	 * replication level to check
+	 * for spares and cache devices there may be no children, and
+	 * therefore no replication level to check
 	 */
 	if ((nvlist_lookup_nvlist_array(newroot, ZPOOL_CONFIG_CHILDREN,
 	    &child, &children) != 0) || (children == 0)) {
@@ -1013,6 +1021,12 @@ make_disks(zpool_handle_t *zhp, nvlist_t *nv)
 			if ((ret = make_disks(zhp, child[c])) != 0)
 				return (ret);
 
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_L2CACHE,
+	    &child, &children) == 0)
+		for (c = 0; c < children; c++)
+			if ((ret = make_disks(zhp, child[c])) != 0)
+				return (ret);
+
 	return (0);
 }
 
@@ -1125,6 +1139,13 @@ check_in_use(nvlist_t *config, nvlist_t *nv, int force, int isreplacing,
 			if ((ret = check_in_use(config, child[c], force,
 			    isreplacing, B_TRUE)) != 0)
 				return (ret);
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_L2CACHE,
+	    &child, &children) == 0)
+		for (c = 0; c < children; c++)
+			if ((ret = check_in_use(config, child[c], force,
+			    isreplacing, B_FALSE)) != 0)
+				return (ret);
 #endif
 	return (0);
 }
@@ -1162,6 +1183,12 @@ is_grouping(const char *type, int *mindev)
 		return (VDEV_TYPE_LOG);
 	}
 
+	if (strcmp(type, "cache") == 0) {
+		if (mindev != NULL)
+			*mindev = 1;
+		return (VDEV_TYPE_L2CACHE);
+	}
+
 	return (NULL);
 }
 
@@ -1174,8 +1201,8 @@ is_grouping(const char *type, int *mindev)
 nvlist_t *
 construct_spec(nvlist_t *props, int argc, char **argv)
 {
-	nvlist_t *nvroot, *nv, **top, **spares;
-	int t, toplevels, mindev, nspares, nlogs;
+	nvlist_t *nvroot, *nv, **top, **spares, **l2cache;
+	int t, toplevels, mindev, nspares, nlogs, nl2cache;
 	const char *type;
 	uint64_t is_log;
 	boolean_t seen_logs;
@@ -1183,8 +1210,10 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 	top = NULL;
 	toplevels = 0;
 	spares = NULL;
+	l2cache = NULL;
 	nspares = 0;
 	nlogs = 0;
+	nl2cache = 0;
 	is_log = B_FALSE;
 	seen_logs = B_FALSE;
 
@@ -1210,6 +1239,17 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				is_log = B_FALSE;
 			}
 
+			if (strcmp(type, VDEV_TYPE_L2CACHE) == 0) {
+				if (l2cache != NULL) {
+					(void) fprintf(stderr,
+					    gettext("invalid vdev "
+					    "specification: 'cache' can be "
+					    "specified only once\n"));
+					return (NULL);
+				}
+				is_log = B_FALSE;
+			}
+
 			if (strcmp(type, VDEV_TYPE_LOG) == 0) {
 				if (seen_logs) {
 					(void) fprintf(stderr,
@@ -1268,6 +1308,10 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				spares = child;
 				nspares = children;
 				continue;
+			} else if (strcmp(type, VDEV_TYPE_L2CACHE) == 0) {
+				l2cache = child;
+				nl2cache = children;
+				continue;
 			} else {
 				verify(nvlist_alloc(&nv, NV_UNIQUE_NAME,
 				    0) == 0);
@@ -1308,7 +1352,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 		top[toplevels - 1] = nv;
 	}
 
-	if (toplevels == 0 && nspares == 0) {
+	if (toplevels == 0 && nspares == 0 && nl2cache == 0) {
 		(void) fprintf(stderr, gettext("invalid vdev "
 		    "specification: at least one toplevel vdev must be "
 		    "specified\n"));
@@ -1332,13 +1376,20 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 	if (nspares != 0)
 		verify(nvlist_add_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES,
 		    spares, nspares) == 0);
+	if (nl2cache != 0)
+		verify(nvlist_add_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
+		    l2cache, nl2cache) == 0);
 
 	for (t = 0; t < toplevels; t++)
 		nvlist_free(top[t]);
 	for (t = 0; t < nspares; t++)
 		nvlist_free(spares[t]);
+	for (t = 0; t < nl2cache; t++)
+		nvlist_free(l2cache[t]);
 	if (spares)
 		free(spares);
+	if (l2cache)
+		free(l2cache);
 	free(top);
 
 	return (nvroot);
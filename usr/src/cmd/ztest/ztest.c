@@ -75,6 +75,9 @@
  * The -N(okill) option will suppress kills, so each child runs to completion.
  * This can be useful when you're trying to distinguish temporal incursions
  * from plain old race conditions.
+ *
+ * The -b(ench) option runs one of the benchmarks at the end of this file
+ * instead of the stress test; use -b list to see which ones exist.
  */
 
 #include <sys/zfs_context.h>
@@ -97,9 +100,11 @@
 #include <sys/zio_compress.h>
 #include <sys/zil.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_file.h>
 #include <sys/spa_impl.h>
 #include <sys/dsl_prop.h>
 #include <sys/refcount.h>
+#include <sys/zfs_ioctl.h>
 #include <stdio.h>
 #ifndef __APPLE__
 #include <stdio_ext.h>
@@ -132,6 +137,7 @@ static int zopt_init = 1;
 static char *zopt_dir = "/tmp";
 static uint64_t zopt_time = 300;	/* 5 minutes */
 static int zopt_maxfaults;
+static char *zopt_bench = NULL;
 #ifdef __APPLE__
 static uint64_t zopt_seed = 0;
 volatile int ztest_forever = 0;
@@ -175,6 +181,8 @@ ztest_func_t ztest_vdev_LUN_growth;
 ztest_func_t ztest_vdev_add_remove;
 ztest_func_t ztest_scrub;
 ztest_func_t ztest_spa_rename;
+ztest_func_t ztest_checksum_impls;
+ztest_func_t ztest_spa_txg_history;
 
 typedef struct ztest_info {
 	ztest_func_t	*zi_func;	/* test function */
@@ -211,6 +219,8 @@ ztest_info_t ztest_info[] = {
 	{ ztest_vdev_LUN_growth,		&zopt_rarely	},
 	{ ztest_vdev_add_remove,		&zopt_vdevtime	},
 	{ ztest_scrub,				&zopt_vdevtime	},
+	{ ztest_checksum_impls,			&zopt_sometimes	},
+	{ ztest_spa_txg_history,		&zopt_sometimes	},
 };
 #else
 ztest_info_t ztest_info[] = {
@@ -262,6 +272,12 @@ ztest_info_t ztest_info[] = {
 	{ ztest_scrub,
 		"ztest_scrub",
 		&zopt_vdevtime},
+	{ ztest_checksum_impls,
+		"ztest_checksum_impls",
+		&zopt_sometimes},
+	{ ztest_spa_txg_history,
+		"ztest_spa_txg_history",
+		&zopt_sometimes},
 };
 #endif
 
@@ -308,6 +324,16 @@ static int ztest_dump_core = 1;
 
 extern uint64_t zio_gang_bang;
 extern uint16_t zio_zil_fail_shift;
+extern int zfs_arc_sublists;
+extern int zio_cache_magazines;
+extern int zfs_vdev_adaptive;
+extern int zil_commit_parallel;
+extern int zil_replay_parallel;
+extern int zfs_txg_history;
+extern int zfs_scrub_sorted;
+extern int vdev_mirror_balance;
+extern uint64_t zfs_send_queue_max;
+extern int zfs_recv_threads;
 
 #define	ZTEST_DIROBJ		1
 #define	ZTEST_MICROZAP_OBJ	2
@@ -452,6 +478,7 @@ usage(boolean_t requested)
 	    "\t[-T time] total run time (default: %llu sec)\n"
 	    "\t[-P passtime] time per pass (default: %llu sec)\n"
 	    "\t[-z zil failure rate (default: fail every 2^%llu allocs)]\n"
+	    "\t[-b benchmark] run the named benchmark and exit (-b list)\n"
 #ifdef __APPLE__
 	    "\t[-S random seed (default: randomly chosen)]\n"
 	    "\t[-D] wait in child process for GDB to attach.  (After attaching say 'set ztest_forever=0')\n"
@@ -519,9 +546,9 @@ process_options(int argc, char **argv)
 
 	while ((opt = getopt(argc, argv,
 #ifdef __APPLE__	    
-		"v:s:a:m:r:R:d:t:g:i:k:p:f:VET:P:z:h:S:D")) != EOF) {
+		"v:s:a:m:r:R:d:t:g:i:k:p:f:VET:P:z:b:h:S:D")) != EOF) {
 #else
-	    "v:s:a:m:r:R:d:t:g:i:k:p:f:VET:P:z:h")) != EOF) {
+	    "v:s:a:m:r:R:d:t:g:i:k:p:f:VET:P:z:b:h")) != EOF) {
 #endif
 		value = 0;
 		switch (opt) {
@@ -599,6 +626,9 @@ process_options(int argc, char **argv)
 		case 'z':
 			zio_zil_fail_shift = MIN(value, 16);
 			break;
+		case 'b':
+			zopt_bench = strdup(optarg);
+			break;
 #ifdef __APPLE__
 	    case 'S':
 			zopt_seed = value;
@@ -857,6 +887,30 @@ ztest_replay_remove(ztest_replay_t *zr, lr_remove_t *lr, boolean_t byteswap)
 	return (error);
 }
 
+static int
+ztest_replay_write(ztest_replay_t *zr, lr_write_t *lr, boolean_t byteswap)
+{
+	objset_t *os = zr->zr_os;
+	dmu_tx_t *tx;
+	int error;
+
+	if (byteswap)
+		byteswap_uint64_array(lr, sizeof (*lr));
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, lr->lr_foid, lr->lr_offset, lr->lr_length);
+	error = dmu_tx_assign(tx, zr->zr_assign);
+	if (error) {
+		dmu_tx_abort(tx);
+		return (error);
+	}
+
+	dmu_write(os, lr->lr_foid, lr->lr_offset, lr->lr_length, lr + 1, tx);
+	dmu_tx_commit(tx);
+
+	return (0);
+}
+
 zil_replay_func_t *ztest_replay_vector[TX_MAX_TYPE] = {
 	NULL,			/* 0 no such transaction type */
 	ztest_replay_create,	/* TX_CREATE */
@@ -867,7 +921,7 @@ zil_replay_func_t *ztest_replay_vector[TX_MAX_TYPE] = {
 	NULL,			/* TX_RMDIR */
 	NULL,			/* TX_LINK */
 	NULL,			/* TX_RENAME */
-	NULL,			/* TX_WRITE */
+	ztest_replay_write,	/* TX_WRITE */
 	NULL,			/* TX_TRUNCATE */
 	NULL,			/* TX_SETATTR */
 	NULL,			/* TX_ACL */
@@ -2867,6 +2921,131 @@ ztest_spa_rename(ztest_args_t *za)
 	(void) rw_unlock(&ztest_shared->zs_name_lock);
 }
 
+/*
+ * Fill 'buf' with pseudo-random data. ztest_random() is far too slow to
+ * call for every word of a 128K buffer, so it just seeds an xorshift.
+ */
+static void
+ztest_random_fill(void *buf, uint64_t size)
+{
+	uint64_t *wp = buf;
+	uint64_t x = ztest_random(-1ULL) | 1;
+	uint64_t i;
+
+	for (i = 0; i < size / sizeof (uint64_t); i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		wp[i] = x;
+	}
+}
+
+/*
+ * Cross-check every supported SHA-256 implementation against the generic
+ * C code on random buffers of random length, so that padding and partial
+ * blocks are exercised as well as whole ones.
+ */
+/* ARGSUSED */
+void
+ztest_checksum_impls(ztest_args_t *za)
+{
+	uint8_t *buf = umem_alloc(SPA_MAXBLOCKSIZE, UMEM_NOFAIL);
+	zio_cksum_t ref, zc;
+	uint64_t size;
+	int i, impl, error;
+
+	for (i = 0; i < 16; i++) {
+		size = ztest_random(SPA_MAXBLOCKSIZE + 1);
+		ztest_random_fill(buf, SPA_MAXBLOCKSIZE);
+
+		VERIFY(sha256_impl_checksum(0, buf, size, &ref) == 0);
+		for (impl = 1; sha256_impl_name(impl) != NULL; impl++) {
+			error = sha256_impl_checksum(impl, buf, size, &zc);
+			if (error == ENOTSUP)
+				continue;
+			if (error != 0 || !ZIO_CHECKSUM_EQUAL(ref, zc))
+				fatal(0, "SHA-256 %s differs from %s, "
+				    "size %llu", sha256_impl_name(impl),
+				    sha256_impl_name(0), (u_longlong_t)size);
+		}
+	}
+
+	umem_free(buf, SPA_MAXBLOCKSIZE);
+}
+
+/*
+ * Force a txg to sync, then sanity check the pool's txg history: the
+ * records must be in txg order, and neither the phases nor the passes
+ * of a txg can add up to more than its whole sync.
+ */
+void
+ztest_spa_txg_history(ztest_args_t *za)
+{
+	spa_t *spa = dmu_objset_spa(za->za_os);
+	nvlist_t *nvl, **records;
+	uint64_t txg, last_txg, total, passes, sum;
+	uint64_t *phase, *pass;
+	uint_t numrecords, nphase, npass;
+	int i, p;
+
+	txg_wait_synced(spa_get_dsl(spa), 0);
+
+	VERIFY(spa_txg_history_get(spa, &nvl) == 0);
+	if (nvlist_lookup_nvlist_array(nvl, ZPOOL_TXG_RECORD,
+	    &records, &numrecords) != 0) {
+		if (zfs_txg_history != 0)
+			fatal(0, "no txg history after txg_wait_synced()");
+		nvlist_free(nvl);
+		return;
+	}
+
+	last_txg = 0;
+	for (i = 0; i < numrecords; i++) {
+		VERIFY(nvlist_lookup_uint64(records[i], ZPOOL_TXG_TXG,
+		    &txg) == 0);
+		VERIFY(nvlist_lookup_uint64(records[i], ZPOOL_TXG_TOTAL,
+		    &total) == 0);
+		VERIFY(nvlist_lookup_uint64(records[i], ZPOOL_TXG_PASSES,
+		    &passes) == 0);
+		VERIFY(nvlist_lookup_uint64_array(records[i],
+		    ZPOOL_TXG_PHASE_NS, &phase, &nphase) == 0);
+		VERIFY(nvlist_lookup_uint64_array(records[i],
+		    ZPOOL_TXG_PASS_NS, &pass, &npass) == 0);
+
+		if (txg <= last_txg)
+			fatal(0, "txg history out of order: %llu after %llu",
+			    (u_longlong_t)txg, (u_longlong_t)last_txg);
+		last_txg = txg;
+
+		if (passes == 0 || nphase != SPA_SYNC_PHASES ||
+		    npass == 0 || npass > passes)
+			fatal(0, "txg %llu: %llu passes, %u phases, %u pass "
+			    "times", (u_longlong_t)txg, (u_longlong_t)passes,
+			    nphase, npass);
+
+		for (sum = 0, p = 0; p < nphase; p++)
+			sum += phase[p];
+		if (sum > total)
+			fatal(0, "txg %llu: phases took %llu ns of %llu",
+			    (u_longlong_t)txg, (u_longlong_t)sum,
+			    (u_longlong_t)total);
+
+		for (sum = 0, p = 0; p < npass; p++)
+			sum += pass[p];
+		if (sum > total)
+			fatal(0, "txg %llu: passes took %llu ns of %llu",
+			    (u_longlong_t)txg, (u_longlong_t)sum,
+			    (u_longlong_t)total);
+	}
+
+	if (zopt_verbose >= 6)
+		(void) printf("%u txgs in history, last txg %llu took "
+		    "%llu ns\n", numrecords, (u_longlong_t)last_txg,
+		    (u_longlong_t)total);
+
+	nvlist_free(nvl);
+}
+
 
 /*
  * Completely obliterate one disk.
@@ -3491,64 +3670,1914 @@ ztest_init(char *pool)
 	kernel_fini();
 }
 
-int
-main(int argc, char **argv)
+/*
+ * Benchmarks.
+ *
+ * Unlike the stress tests above, these are run on demand (-b name) in the
+ * parent process, one at a time, and report their results on stdout. Each
+ * benchmark does its own kernel_init() and pool setup as required.
+ */
+typedef void ztest_bench_func_t(void);
+
+typedef struct ztest_bench {
+	char			*zb_name;
+	ztest_bench_func_t	*zb_func;
+	char			*zb_desc;
+} ztest_bench_t;
+
+/*
+ * RAID-Z parity generation and reconstruction throughput for each parity
+ * implementation, parity level and column count. Each iteration processes
+ * one 128K block spread across the data columns, as a write would.
+ */
+static void
+ztest_bench_raidz_impl(int impl)
 {
-	int kills = 0;
-	int iters = 0;
-	int i, f;
-	ztest_shared_t *zs;
-	ztest_info_t *zi;
-	char timebuf[100];
-	char numbuf[6];
+	const char *name = vdev_raidz_impl_name(impl);
+	hrtime_t gen, rec;
+	uint64_t colsize, bytes;
+	int nparity, cols, error;
+	int iters = 200;
+
+	for (nparity = 1; nparity <= 2; nparity++) {
+		for (cols = nparity + 1; cols <= 16; cols++) {
+			colsize = P2ROUNDUP(SPA_MAXBLOCKSIZE / (cols - nparity),
+			    SPA_MINBLOCKSIZE);
+			error = vdev_raidz_bench(impl, nparity, cols, colsize,
+			    iters, &gen, &rec);
+			if (error == ENOTSUP) {
+				(void) printf("%-8s (not supported on this "
+				    "processor)\n", name);
+				return;
+			}
+			if (error != 0)
+				fatal(0, "vdev_raidz_bench(%s, %d, %d) = %d",
+				    name, nparity, cols, error);
+			bytes = colsize * (cols - nparity) * iters;
+			(void) printf("%-8s %6d %4d %8llu %10.2f %10.2f\n",
+			    name, nparity, cols, (u_longlong_t)colsize,
+			    (double)bytes / MAX(gen, 1),
+			    (double)bytes / MAX(rec, 1));
+		}
+	}
+}
 
-	(void) setvbuf(stdout, NULL, _IOLBF, 0);
+static void
+ztest_bench_raidz(void)
+{
+	int impl;
 
-	/* Override location of zpool.cache */
-	spa_config_dir = "/tmp";
+	kernel_init(FREAD);
 
-#ifdef __APPLE__
-	zopt_seed = time(0);
-#else
-	ztest_random_fd = open("/dev/urandom", O_RDONLY);
-#endif
+	(void) printf("%-8s %6s %4s %8s %10s %10s\n",
+	    "impl", "parity", "cols", "colsize", "gen GB/s", "rec GB/s");
+	for (impl = 0; vdev_raidz_impl_name(impl) != NULL; impl++)
+		ztest_bench_raidz_impl(impl);
 
-#ifdef __APPLE__
-	/* fake getexecname() by just saving Arg0, which is supposed
-	   to be the full path to the executable. */
-	getexecname_fake = strdup(argv[0]);
-#endif
+	kernel_fini();
+}
 
-	process_options(argc, argv);
-#ifdef __APPLE__
-	srandom(zopt_seed);
-#endif
+/*
+ * Checksum functions with more than one implementation, and the hooks
+ * needed to select each implementation in turn.
+ */
+typedef struct ztest_cksum_impl {
+	zio_checksum_t	*zci_func;
+	int		*zci_tunable;
+	void		(*zci_init)(void);
+	const char	*(*zci_name)(int);
+	boolean_t	(*zci_supported)(int);
+} ztest_cksum_impl_t;
+
+static ztest_cksum_impl_t ztest_cksum_impls[] = {
+	{ fletcher_4_native, &zfs_fletcher_4_impl, fletcher_4_init,
+	    fletcher_4_impl_name, fletcher_4_impl_supported },
+	{ zio_checksum_SHA256, &zfs_sha256_impl, sha256_init,
+	    sha256_impl_name, sha256_impl_supported },
+};
 
-	argc -= optind;
-	argv += optind;
+#define	ZTEST_CKSUM_IMPLS	\
+	(sizeof (ztest_cksum_impls) / sizeof (ztest_cksum_impl_t))
 
-#ifdef __APPLE__
-	/*
-	 * Check zopt_dir, as ztest_init() will fail if path is not absolute
-	 */
-	
-	if (zopt_dir[0] != '/') {
-		fprintf(stderr, "%s: -f : path must start with '/'.\n", getexecname_fake);
-		exit(1);
+/*
+ * Checksum throughput, in MB/s, for every function in zio_checksum_table[]
+ * at each power-of-two block size. Functions with several implementations
+ * are reported once per implementation, after checking that each agrees
+ * bit-for-bit with the first (reference) one in both byte orders on
+ * buffers of random length.
+ */
+static uint64_t
+ztest_bench_checksum_rate(zio_checksum_t *func, void *buf, uint64_t size)
+{
+	uint64_t iters = MAX((64ULL << 20) / size, 16);
+	uint64_t i;
+	zio_cksum_t zc;
+	hrtime_t start, elapsed;
+
+	start = gethrtime();
+	for (i = 0; i < iters; i++)
+		func(buf, size, &zc);
+	elapsed = MAX(gethrtime() - start, 1);
+
+	return (iters * size * (NANOSEC / 1000000) / elapsed);
+}
+
+static void
+ztest_bench_checksum_row(const char *name, zio_checksum_t *func, void *buf)
+{
+	uint64_t size;
+
+	(void) printf("%-18s", name);
+	for (size = SPA_MINBLOCKSIZE; size <= SPA_MAXBLOCKSIZE; size <<= 1)
+		(void) printf(" %7llu", (u_longlong_t)
+		    ztest_bench_checksum_rate(func, buf, size));
+	(void) printf("\n");
+}
+
+#define	ZTEST_CKSUM_VERIFY	256
+
+static void
+ztest_bench_checksum_impls(zio_checksum_info_t *ci, ztest_cksum_impl_t *zci,
+    void *buf)
+{
+	zio_cksum_t *ref;
+	zio_cksum_t zc;
+	uint64_t sizes[ZTEST_CKSUM_VERIFY];
+	char name[32];
+	int i, impl, bswap;
+
+	ref = umem_alloc(sizeof (zio_cksum_t) * 2 * ZTEST_CKSUM_VERIFY,
+	    UMEM_NOFAIL);
+
+	for (impl = 0; zci->zci_name(impl) != NULL; impl++) {
+		(void) snprintf(name, sizeof (name), "%s/%s", ci->ci_name,
+		    zci->zci_name(impl));
+		if (!zci->zci_supported(impl)) {
+			(void) printf("%-18s (not supported on this "
+			    "processor)\n", name);
+			continue;
+		}
+		*zci->zci_tunable = impl;
+		zci->zci_init();
+
+		for (i = 0; i < ZTEST_CKSUM_VERIFY; i++) {
+			if (impl == 0)
+				sizes[i] = ztest_random(SPA_MAXBLOCKSIZE + 1);
+			for (bswap = 0; bswap < 2; bswap++) {
+				ci->ci_func[bswap](buf, sizes[i], &zc);
+				if (impl == 0)
+					ref[2 * i + bswap] = zc;
+				else if (!ZIO_CHECKSUM_EQUAL(zc,
+				    ref[2 * i + bswap]))
+					fatal(0, "%s differs from %s/%s, "
+					    "size %llu%s", name, ci->ci_name,
+					    zci->zci_name(0),
+					    (u_longlong_t)sizes[i],
+					    bswap ? " (byteswap)" : "");
+			}
+		}
+
+		ztest_bench_checksum_row(name, ci->ci_func[0], buf);
 	}
-#endif
 
-	dprintf_setup(&argc, argv);
+	*zci->zci_tunable = -1;
+	zci->zci_init();
 
-	/*
-	 * Blow away any existing copy of zpool.cache
-	 */
-	if (zopt_init != 0)
-		(void) remove("/tmp/zpool.cache");
+	umem_free(ref, sizeof (zio_cksum_t) * 2 * ZTEST_CKSUM_VERIFY);
+}
 
-	zs = ztest_shared = (void *)mmap(0,
-	    P2ROUNDUP(sizeof (ztest_shared_t), getpagesize()),
-	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+static void
+ztest_bench_checksum(void)
+{
+	zio_checksum_info_t *ci;
+	void *buf;
+	uint64_t size;
+	int c, d, i;
+
+	kernel_init(FREAD);
+
+	buf = umem_alloc(SPA_MAXBLOCKSIZE, UMEM_NOFAIL);
+	ztest_random_fill(buf, SPA_MAXBLOCKSIZE);
+
+	(void) printf("%-18s", "checksum MB/s");
+	for (size = SPA_MINBLOCKSIZE; size <= SPA_MAXBLOCKSIZE; size <<= 1)
+		(void) printf(" %6lluK", (u_longlong_t)size >> 10);
+	(void) printf("\n");
+
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ci = &zio_checksum_table[c];
+		if (ci->ci_func[0] == NULL || c == ZIO_CHECKSUM_OFF)
+			continue;
+
+		/*
+		 * Several table entries share a function; report it once,
+		 * under the name of the last (user-visible) entry.
+		 */
+		for (d = c + 1; d < ZIO_CHECKSUM_FUNCTIONS; d++)
+			if (zio_checksum_table[d].ci_func[0] == ci->ci_func[0])
+				break;
+		if (d != ZIO_CHECKSUM_FUNCTIONS)
+			continue;
+
+		for (i = 0; i < ZTEST_CKSUM_IMPLS; i++)
+			if (ztest_cksum_impls[i].zci_func == ci->ci_func[0])
+				break;
+		if (i == ZTEST_CKSUM_IMPLS)
+			ztest_bench_checksum_row(ci->ci_name, ci->ci_func[0],
+			    buf);
+		else
+			ztest_bench_checksum_impls(ci, &ztest_cksum_impls[i],
+			    buf);
+	}
+
+	umem_free(buf, SPA_MAXBLOCKSIZE);
+
+	kernel_fini();
+}
+
+/*
+ * Create and open a pool for a benchmark, replacing any existing one.  The
+ * pool has a single top-level vdev of 'size' bytes per file, built by
+ * make_vdev_root() from 'r' RAID-Z and 'm' mirror children.
+ */
+static spa_t *
+ztest_bench_pool_create(size_t size, int r, int m)
+{
+	nvlist_t *nvroot;
+	spa_t *spa;
+	int error;
+
+	kernel_init(FREAD | FWRITE);
+
+	(void) spa_destroy(zopt_pool);
+	ztest_shared->zs_vdev_primaries = 0;
+	nvroot = make_vdev_root(size, 0, r, m, 1);
+	error = spa_create(zopt_pool, nvroot, NULL, NULL);
+	nvlist_free(nvroot);
+	if (error)
+		fatal(0, "spa_create() = %d", error);
+	error = spa_open(zopt_pool, &spa, FTAG);
+	if (error)
+		fatal(0, "spa_open() = %d", error);
+
+	return (spa);
+}
+
+static void
+ztest_bench_pool_destroy(spa_t *spa)
+{
+	spa_close(spa, FTAG);
+	(void) spa_destroy(zopt_pool);
+
+	kernel_fini();
+}
+
+/*
+ * Fill 'order' with a random permutation of 0 .. n - 1.
+ */
+static void
+ztest_bench_shuffle(uint64_t *order, uint64_t n)
+{
+	uint64_t i, j, tmp;
+
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	for (i = n; i > 1; i--) {
+		j = ztest_random(i);
+		tmp = order[i - 1];
+		order[i - 1] = order[j];
+		order[j] = tmp;
+	}
+}
+
+/*
+ * Allocate an object with 'blksz' blocks (0 for the default) for a
+ * benchmark.
+ */
+static uint64_t
+ztest_bench_object_alloc(objset_t *os, uint64_t blksz)
+{
+	dmu_tx_t *tx;
+	uint64_t object;
+	int error;
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error)
+		fatal(0, "dmu_tx_assign() = %d", error);
+	object = dmu_object_alloc(os, DMU_OT_UINT64_OTHER, blksz,
+	    DMU_OT_NONE, 0, tx);
+	dmu_tx_commit(tx);
+
+	return (object);
+}
+
+/*
+ * Create and open a filesystem for a benchmark, with one object in it.
+ */
+static void
+ztest_bench_objset_create(char *name, objset_t **osp, uint64_t *objectp,
+    uint64_t blksz)
+{
+	int error;
+
+	error = dmu_objset_create(name, DMU_OST_OTHER, NULL, NULL, NULL);
+	if (error)
+		fatal(0, "dmu_objset_create(%s) = %d", name, error);
+	error = dmu_objset_open(name, DMU_OST_OTHER, DS_MODE_STANDARD, osp);
+	if (error)
+		fatal(0, "dmu_objset_open(%s) = %d", name, error);
+
+	*objectp = ztest_bench_object_alloc(*osp, blksz);
+}
+
+/*
+ * Random 4K physical reads and writes against a single file vdev, with up
+ * to ZTEST_FILE_DEPTH I/Os outstanding, for the synchronous and the
+ * asynchronous file vdev paths. The I/Os go to the unused part of the boot
+ * block region, which is the only space a physical I/O may address without
+ * disturbing the pool.
+ */
+#define	ZTEST_FILE_IOS		20000
+#define	ZTEST_FILE_DEPTH	256
+#define	ZTEST_FILE_IOSIZE	4096
+
+static uint64_t
+ztest_bench_file_iops(vdev_t *vd, int type, char *buf)
+{
+	uint64_t start = VDEV_BOOT_OFFSET + VDEV_BOOT_HEADER_SIZE;
+	uint64_t blocks = (VDEV_LABEL_START_SIZE - start) / ZTEST_FILE_IOSIZE;
+	uint64_t offset;
+	hrtime_t t0, elapsed;
+	zio_t *rio;
+	int i, d;
+
+	t0 = gethrtime();
+	for (i = 0; i < ZTEST_FILE_IOS; i += ZTEST_FILE_DEPTH) {
+		rio = zio_root(vd->vdev_spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+		for (d = 0; d < ZTEST_FILE_DEPTH; d++) {
+			offset = start +
+			    ztest_random(blocks) * ZTEST_FILE_IOSIZE;
+			if (type == ZIO_TYPE_READ)
+				zio_nowait(zio_read_phys(rio, vd, offset,
+				    ZTEST_FILE_IOSIZE,
+				    buf + d * ZTEST_FILE_IOSIZE,
+				    ZIO_CHECKSUM_OFF, NULL, NULL,
+				    ZIO_PRIORITY_SYNC_READ,
+				    ZIO_FLAG_CONFIG_HELD | ZIO_FLAG_CANFAIL |
+				    ZIO_FLAG_DONT_CACHE));
+			else
+				zio_nowait(zio_write_phys(rio, vd, offset,
+				    ZTEST_FILE_IOSIZE,
+				    buf + d * ZTEST_FILE_IOSIZE,
+				    ZIO_CHECKSUM_OFF, NULL, NULL,
+				    ZIO_PRIORITY_SYNC_WRITE,
+				    ZIO_FLAG_CONFIG_HELD | ZIO_FLAG_CANFAIL));
+		}
+		if (zio_wait(rio) != 0)
+			fatal(0, "file vdev %s failed",
+			    type == ZIO_TYPE_READ ? "read" : "write");
+	}
+	elapsed = MAX(gethrtime() - t0, 1);
+
+	return ((uint64_t)P2ROUNDUP(ZTEST_FILE_IOS, ZTEST_FILE_DEPTH) *
+	    NANOSEC / elapsed);
+}
+
+static void
+ztest_bench_file(void)
+{
+	spa_t *spa;
+	vdev_t *vd;
+	char *buf;
+	int async;
+
+	buf = umem_zalloc(ZTEST_FILE_DEPTH * ZTEST_FILE_IOSIZE, UMEM_NOFAIL);
+
+	(void) printf("%-8s %10s %10s\n", "path", "read IOPS", "write IOPS");
+	for (async = 0; async <= 1; async++) {
+		zfs_vdev_file_async = async;
+		spa = ztest_bench_pool_create(zopt_vdev_size, 0, 0);
+
+		spa_config_enter(spa, RW_READER, FTAG);
+		vd = spa->spa_root_vdev->vdev_child[0];
+		ASSERT(vd->vdev_ops->vdev_op_leaf);
+		(void) printf("%-8s %10llu %10llu\n",
+		    async ? "async" : "sync",
+		    (u_longlong_t)ztest_bench_file_iops(vd, ZIO_TYPE_READ, buf),
+		    (u_longlong_t)ztest_bench_file_iops(vd, ZIO_TYPE_WRITE,
+		    buf));
+		spa_config_exit(spa, FTAG);
+
+		ztest_bench_pool_destroy(spa);
+	}
+	zfs_vdev_file_async = 1;
+
+	umem_free(buf, ZTEST_FILE_DEPTH * ZTEST_FILE_IOSIZE);
+}
+
+/*
+ * ARC cache hit throughput with an increasing number of threads, each
+ * reading random blocks of an object small enough to stay cached. Every
+ * read takes and drops an ARC reference on the block, moving its header
+ * off and back onto its state's list, so this measures contention on the
+ * ARC state lists. It is run once with a single sublist per state, that
+ * is a single list lock per state, and once with the default.
+ */
+#define	ZTEST_ARC_BLOCKS	1024
+#define	ZTEST_ARC_BLOCKSIZE	4096
+#define	ZTEST_ARC_READS		(1 << 20)
+#define	ZTEST_ARC_THREADS	32
+
+typedef struct ztest_arc_reader {
+	objset_t	*zar_os;
+	uint64_t	zar_object;
+	uint64_t	zar_reads;
+	uint64_t	zar_seed;
+	thread_t	zar_thread;
+} ztest_arc_reader_t;
+
+static void *
+ztest_bench_arc_reader(void *arg)
+{
+	ztest_arc_reader_t *zar = arg;
+	char buf[ZTEST_ARC_BLOCKSIZE];
+	uint64_t x = zar->zar_seed;
+	uint64_t i;
+
+	/* ztest_random() is serialized, so use a private generator */
+	for (i = 0; i < zar->zar_reads; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		VERIFY(0 == dmu_read(zar->zar_os, zar->zar_object,
+		    (x % ZTEST_ARC_BLOCKS) * ZTEST_ARC_BLOCKSIZE,
+		    ZTEST_ARC_BLOCKSIZE, buf));
+	}
+
+	return (NULL);
+}
+
+static uint64_t
+ztest_bench_arc_rate(objset_t *os, uint64_t object, int threads)
+{
+	ztest_arc_reader_t *zar;
+	hrtime_t t0, elapsed;
+	int t, error;
+
+	zar = umem_zalloc(threads * sizeof (ztest_arc_reader_t), UMEM_NOFAIL);
+
+	t0 = gethrtime();
+	for (t = 0; t < threads; t++) {
+		zar[t].zar_os = os;
+		zar[t].zar_object = object;
+		zar[t].zar_reads = ZTEST_ARC_READS / threads;
+		zar[t].zar_seed = ztest_random(-1ULL) | 1;
+		error = thr_create(0, 0, ztest_bench_arc_reader, &zar[t],
+		    THR_BOUND, &zar[t].zar_thread);
+		if (error)
+			fatal(0, "can't create thread %d: error %d", t, error);
+	}
+	for (t = 0; t < threads; t++) {
+		error = thr_join(zar[t].zar_thread, NULL, NULL);
+		if (error)
+			fatal(0, "thr_join(%d) = %d", t, error);
+	}
+	elapsed = MAX(gethrtime() - t0, 1);
+
+	umem_free(zar, threads * sizeof (ztest_arc_reader_t));
+
+	return ((ZTEST_ARC_READS / threads) * threads * NANOSEC / elapsed);
+}
+
+static void
+ztest_bench_arc(void)
+{
+	uint64_t rate[2][ZTEST_ARC_THREADS + 1];
+	char name[100];
+	char *buf;
+	spa_t *spa;
+	objset_t *os;
+	dmu_tx_t *tx;
+	uint64_t object;
+	int pass, threads, error;
+
+	buf = umem_zalloc(ZTEST_ARC_BLOCKS * ZTEST_ARC_BLOCKSIZE,
+	    UMEM_NOFAIL);
+	(void) snprintf(name, sizeof (name), "%s/arc", zopt_pool);
+
+	for (pass = 0; pass < 2; pass++) {
+		zfs_arc_sublists = (pass == 0) ? 1 : 0;
+		spa = ztest_bench_pool_create(zopt_vdev_size, 0, 0);
+
+		ztest_bench_objset_create(name, &os, &object,
+		    ZTEST_ARC_BLOCKSIZE);
+
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_write(tx, object, 0,
+		    ZTEST_ARC_BLOCKS * ZTEST_ARC_BLOCKSIZE);
+		error = dmu_tx_assign(tx, TXG_WAIT);
+		if (error)
+			fatal(0, "dmu_tx_assign() = %d", error);
+		dmu_write(os, object, 0, ZTEST_ARC_BLOCKS * ZTEST_ARC_BLOCKSIZE,
+		    buf, tx);
+		dmu_tx_commit(tx);
+		txg_wait_synced(spa_get_dsl(spa), 0);
+
+		/* bring every block into the cache before timing */
+		VERIFY(0 == dmu_read(os, object, 0,
+		    ZTEST_ARC_BLOCKS * ZTEST_ARC_BLOCKSIZE, buf));
+
+		for (threads = 1; threads <= ZTEST_ARC_THREADS; threads <<= 1)
+			rate[pass][threads] =
+			    ztest_bench_arc_rate(os, object, threads);
+
+		dmu_objset_close(os);
+		ztest_bench_pool_destroy(spa);
+	}
+	zfs_arc_sublists = 0;
+
+	(void) printf("%-8s %12s %12s\n", "threads", "1 sublist", "default");
+	for (threads = 1; threads <= ZTEST_ARC_THREADS; threads <<= 1)
+		(void) printf("%-8d %12llu %12llu\n", threads,
+		    (u_longlong_t)rate[0][threads],
+		    (u_longlong_t)rate[1][threads]);
+
+	umem_free(buf, ZTEST_ARC_BLOCKS * ZTEST_ARC_BLOCKSIZE);
+}
+
+/*
+ * zio and zio transform allocations per 128K write to a 6-wide RAID-Z2
+ * vdev, counting everything issued while the writes are synced out
+ * (parity columns, metadata and all). It is run once with the per-CPU
+ * zio magazines disabled, so that every allocation goes to kmem, and once
+ * with the default.
+ */
+#define	ZTEST_ZIO_BLOCKS	128
+#define	ZTEST_ZIO_TXGS		4
+
+static void
+ztest_bench_zio(void)
+{
+	zio_alloc_stats_t before, after;
+	int magazines = zio_cache_magazines;
+	uint64_t writes = ZTEST_ZIO_BLOCKS * ZTEST_ZIO_TXGS;
+	char name[100];
+	char *buf;
+	spa_t *spa;
+	objset_t *os;
+	dmu_tx_t *tx;
+	uint64_t object, off, i;
+	hrtime_t t0, elapsed;
+	int pass, txg, error, parity;
+
+	buf = umem_alloc(SPA_MAXBLOCKSIZE, UMEM_NOFAIL);
+	for (i = 0; i < SPA_MAXBLOCKSIZE / sizeof (uint64_t); i++)
+		((uint64_t *)buf)[i] = ztest_random(-1ULL);
+	(void) snprintf(name, sizeof (name), "%s/zio", zopt_pool);
+
+	parity = zopt_raidz_parity;
+	zopt_raidz_parity = 2;
+
+	(void) printf("%-10s %10s %10s %10s %10s %10s\n", "magazines",
+	    "zios", "zio kmem", "xforms", "xform kmem", "usec");
+
+	for (pass = 0; pass < 2; pass++) {
+		zio_cache_magazines = pass;
+		spa = ztest_bench_pool_create(zopt_vdev_size, 6, 0);
+
+		ztest_bench_objset_create(name, &os, &object,
+		    SPA_MAXBLOCKSIZE);
+		txg_wait_synced(spa_get_dsl(spa), 0);
+
+		zio_alloc_stats(&before);
+		t0 = gethrtime();
+		for (txg = 0, off = 0; txg < ZTEST_ZIO_TXGS; txg++) {
+			tx = dmu_tx_create(os);
+			dmu_tx_hold_write(tx, object, off,
+			    ZTEST_ZIO_BLOCKS * SPA_MAXBLOCKSIZE);
+			error = dmu_tx_assign(tx, TXG_WAIT);
+			if (error)
+				fatal(0, "dmu_tx_assign() = %d", error);
+			for (i = 0; i < ZTEST_ZIO_BLOCKS; i++) {
+				dmu_write(os, object, off, SPA_MAXBLOCKSIZE,
+				    buf, tx);
+				off += SPA_MAXBLOCKSIZE;
+			}
+			dmu_tx_commit(tx);
+			txg_wait_synced(spa_get_dsl(spa), 0);
+		}
+		elapsed = gethrtime() - t0;
+		zio_alloc_stats(&after);
+
+		(void) printf("%-10s %10.2f %10.2f %10.2f %10.2f %10.1f\n",
+		    pass ? "on" : "off",
+		    (double)(after.zas_zio - before.zas_zio) / writes,
+		    (double)(after.zas_zio_kmem - before.zas_zio_kmem) / writes,
+		    (double)(after.zas_transform - before.zas_transform) /
+		    writes,
+		    (double)(after.zas_transform_kmem -
+		    before.zas_transform_kmem) / writes,
+		    (double)elapsed / writes / 1000);
+
+		dmu_objset_close(os);
+		ztest_bench_pool_destroy(spa);
+	}
+	zio_cache_magazines = magazines;
+	zopt_raidz_parity = parity;
+
+	umem_free(buf, SPA_MAXBLOCKSIZE);
+}
+
+/*
+ * Synchronous read latency on a single vdev while a writer keeps the pool
+ * busy syncing large async txgs. One thread issues 4K physical reads one
+ * at a time, in the unused part of the boot block region, and reports the
+ * median and 99th percentile latency; this is done with the pool idle, and
+ * under write load with the adaptive vdev queue limits off and on.
+ */
+#define	ZTEST_QUEUE_READS	4000
+#define	ZTEST_QUEUE_IOSIZE	4096
+#define	ZTEST_QUEUE_WRITE	(8 << 20)
+
+typedef struct ztest_queue_writer {
+	spa_t		*zqw_spa;
+	objset_t	*zqw_os;
+	uint64_t	zqw_object;
+	char		*zqw_buf;
+	volatile int	zqw_stop;
+	uint64_t	zqw_txgs;
+} ztest_queue_writer_t;
+
+static void *
+ztest_bench_queue_writer(void *arg)
+{
+	ztest_queue_writer_t *zqw = arg;
+	dmu_tx_t *tx;
+	int error;
+
+	while (!zqw->zqw_stop) {
+		tx = dmu_tx_create(zqw->zqw_os);
+		dmu_tx_hold_write(tx, zqw->zqw_object, 0, ZTEST_QUEUE_WRITE);
+		error = dmu_tx_assign(tx, TXG_WAIT);
+		if (error)
+			fatal(0, "dmu_tx_assign() = %d", error);
+		dmu_write(zqw->zqw_os, zqw->zqw_object, 0, ZTEST_QUEUE_WRITE,
+		    zqw->zqw_buf, tx);
+		dmu_tx_commit(tx);
+		txg_wait_synced(spa_get_dsl(zqw->zqw_spa), 0);
+		zqw->zqw_txgs++;
+	}
+
+	return (NULL);
+}
+
+static int
+ztest_hrtime_compare(const void *a, const void *b)
+{
+	hrtime_t x = *(const hrtime_t *)a;
+	hrtime_t y = *(const hrtime_t *)b;
+
+	return (x < y ? -1 : x > y ? 1 : 0);
+}
+
+static void
+ztest_bench_queue_reads(spa_t *spa, hrtime_t *lat)
+{
+	uint64_t start = VDEV_BOOT_OFFSET + VDEV_BOOT_HEADER_SIZE;
+	uint64_t blocks = (VDEV_LABEL_START_SIZE - start) / ZTEST_QUEUE_IOSIZE;
+	char buf[ZTEST_QUEUE_IOSIZE];
+	vdev_t *vd;
+	hrtime_t t0;
+	int i;
+
+	spa_config_enter(spa, RW_READER, FTAG);
+	vd = spa->spa_root_vdev->vdev_child[0];
+	for (i = 0; i < ZTEST_QUEUE_READS; i++) {
+		t0 = gethrtime();
+		if (zio_wait(zio_read_phys(NULL, vd, start +
+		    ztest_random(blocks) * ZTEST_QUEUE_IOSIZE,
+		    ZTEST_QUEUE_IOSIZE, buf, ZIO_CHECKSUM_OFF, NULL, NULL,
+		    ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CONFIG_HELD |
+		    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_CACHE)) != 0)
+			fatal(0, "queue bench read failed");
+		lat[i] = gethrtime() - t0;
+	}
+	spa_config_exit(spa, FTAG);
+
+	qsort(lat, ZTEST_QUEUE_READS, sizeof (hrtime_t), ztest_hrtime_compare);
+}
+
+static void
+ztest_bench_queue(void)
+{
+	static const char *passes[] = { "idle", "fixed", "adaptive" };
+	ztest_queue_writer_t zqw;
+	hrtime_t *lat;
+	char name[100];
+	spa_t *spa;
+	objset_t *os;
+	thread_t tid;
+	uint64_t i;
+	int pass, error;
+
+	lat = umem_alloc(ZTEST_QUEUE_READS * sizeof (hrtime_t), UMEM_NOFAIL);
+	bzero(&zqw, sizeof (zqw));
+	zqw.zqw_buf = umem_alloc(ZTEST_QUEUE_WRITE, UMEM_NOFAIL);
+	for (i = 0; i < ZTEST_QUEUE_WRITE / sizeof (uint64_t); i++)
+		((uint64_t *)zqw.zqw_buf)[i] = ztest_random(-1ULL);
+	(void) snprintf(name, sizeof (name), "%s/queue", zopt_pool);
+
+	(void) printf("%-10s %10s %10s %8s\n", "load", "p50 usec", "p99 usec",
+	    "txgs");
+
+	for (pass = 0; pass < 3; pass++) {
+		zfs_vdev_adaptive = (pass == 2);
+		spa = ztest_bench_pool_create(zopt_vdev_size, 0, 0);
+
+		ztest_bench_objset_create(name, &os, &zqw.zqw_object,
+		    SPA_MAXBLOCKSIZE);
+		txg_wait_synced(spa_get_dsl(spa), 0);
+
+		zqw.zqw_spa = spa;
+		zqw.zqw_os = os;
+		zqw.zqw_stop = 0;
+		zqw.zqw_txgs = 0;
+		if (pass != 0) {
+			error = thr_create(0, 0, ztest_bench_queue_writer,
+			    &zqw, THR_BOUND, &tid);
+			if (error)
+				fatal(0, "can't create writer: error %d",
+				    error);
+		}
+
+		ztest_bench_queue_reads(spa, lat);
+
+		if (pass != 0) {
+			zqw.zqw_stop = 1;
+			error = thr_join(tid, NULL, NULL);
+			if (error)
+				fatal(0, "thr_join() = %d", error);
+		}
+
+		(void) printf("%-10s %10.1f %10.1f %8llu\n", passes[pass],
+		    (double)lat[ZTEST_QUEUE_READS / 2] / 1000,
+		    (double)lat[ZTEST_QUEUE_READS * 99 / 100] / 1000,
+		    (u_longlong_t)zqw.zqw_txgs);
+
+		dmu_objset_close(os);
+		ztest_bench_pool_destroy(spa);
+	}
+	zfs_vdev_adaptive = 1;
+
+	umem_free(zqw.zqw_buf, ZTEST_QUEUE_WRITE);
+	umem_free(lat, ZTEST_QUEUE_READS * sizeof (hrtime_t));
+}
+
+/*
+ * Block allocator cost as a metaslab fills up and fragments. An in-core
+ * space map is filled with random 512-byte to 128K allocations, freeing a
+ * random earlier allocation for every third one, and the average time per
+ * allocation (and the number that failed) is reported per band of fill
+ * level, for the first-fit and the dynamic-fit allocators. Both see the
+ * same sequence of requests.
+ */
+#define	ZTEST_MS_SIZE		(256ULL << 20)
+#define	ZTEST_MS_SHIFT		SPA_MINBLOCKSHIFT
+#define	ZTEST_MS_BANDS		10
+#define	ZTEST_MS_MAXFILL	98
+
+typedef struct ztest_ms_alloc {
+	uint64_t	zma_start;
+	uint64_t	zma_size;
+} ztest_ms_alloc_t;
+
+typedef struct ztest_ms_band {
+	uint64_t	zmb_allocs;
+	uint64_t	zmb_failed;
+	hrtime_t	zmb_time;
+} ztest_ms_band_t;
+
+static int ztest_ms_fill[ZTEST_MS_BANDS] = {
+	10, 30, 50, 60, 70, 80, 85, 90, 95, ZTEST_MS_MAXFILL
+};
+
+static void
+ztest_bench_metaslab_run(space_map_ops_t *ops, ztest_ms_band_t *zmb)
+{
+	uint64_t nallocs = ZTEST_MS_SIZE >> ZTEST_MS_SHIFT;
+	ztest_ms_alloc_t *zma;
+	space_map_obj_t smo;
+	space_map_t sm;
+	kmutex_t lock;
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	uint64_t n = 0, size, start, used, r;
+	hrtime_t t0;
+	int band = 0;
+
+	zma = umem_alloc(nallocs * sizeof (ztest_ms_alloc_t), UMEM_NOFAIL);
+	bzero(&smo, sizeof (smo));
+	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
+	space_map_create(&sm, 0, ZTEST_MS_SIZE, ZTEST_MS_SHIFT, &lock);
+
+	mutex_enter(&lock);
+	/* an empty free map is loaded without reading anything */
+	VERIFY(space_map_load(&sm, ops, SM_FREE, &smo, NULL) == 0);
+
+	while (band < ZTEST_MS_BANDS) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		size = 1ULL << (ZTEST_MS_SHIFT + x % (SPA_MAXBLOCKSHIFT -
+		    ZTEST_MS_SHIFT + 1));
+
+		t0 = gethrtime();
+		start = space_map_alloc(&sm, size);
+		zmb[band].zmb_time += gethrtime() - t0;
+		zmb[band].zmb_allocs++;
+
+		if (start == -1ULL) {
+			zmb[band].zmb_failed++;
+		} else {
+			zma[n].zma_start = start;
+			zma[n].zma_size = size;
+			n++;
+		}
+
+		if ((x >> 32) % 3 == 0 && n != 0) {
+			r = (x >> 40) % n;
+			space_map_free(&sm, zma[r].zma_start, zma[r].zma_size);
+			zma[r] = zma[--n];
+		}
+
+		used = ZTEST_MS_SIZE - sm.sm_space;
+		if (used * 100 >= ztest_ms_fill[band] * ZTEST_MS_SIZE ||
+		    zmb[band].zmb_failed > 1000)
+			band++;
+	}
+
+	while (n != 0) {
+		n--;
+		space_map_free(&sm, zma[n].zma_start, zma[n].zma_size);
+	}
+	space_map_unload(&sm);
+	mutex_exit(&lock);
+
+	space_map_destroy(&sm);
+	mutex_destroy(&lock);
+	umem_free(zma, nallocs * sizeof (ztest_ms_alloc_t));
+}
+
+static void
+ztest_bench_metaslab(void)
+{
+	ztest_ms_band_t ff[ZTEST_MS_BANDS], df[ZTEST_MS_BANDS];
+	int band, lo = 0;
+
+	bzero(ff, sizeof (ff));
+	bzero(df, sizeof (df));
+	ztest_bench_metaslab_run(&metaslab_ff_ops, ff);
+	ztest_bench_metaslab_run(&metaslab_df_ops, df);
+
+	(void) printf("%-8s %12s %8s %12s %8s\n", "fill %",
+	    "ff ns/alloc", "failed", "df ns/alloc", "failed");
+	for (band = 0; band < ZTEST_MS_BANDS; band++) {
+		(void) printf("%3d-%-4d %12llu %8llu %12llu %8llu\n",
+		    lo, ztest_ms_fill[band],
+		    (u_longlong_t)(ff[band].zmb_time /
+		    MAX(ff[band].zmb_allocs, 1)),
+		    (u_longlong_t)ff[band].zmb_failed,
+		    (u_longlong_t)(df[band].zmb_time /
+		    MAX(df[band].zmb_allocs, 1)),
+		    (u_longlong_t)df[band].zmb_failed);
+		lo = ztest_ms_fill[band];
+	}
+}
+
+/*
+ * fsync latency under concurrency. Each thread writes 4K to its own
+ * object, logs it as a TX_WRITE with the data copied into the record
+ * (as zfs_log_write() does for small writes), and times zil_commit() for
+ * that object. p50/p99 commit latency over all threads is reported by
+ * thread count, with commit rounds serialized and with rounds overlapping.
+ */
+#define	ZTEST_ZIL_THREADS	16
+#define	ZTEST_ZIL_COMMITS	100
+#define	ZTEST_ZIL_WRITE		4096
+
+typedef struct ztest_zil_committer {
+	objset_t	*zzc_os;
+	zilog_t		*zzc_zilog;
+	uint64_t	zzc_object;
+	hrtime_t	*zzc_lat;
+	thread_t	zzc_thread;
+} ztest_zil_committer_t;
+
+static void *
+ztest_bench_zil_committer(void *arg)
+{
+	ztest_zil_committer_t *zzc = arg;
+	char buf[ZTEST_ZIL_WRITE];
+	lr_write_t *lr;
+	itx_t *itx;
+	dmu_tx_t *tx;
+	uint64_t seq;
+	hrtime_t t0;
+	int i, error;
+
+	bzero(buf, sizeof (buf));
+	for (i = 0; i < ZTEST_ZIL_COMMITS; i++) {
+		tx = dmu_tx_create(zzc->zzc_os);
+		dmu_tx_hold_write(tx, zzc->zzc_object, 0, ZTEST_ZIL_WRITE);
+		error = dmu_tx_assign(tx, TXG_WAIT);
+		if (error)
+			fatal(0, "dmu_tx_assign() = %d", error);
+		dmu_write(zzc->zzc_os, zzc->zzc_object, 0, ZTEST_ZIL_WRITE,
+		    buf, tx);
+
+		itx = zil_itx_create(TX_WRITE, sizeof (*lr) + ZTEST_ZIL_WRITE);
+		lr = (lr_write_t *)&itx->itx_lr;
+		lr->lr_foid = zzc->zzc_object;
+		lr->lr_offset = 0;
+		lr->lr_length = ZTEST_ZIL_WRITE;
+		lr->lr_blkoff = 0;
+		BP_ZERO(&lr->lr_blkptr);
+		bcopy(buf, lr + 1, ZTEST_ZIL_WRITE);
+		itx->itx_wr_state = WR_COPIED;
+		itx->itx_sync = B_FALSE;
+		itx->itx_private = NULL;
+		seq = zil_itx_assign(zzc->zzc_zilog, itx, tx);
+		dmu_tx_commit(tx);
+
+		t0 = gethrtime();
+		zil_commit(zzc->zzc_zilog, seq, zzc->zzc_object);
+		zzc->zzc_lat[i] = gethrtime() - t0;
+	}
+
+	return (NULL);
+}
+
+static void
+ztest_bench_zil(void)
+{
+	ztest_zil_committer_t zzc[ZTEST_ZIL_THREADS];
+	hrtime_t *lat;
+	char name[100];
+	spa_t *spa;
+	objset_t *os;
+	zilog_t *zilog;
+	int threads, pass, t, n, error;
+	hrtime_t p50[2], p99[2];
+
+	lat = umem_alloc(ZTEST_ZIL_THREADS * ZTEST_ZIL_COMMITS *
+	    sizeof (hrtime_t), UMEM_NOFAIL);
+	(void) snprintf(name, sizeof (name), "%s/zil", zopt_pool);
+
+	(void) printf("%-8s %12s %12s %12s %12s\n", "threads",
+	    "serial p50", "serial p99", "parallel p50", "parallel p99");
+
+	for (threads = 1; threads <= ZTEST_ZIL_THREADS; threads <<= 1) {
+		for (pass = 0; pass < 2; pass++) {
+			zil_commit_parallel = pass;
+			spa = ztest_bench_pool_create(zopt_vdev_size, 0, 0);
+
+			ztest_bench_objset_create(name, &os,
+			    &zzc[0].zzc_object, 0);
+			for (t = 1; t < threads; t++) {
+				zzc[t].zzc_object =
+				    ztest_bench_object_alloc(os, 0);
+			}
+			zilog = zil_open(os, NULL);
+			txg_wait_synced(spa_get_dsl(spa), 0);
+
+			for (t = 0; t < threads; t++) {
+				zzc[t].zzc_os = os;
+				zzc[t].zzc_zilog = zilog;
+				zzc[t].zzc_lat = lat + t * ZTEST_ZIL_COMMITS;
+				error = thr_create(0, 0,
+				    ztest_bench_zil_committer, &zzc[t],
+				    THR_BOUND, &zzc[t].zzc_thread);
+				if (error)
+					fatal(0, "can't create thread %d: "
+					    "error %d", t, error);
+			}
+			for (t = 0; t < threads; t++) {
+				error = thr_join(zzc[t].zzc_thread, NULL, NULL);
+				if (error)
+					fatal(0, "thr_join(%d) = %d", t, error);
+			}
+
+			n = threads * ZTEST_ZIL_COMMITS;
+			qsort(lat, n, sizeof (hrtime_t), ztest_hrtime_compare);
+			p50[pass] = lat[n / 2];
+			p99[pass] = lat[n * 99 / 100];
+
+			zil_close(zilog);
+			dmu_objset_close(os);
+			ztest_bench_pool_destroy(spa);
+		}
+
+		(void) printf("%-8d %12.1f %12.1f %12.1f %12.1f\n", threads,
+		    (double)p50[0] / 1000, (double)p99[0] / 1000,
+		    (double)p50[1] / 1000, (double)p99[1] / 1000);
+	}
+	zil_commit_parallel = 1;
+
+	umem_free(lat, ZTEST_ZIL_THREADS * ZTEST_ZIL_COMMITS *
+	    sizeof (hrtime_t));
+}
+
+/*
+ * Time to replay a 1GB intent log, serially and in parallel. A child
+ * process logs ZTEST_REPLAY_RECORDS copied writes, spread over
+ * ZTEST_REPLAY_OBJECTS objects, while holding its txg open so that none
+ * of them is synced, and then exits without closing the pool, as if it
+ * had crashed. We then reopen the pool, which claims the log, and time
+ * zil_replay() and the sync of what it replayed. Two writes fill a log
+ * block.
+ */
+#define	ZTEST_REPLAY_VDEV	(4ULL << 30)
+#define	ZTEST_REPLAY_WRITE	(60 << 10)
+#define	ZTEST_REPLAY_RECORDS	((1ULL << 30) / ZTEST_REPLAY_WRITE)
+#define	ZTEST_REPLAY_OBJECTS	16
+#define	ZTEST_REPLAY_OBJSIZE	(16 << 20)
+#define	ZTEST_REPLAY_COMMIT	64
+
+static void
+ztest_bench_replay_log(char *name)
+{
+	uint64_t object[ZTEST_REPLAY_OBJECTS];
+	spa_t *spa;
+	objset_t *os;
+	zilog_t *zilog;
+	dmu_tx_t *tx;
+	lr_write_t *lr;
+	itx_t *itx;
+	uint64_t i, seq;
+	int o, error;
+
+	spa = ztest_bench_pool_create(ZTEST_REPLAY_VDEV, 0, 0);
+	ztest_bench_objset_create(name, &os, &object[0], 0);
+	for (o = 1; o < ZTEST_REPLAY_OBJECTS; o++)
+		object[o] = ztest_bench_object_alloc(os, 0);
+	zilog = zil_open(os, NULL);
+
+	/*
+	 * Log something so that the log exists on disk before we stop
+	 * syncing.
+	 */
+	tx = dmu_tx_create(os);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error)
+		fatal(0, "dmu_tx_assign() = %d", error);
+	itx = zil_itx_create(TX_WRITE, sizeof (*lr));
+	lr = (lr_write_t *)&itx->itx_lr;
+	lr->lr_foid = object[0];
+	lr->lr_offset = 0;
+	lr->lr_length = 0;
+	lr->lr_blkoff = 0;
+	BP_ZERO(&lr->lr_blkptr);
+	itx->itx_wr_state = WR_COPIED;
+	itx->itx_sync = B_FALSE;
+	itx->itx_private = NULL;
+	seq = zil_itx_assign(zilog, itx, tx);
+	dmu_tx_commit(tx);
+	zil_commit(zilog, seq, 0);
+	txg_wait_synced(spa_get_dsl(spa), 0);
+
+	/*
+	 * Everything from here on is logged in this one, never synced, txg.
+	 */
+	tx = dmu_tx_create(os);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error)
+		fatal(0, "dmu_tx_assign() = %d", error);
+
+	for (i = 0; i < ZTEST_REPLAY_RECORDS; i++) {
+		itx = zil_itx_create(TX_WRITE,
+		    sizeof (*lr) + ZTEST_REPLAY_WRITE);
+		lr = (lr_write_t *)&itx->itx_lr;
+		lr->lr_foid = object[i % ZTEST_REPLAY_OBJECTS];
+		lr->lr_offset = (i / ZTEST_REPLAY_OBJECTS * ZTEST_REPLAY_WRITE) %
+		    ZTEST_REPLAY_OBJSIZE;
+		lr->lr_length = ZTEST_REPLAY_WRITE;
+		lr->lr_blkoff = 0;
+		BP_ZERO(&lr->lr_blkptr);
+		(void) memset(lr + 1, (int)i, ZTEST_REPLAY_WRITE);
+		itx->itx_wr_state = WR_COPIED;
+		itx->itx_sync = B_FALSE;
+		itx->itx_private = NULL;
+		seq = zil_itx_assign(zilog, itx, tx);
+		if ((i + 1) % ZTEST_REPLAY_COMMIT == 0)
+			zil_commit(zilog, seq, 0);
+	}
+	zil_commit(zilog, seq, 0);
+
+	_exit(0);
+}
+
+static void
+ztest_bench_replay(void)
+{
+	ztest_replay_t zr;
+	char name[100];
+	spa_t *spa;
+	objset_t *os;
+	pid_t pid;
+	hrtime_t t0, elapsed[2];
+	int pass, status, error;
+
+	(void) snprintf(name, sizeof (name), "%s/replay", zopt_pool);
+
+	for (pass = 0; pass < 2; pass++) {
+		pid = fork();
+		if (pid == -1)
+			fatal(1, "fork of replay logger failed");
+		if (pid == 0)
+			ztest_bench_replay_log(name);
+		while (waitpid(pid, &status, 0) != pid)
+			continue;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			fatal(0, "replay logger failed, status %d", status);
+
+		zil_replay_parallel = pass;
+		kernel_init(FREAD | FWRITE);
+		error = spa_open(zopt_pool, &spa, FTAG);
+		if (error)
+			fatal(0, "spa_open() = %d", error);
+		error = dmu_objset_open(name, DMU_OST_OTHER, DS_MODE_STANDARD,
+		    &os);
+		if (error)
+			fatal(0, "dmu_objset_open(%s) = %d", name, error);
+
+		zr.zr_os = os;
+		t0 = gethrtime();
+		zil_replay(os, &zr, &zr.zr_assign, ztest_replay_vector);
+		txg_wait_synced(spa_get_dsl(spa), 0);
+		elapsed[pass] = gethrtime() - t0;
+
+		dmu_objset_close(os);
+		ztest_bench_pool_destroy(spa);
+	}
+	zil_replay_parallel = 1;
+
+	(void) printf("%-10s %10s %12s %12s\n", "log MB", "records",
+	    "serial s", "parallel s");
+	(void) printf("%-10llu %10llu %12.2f %12.2f\n",
+	    (u_longlong_t)(ZTEST_REPLAY_RECORDS * ZTEST_REPLAY_WRITE >> 20),
+	    (u_longlong_t)ZTEST_REPLAY_RECORDS,
+	    (double)elapsed[0] / NANOSEC, (double)elapsed[1] / NANOSEC);
+}
+
+/*
+ * Wall-clock time to scrub a fragmented object, with reads issued in
+ * traversal order and sorted by offset. The object's ZTEST_SCRUB_BLOCKS
+ * blocks are written in a random order over many txgs, so that logical
+ * and physical order have nothing in common. File vdevs read through
+ * the page cache, so point -f at a directory on a disk to see the full
+ * cost of the seeks. A final, untimed scrub is exported and imported
+ * partway through, and must resume and complete without errors.
+ */
+#define	ZTEST_SCRUB_VDEV	(1ULL << 30)
+#define	ZTEST_SCRUB_BLOCKS	16384
+#define	ZTEST_SCRUB_BLOCKSIZE	8192
+#define	ZTEST_SCRUB_TXG_BLOCKS	512
+
+/*
+ * Check that a scrub interrupted by export resumes on import. Reads from
+ * the pool's only disk are slowed so that the scrub is still running
+ * when the pool is exported and again when it is imported. Returns the
+ * reopened pool.
+ */
+static spa_t *
+ztest_bench_scrub_resume(spa_t *spa)
+{
+	pool_scrub_position_t *psp;
+	nvlist_t *config;
+	vdev_stat_t vs;
+	uint_t n;
+	int error;
+
+	vdev_file_slow_guid = spa->spa_root_vdev->vdev_child[0]->vdev_guid;
+	vdev_file_slow_ticks = 1;
+
+	mutex_enter(&spa_namespace_lock);
+	error = spa_scrub(spa, POOL_SCRUB_EVERYTHING, B_FALSE);
+	mutex_exit(&spa_namespace_lock);
+	if (error)
+		fatal(0, "spa_scrub() = %d", error);
+
+	mutex_enter(&spa->spa_scrub_lock);
+	while (spa->spa_scrub_cursor_examined == 0 &&
+	    spa->spa_scrub_thread != NULL) {
+		mutex_exit(&spa->spa_scrub_lock);
+		delay(1);
+		mutex_enter(&spa->spa_scrub_lock);
+	}
+	if (spa->spa_scrub_thread == NULL)
+		fatal(0, "scrub finished before export");
+	mutex_exit(&spa->spa_scrub_lock);
+
+	spa_close(spa, FTAG);
+	error = spa_export(zopt_pool, &config);
+	if (error)
+		fatal(0, "spa_export(%s) = %d", zopt_pool, error);
+	error = spa_import(zopt_pool, config, NULL);
+	if (error)
+		fatal(0, "spa_import(%s) = %d", zopt_pool, error);
+	nvlist_free(config);
+
+	error = spa_get_stats(zopt_pool, &config, NULL, 0);
+	if (error)
+		fatal(0, "spa_get_stats(%s) = %d", zopt_pool, error);
+	if (nvlist_lookup_uint64_array(config, ZPOOL_CONFIG_SCRUB_RESUMED,
+	    (uint64_t **)&psp, &n) != 0 ||
+	    n * sizeof (uint64_t) < sizeof (pool_scrub_position_t) ||
+	    psp->psp_type != POOL_SCRUB_EVERYTHING || psp->psp_examined == 0)
+		fatal(0, "scrub was not resumed on import");
+	nvlist_free(config);
+
+	vdev_file_slow_guid = 0;
+	vdev_file_slow_ticks = 0;
+
+	error = spa_open(zopt_pool, &spa, FTAG);
+	if (error)
+		fatal(0, "spa_open(%s) = %d", zopt_pool, error);
+	mutex_enter(&spa->spa_scrub_lock);
+	while (spa->spa_scrub_thread != NULL)
+		cv_wait(&spa->spa_scrub_cv, &spa->spa_scrub_lock);
+	mutex_exit(&spa->spa_scrub_lock);
+
+	vdev_get_stats(spa->spa_root_vdev, &vs);
+	if (!vs.vs_scrub_complete || vs.vs_scrub_errors != 0)
+		fatal(0, "resumed scrub: complete %llu, %llu errors",
+		    (u_longlong_t)vs.vs_scrub_complete,
+		    (u_longlong_t)vs.vs_scrub_errors);
+
+	return (spa);
+}
+
+static void
+ztest_bench_scrub(void)
+{
+	char name[100];
+	char *buf;
+	spa_t *spa;
+	objset_t *os;
+	dmu_tx_t *tx;
+	vdev_stat_t vs;
+	uint64_t object, *order, i, j;
+	uint64_t bytes[2];
+	hrtime_t t0, elapsed[2];
+	int pass, error;
+
+	buf = umem_alloc(ZTEST_SCRUB_BLOCKSIZE, UMEM_NOFAIL);
+	order = umem_alloc(ZTEST_SCRUB_BLOCKS * sizeof (uint64_t),
+	    UMEM_NOFAIL);
+	ztest_bench_shuffle(order, ZTEST_SCRUB_BLOCKS);
+	(void) snprintf(name, sizeof (name), "%s/scrub", zopt_pool);
+
+	spa = ztest_bench_pool_create(ZTEST_SCRUB_VDEV, 0, 0);
+
+	ztest_bench_objset_create(name, &os, &object, ZTEST_SCRUB_BLOCKSIZE);
+
+	for (i = 0; i < ZTEST_SCRUB_BLOCKS; i += ZTEST_SCRUB_TXG_BLOCKS) {
+		tx = dmu_tx_create(os);
+		for (j = i; j < i + ZTEST_SCRUB_TXG_BLOCKS; j++)
+			dmu_tx_hold_write(tx, object,
+			    order[j] * ZTEST_SCRUB_BLOCKSIZE,
+			    ZTEST_SCRUB_BLOCKSIZE);
+		error = dmu_tx_assign(tx, TXG_WAIT);
+		if (error)
+			fatal(0, "dmu_tx_assign() = %d", error);
+		for (j = i; j < i + ZTEST_SCRUB_TXG_BLOCKS; j++) {
+			ztest_random_fill(buf, ZTEST_SCRUB_BLOCKSIZE);
+			dmu_write(os, object, order[j] * ZTEST_SCRUB_BLOCKSIZE,
+			    ZTEST_SCRUB_BLOCKSIZE, buf, tx);
+		}
+		dmu_tx_commit(tx);
+		txg_wait_synced(spa_get_dsl(spa), 0);
+	}
+	dmu_objset_close(os);
+
+	for (pass = 0; pass < 2; pass++) {
+		zfs_scrub_sorted = pass;
+
+		t0 = gethrtime();
+		mutex_enter(&spa_namespace_lock);
+		error = spa_scrub(spa, POOL_SCRUB_EVERYTHING, B_FALSE);
+		mutex_exit(&spa_namespace_lock);
+		if (error)
+			fatal(0, "spa_scrub() = %d", error);
+		mutex_enter(&spa->spa_scrub_lock);
+		while (spa->spa_scrub_thread != NULL)
+			cv_wait(&spa->spa_scrub_cv, &spa->spa_scrub_lock);
+		mutex_exit(&spa->spa_scrub_lock);
+		elapsed[pass] = gethrtime() - t0;
+
+		vdev_get_stats(spa->spa_root_vdev, &vs);
+		if (!vs.vs_scrub_complete || vs.vs_scrub_errors != 0)
+			fatal(0, "scrub pass %d: complete %llu, %llu errors",
+			    pass, (u_longlong_t)vs.vs_scrub_complete,
+			    (u_longlong_t)vs.vs_scrub_errors);
+		bytes[pass] = vs.vs_scrub_issued;
+	}
+	zfs_scrub_sorted = 1;
+
+	spa = ztest_bench_scrub_resume(spa);
+	ztest_bench_pool_destroy(spa);
+
+	(void) printf("%-10s %10s %12s %12s %12s %12s\n", "data MB", "blocks",
+	    "unsorted s", "MB/s", "sorted s", "MB/s");
+	(void) printf("%-10llu %10llu %12.2f %12.2f %12.2f %12.2f\n",
+	    (u_longlong_t)(ZTEST_SCRUB_BLOCKS * ZTEST_SCRUB_BLOCKSIZE >> 20),
+	    (u_longlong_t)ZTEST_SCRUB_BLOCKS,
+	    (double)elapsed[0] / NANOSEC,
+	    (double)bytes[0] / (1 << 20) * NANOSEC / elapsed[0],
+	    (double)elapsed[1] / NANOSEC,
+	    (double)bytes[1] / (1 << 20) * NANOSEC / elapsed[1]);
+
+	umem_free(order, ZTEST_SCRUB_BLOCKS * sizeof (uint64_t));
+	umem_free(buf, ZTEST_SCRUB_BLOCKSIZE);
+}
+
+/*
+ * Read latency from a two-way mirror whose second child takes an extra
+ * ZTEST_MIRROR_SLOW ticks per read, with each read sent to the child
+ * picked by offset and to the least loaded child. ZTEST_MIRROR_THREADS
+ * threads each read their share of an object's blocks once, in random
+ * order, after the ARC has been flushed, so that every read goes to the
+ * mirror. The blocks are larger than zfs_vdev_cache_max, so the vdev
+ * cache doesn't absorb any of them.
+ */
+#define	ZTEST_MIRROR_VDEV	(1ULL << 30)
+#define	ZTEST_MIRROR_BLOCKS	1024
+#define	ZTEST_MIRROR_TXG_BLOCKS	64
+#define	ZTEST_MIRROR_THREADS	8
+#define	ZTEST_MIRROR_SLOW	1
+
+typedef struct ztest_mirror_reader {
+	objset_t	*zmr_os;
+	uint64_t	zmr_object;
+	uint64_t	*zmr_blocks;
+	hrtime_t	*zmr_lat;
+	uint64_t	zmr_count;
+	thread_t	zmr_thread;
+} ztest_mirror_reader_t;
+
+static void *
+ztest_bench_mirror_reader(void *arg)
+{
+	ztest_mirror_reader_t *zmr = arg;
+	char *buf = umem_alloc(SPA_MAXBLOCKSIZE, UMEM_NOFAIL);
+	hrtime_t t0;
+	uint64_t i;
+
+	for (i = 0; i < zmr->zmr_count; i++) {
+		t0 = gethrtime();
+		VERIFY(0 == dmu_read(zmr->zmr_os, zmr->zmr_object,
+		    zmr->zmr_blocks[i] * SPA_MAXBLOCKSIZE, SPA_MAXBLOCKSIZE,
+		    buf));
+		zmr->zmr_lat[i] = gethrtime() - t0;
+	}
+
+	umem_free(buf, SPA_MAXBLOCKSIZE);
+	return (NULL);
+}
+
+static void
+ztest_bench_mirror(void)
+{
+	static const char *passes[] = { "offset", "load" };
+	ztest_mirror_reader_t zmr[ZTEST_MIRROR_THREADS];
+	uint64_t share = ZTEST_MIRROR_BLOCKS / ZTEST_MIRROR_THREADS;
+	char name[100];
+	char *buf;
+	spa_t *spa;
+	objset_t *os;
+	dmu_tx_t *tx;
+	vdev_t *mvd;
+	uint64_t object, *order, i, j;
+	uint64_t reads[2];
+	hrtime_t *lat, t0, elapsed;
+	int pass, t, c, error;
+
+	buf = umem_alloc(SPA_MAXBLOCKSIZE, UMEM_NOFAIL);
+	lat = umem_alloc(ZTEST_MIRROR_BLOCKS * sizeof (hrtime_t), UMEM_NOFAIL);
+	order = umem_alloc(ZTEST_MIRROR_BLOCKS * sizeof (uint64_t),
+	    UMEM_NOFAIL);
+	(void) snprintf(name, sizeof (name), "%s/mirror", zopt_pool);
+
+	spa = ztest_bench_pool_create(ZTEST_MIRROR_VDEV, 0, 2);
+
+	ztest_bench_objset_create(name, &os, &object, SPA_MAXBLOCKSIZE);
+
+	for (i = 0; i < ZTEST_MIRROR_BLOCKS; i += ZTEST_MIRROR_TXG_BLOCKS) {
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_write(tx, object, i * SPA_MAXBLOCKSIZE,
+		    ZTEST_MIRROR_TXG_BLOCKS * SPA_MAXBLOCKSIZE);
+		error = dmu_tx_assign(tx, TXG_WAIT);
+		if (error)
+			fatal(0, "dmu_tx_assign() = %d", error);
+		for (j = i; j < i + ZTEST_MIRROR_TXG_BLOCKS; j++) {
+			ztest_random_fill(buf, SPA_MAXBLOCKSIZE);
+			dmu_write(os, object, j * SPA_MAXBLOCKSIZE,
+			    SPA_MAXBLOCKSIZE, buf, tx);
+		}
+		dmu_tx_commit(tx);
+		txg_wait_synced(spa_get_dsl(spa), 0);
+	}
+
+	mvd = spa->spa_root_vdev->vdev_child[0];
+	ASSERT(mvd->vdev_ops == &vdev_mirror_ops);
+	vdev_file_slow_guid = mvd->vdev_child[1]->vdev_guid;
+	vdev_file_slow_ticks = ZTEST_MIRROR_SLOW;
+
+	(void) printf("%-8s %10s %10s %10s %10s %10s\n", "policy",
+	    "p50 usec", "p99 usec", "reads/s", "fast", "slow");
+
+	for (pass = 0; pass < 2; pass++) {
+		vdev_mirror_balance = pass;
+
+		ztest_bench_shuffle(order, ZTEST_MIRROR_BLOCKS);
+		for (c = 0; c < 2; c++)
+			reads[c] = mvd->vdev_child[c]->vdev_stat.vs_ops[
+			    ZIO_TYPE_READ];
+
+		arc_flush();
+
+		t0 = gethrtime();
+		for (t = 0; t < ZTEST_MIRROR_THREADS; t++) {
+			zmr[t].zmr_os = os;
+			zmr[t].zmr_object = object;
+			zmr[t].zmr_blocks = order + t * share;
+			zmr[t].zmr_lat = lat + t * share;
+			zmr[t].zmr_count = share;
+			error = thr_create(0, 0, ztest_bench_mirror_reader,
+			    &zmr[t], THR_BOUND, &zmr[t].zmr_thread);
+			if (error)
+				fatal(0, "can't create thread %d: error %d",
+				    t, error);
+		}
+		for (t = 0; t < ZTEST_MIRROR_THREADS; t++) {
+			error = thr_join(zmr[t].zmr_thread, NULL, NULL);
+			if (error)
+				fatal(0, "thr_join(%d) = %d", t, error);
+		}
+		elapsed = MAX(gethrtime() - t0, 1);
+
+		for (c = 0; c < 2; c++)
+			reads[c] = mvd->vdev_child[c]->vdev_stat.vs_ops[
+			    ZIO_TYPE_READ] - reads[c];
+
+		qsort(lat, share * ZTEST_MIRROR_THREADS, sizeof (hrtime_t),
+		    ztest_hrtime_compare);
+		(void) printf("%-8s %10.1f %10.1f %10.1f %10llu %10llu\n",
+		    passes[pass],
+		    (double)lat[share * ZTEST_MIRROR_THREADS / 2] / 1000,
+		    (double)lat[share * ZTEST_MIRROR_THREADS * 99 / 100] / 1000,
+		    (double)share * ZTEST_MIRROR_THREADS * NANOSEC / elapsed,
+		    (u_longlong_t)reads[0], (u_longlong_t)reads[1]);
+	}
+	vdev_mirror_balance = 1;
+	vdev_file_slow_guid = 0;
+	vdev_file_slow_ticks = 0;
+
+	dmu_objset_close(os);
+	ztest_bench_pool_destroy(spa);
+
+	umem_free(order, ZTEST_MIRROR_BLOCKS * sizeof (uint64_t));
+	umem_free(lat, ZTEST_MIRROR_BLOCKS * sizeof (hrtime_t));
+	umem_free(buf, SPA_MAXBLOCKSIZE);
+}
+
+/*
+ * Create a filesystem holding 'objects' objects of 'size' bytes of random
+ * data in 'blksz' blocks, snapshot it as <name>@snap, and return the
+ * snapshot, open read-only.
+ */
+#define	ZTEST_SEND_VDEV		(1ULL << 30)
+#define	ZTEST_SEND_TXG_BYTES	(8ULL << 20)
+
+static objset_t *
+ztest_bench_send_setup(spa_t *spa, char *name, int objects, uint64_t blksz,
+    uint64_t size)
+{
+	char snapname[100];
+	char *buf;
+	objset_t *os;
+	dmu_tx_t *tx;
+	uint64_t object, off, len;
+	int o, error;
+
+	buf = umem_alloc(ZTEST_SEND_TXG_BYTES, UMEM_NOFAIL);
+
+	ztest_bench_objset_create(name, &os, &object, blksz);
+	for (o = 0; o < objects; o++) {
+		if (o != 0)
+			object = ztest_bench_object_alloc(os, blksz);
+
+		for (off = 0; off < size; off += len) {
+			len = MIN(size - off, ZTEST_SEND_TXG_BYTES);
+			tx = dmu_tx_create(os);
+			dmu_tx_hold_write(tx, object, off, len);
+			error = dmu_tx_assign(tx, TXG_WAIT);
+			if (error)
+				fatal(0, "dmu_tx_assign() = %d", error);
+			ztest_random_fill(buf, len);
+			dmu_write(os, object, off, len, buf, tx);
+			dmu_tx_commit(tx);
+		}
+	}
+	txg_wait_synced(spa_get_dsl(spa), 0);
+	dmu_objset_close(os);
+
+	error = dmu_objset_snapshot(name, "snap", FALSE);
+	if (error)
+		fatal(0, "dmu_objset_snapshot(%s@snap) = %d", name, error);
+	(void) snprintf(snapname, sizeof (snapname), "%s@snap", name);
+	error = dmu_objset_open(snapname, DMU_OST_ANY,
+	    DS_MODE_STANDARD | DS_MODE_READONLY, &os);
+	if (error)
+		fatal(0, "dmu_objset_open(%s) = %d", snapname, error);
+
+	umem_free(buf, ZTEST_SEND_TXG_BYTES);
+	return (os);
+}
+
+/*
+ * Check that the snapshot 'name' holds the same objects, with the same
+ * contents, as 'os'.
+ */
+static void
+ztest_bench_objset_verify(objset_t *os, char *name)
+{
+	dmu_object_info_t doi, rdoi;
+	objset_t *ros;
+	char *buf, *rbuf;
+	uint64_t object, robject, off, len, size;
+	int error, rerror;
+
+	error = dmu_objset_open(name, DMU_OST_ANY,
+	    DS_MODE_STANDARD | DS_MODE_READONLY, &ros);
+	if (error)
+		fatal(0, "dmu_objset_open(%s) = %d", name, error);
+
+	buf = umem_alloc(ZTEST_SEND_TXG_BYTES, UMEM_NOFAIL);
+	rbuf = umem_alloc(ZTEST_SEND_TXG_BYTES, UMEM_NOFAIL);
+
+	for (object = robject = 0; ; ) {
+		error = dmu_object_next(os, &object, B_FALSE, 0);
+		rerror = dmu_object_next(ros, &robject, B_FALSE, 0);
+		if (error != rerror)
+			fatal(0, "%s: object %llu next = %d, expected %d",
+			    name, (u_longlong_t)object, rerror, error);
+		if (error == ESRCH)
+			break;
+		if (error)
+			fatal(0, "dmu_object_next() = %d", error);
+		if (object != robject)
+			fatal(0, "%s: object %llu, expected %llu", name,
+			    (u_longlong_t)robject, (u_longlong_t)object);
+
+		VERIFY(0 == dmu_object_info(os, object, &doi));
+		VERIFY(0 == dmu_object_info(ros, object, &rdoi));
+		if (doi.doi_type != rdoi.doi_type ||
+		    doi.doi_data_block_size != rdoi.doi_data_block_size ||
+		    doi.doi_bonus_size != rdoi.doi_bonus_size ||
+		    doi.doi_max_block_offset != rdoi.doi_max_block_offset)
+			fatal(0, "%s: object %llu info differs", name,
+			    (u_longlong_t)object);
+
+		size = (doi.doi_max_block_offset + 1) *
+		    doi.doi_data_block_size;
+		for (off = 0; off < size; off += len) {
+			len = MIN(size - off, ZTEST_SEND_TXG_BYTES);
+			VERIFY(0 == dmu_read(os, object, off, len, buf));
+			VERIFY(0 == dmu_read(ros, object, off, len, rbuf));
+			if (bcmp(buf, rbuf, len) != 0)
+				fatal(0, "%s: object %llu differs at "
+				    "offset %llu", name, (u_longlong_t)object,
+				    (u_longlong_t)off);
+		}
+	}
+
+	umem_free(rbuf, ZTEST_SEND_TXG_BYTES);
+	umem_free(buf, ZTEST_SEND_TXG_BYTES);
+	dmu_objset_close(ros);
+}
+
+/*
+ * Check that the files 'path0' and 'path1' have the same contents.
+ */
+static void
+ztest_bench_file_compare(char *path0, char *path1)
+{
+	vnode_t *vp0, *vp1;
+	char *buf0, *buf1;
+	ssize_t resid0, resid1;
+	offset_t off;
+	int error;
+
+	error = vn_open(path0, UIO_SYSSPACE, FREAD | FOFFMAX, 0, &vp0, 0, 0);
+	if (error)
+		fatal(0, "vn_open(%s) = %d", path0, error);
+	error = vn_open(path1, UIO_SYSSPACE, FREAD | FOFFMAX, 0, &vp1, 0, 0);
+	if (error)
+		fatal(0, "vn_open(%s) = %d", path1, error);
+
+	buf0 = umem_alloc(ZTEST_SEND_TXG_BYTES, UMEM_NOFAIL);
+	buf1 = umem_alloc(ZTEST_SEND_TXG_BYTES, UMEM_NOFAIL);
+
+	for (off = 0; ; off += ZTEST_SEND_TXG_BYTES - resid0) {
+		error = vn_rdwr(UIO_READ, vp0, buf0, ZTEST_SEND_TXG_BYTES,
+		    off, UIO_SYSSPACE, 0, RLIM64_INFINITY, CRED(), &resid0);
+		if (error)
+			fatal(0, "vn_rdwr(%s) = %d", path0, error);
+		error = vn_rdwr(UIO_READ, vp1, buf1, ZTEST_SEND_TXG_BYTES,
+		    off, UIO_SYSSPACE, 0, RLIM64_INFINITY, CRED(), &resid1);
+		if (error)
+			fatal(0, "vn_rdwr(%s) = %d", path1, error);
+		if (resid0 != resid1 ||
+		    bcmp(buf0, buf1, ZTEST_SEND_TXG_BYTES - resid0) != 0)
+			fatal(0, "%s and %s differ after offset %llu",
+			    path0, path1, (u_longlong_t)off);
+		if (resid0 == ZTEST_SEND_TXG_BYTES)
+			break;
+	}
+
+	umem_free(buf1, ZTEST_SEND_TXG_BYTES);
+	umem_free(buf0, ZTEST_SEND_TXG_BYTES);
+	vn_close(vp1);
+	vn_close(vp0);
+}
+
+/*
+ * Throughput of a full send of a snapshot to a file in the -f directory,
+ * reading one block at a time and pipelined. The snapshot holds one
+ * object of ZTEST_SEND_BYTES in 128K blocks. The ARC is flushed before
+ * each pass, so every block is read from the pool. File vdevs read
+ * through the page cache, so point -f at a directory on a disk to see
+ * the full effect of keeping reads in flight. The two streams must be
+ * identical.
+ */
+#define	ZTEST_SEND_BYTES	(256ULL << 20)
+
+static void
+ztest_bench_send(void)
+{
+	uint64_t queue_max = zfs_send_queue_max;
+	char name[100], path[2][MAXPATHLEN];
+	spa_t *spa;
+	objset_t *os;
+	vnode_t *vp;
+	hrtime_t t0, elapsed[2];
+	int pass, error;
+
+	(void) snprintf(name, sizeof (name), "%s/send", zopt_pool);
+
+	spa = ztest_bench_pool_create(ZTEST_SEND_VDEV, 0, 0);
+	os = ztest_bench_send_setup(spa, name, 1, SPA_MAXBLOCKSIZE,
+	    ZTEST_SEND_BYTES);
+
+	for (pass = 0; pass < 2; pass++) {
+		zfs_send_queue_max = pass ? queue_max : 0;
+
+		(void) snprintf(path[pass], sizeof (path[pass]),
+		    "%s/%s.send%d", zopt_dir, zopt_pool, pass);
+		error = vn_open(path[pass], UIO_SYSSPACE, FWRITE | FTRUNC |
+		    FCREAT | FOFFMAX, 0644, &vp, CRCREAT, 0);
+		if (error)
+			fatal(0, "vn_open(%s) = %d", path[pass], error);
+
+		arc_flush();
+
+		t0 = gethrtime();
+		error = dmu_sendbackup(os, NULL, vp);
+		if (error)
+			fatal(0, "dmu_sendbackup() pass %d = %d", pass, error);
+		elapsed[pass] = MAX(gethrtime() - t0, 1);
+
+		vn_close(vp);
+	}
+	zfs_send_queue_max = queue_max;
+
+	ztest_bench_file_compare(path[0], path[1]);
+	(void) remove(path[0]);
+	(void) remove(path[1]);
+	dmu_objset_close(os);
+	ztest_bench_pool_destroy(spa);
+
+	(void) printf("%-10s %12s %12s %12s %12s\n", "data MB",
+	    "serial s", "MB/s", "pipelined s", "MB/s");
+	(void) printf("%-10llu %12.2f %12.2f %12.2f %12.2f\n",
+	    (u_longlong_t)(ZTEST_SEND_BYTES >> 20),
+	    (double)elapsed[0] / NANOSEC,
+	    (double)ZTEST_SEND_BYTES / (1 << 20) * NANOSEC / elapsed[0],
+	    (double)elapsed[1] / NANOSEC,
+	    (double)ZTEST_SEND_BYTES / (1 << 20) * NANOSEC / elapsed[1]);
+}
+
+/*
+ * Round trip of a full send stream through a file in the -f directory:
+ * the stream is received into a new filesystem once with the records
+ * applied one at a time and once in parallel, and each receive is timed
+ * until its data has synced. The snapshot holds ZTEST_RECV_OBJECTS
+ * objects in 8K blocks, so the stream is many small writes spread over
+ * several objects. Each received snapshot is then checked against the
+ * source.
+ */
+#define	ZTEST_RECV_OBJECTS	16
+#define	ZTEST_RECV_BYTES	(8ULL << 20)
+
+static void
+ztest_bench_recv(void)
+{
+	int threads = zfs_recv_threads;
+	char name[100], tosnap[100], path[MAXPATHLEN];
+	dmu_replay_record_t drr;
+	spa_t *spa;
+	objset_t *os;
+	vnode_t *vp;
+	uint64_t size;
+	ssize_t resid;
+	hrtime_t t0, elapsed[2];
+	int pass, error;
+
+	(void) snprintf(name, sizeof (name), "%s/send", zopt_pool);
+	(void) snprintf(path, sizeof (path), "%s/%s.send", zopt_dir,
+	    zopt_pool);
+
+	spa = ztest_bench_pool_create(ZTEST_SEND_VDEV, 0, 0);
+	os = ztest_bench_send_setup(spa, name, ZTEST_RECV_OBJECTS, 8192,
+	    ZTEST_RECV_BYTES);
+
+	error = vn_open(path, UIO_SYSSPACE, FWRITE | FTRUNC | FCREAT |
+	    FOFFMAX, 0644, &vp, CRCREAT, 0);
+	if (error)
+		fatal(0, "vn_open(%s) = %d", path, error);
+	error = dmu_sendbackup(os, NULL, vp);
+	if (error)
+		fatal(0, "dmu_sendbackup() = %d", error);
+	vn_close(vp);
+
+	error = vn_open(path, UIO_SYSSPACE, FREAD, 0, &vp, 0, 0);
+	if (error)
+		fatal(0, "vn_open(%s) = %d", path, error);
+
+	for (pass = 0; pass < 2; pass++) {
+		zfs_recv_threads = pass ? threads : 0;
+
+		error = vn_rdwr(UIO_READ, vp, (caddr_t)&drr, sizeof (drr), 0,
+		    UIO_SYSSPACE, 0, RLIM64_INFINITY, CRED(), &resid);
+		if (error || resid != 0)
+			fatal(0, "vn_rdwr(%s) = %d", path, error);
+		(void) snprintf(tosnap, sizeof (tosnap), "%s/recv%d@snap",
+		    zopt_pool, pass);
+
+		t0 = gethrtime();
+		error = dmu_recvbackup(tosnap, &drr.drr_u.drr_begin, &size,
+		    B_FALSE, vp, sizeof (drr));
+		if (error)
+			fatal(0, "dmu_recvbackup() pass %d = %d", pass, error);
+		txg_wait_synced(spa_get_dsl(spa), 0);
+		elapsed[pass] = MAX(gethrtime() - t0, 1);
+
+		ztest_bench_objset_verify(os, tosnap);
+	}
+	zfs_recv_threads = threads;
+
+	vn_close(vp);
+	(void) remove(path);
+	dmu_objset_close(os);
+	ztest_bench_pool_destroy(spa);
+
+	(void) printf("%-10s %12s %12s %12s %12s\n", "stream MB",
+	    "serial s", "MB/s", "parallel s", "MB/s");
+	(void) printf("%-10llu %12.2f %12.2f %12.2f %12.2f\n",
+	    (u_longlong_t)(size >> 20),
+	    (double)elapsed[0] / NANOSEC,
+	    (double)size / (1 << 20) * NANOSEC / elapsed[0],
+	    (double)elapsed[1] / NANOSEC,
+	    (double)size / (1 << 20) * NANOSEC / elapsed[1]);
+}
+
+static ztest_bench_t ztest_bench[] = {
+	{ "raidz",	ztest_bench_raidz,
+	    "RAID-Z parity kernels, GB/s per implementation and width" },
+	{ "checksum",	ztest_bench_checksum,
+	    "checksum functions, MB/s per block size" },
+	{ "filevdev",	ztest_bench_file,
+	    "file vdev 4K random IOPS, synchronous vs. asynchronous path" },
+	{ "arc",	ztest_bench_arc,
+	    "ARC cache hits/s by thread count, 1 vs. default sublists" },
+	{ "zio",	ztest_bench_zio,
+	    "zio and transform allocations per 128K RAID-Z2 write" },
+	{ "queue",	ztest_bench_queue,
+	    "sync read latency during txg sync, fixed vs. adaptive queue" },
+	{ "metaslab",	ztest_bench_metaslab,
+	    "block allocation time by fill level, first-fit vs. dynamic-fit" },
+	{ "zil",	ztest_bench_zil,
+	    "fsync p50/p99 latency by thread count, serial vs. parallel" },
+	{ "replay",	ztest_bench_replay,
+	    "time to replay a 1GB intent log, serial vs. parallel" },
+	{ "scrub",	ztest_bench_scrub,
+	    "scrub of 128MB written in random order, unsorted vs. sorted" },
+	{ "mirror",	ztest_bench_mirror,
+	    "mirror read latency with one slow child, by offset vs. load" },
+	{ "send",	ztest_bench_send,
+	    "send of a 256MB snapshot to a file, serial vs. pipelined" },
+	{ "recv",	ztest_bench_recv,
+	    "send | recv of 128MB in 8K blocks, serial vs. parallel" },
+};
+
+#define	ZTEST_BENCHES	(sizeof (ztest_bench) / sizeof (ztest_bench_t))
+
+static void
+ztest_run_bench(char *name)
+{
+	int b;
+
+	for (b = 0; b < ZTEST_BENCHES; b++) {
+		if (strcmp(name, ztest_bench[b].zb_name) == 0) {
+			ztest_bench[b].zb_func();
+			return;
+		}
+	}
+
+	if (strcmp(name, "list") != 0)
+		(void) fprintf(stderr, "ztest: unknown benchmark '%s'\n", name);
+	(void) fprintf(stderr, "available benchmarks:\n");
+	for (b = 0; b < ZTEST_BENCHES; b++)
+		(void) fprintf(stderr, "\t%-12s %s\n", ztest_bench[b].zb_name,
+		    ztest_bench[b].zb_desc);
+	exit(strcmp(name, "list") == 0 ? 0 : 1);
+}
+
+int
+main(int argc, char **argv)
+{
+	int kills = 0;
+	int iters = 0;
+	int i, f;
+	ztest_shared_t *zs;
+	ztest_info_t *zi;
+	char timebuf[100];
+	char numbuf[6];
+
+	(void) setvbuf(stdout, NULL, _IOLBF, 0);
+
+	/* Override location of zpool.cache */
+	spa_config_dir = "/tmp";
+
+#ifdef __APPLE__
+	zopt_seed = time(0);
+#else
+	ztest_random_fd = open("/dev/urandom", O_RDONLY);
+#endif
+
+#ifdef __APPLE__
+	/* fake getexecname() by just saving Arg0, which is supposed
+	   to be the full path to the executable. */
+	getexecname_fake = strdup(argv[0]);
+#endif
+
+	process_options(argc, argv);
+#ifdef __APPLE__
+	srandom(zopt_seed);
+#endif
+
+	argc -= optind;
+	argv += optind;
+
+#ifdef __APPLE__
+	/*
+	 * Check zopt_dir, as ztest_init() will fail if path is not absolute
+	 */
+	
+	if (zopt_dir[0] != '/') {
+		fprintf(stderr, "%s: -f : path must start with '/'.\n", getexecname_fake);
+		exit(1);
+	}
+#endif
+
+	dprintf_setup(&argc, argv);
+
+	/*
+	 * Blow away any existing copy of zpool.cache
+	 */
+	if (zopt_init != 0)
+		(void) remove("/tmp/zpool.cache");
+
+	zs = ztest_shared = (void *)mmap(0,
+	    P2ROUNDUP(sizeof (ztest_shared_t), getpagesize()),
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+
+	if (zopt_bench != NULL) {
+		ztest_run_bench(zopt_bench);
+		return (0);
+	}
 
 	if (zopt_verbose >= 1) {
 #ifdef __APPLE__
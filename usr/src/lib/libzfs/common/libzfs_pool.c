@@ -837,6 +837,15 @@ vdev_to_nvlist_iter(nvlist_t *nv, const char *search, uint64_t guid,
 		}
 	}
 
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_L2CACHE,
+	    &child, &children) == 0) {
+		for (c = 0; c < children; c++) {
+			if ((ret = vdev_to_nvlist_iter(child[c], search, guid,
+			    avail_spare)) != NULL)
+				return (ret);
+		}
+	}
+
 	return (NULL);
 }
 
@@ -897,6 +906,33 @@ is_spare(zpool_handle_t *zhp, uint64_t guid)
 	return (B_FALSE);
 }
 
+/*
+ * Returns TRUE if the given guid corresponds to a cache device.
+ */
+static boolean_t
+is_l2cache(zpool_handle_t *zhp, uint64_t guid)
+{
+	uint64_t l2cache_guid;
+	nvlist_t *nvroot;
+	nvlist_t **l2cache;
+	uint_t nl2cache;
+	int i;
+
+	verify(nvlist_lookup_nvlist(zhp->zpool_config, ZPOOL_CONFIG_VDEV_TREE,
+	    &nvroot) == 0);
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
+	    &l2cache, &nl2cache) == 0) {
+		for (i = 0; i < nl2cache; i++) {
+			verify(nvlist_lookup_uint64(l2cache[i],
+			    ZPOOL_CONFIG_GUID, &l2cache_guid) == 0);
+			if (guid == l2cache_guid)
+				return (B_TRUE);
+		}
+	}
+
+	return (B_FALSE);
+}
+
 /*
  * Bring the specified vdev online.   The 'flags' parameter is a set of the
  * ZFS_ONLINE_* flags.
@@ -1287,14 +1323,15 @@ zpool_vdev_remove(zpool_handle_t *zhp, const char *path)
 	if ((tgt = zpool_find_vdev(zhp, path, &avail_spare)) == 0)
 		return (zfs_error(hdl, EZFS_NODEVICE, msg));
 
-	if (!avail_spare) {
+	verify(nvlist_lookup_uint64(tgt, ZPOOL_CONFIG_GUID, &zc.zc_guid) == 0);
+
+	if (!avail_spare && !is_l2cache(zhp, zc.zc_guid)) {
 		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-		    "only inactive hot spares can be removed"));
+		    "only inactive hot spares or cache devices "
+		    "can be removed"));
 		return (zfs_error(hdl, EZFS_NODEVICE, msg));
 	}
 
-	verify(nvlist_lookup_uint64(tgt, ZPOOL_CONFIG_GUID, &zc.zc_guid) == 0);
-
 	if (zfs_ioctl(hdl, ZFS_IOC_VDEV_REMOVE, &zc) == 0)
 		return (0);
 
@@ -2008,6 +2045,46 @@ zpool_get_history(zpool_handle_t *zhp, nvlist_t **nvhisp)
 	return (err);
 }
 
+/*
+ * Retrieve the timings of the pool's most recently synced txgs.
+ */
+int
+zpool_get_txg_history(zpool_handle_t *zhp, nvlist_t **nvp)
+{
+	zfs_cmd_t zc = { 0 };
+	libzfs_handle_t *hdl = zhp->zpool_hdl;
+	char msg[1024];
+
+	(void) snprintf(msg, sizeof (msg), dgettext(TEXT_DOMAIN,
+	    "cannot get txg history for '%s'"), zhp->zpool_name);
+
+	(void) strlcpy(zc.zc_name, zhp->zpool_name, sizeof (zc.zc_name));
+
+	if (zcmd_alloc_dst_nvlist(hdl, &zc, 0) != 0)
+		return (-1);
+
+	while (ioctl(hdl->libzfs_fd, ZFS_IOC_POOL_TXG_HISTORY, &zc) != 0) {
+		if (errno == ENOMEM) {
+			if (zcmd_expand_dst_nvlist(hdl, &zc) != 0) {
+				zcmd_free_nvlists(&zc);
+				return (-1);
+			}
+		} else {
+			zcmd_free_nvlists(&zc);
+			return (zpool_standard_error(hdl, errno, msg));
+		}
+	}
+
+	if (zcmd_read_dst_nvlist(hdl, &zc, nvp) != 0) {
+		zcmd_free_nvlists(&zc);
+		return (-1);
+	}
+
+	zcmd_free_nvlists(&zc);
+
+	return (0);
+}
+
 void
 zpool_obj_to_path(zpool_handle_t *zhp, uint64_t dsobj, uint64_t obj,
     char *pathname, size_t len)
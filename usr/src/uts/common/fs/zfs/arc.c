@@ -94,11 +94,16 @@
  * buf_hash_remove() expects the appropriate hash mutex to be
  * already held before it is invoked.
  *
- * Each arc state also has a mutex which is used to protect the
- * buffer list associated with the state.  When attempting to
- * obtain a hash table lock while holding an arc list lock you
- * must use: mutex_tryenter() to avoid deadlock.  Also note that
- * the active state mutex must be held before the ghost state mutex.
+ * The hash mutexs are striped over the table and the table may grow
+ * underneath them, but a buffer always maps to the same mutex (see
+ * the comment above ht_lock_t).
+ *
+ * Each arc state also has a set of sublists, each with a mutex
+ * which is used to protect the buffer lists of that sublist.  When
+ * attempting to obtain a hash table lock while holding an arc list
+ * lock you must use: mutex_tryenter() to avoid deadlock.  Also note
+ * that the active state mutex must be held before the ghost state
+ * mutex.
  *
  * Arc buffers may have an associated eviction callback function.
  * This function will be invoked prior to removing the buffer (e.g.
@@ -111,11 +116,22 @@
  *
  * Note that the majority of the performance stats are manipulated
  * with atomic operations.
+ *
+ * The L2ARC uses the l2arc_buflist_mtx global mutex for the following:
+ *
+ *	- L2ARC buflist creation
+ *	- L2ARC buflist eviction
+ *	- L2ARC write completion, which adds items to the buflist
+ *	- ARC header destruction, as it removes from the buflist
+ *
+ * It is taken after the hash lock, or with mutex_tryenter() on the hash
+ * lock when a buflist is walked.
  */
 
 #include <sys/spa.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
+#include <sys/vdev_impl.h>
 #include <sys/zfs_context.h>
 #include <sys/arc.h>
 #include <sys/refcount.h>
@@ -157,14 +173,16 @@ static int arc_dead;
 uint64_t zfs_arc_max;
 uint64_t zfs_arc_min;
 uint64_t zfs_arc_meta_limit = 0;
+int zfs_arc_sublists = 0;		/* per-state sublists, 0 = max_ncpus */
 
 /*
- * Note that buffers can be in one of 5 states:
+ * Note that buffers can be in one of 6 states:
  *	ARC_anon	- anonymous (discussed below)
  *	ARC_mru		- recently used, currently cached
  *	ARC_mru_ghost	- recentely used, no longer in cache
  *	ARC_mfu		- frequently used, currently cached
  *	ARC_mfu_ghost	- frequently used, no longer in cache
+ *	ARC_l2c_only	- exists in L2ARC but not other states
  * When there are no active references to the buffer, they are
  * are linked onto a list in one of these arc states.  These are
  * the only buffers that can be evicted or deleted.  Within each
@@ -181,19 +199,50 @@ uint64_t zfs_arc_meta_limit = 0;
  * as they are written and migrate onto the arc_mru list.
  */
 
+/*
+ * The lists of a state are split into arc_sublist_count sublists, each
+ * with its own lock and padded out to a cache line, so that buffers
+ * moving on and off the lists on different CPUs do not all serialize on
+ * a single state mutex. A header's sublist is chosen from its address, so
+ * it is the same in every state; this lets arc_evict() hold a sublist of a
+ * state together with the matching sublist of its ghost state. Eviction
+ * takes from the sublists in turn (see arc_evict()).
+ */
+#define	ARC_SUBLIST_PAD	64
+
+typedef struct arc_sublist {
+	kmutex_t	asl_mtx;
+	list_t		asl_list[ARC_BUFC_NUMTYPES];
+} arc_sublist_t;
+
+typedef union arc_sublist_pad {
+	arc_sublist_t	aslp_sublist;
+	unsigned char	aslp_pad[P2ROUNDUP(sizeof (arc_sublist_t),
+	    ARC_SUBLIST_PAD)];
+} arc_sublist_pad_t;
+
 typedef struct arc_state {
-	list_t	arcs_list[ARC_BUFC_NUMTYPES];	/* list of evictable buffers */
+	arc_sublist_pad_t *arcs_sublists; /* lists of evictable buffers */
+	void	*arcs_sublists_base;	/* unaligned allocation */
 	uint64_t arcs_lsize[ARC_BUFC_NUMTYPES];	/* amount of evictable data */
 	uint64_t arcs_size;	/* total amount of data in this state */
-	kmutex_t arcs_mtx;
+	uint32_t arcs_evict_next; /* sublist to start the next eviction at */
 } arc_state_t;
 
-/* The 5 states: */
+static uint64_t arc_sublist_count;
+
+#define	ARC_SUBLIST_INDEX(ab)	\
+	(((uintptr_t)(ab) / sizeof (arc_buf_hdr_t)) % arc_sublist_count)
+#define	ARC_SUBLIST(state, idx)	(&(state)->arcs_sublists[idx].aslp_sublist)
+#define	HDR_SUBLIST(state, ab)	ARC_SUBLIST(state, ARC_SUBLIST_INDEX(ab))
+
+/* The 6 states: */
 static arc_state_t ARC_anon;
 static arc_state_t ARC_mru;
 static arc_state_t ARC_mru_ghost;
 static arc_state_t ARC_mfu;
 static arc_state_t ARC_mfu_ghost;
+static arc_state_t ARC_l2c_only;
 
 typedef struct arc_stats {
 	kstat_named_t arcstat_hits;
@@ -219,11 +268,29 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_hash_collisions;
 	kstat_named_t arcstat_hash_chains;
 	kstat_named_t arcstat_hash_chain_max;
+	kstat_named_t arcstat_hash_buckets;
+	kstat_named_t arcstat_hash_resizes;
+	kstat_named_t arcstat_hash_locks;
+	kstat_named_t arcstat_hash_lock_contended;
+	kstat_named_t arcstat_hash_lock_contended_max;
 	kstat_named_t arcstat_p;
 	kstat_named_t arcstat_c;
 	kstat_named_t arcstat_c_min;
 	kstat_named_t arcstat_c_max;
 	kstat_named_t arcstat_size;
+	kstat_named_t arcstat_l2_hits;
+	kstat_named_t arcstat_l2_misses;
+	kstat_named_t arcstat_l2_feeds;
+	kstat_named_t arcstat_l2_read_bytes;
+	kstat_named_t arcstat_l2_write_bytes;
+	kstat_named_t arcstat_l2_writes_sent;
+	kstat_named_t arcstat_l2_writes_error;
+	kstat_named_t arcstat_l2_evict_lock_retry;
+	kstat_named_t arcstat_l2_evicts;
+	kstat_named_t arcstat_l2_cksum_bad;
+	kstat_named_t arcstat_l2_io_error;
+	kstat_named_t arcstat_l2_size;
+	kstat_named_t arcstat_l2_hdr_size;
 } arc_stats_t;
 
 static arc_stats_t arc_stats = {
@@ -250,11 +317,29 @@ static arc_stats_t arc_stats = {
 	{ "hash_collisions",		KSTAT_DATA_UINT64 },
 	{ "hash_chains",		KSTAT_DATA_UINT64 },
 	{ "hash_chain_max",		KSTAT_DATA_UINT64 },
+	{ "hash_buckets",		KSTAT_DATA_UINT64 },
+	{ "hash_resizes",		KSTAT_DATA_UINT64 },
+	{ "hash_locks",			KSTAT_DATA_UINT64 },
+	{ "hash_lock_contended",	KSTAT_DATA_UINT64 },
+	{ "hash_lock_contended_max",	KSTAT_DATA_UINT64 },
 	{ "p",				KSTAT_DATA_UINT64 },
 	{ "c",				KSTAT_DATA_UINT64 },
 	{ "c_min",			KSTAT_DATA_UINT64 },
 	{ "c_max",			KSTAT_DATA_UINT64 },
-	{ "size",			KSTAT_DATA_UINT64 }
+	{ "size",			KSTAT_DATA_UINT64 },
+	{ "l2_hits",			KSTAT_DATA_UINT64 },
+	{ "l2_misses",			KSTAT_DATA_UINT64 },
+	{ "l2_feeds",			KSTAT_DATA_UINT64 },
+	{ "l2_read_bytes",		KSTAT_DATA_UINT64 },
+	{ "l2_write_bytes",		KSTAT_DATA_UINT64 },
+	{ "l2_writes_sent",		KSTAT_DATA_UINT64 },
+	{ "l2_writes_error",		KSTAT_DATA_UINT64 },
+	{ "l2_evict_lock_retry",	KSTAT_DATA_UINT64 },
+	{ "l2_evicts",			KSTAT_DATA_UINT64 },
+	{ "l2_cksum_bad",		KSTAT_DATA_UINT64 },
+	{ "l2_io_error",		KSTAT_DATA_UINT64 },
+	{ "l2_size",			KSTAT_DATA_UINT64 },
+	{ "l2_hdr_size",		KSTAT_DATA_UINT64 }
 };
 
 #define	ARCSTAT(stat)	(arc_stats.stat.value.ui64)
@@ -301,6 +386,7 @@ static arc_state_t	*arc_mru;
 static arc_state_t	*arc_mru_ghost;
 static arc_state_t	*arc_mfu;
 static arc_state_t	*arc_mfu_ghost;
+static arc_state_t	*arc_l2c_only;
 
 /*
  * There are several ARC variables that are critical to export as kstats --
@@ -327,6 +413,7 @@ static uint64_t         arc_c_peak;     /* Peak cache size */
 #endif
 
 typedef struct arc_callback arc_callback_t;
+typedef struct l2arc_buf_hdr l2arc_buf_hdr_t;
 
 struct arc_callback {
 	void			*acb_private;
@@ -377,6 +464,10 @@ struct arc_buf_hdr {
 
 	/* self protecting */
 	refcount_t		b_refcnt;
+
+	/* protected by hash lock and l2arc_buflist_mtx */
+	l2arc_buf_hdr_t		*b_l2hdr;
+	list_node_t		b_l2node;
 };
 
 static arc_buf_t *arc_eviction_list;
@@ -386,9 +477,14 @@ static void arc_get_data_buf(arc_buf_t *buf);
 static void arc_access(arc_buf_hdr_t *buf, kmutex_t *hash_lock);
 static int arc_evict_needed(arc_buf_contents_t type);
 static void arc_evict_ghost(arc_state_t *state, int64_t bytes);
+static void l2arc_hdr_drop(arc_buf_hdr_t *ab);
+static void l2arc_read_done(zio_t *zio);
+static void l2arc_init(void);
+static void l2arc_fini(void);
 
 #define	GHOST_STATE(state)	\
-	((state) == arc_mru_ghost || (state) == arc_mfu_ghost)
+	((state) == arc_mru_ghost || (state) == arc_mfu_ghost ||	\
+	(state) == arc_l2c_only)
 
 /*
  * Private ARC flags.  These flags are private ARC only flags that will show up
@@ -411,34 +507,146 @@ static void arc_evict_ghost(arc_state_t *state, int64_t bytes);
 #define	HDR_FREED_IN_READ(hdr)	((hdr)->b_flags & ARC_FREED_IN_READ)
 #define	HDR_BUF_AVAILABLE(hdr)	((hdr)->b_flags & ARC_BUF_AVAILABLE)
 
+/*
+ * Level 2 ARC
+ */
+
+#define	L2ARC_FEED_BUFS		4096	/* max buffers written per feed */
+
+/*
+ * L2ARC Performance Tunables
+ */
+uint64_t l2arc_write_max = 8 * 1024 * 1024;	/* max write size per feed */
+uint64_t l2arc_headroom = 2;		/* list tail scanned, in write_max's */
+uint64_t l2arc_feed_secs = 1;		/* interval seconds */
+
+/*
+ * L2ARC Internals
+ */
+typedef struct l2arc_dev {
+	vdev_t		*l2ad_vdev;	/* vdev */
+	spa_t		*l2ad_spa;	/* spa */
+	uint64_t	l2ad_hand;	/* next write location */
+	uint64_t	l2ad_start;	/* first addr on device */
+	uint64_t	l2ad_end;	/* last addr on device */
+	list_t		l2ad_buflist;	/* buffer list, oldest at the tail */
+	kmutex_t	l2ad_mtx;	/* protects l2ad_inflight */
+	kcondvar_t	l2ad_cv;	/* signalled as l2ad_inflight drains */
+	uint64_t	l2ad_inflight;	/* feeds and reads in progress */
+	list_node_t	l2ad_node;	/* device list node */
+} l2arc_dev_t;
+
+static list_t L2ARC_dev_list;			/* device list */
+static list_t *l2arc_dev_list;			/* device list pointer */
+static kmutex_t l2arc_dev_mtx;			/* device list mutex */
+static l2arc_dev_t *l2arc_dev_last;		/* last device used */
+static uint64_t l2arc_ndev;			/* number of devices */
+static kmutex_t l2arc_buflist_mtx;		/* mutex for all buflists */
+static kmutex_t l2arc_feed_thr_lock;
+static kcondvar_t l2arc_feed_thr_cv;
+static uint8_t l2arc_thread_exit;
+
+struct l2arc_buf_hdr {
+	/* protected by arc_buf_hdr  mutex */
+	l2arc_dev_t	*b_dev;			/* L2ARC device */
+	uint64_t	b_daddr;		/* disk address, offset byte */
+	zio_cksum_t	b_cksum;		/* fletcher-4 of the cached copy */
+};
+
+typedef struct l2arc_read_callback {
+	arc_buf_t	*l2rcb_buf;		/* read buffer */
+	spa_t		*l2rcb_spa;		/* spa */
+	blkptr_t	l2rcb_bp;		/* original blkptr */
+	zbookmark_t	l2rcb_zb;		/* original bookmark */
+	int		l2rcb_priority;		/* original priority */
+	int		l2rcb_flags;		/* original flags */
+	l2arc_dev_t	*l2rcb_dev;		/* device read from */
+	zio_cksum_t	l2rcb_cksum;		/* expected checksum */
+} l2arc_read_callback_t;
+
+typedef struct l2arc_write {
+	dva_t		l2w_dva;		/* identity of the buffer */
+	uint64_t	l2w_birth;
+	uint64_t	l2w_size;		/* buffer size */
+	uint64_t	l2w_daddr;		/* where it is written */
+	zio_cksum_t	l2w_cksum;		/* fletcher-4 of l2w_data */
+	void		*l2w_data;		/* copy of the buffer */
+	int		l2w_error;		/* write result */
+} l2arc_write_t;
+
+/*
+ * kmem_alloc() only guarantees 8-byte alignment, so the arrays of padded
+ * locks are over-allocated to be able to start them on a cache line.
+ * *basep receives the address to pass to arc_free_aligned().
+ */
+static void *
+arc_zalloc_aligned(size_t size, size_t align, void **basep)
+{
+	*basep = kmem_zalloc(size + align, KM_SLEEP);
+	return ((void *)P2ROUNDUP((uintptr_t)*basep, align));
+}
+
+static void
+arc_free_aligned(void *base, size_t size, size_t align)
+{
+	kmem_free(base, size + align);
+}
+
 /*
  * Hash table routines
  */
 
+/*
+ * The hash table is protected by an array of lock stripes. A buffer's
+ * stripe is chosen by the low bits of its hash, and does not depend on the
+ * size of the table, so that HDR_LOCK() is stable while the table grows.
+ * The number of stripes is a power of two scaled by the number of CPUs,
+ * and each stripe is padded out to its own cache line.
+ *
+ * The table itself starts out small and is doubled by the reclaim thread
+ * whenever the average chain length exceeds BUF_HASH_LOAD. Since the table
+ * size is always a multiple of the number of stripes, the buckets of a
+ * stripe before the split map onto buckets of the same stripe after it.
+ * The table is therefore grown one stripe at a time: with only that
+ * stripe's lock held, its chains are moved to the new table and the stripe
+ * is pointed at it. Lookups always go through the stripe's own table
+ * pointer, so they never see a partially moved stripe and never wait for
+ * more than one stripe's worth of rehashing.
+ */
 #define	HT_LOCK_PAD	64
 
-struct ht_lock {
+typedef struct ht_lock {
 	kmutex_t	ht_lock;
-#ifdef _KERNEL
-	unsigned char	pad[(HT_LOCK_PAD - sizeof (kmutex_t))];
-#endif
-};
+	arc_buf_hdr_t	**ht_table;	/* table holding this stripe */
+	uint64_t	ht_mask;	/* bucket mask for ht_table */
+	uint64_t	ht_contended;	/* acquisitions that had to wait */
+} ht_lock_t;
+
+typedef union ht_lock_pad {
+	ht_lock_t	hlp_lock;
+	unsigned char	hlp_pad[P2ROUNDUP(sizeof (ht_lock_t), HT_LOCK_PAD)];
+} ht_lock_pad_t;
+
+#define	BUF_LOCKS_PER_CPU	32
+#define	BUF_LOCKS_MIN		256
+#define	BUF_HASH_LOAD		2	/* average chain length before growth */
 
-#define	BUF_LOCKS 256
 typedef struct buf_hash_table {
 	uint64_t ht_mask;
 	arc_buf_hdr_t **ht_table;
-	struct ht_lock ht_locks[BUF_LOCKS];
+	uint64_t ht_nlocks;
+	ht_lock_pad_t *ht_locks;
+	void *ht_locks_base;		/* unaligned allocation */
 } buf_hash_table_t;
 
 static buf_hash_table_t buf_hash_table;
 
-#define	BUF_HASH_INDEX(spa, dva, birth) \
-	(buf_hash(spa, dva, birth) & buf_hash_table.ht_mask)
-#define	BUF_HASH_LOCK_NTRY(idx) (buf_hash_table.ht_locks[idx & (BUF_LOCKS-1)])
-#define	BUF_HASH_LOCK(idx)	(&(BUF_HASH_LOCK_NTRY(idx).ht_lock))
-#define	HDR_LOCK(buf) \
-	(BUF_HASH_LOCK(BUF_HASH_INDEX(buf->b_spa, &buf->b_dva, buf->b_birth)))
+#define	BUF_HASH_STRIPE(hash)	\
+	(&buf_hash_table.ht_locks[(hash) & (buf_hash_table.ht_nlocks - 1)] \
+	.hlp_lock)
+#define	HDR_STRIPE(buf) \
+	(BUF_HASH_STRIPE(buf_hash(buf->b_spa, &buf->b_dva, buf->b_birth)))
+#define	HDR_LOCK(buf)	(&HDR_STRIPE(buf)->ht_lock)
 
 uint64_t zfs_crc64_table[256];
 
@@ -460,6 +668,18 @@ buf_hash(spa_t *spa, dva_t *dva, uint64_t birth)
 	return (crc);
 }
 
+/*
+ * Acquire a stripe lock, counting the acquisitions that find it held.
+ */
+static void
+buf_hash_enter(ht_lock_t *hl)
+{
+	if (!mutex_tryenter(&hl->ht_lock)) {
+		mutex_enter(&hl->ht_lock);
+		hl->ht_contended++;
+	}
+}
+
 #define	BUF_EMPTY(buf)						\
 	((buf)->b_dva.dva_word[0] == 0 &&			\
 	(buf)->b_dva.dva_word[1] == 0 &&			\
@@ -473,19 +693,19 @@ buf_hash(spa_t *spa, dva_t *dva, uint64_t birth)
 static arc_buf_hdr_t *
 buf_hash_find(spa_t *spa, dva_t *dva, uint64_t birth, kmutex_t **lockp)
 {
-	uint64_t idx = BUF_HASH_INDEX(spa, dva, birth);
-	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
+	uint64_t hash = buf_hash(spa, dva, birth);
+	ht_lock_t *hl = BUF_HASH_STRIPE(hash);
 	arc_buf_hdr_t *buf;
 
-	mutex_enter(hash_lock);
-	for (buf = buf_hash_table.ht_table[idx]; buf != NULL;
+	buf_hash_enter(hl);
+	for (buf = hl->ht_table[hash & hl->ht_mask]; buf != NULL;
 	    buf = buf->b_hash_next) {
 		if (BUF_EQUAL(spa, dva, birth, buf)) {
-			*lockp = hash_lock;
+			*lockp = &hl->ht_lock;
 			return (buf);
 		}
 	}
-	mutex_exit(hash_lock);
+	mutex_exit(&hl->ht_lock);
 	*lockp = NULL;
 	return (NULL);
 }
@@ -499,22 +719,23 @@ buf_hash_find(spa_t *spa, dva_t *dva, uint64_t birth, kmutex_t **lockp)
 static arc_buf_hdr_t *
 buf_hash_insert(arc_buf_hdr_t *buf, kmutex_t **lockp)
 {
-	uint64_t idx = BUF_HASH_INDEX(buf->b_spa, &buf->b_dva, buf->b_birth);
-	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
-	arc_buf_hdr_t *fbuf;
+	uint64_t hash = buf_hash(buf->b_spa, &buf->b_dva, buf->b_birth);
+	ht_lock_t *hl = BUF_HASH_STRIPE(hash);
+	arc_buf_hdr_t *fbuf, **bucket;
 	uint32_t i;
 
 	ASSERT(!HDR_IN_HASH_TABLE(buf));
-	*lockp = hash_lock;
-	mutex_enter(hash_lock);
-	for (fbuf = buf_hash_table.ht_table[idx], i = 0; fbuf != NULL;
+	*lockp = &hl->ht_lock;
+	buf_hash_enter(hl);
+	bucket = &hl->ht_table[hash & hl->ht_mask];
+	for (fbuf = *bucket, i = 0; fbuf != NULL;
 	    fbuf = fbuf->b_hash_next, i++) {
 		if (BUF_EQUAL(buf->b_spa, &buf->b_dva, buf->b_birth, fbuf))
 			return (fbuf);
 	}
 
-	buf->b_hash_next = buf_hash_table.ht_table[idx];
-	buf_hash_table.ht_table[idx] = buf;
+	buf->b_hash_next = *bucket;
+	*bucket = buf;
 	buf->b_flags |= ARC_IN_HASH_TABLE;
 
 	/* collect some hash table performance data */
@@ -535,13 +756,14 @@ buf_hash_insert(arc_buf_hdr_t *buf, kmutex_t **lockp)
 static void
 buf_hash_remove(arc_buf_hdr_t *buf)
 {
-	arc_buf_hdr_t *fbuf, **bufp;
-	uint64_t idx = BUF_HASH_INDEX(buf->b_spa, &buf->b_dva, buf->b_birth);
+	arc_buf_hdr_t *fbuf, **bufp, **bucket;
+	uint64_t hash = buf_hash(buf->b_spa, &buf->b_dva, buf->b_birth);
+	ht_lock_t *hl = BUF_HASH_STRIPE(hash);
 
-	ASSERT(MUTEX_HELD(BUF_HASH_LOCK(idx)));
+	ASSERT(MUTEX_HELD(&hl->ht_lock));
 	ASSERT(HDR_IN_HASH_TABLE(buf));
 
-	bufp = &buf_hash_table.ht_table[idx];
+	bucket = bufp = &hl->ht_table[hash & hl->ht_mask];
 	while ((fbuf = *bufp) != buf) {
 		ASSERT(fbuf != NULL);
 		bufp = &fbuf->b_hash_next;
@@ -553,11 +775,110 @@ buf_hash_remove(arc_buf_hdr_t *buf)
 	/* collect some hash table performance data */
 	ARCSTAT_BUMPDOWN(arcstat_hash_elements);
 
-	if (buf_hash_table.ht_table[idx] &&
-	    buf_hash_table.ht_table[idx]->b_hash_next == NULL)
+	if (*bucket && (*bucket)->b_hash_next == NULL)
 		ARCSTAT_BUMPDOWN(arcstat_hash_chains);
 }
 
+/*
+ * Number of chains of two or more buffers among the given buckets.
+ */
+static uint64_t
+buf_hash_count_chains(arc_buf_hdr_t **table, uint64_t first, uint64_t last,
+    uint64_t stride)
+{
+	uint64_t idx, chains = 0;
+
+	for (idx = first; idx <= last; idx += stride)
+		if (table[idx] != NULL && table[idx]->b_hash_next != NULL)
+			chains++;
+
+	return (chains);
+}
+
+/*
+ * Double the size of the hash table if it has become too heavily loaded.
+ * Called only from the reclaim thread, so there is never more than one
+ * resize in progress. Each stripe is moved under its own lock (see the
+ * comment above ht_lock_t).
+ */
+static void
+buf_hash_grow(void)
+{
+	buf_hash_table_t *ht = &buf_hash_table;
+	uint64_t oldsize = ht->ht_mask + 1;
+	uint64_t newsize = oldsize << 1;
+	arc_buf_hdr_t **oldtable = ht->ht_table;
+	arc_buf_hdr_t **newtable, *buf, *next;
+	uint64_t s, idx, chains;
+	ht_lock_t *hl;
+
+	if (ARCSTAT(arcstat_hash_elements) <= oldsize * BUF_HASH_LOAD)
+		return;
+
+	newtable = kmem_zalloc(newsize * sizeof (void *), KM_NOSLEEP);
+	if (newtable == NULL)
+		return;
+
+	for (s = 0; s < ht->ht_nlocks; s++) {
+		hl = &ht->ht_locks[s].hlp_lock;
+		mutex_enter(&hl->ht_lock);
+		ASSERT(hl->ht_table == oldtable);
+
+		chains = buf_hash_count_chains(oldtable, s, oldsize - 1,
+		    ht->ht_nlocks);
+		for (idx = s; idx < oldsize; idx += ht->ht_nlocks) {
+			for (buf = oldtable[idx]; buf != NULL; buf = next) {
+				uint64_t nidx = buf_hash(buf->b_spa,
+				    &buf->b_dva, buf->b_birth) & (newsize - 1);
+
+				ASSERT((nidx & (ht->ht_nlocks - 1)) == s);
+				next = buf->b_hash_next;
+				buf->b_hash_next = newtable[nidx];
+				newtable[nidx] = buf;
+			}
+		}
+		hl->ht_table = newtable;
+		hl->ht_mask = newsize - 1;
+		ARCSTAT_INCR(arcstat_hash_chains, buf_hash_count_chains(
+		    newtable, s, newsize - 1, ht->ht_nlocks) - chains);
+
+		mutex_exit(&hl->ht_lock);
+	}
+
+	/*
+	 * No stripe refers to the old table any more, and all lookups go
+	 * through a stripe, so it can be freed.
+	 */
+	ht->ht_table = newtable;
+	ht->ht_mask = newsize - 1;
+	kmem_free(oldtable, oldsize * sizeof (void *));
+
+	ARCSTAT_BUMP(arcstat_hash_resizes);
+	ARCSTAT(arcstat_hash_buckets) = newsize;
+}
+
+/*
+ * Refresh the lock contention kstats from the per-stripe counters.
+ * The counters are read without the stripe locks, so the sums are only
+ * approximate.
+ */
+static void
+buf_hash_update_stats(void)
+{
+	buf_hash_table_t *ht = &buf_hash_table;
+	uint64_t s, contended, total = 0, max = 0;
+
+	for (s = 0; s < ht->ht_nlocks; s++) {
+		contended = ht->ht_locks[s].hlp_lock.ht_contended;
+		total += contended;
+		if (contended > max)
+			max = contended;
+	}
+
+	ARCSTAT(arcstat_hash_lock_contended) = total;
+	ARCSTAT(arcstat_hash_lock_contended_max) = max;
+}
+
 /*
  * Global data structures and functions for the buf kmem cache.
  */
@@ -571,8 +892,10 @@ buf_fini(void)
 
 	kmem_free(buf_hash_table.ht_table,
 	    (buf_hash_table.ht_mask + 1) * sizeof (void *));
-	for (i = 0; i < BUF_LOCKS; i++)
-		mutex_destroy(&buf_hash_table.ht_locks[i].ht_lock);
+	for (i = 0; i < buf_hash_table.ht_nlocks; i++)
+		mutex_destroy(&buf_hash_table.ht_locks[i].hlp_lock.ht_lock);
+	arc_free_aligned(buf_hash_table.ht_locks_base,
+	    buf_hash_table.ht_nlocks * sizeof (ht_lock_pad_t), HT_LOCK_PAD);
 	kmem_cache_destroy(hdr_cache);
 	kmem_cache_destroy(buf_cache);
 }
@@ -630,14 +953,21 @@ buf_init(void)
 {
 	uint64_t *ct;
 	uint64_t hsize = 1ULL << 12;
+	uint64_t nlocks = BUF_LOCKS_MIN;
 	int i, j;
 
 	/*
-	 * The hash table is big enough to fill half of physical memory
-	 * with an average 64K block size.  The table will take up
-	 * totalmem*sizeof(void*)/64K (eg. 128KB/GB with 8-byte pointers).
+	 * Scale the number of lock stripes with the number of CPUs.
+	 */
+	while (nlocks < max_ncpus * BUF_LOCKS_PER_CPU)
+		nlocks <<= 1;
+
+	/*
+	 * The hash table starts out big enough to hold an eighth of physical
+	 * memory with an average 64K block size, and is grown from there by
+	 * buf_hash_grow(). It must have at least one bucket per stripe.
 	 */
-	while (hsize * (65536/2) < physmem * PAGESIZE)
+	while (hsize * (65536 * 8) < physmem * PAGESIZE || hsize < nlocks)
 		hsize <<= 1;
 retry:
 	buf_hash_table.ht_mask = hsize - 1;
@@ -650,8 +980,11 @@ retry:
 	if (buf_hash_table.ht_table == NULL) {
 		ASSERT(hsize > (1ULL << 8));
 		hsize >>= 1;
+		if (hsize < nlocks)
+			nlocks = hsize;
 		goto retry;
 	}
+	ARCSTAT(arcstat_hash_buckets) = hsize;
 
 	hdr_cache = kmem_cache_create("arc_buf_hdr_t", sizeof (arc_buf_hdr_t),
 	    0, hdr_cons, hdr_dest, hdr_recl, NULL, NULL, 0);
@@ -662,9 +995,18 @@ retry:
 		for (ct = zfs_crc64_table + i, *ct = i, j = 8; j > 0; j--)
 			*ct = (*ct >> 1) ^ (-(*ct & 1) & ZFS_CRC64_POLY);
 
-	for (i = 0; i < BUF_LOCKS; i++) {
-		mutex_init(&buf_hash_table.ht_locks[i].ht_lock,
-		    NULL, MUTEX_DEFAULT, NULL);
+	buf_hash_table.ht_nlocks = nlocks;
+	buf_hash_table.ht_locks = arc_zalloc_aligned(
+	    nlocks * sizeof (ht_lock_pad_t), HT_LOCK_PAD,
+	    &buf_hash_table.ht_locks_base);
+	ARCSTAT(arcstat_hash_locks) = nlocks;
+
+	for (i = 0; i < nlocks; i++) {
+		ht_lock_t *hl = &buf_hash_table.ht_locks[i].hlp_lock;
+
+		mutex_init(&hl->ht_lock, NULL, MUTEX_DEFAULT, NULL);
+		hl->ht_table = buf_hash_table.ht_table;
+		hl->ht_mask = buf_hash_table.ht_mask;
 	}
 }
 
@@ -745,11 +1087,12 @@ add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 	if ((refcount_add(&ab->b_refcnt, tag) == 1) &&
 	    (ab->b_state != arc_anon)) {
 		uint64_t delta = ab->b_size * ab->b_datacnt;
-		list_t *list = &ab->b_state->arcs_list[ab->b_type];
+		arc_sublist_t *sl = HDR_SUBLIST(ab->b_state, ab);
+		list_t *list = &sl->asl_list[ab->b_type];
 		uint64_t *size = &ab->b_state->arcs_lsize[ab->b_type];
 
-		ASSERT(!MUTEX_HELD(&ab->b_state->arcs_mtx));
-		mutex_enter(&ab->b_state->arcs_mtx);
+		ASSERT(!MUTEX_HELD(&sl->asl_mtx));
+		mutex_enter(&sl->asl_mtx);
 		ASSERT(list_link_active(&ab->b_arc_node));
 		list_remove(list, ab);
 		if (GHOST_STATE(ab->b_state)) {
@@ -760,7 +1103,7 @@ add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 		ASSERT(delta > 0);
 		ASSERT3U(*size, >=, delta);
 		atomic_add_64(size, -delta);
-		mutex_exit(&ab->b_state->arcs_mtx);
+		mutex_exit(&sl->asl_mtx);
 		/* remove the prefetch flag is we get a reference */
 		if (ab->b_flags & ARC_PREFETCH)
 			ab->b_flags &= ~ARC_PREFETCH;
@@ -778,15 +1121,16 @@ remove_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 
 	if (((cnt = refcount_remove(&ab->b_refcnt, tag)) == 0) &&
 	    (state != arc_anon)) {
+		arc_sublist_t *sl = HDR_SUBLIST(state, ab);
 		uint64_t *size = &state->arcs_lsize[ab->b_type];
 
-		ASSERT(!MUTEX_HELD(&state->arcs_mtx));
-		mutex_enter(&state->arcs_mtx);
+		ASSERT(!MUTEX_HELD(&sl->asl_mtx));
+		mutex_enter(&sl->asl_mtx);
 		ASSERT(!list_link_active(&ab->b_arc_node));
-		list_insert_head(&state->arcs_list[ab->b_type], ab);
+		list_insert_head(&sl->asl_list[ab->b_type], ab);
 		ASSERT(ab->b_datacnt > 0);
 		atomic_add_64(size, ab->b_size * ab->b_datacnt);
-		mutex_exit(&state->arcs_mtx);
+		mutex_exit(&sl->asl_mtx);
 	}
 	return (cnt);
 }
@@ -815,14 +1159,15 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 	 */
 	if (refcnt == 0) {
 		if (old_state != arc_anon) {
-			int use_mutex = !MUTEX_HELD(&old_state->arcs_mtx);
+			arc_sublist_t *sl = HDR_SUBLIST(old_state, ab);
+			int use_mutex = !MUTEX_HELD(&sl->asl_mtx);
 			uint64_t *size = &old_state->arcs_lsize[ab->b_type];
 
 			if (use_mutex)
-				mutex_enter(&old_state->arcs_mtx);
+				mutex_enter(&sl->asl_mtx);
 
 			ASSERT(list_link_active(&ab->b_arc_node));
-			list_remove(&old_state->arcs_list[ab->b_type], ab);
+			list_remove(&sl->asl_list[ab->b_type], ab);
 
 			/*
 			 * If prefetching out of the ghost cache,
@@ -837,16 +1182,17 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 			atomic_add_64(size, -from_delta);
 			
 			if (use_mutex)
-				mutex_exit(&old_state->arcs_mtx);
+				mutex_exit(&sl->asl_mtx);
 		}
 		if (new_state != arc_anon) {
-			int use_mutex = !MUTEX_HELD(&new_state->arcs_mtx);
+			arc_sublist_t *sl = HDR_SUBLIST(new_state, ab);
+			int use_mutex = !MUTEX_HELD(&sl->asl_mtx);
 			uint64_t *size = &new_state->arcs_lsize[ab->b_type];
 
 			if (use_mutex)
-				mutex_enter(&new_state->arcs_mtx);
+				mutex_enter(&sl->asl_mtx);
 
-			list_insert_head(&new_state->arcs_list[ab->b_type], ab);
+			list_insert_head(&sl->asl_list[ab->b_type], ab);
 
 			/* ghost elements have a ghost size */
 			if (GHOST_STATE(new_state)) {
@@ -857,7 +1203,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 			atomic_add_64(size, to_delta);
 
 			if (use_mutex)
-				mutex_exit(&new_state->arcs_mtx);
+				mutex_exit(&sl->asl_mtx);
 		}
 	}
 
@@ -866,6 +1212,10 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 		buf_hash_remove(ab);
 	}
 
+	/* an anonymous buffer has no identity to cache on the L2ARC */
+	if (new_state == arc_anon && ab->b_l2hdr != NULL)
+		l2arc_hdr_drop(ab);
+
 	/* adjust state sizes */
 	if (to_delta) 
 		atomic_add_64(&new_state->arcs_size, to_delta);
@@ -1095,6 +1445,7 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 	ASSERT(!list_link_active(&hdr->b_arc_node));
 	ASSERT3P(hdr->b_hash_next, ==, NULL);
 	ASSERT3P(hdr->b_acb, ==, NULL);
+	ASSERT3P(hdr->b_l2hdr, ==, NULL);
 	kmem_cache_free(hdr_cache, hdr);
 }
 
@@ -1178,32 +1529,29 @@ arc_buf_size(arc_buf_t *buf)
 }
 
 /*
- * Evict buffers from list until we've removed the specified number of
- * bytes.  Move the removed buffers to the appropriate evict state.
- * If the recycle flag is set, then attempt to "recycle" a buffer:
- * - look for a buffer to evict that is `bytes' long.
- * - return the data block from this buffer rather than freeing it.
- * This flag is used by callers that are trying to make space for a
- * new buffer in a full arc cache.
+ * Evict buffers from the tail of one sublist of a state until we've
+ * removed the specified number of bytes, moving them to the matching
+ * sublist of the ghost state. If recycle_size is non-zero and no data
+ * has been stolen yet, try to steal a data block of that size (see
+ * arc_evict()).
  */
-static void *
-arc_evict(arc_state_t *state, int64_t bytes, boolean_t recycle,
-    arc_buf_contents_t type)
+static uint64_t
+arc_evict_sublist(arc_state_t *state, arc_state_t *evicted_state,
+    uint64_t idx, int64_t bytes, uint64_t recycle_size,
+    arc_buf_contents_t type, void **stolenp, uint64_t *skippedp,
+    uint64_t *missedp)
 {
-	arc_state_t *evicted_state;
-	uint64_t bytes_evicted = 0, skipped = 0, missed = 0;
+	arc_sublist_t *sl = ARC_SUBLIST(state, idx);
+	arc_sublist_t *evicted_sl = ARC_SUBLIST(evicted_state, idx);
+	list_t *list = &sl->asl_list[type];
+	uint64_t bytes_evicted = 0;
 	arc_buf_hdr_t *ab, *ab_prev = NULL;
-	list_t *list = &state->arcs_list[type];
 	kmutex_t *hash_lock;
 	boolean_t have_lock;
-	void *stolen = NULL;
-
-	ASSERT(state == arc_mru || state == arc_mfu);
+	boolean_t recycle = (recycle_size != 0 && *stolenp == NULL);
 
-	evicted_state = (state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
-
-	mutex_enter(&state->arcs_mtx);
-	mutex_enter(&evicted_state->arcs_mtx);
+	mutex_enter(&sl->asl_mtx);
+	mutex_enter(&evicted_sl->asl_mtx);
 
 	for (ab = list_tail(list); ab; ab = ab_prev) {
 		ab_prev = list_prev(list, ab);
@@ -1211,12 +1559,12 @@ arc_evict(arc_state_t *state, int64_t bytes, boolean_t recycle,
 		if (HDR_IO_IN_PROGRESS(ab) ||
 		    (ab->b_flags & (ARC_PREFETCH|ARC_INDIRECT) &&
 		    lbolt - ab->b_arc_access < arc_min_prefetch_lifespan)) {
-			skipped++;
+			(*skippedp)++;
 			continue;
 		}
 		/* "lookahead" for better eviction candidate */
-		if (recycle && ab->b_size != bytes &&
-		    ab_prev && ab_prev->b_size == bytes)
+		if (recycle && ab->b_size != recycle_size &&
+		    ab_prev && ab_prev->b_size == recycle_size)
 			continue;
 		hash_lock = HDR_LOCK(ab);
 		have_lock = MUTEX_HELD(hash_lock);
@@ -1228,15 +1576,15 @@ arc_evict(arc_state_t *state, int64_t bytes, boolean_t recycle,
 				if (buf->b_data) {
 					bytes_evicted += ab->b_size;
 					if (recycle && ab->b_type == type &&
-					    ab->b_size == bytes) {
-						stolen = buf->b_data;
+					    ab->b_size == recycle_size) {
+						*stolenp = buf->b_data;
 						recycle = FALSE;
 					}
 				}
 				if (buf->b_efunc) {
 					mutex_enter(&arc_eviction_mtx);
 					arc_buf_destroy(buf,
-					    buf->b_data == stolen, FALSE);
+					    buf->b_data == *stolenp, FALSE);
 					ab->b_buf = buf->b_next;
 					buf->b_hdr = &arc_eviction_hdr;
 					buf->b_next = arc_eviction_list;
@@ -1244,7 +1592,7 @@ arc_evict(arc_state_t *state, int64_t bytes, boolean_t recycle,
 					mutex_exit(&arc_eviction_mtx);
 				} else {
 					arc_buf_destroy(buf,
-					    buf->b_data == stolen, TRUE);
+					    buf->b_data == *stolenp, TRUE);
 				}
 			}
 			ASSERT(ab->b_datacnt == 0);
@@ -1257,12 +1605,66 @@ arc_evict(arc_state_t *state, int64_t bytes, boolean_t recycle,
 			if (bytes >= 0 && bytes_evicted >= bytes)
 				break;
 		} else {
-			missed += 1;
+			(*missedp)++;
 		}
 	}
 
-	mutex_exit(&evicted_state->arcs_mtx);
-	mutex_exit(&state->arcs_mtx);
+	mutex_exit(&evicted_sl->asl_mtx);
+	mutex_exit(&sl->asl_mtx);
+
+	return (bytes_evicted);
+}
+
+/*
+ * Evict buffers from state until we've removed the specified number of
+ * bytes.  Move the removed buffers to the appropriate evict state.
+ * If the recycle flag is set, then attempt to "recycle" a buffer:
+ * - look for a buffer to evict that is `bytes' long.
+ * - return the data block from this buffer rather than freeing it.
+ * This flag is used by callers that are trying to make space for a
+ * new buffer in a full arc cache.
+ *
+ * The sublists are visited round-robin, starting after the one the
+ * previous eviction from this state started at, and each gives up an
+ * equal share of the total at a time. This keeps eviction close to LRU
+ * order for the state as a whole, while holding only one sublist lock
+ * (and its ghost) at a time.
+ */
+static void *
+arc_evict(arc_state_t *state, int64_t bytes, boolean_t recycle,
+    arc_buf_contents_t type)
+{
+	arc_state_t *evicted_state;
+	uint64_t bytes_evicted = 0, skipped = 0, missed = 0;
+	uint64_t start, n, progress;
+	int64_t share, want;
+	void *stolen = NULL;
+
+	ASSERT(state == arc_mru || state == arc_mfu);
+
+	evicted_state = (state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
+
+	if (bytes < 0 || recycle)
+		share = bytes;
+	else
+		share = MAX(bytes / arc_sublist_count, SPA_MAXBLOCKSIZE);
+
+	/* the cursor is only a hint, so races on it are harmless */
+	start = state->arcs_evict_next++;
+	do {
+		progress = bytes_evicted;
+		for (n = 0; n < arc_sublist_count; n++) {
+			want = (bytes < 0) ? -1 :
+			    MIN(share, bytes - (int64_t)bytes_evicted);
+			bytes_evicted += arc_evict_sublist(state, evicted_state,
+			    (start + n) % arc_sublist_count, want,
+			    recycle ? bytes : 0, type, &stolen, &skipped,
+			    &missed);
+			if (bytes >= 0 && bytes_evicted >= bytes)
+				break;
+		}
+	} while (bytes >= 0 && bytes_evicted < bytes &&
+	    bytes_evicted != progress);
 
 	if (bytes_evicted < bytes)
 		dprintf("only evicted %lld bytes from %x",
@@ -1299,61 +1701,84 @@ arc_evict(arc_state_t *state, int64_t bytes, boolean_t recycle,
 }
 
 /*
- * Remove buffers from list until we've removed the specified number of
+ * Remove buffers from the state until we've removed the specified number of
  * bytes.  Destroy the buffers that are removed.
  */
 static void
 arc_evict_ghost(arc_state_t *state, int64_t bytes)
 {
 	arc_buf_hdr_t *ab, *ab_prev;
-	list_t *list = &state->arcs_list[ARC_BUFC_DATA];
+	arc_sublist_t *sl;
+	list_t *list;
 	kmutex_t *hash_lock;
 	uint64_t bytes_deleted = 0;
 	uint64_t bufs_skipped = 0;
+	uint64_t start, n;
+	arc_buf_contents_t type;
 #ifdef __APPLE__
 	boolean_t have_lock;
 #endif
 
 	ASSERT(GHOST_STATE(state));
+
+	/* data is deleted before metadata, as with the active states */
+	start = state->arcs_evict_next++;
+	for (type = ARC_BUFC_DATA; type <= ARC_BUFC_METADATA; type++) {
+		for (n = 0; n < arc_sublist_count; n++) {
+			if (bytes >= 0 && bytes_deleted >= bytes)
+				break;
+			sl = ARC_SUBLIST(state, (start + n) % arc_sublist_count);
+			list = &sl->asl_list[type];
 top:
-	mutex_enter(&state->arcs_mtx);
-	for (ab = list_tail(list); ab; ab = ab_prev) {
-		ab_prev = list_prev(list, ab);
-		hash_lock = HDR_LOCK(ab);
+			mutex_enter(&sl->asl_mtx);
+			for (ab = list_tail(list); ab; ab = ab_prev) {
+				ab_prev = list_prev(list, ab);
+				hash_lock = HDR_LOCK(ab);
 #ifdef __APPLE__
-		have_lock = MUTEX_HELD(hash_lock);
-		if (!have_lock && mutex_tryenter(hash_lock)) 
+				have_lock = MUTEX_HELD(hash_lock);
+				if (!have_lock && mutex_tryenter(hash_lock))
 #else
-		if (mutex_tryenter(hash_lock)) 
+				if (mutex_tryenter(hash_lock))
 #endif
-		{
-			ASSERT(!HDR_IO_IN_PROGRESS(ab));
-			ASSERT(ab->b_buf == NULL);
-			arc_change_state(arc_anon, ab, hash_lock);
-			mutex_exit(hash_lock);
-			ARCSTAT_BUMP(arcstat_deleted);
-			bytes_deleted += ab->b_size;
-			arc_hdr_destroy(ab);
-			DTRACE_PROBE1(arc__delete, arc_buf_hdr_t *, ab);
-			if (bytes >= 0 && bytes_deleted >= bytes)
-				break;
-		} else {
-			if (bytes < 0) {
-				mutex_exit(&state->arcs_mtx);
-				mutex_enter(hash_lock);
-				mutex_exit(hash_lock);
-				goto top;
+				{
+					ASSERT(!HDR_IO_IN_PROGRESS(ab));
+					ASSERT(ab->b_buf == NULL);
+					ARCSTAT_BUMP(arcstat_deleted);
+					bytes_deleted += ab->b_size;
+					if (ab->b_l2hdr != NULL &&
+					    state != arc_l2c_only) {
+						/*
+						 * This buffer is cached on
+						 * the L2ARC, so keep its
+						 * header around to find it.
+						 */
+						arc_change_state(arc_l2c_only,
+						    ab, hash_lock);
+						mutex_exit(hash_lock);
+					} else {
+						arc_change_state(arc_anon, ab,
+						    hash_lock);
+						mutex_exit(hash_lock);
+						arc_hdr_destroy(ab);
+					}
+					DTRACE_PROBE1(arc__delete,
+					    arc_buf_hdr_t *, ab);
+					if (bytes >= 0 &&
+					    bytes_deleted >= bytes)
+						break;
+				} else {
+					if (bytes < 0) {
+						mutex_exit(&sl->asl_mtx);
+						mutex_enter(hash_lock);
+						mutex_exit(hash_lock);
+						goto top;
+					}
+					bufs_skipped += 1;
+				}
 			}
-			bufs_skipped += 1;
+			mutex_exit(&sl->asl_mtx);
 		}
 	}
-	mutex_exit(&state->arcs_mtx);
-
-	if (list == &state->arcs_list[ARC_BUFC_DATA] &&
-	    (bytes < 0 || bytes_deleted < bytes)) {
-		list = &state->arcs_list[ARC_BUFC_METADATA];
-		goto top;
-	}
 
 	if (bufs_skipped) {
 		ARCSTAT_INCR(arcstat_mutex_miss, bufs_skipped);
@@ -1446,6 +1871,23 @@ arc_do_user_evicts(void)
 	mutex_exit(&arc_eviction_mtx);
 }
 
+/*
+ * Returns true if any sublist of the state has buffers of the given type
+ * on it. Like the list_head() checks this replaces, the lists are
+ * sampled without their locks.
+ */
+static boolean_t
+arc_state_has_evictable(arc_state_t *state, arc_buf_contents_t type)
+{
+	uint64_t idx;
+
+	for (idx = 0; idx < arc_sublist_count; idx++)
+		if (list_head(&ARC_SUBLIST(state, idx)->asl_list[type]) != NULL)
+			return (B_TRUE);
+
+	return (B_FALSE);
+}
+
 /*
  * Flush all *evictable* data from the cache.
  * NOTE: this will not touch "active" (i.e. referenced) data.
@@ -1453,17 +1895,18 @@ arc_do_user_evicts(void)
 void
 arc_flush(void)
 {
-	while (list_head(&arc_mru->arcs_list[ARC_BUFC_DATA]))
+	while (arc_state_has_evictable(arc_mru, ARC_BUFC_DATA))
 		(void) arc_evict(arc_mru, -1, FALSE, ARC_BUFC_DATA);
-	while (list_head(&arc_mru->arcs_list[ARC_BUFC_METADATA]))
+	while (arc_state_has_evictable(arc_mru, ARC_BUFC_METADATA))
 		(void) arc_evict(arc_mru, -1, FALSE, ARC_BUFC_METADATA);
-	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_DATA]))
+	while (arc_state_has_evictable(arc_mfu, ARC_BUFC_DATA))
 		(void) arc_evict(arc_mfu, -1, FALSE, ARC_BUFC_DATA);
-	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_METADATA]))
+	while (arc_state_has_evictable(arc_mfu, ARC_BUFC_METADATA))
 		(void) arc_evict(arc_mfu, -1, FALSE, ARC_BUFC_METADATA);
 
 	arc_evict_ghost(arc_mru_ghost, -1);
 	arc_evict_ghost(arc_mfu_ghost, -1);
+	arc_evict_ghost(arc_l2c_only, -1);
 
 	mutex_enter(&arc_reclaim_thr_lock);
 	arc_do_user_evicts();
@@ -1502,7 +1945,7 @@ arc_shrink(void)
 		arc_adjust();
 }
 
-static int
+int
 arc_reclaim_needed(void)
 {
 #ifdef __APPLE__
@@ -1666,6 +2109,9 @@ arc_reclaim_thread(void)
 		if (arc_eviction_list != NULL)
 			arc_do_user_evicts();
 
+		buf_hash_grow();
+		buf_hash_update_stats();
+
 		/* block until needed, or one second, whichever is shorter */
 		CALLB_CPR_SAFE_BEGIN(&cpr);
 		(void) cv_timedwait(&arc_reclaim_thr_cv,
@@ -1826,6 +2272,8 @@ arc_get_data_buf(arc_buf_t *buf)
 		state = buf->b_hdr->b_flags & ARC_PREFETCH ? arc_mru : arc_mfu;
 	else if (state == arc_mru_ghost)
 		state = arc_mru;
+	else if (state == arc_l2c_only)
+		state = arc_mfu;
 
 	if (state == arc_mru || state == arc_anon) {
 		uint64_t mru_used = arc_anon->arcs_size + arc_mru->arcs_size;
@@ -1993,6 +2441,14 @@ arc_access(arc_buf_hdr_t *buf, kmutex_t *hash_lock)
 		arc_change_state(new_state, buf, hash_lock);
 
 		ARCSTAT_BUMP(arcstat_mfu_ghost_hits);
+	} else if (buf->b_state == arc_l2c_only) {
+		/*
+		 * This buffer is on the 2nd Level ARC.
+		 */
+
+		buf->b_arc_access = lbolt;
+		DTRACE_PROBE1(new_state__mfu, arc_buf_hdr_t *, buf);
+		arc_change_state(arc_mfu, buf, hash_lock);
 	} else {
 		ASSERT(!"invalid arc state");
 	}
@@ -2158,6 +2614,9 @@ arc_read(zio_t *pio, spa_t *spa, blkptr_t *bp, arc_byteswap_func_t *swap,
 	arc_buf_t *buf;
 	kmutex_t *hash_lock;
 	zio_t	*rzio;
+	l2arc_dev_t *l2dev = NULL;
+	uint64_t l2daddr = 0;
+	zio_cksum_t l2cksum;
 
 top:
 	/* 
@@ -2308,6 +2767,20 @@ top:
 
 		if (GHOST_STATE(hdr->b_state))
 			arc_access(hdr, hash_lock);
+
+		/*
+		 * If the buffer has a copy on an L2ARC device, hold the
+		 * device so that it stays around until the read is done.
+		 */
+		if (hdr->b_l2hdr != NULL &&
+		    !vdev_is_dead(hdr->b_l2hdr->b_dev->l2ad_vdev)) {
+			l2dev = hdr->b_l2hdr->b_dev;
+			l2daddr = hdr->b_l2hdr->b_daddr;
+			l2cksum = hdr->b_l2hdr->b_cksum;
+			mutex_enter(&l2dev->l2ad_mtx);
+			l2dev->l2ad_inflight++;
+			mutex_exit(&l2dev->l2ad_mtx);
+		}
 		mutex_exit(hash_lock);
 
 		ASSERT3U(hdr->b_size, ==, size);
@@ -2318,8 +2791,39 @@ top:
 		    demand, prefetch, hdr->b_type != ARC_BUFC_METADATA,
 		    data, metadata, misses);
 
-		rzio = zio_read(pio, spa, bp, buf->b_data, size,
-		    arc_read_done, buf, priority, flags, zb);
+		if (l2dev != NULL) {
+			l2arc_read_callback_t *cb;
+
+			/*
+			 * Read from the L2ARC device.  The physical read
+			 * is issued under a null zio so that, should it
+			 * fail, l2arc_read_done() can reissue the logical
+			 * read beneath the same parent and our caller
+			 * waits for it as usual.
+			 */
+			cb = kmem_zalloc(sizeof (l2arc_read_callback_t),
+			    KM_SLEEP);
+			cb->l2rcb_buf = buf;
+			cb->l2rcb_spa = spa;
+			cb->l2rcb_bp = *bp;
+			cb->l2rcb_zb = *zb;
+			cb->l2rcb_priority = priority;
+			cb->l2rcb_flags = flags;
+			cb->l2rcb_dev = l2dev;
+			cb->l2rcb_cksum = l2cksum;
+
+			rzio = zio_null(pio, spa, NULL, NULL, flags);
+			zio_nowait(zio_read_phys(rzio, l2dev->l2ad_vdev,
+			    l2daddr, size, buf->b_data, ZIO_CHECKSUM_OFF,
+			    l2arc_read_done, cb, priority,
+			    flags | ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+			    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY));
+		} else {
+			if (l2arc_ndev != 0)
+				ARCSTAT_BUMP(arcstat_l2_misses);
+			rzio = zio_read(pio, spa, bp, buf->b_data, size,
+			    arc_read_done, buf, priority, flags, zb);
+		}
 
 		if (*arc_flags & ARC_WAIT)
 			return (zio_wait(rzio));
@@ -2450,15 +2954,15 @@ arc_buf_evict(arc_buf_t *buf)
 		evicted_state =
 		    (old_state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
 
-		mutex_enter(&old_state->arcs_mtx);
-		mutex_enter(&evicted_state->arcs_mtx);
+		mutex_enter(&HDR_SUBLIST(old_state, hdr)->asl_mtx);
+		mutex_enter(&HDR_SUBLIST(evicted_state, hdr)->asl_mtx);
 
 		arc_change_state(evicted_state, hdr, hash_lock);
 		ASSERT(HDR_IN_HASH_TABLE(hdr));
 		hdr->b_flags = ARC_IN_HASH_TABLE;
 
-		mutex_exit(&evicted_state->arcs_mtx);
-		mutex_exit(&old_state->arcs_mtx);
+		mutex_exit(&HDR_SUBLIST(evicted_state, hdr)->asl_mtx);
+		mutex_exit(&HDR_SUBLIST(old_state, hdr)->asl_mtx);
 	}
 	mutex_exit(hash_lock);
 
@@ -2816,6 +3320,46 @@ arc_tempreserve_space(uint64_t tempreserve)
 	return (0);
 }
 
+static void
+arc_state_init(arc_state_t *state)
+{
+	uint64_t idx;
+	arc_buf_contents_t type;
+
+	state->arcs_sublists = arc_zalloc_aligned(
+	    arc_sublist_count * sizeof (arc_sublist_pad_t), ARC_SUBLIST_PAD,
+	    &state->arcs_sublists_base);
+
+	for (idx = 0; idx < arc_sublist_count; idx++) {
+		arc_sublist_t *sl = ARC_SUBLIST(state, idx);
+
+		mutex_init(&sl->asl_mtx, NULL, MUTEX_DEFAULT, NULL);
+		for (type = ARC_BUFC_DATA; type < ARC_BUFC_NUMTYPES; type++)
+			list_create(&sl->asl_list[type],
+			    sizeof (arc_buf_hdr_t),
+			    offsetof(arc_buf_hdr_t, b_arc_node));
+	}
+}
+
+static void
+arc_state_fini(arc_state_t *state)
+{
+	uint64_t idx;
+	arc_buf_contents_t type;
+
+	for (idx = 0; idx < arc_sublist_count; idx++) {
+		arc_sublist_t *sl = ARC_SUBLIST(state, idx);
+
+		for (type = ARC_BUFC_DATA; type < ARC_BUFC_NUMTYPES; type++)
+			list_destroy(&sl->asl_list[type]);
+		mutex_destroy(&sl->asl_mtx);
+	}
+
+	arc_free_aligned(state->arcs_sublists_base,
+	    arc_sublist_count * sizeof (arc_sublist_pad_t), ARC_SUBLIST_PAD);
+	state->arcs_sublists = NULL;
+}
+
 void
 arc_init(void)
 {
@@ -2888,30 +3432,16 @@ arc_init(void)
 	arc_mru_ghost = &ARC_mru_ghost;
 	arc_mfu = &ARC_mfu;
 	arc_mfu_ghost = &ARC_mfu_ghost;
+	arc_l2c_only = &ARC_l2c_only;
 	arc_size = 0;
 
-	mutex_init(&arc_anon->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mru->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mru_ghost->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mfu->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mfu_ghost->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-
-	list_create(&arc_mru->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru_ghost->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru_ghost->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu_ghost->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
+	arc_sublist_count = (zfs_arc_sublists > 0) ?
+	    zfs_arc_sublists : MAX(max_ncpus, 1);
+	arc_state_init(arc_mru);
+	arc_state_init(arc_mru_ghost);
+	arc_state_init(arc_mfu);
+	arc_state_init(arc_mfu_ghost);
+	arc_state_init(arc_l2c_only);
 
 	buf_init();
 
@@ -2931,6 +3461,8 @@ arc_init(void)
 	(void) thread_create(NULL, 0, arc_reclaim_thread, NULL, 0, &p0,
 	    TS_RUN, minclsyspri);
 
+	l2arc_init();
+
 	arc_dead = FALSE;
 }
 
@@ -2943,6 +3475,8 @@ arc_fini(void)
 		cv_wait(&arc_reclaim_thr_cv, &arc_reclaim_thr_lock);
 	mutex_exit(&arc_reclaim_thr_lock);
 
+	l2arc_fini();
+
 	arc_flush();
 
 	arc_dead = TRUE;
@@ -2956,32 +3490,632 @@ arc_fini(void)
 	mutex_destroy(&arc_reclaim_thr_lock);
 	cv_destroy(&arc_reclaim_thr_cv);
 
-	list_destroy(&arc_mru->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mru_ghost->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mfu->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mfu_ghost->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mru->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mru_ghost->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mfu->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA]);
-
-	mutex_destroy(&arc_anon->arcs_mtx);
-	mutex_destroy(&arc_mru->arcs_mtx);
-	mutex_destroy(&arc_mru_ghost->arcs_mtx);
-	mutex_destroy(&arc_mfu->arcs_mtx);
-	mutex_destroy(&arc_mfu_ghost->arcs_mtx);
+	arc_state_fini(arc_mru);
+	arc_state_fini(arc_mru_ghost);
+	arc_state_fini(arc_mfu);
+	arc_state_fini(arc_mfu_ghost);
+	arc_state_fini(arc_l2c_only);
 
 	buf_fini();
 }
 
 #ifdef __APPLE__
 void
-arc_get_stats(zfs_memory_stats_t *stats)
+arc_get_stats(zfs_memory_stats_t *stats, zfs_hash_stats_t *hash_stats)
 {
 	stats->current = arc_size;
 	stats->target = arc_c;
 	stats->highest = arc_c_peak;
 	stats->maximum = arc_c_max;
+
+	buf_hash_update_stats();
+	hash_stats->buckets = ARCSTAT(arcstat_hash_buckets);
+	hash_stats->elements = ARCSTAT(arcstat_hash_elements);
+	hash_stats->locks = ARCSTAT(arcstat_hash_locks);
+	hash_stats->resizes = ARCSTAT(arcstat_hash_resizes);
+	hash_stats->contended = ARCSTAT(arcstat_hash_lock_contended);
+	hash_stats->contended_max = ARCSTAT(arcstat_hash_lock_contended_max);
 }
 #endif /* __APPLE__ */
 
+
+/*
+ * Level 2 ARC
+ *
+ * The level 2 ARC (L2ARC) is a cache layer in-between main memory and disk.
+ * It uses dedicated storage devices to hold cached data, which are populated
+ * using large infrequent writes.  The main role of this cache is to boost
+ * the performance of random read workloads.  The intended L2ARC devices
+ * include short-stroked disks, solid state disks, and other media with
+ * substantially faster read latency than disk.
+ *
+ *                 +-----------------------+
+ *                 |         ARC           |
+ *                 +-----------------------+
+ *                    |         ^     ^
+ *                    |         |     |
+ *      l2arc_feed()  |         |     |  l2arc_read_done()
+ *                    |         |     |
+ *                    V         |     |
+ *               +---------------+    |
+ *               |     L2ARC     |----+
+ *               +---------------+
+ *                   |    ^
+ *          l2arc_   |    |
+ *          write()  |    | l2arc read
+ *                   V    |
+ *                 +-------+      +-----------------------+
+ *                 | vdev  |      |      pool vdevs       |
+ *                 | cache |      |                       |
+ *                 +-------+      +-----------------------+
+ *
+ * A feed thread wakes up every l2arc_feed_secs, picks the next cache
+ * device in turn and copies buffers from the tails of the MFU and MRU
+ * lists -- the buffers most likely to be evicted soon -- onto it.  Only
+ * up to l2arc_headroom times l2arc_write_max bytes of each list tail are
+ * scanned, and at most l2arc_write_max bytes are written per feed.  The
+ * device is written like a ring: the write hand sweeps from the start of
+ * the device to the end, evicting whatever it passes over, and then wraps.
+ *
+ * The feed never holds a list lock across I/O.  It collects candidate
+ * buffer identities while holding only the list lock, copies the data
+ * out under each buffer's hash lock, writes the copies with no ARC locks
+ * held, and then attaches an l2arc_buf_hdr_t to every header that is
+ * still present.  A fletcher-4 checksum of the copy is kept in that
+ * header; reads from the cache device are verified against it, and any
+ * failure -- I/O error or checksum mismatch -- simply reissues the read
+ * to the pool.  The cache contents are therefore disposable and are not
+ * kept across an export or reboot.
+ *
+ * When a buffer with an L2ARC copy is evicted from the ghost lists, its
+ * header moves to the l2c_only state rather than being destroyed, so that
+ * a later arc_read() can still find the copy.  Such headers are destroyed
+ * when the write hand passes over their copy.
+ *
+ * Cache devices are held by the feed thread and by every read in flight
+ * (l2ad_inflight), so l2arc_remove_vdev() can wait for them to drain
+ * before tearing the device down.
+ */
+
+static void
+l2arc_dev_rele(l2arc_dev_t *dev)
+{
+	mutex_enter(&dev->l2ad_mtx);
+	ASSERT(dev->l2ad_inflight > 0);
+	if (--dev->l2ad_inflight == 0)
+		cv_broadcast(&dev->l2ad_cv);
+	mutex_exit(&dev->l2ad_mtx);
+}
+
+static void
+l2arc_dev_wait(l2arc_dev_t *dev)
+{
+	mutex_enter(&dev->l2ad_mtx);
+	while (dev->l2ad_inflight != 0)
+		cv_wait(&dev->l2ad_cv, &dev->l2ad_mtx);
+	mutex_exit(&dev->l2ad_mtx);
+}
+
+/*
+ * Cycle through L2ARC devices.  The device returned is held, and must
+ * be released with l2arc_dev_rele().
+ */
+static l2arc_dev_t *
+l2arc_dev_get_next(void)
+{
+	l2arc_dev_t *next;
+
+	mutex_enter(&l2arc_dev_mtx);
+	if (l2arc_ndev == 0) {
+		mutex_exit(&l2arc_dev_mtx);
+		return (NULL);
+	}
+
+	if (l2arc_dev_last == NULL ||
+	    (next = list_next(l2arc_dev_list, l2arc_dev_last)) == NULL)
+		next = list_head(l2arc_dev_list);
+	l2arc_dev_last = next;
+
+	mutex_enter(&next->l2ad_mtx);
+	next->l2ad_inflight++;
+	mutex_exit(&next->l2ad_mtx);
+	mutex_exit(&l2arc_dev_mtx);
+
+	return (next);
+}
+
+/*
+ * Remove the L2ARC copy of this buffer.  The hash lock must be held.
+ */
+static void
+l2arc_hdr_drop(arc_buf_hdr_t *ab)
+{
+	l2arc_buf_hdr_t *l2hdr;
+
+	ASSERT(MUTEX_HELD(HDR_LOCK(ab)));
+
+	mutex_enter(&l2arc_buflist_mtx);
+	l2hdr = ab->b_l2hdr;
+	if (l2hdr != NULL) {
+		list_remove(&l2hdr->b_dev->l2ad_buflist, ab);
+		ab->b_l2hdr = NULL;
+		ARCSTAT_INCR(arcstat_l2_size, -ab->b_size);
+		ARCSTAT_INCR(arcstat_l2_hdr_size, -sizeof (l2arc_buf_hdr_t));
+	}
+	mutex_exit(&l2arc_buflist_mtx);
+
+	if (l2hdr != NULL)
+		kmem_free(l2hdr, sizeof (l2arc_buf_hdr_t));
+}
+
+/*
+ * Evict buffers from the device write hand to the distance specified in
+ * bytes, or everything on the device if "all" is set.  Headers that only
+ * described the L2ARC copy are destroyed.
+ */
+static void
+l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
+{
+	list_t *buflist = &dev->l2ad_buflist;
+	l2arc_buf_hdr_t *l2hdr;
+	arc_buf_hdr_t *ab;
+	kmutex_t *hash_lock;
+	uint64_t taddr = dev->l2ad_hand + distance;
+
+top:
+	mutex_enter(&l2arc_buflist_mtx);
+	while ((ab = list_tail(buflist)) != NULL) {
+		l2hdr = ab->b_l2hdr;
+		ASSERT(l2hdr != NULL && l2hdr->b_dev == dev);
+
+		/*
+		 * The buflist is in write order, so once we see a buffer
+		 * outside of the range we are done.
+		 */
+		if (!all && (l2hdr->b_daddr < dev->l2ad_hand ||
+		    l2hdr->b_daddr >= taddr))
+			break;
+
+		hash_lock = HDR_LOCK(ab);
+		if (!mutex_tryenter(hash_lock)) {
+			/*
+			 * Missed the hash lock.  Wait for its holder to
+			 * finish, then retry from the tail.
+			 */
+			ARCSTAT_BUMP(arcstat_l2_evict_lock_retry);
+			mutex_exit(&l2arc_buflist_mtx);
+			mutex_enter(hash_lock);
+			mutex_exit(hash_lock);
+			goto top;
+		}
+
+		list_remove(buflist, ab);
+		ab->b_l2hdr = NULL;
+		mutex_exit(&l2arc_buflist_mtx);
+
+		ARCSTAT_INCR(arcstat_l2_size, -ab->b_size);
+		ARCSTAT_INCR(arcstat_l2_hdr_size, -sizeof (l2arc_buf_hdr_t));
+		ARCSTAT_BUMP(arcstat_l2_evicts);
+		kmem_free(l2hdr, sizeof (l2arc_buf_hdr_t));
+
+		if (ab->b_state == arc_l2c_only) {
+			/*
+			 * This header only existed for its L2ARC copy.
+			 */
+			ASSERT(!HDR_IO_IN_PROGRESS(ab));
+			arc_change_state(arc_anon, ab, hash_lock);
+			mutex_exit(hash_lock);
+			arc_hdr_destroy(ab);
+		} else {
+			mutex_exit(hash_lock);
+		}
+		goto top;
+	}
+	mutex_exit(&l2arc_buflist_mtx);
+}
+
+static void
+l2arc_write_done(zio_t *zio)
+{
+	l2arc_write_t *wp = zio->io_private;
+
+	wp->l2w_error = zio->io_error;
+}
+
+/*
+ * Scan one list tail for buffers worth caching, recording their identity
+ * in wl.  Only the list lock is held; l2arc_feed() revalidates every
+ * candidate under its hash lock.
+ */
+static int
+l2arc_feed_scan(arc_state_t *state, arc_buf_contents_t type, uint64_t ashift,
+    uint64_t headroom, uint64_t target, uint64_t *write_sz,
+    l2arc_write_t *wl, int nbufs)
+{
+	arc_sublist_t *sl;
+	arc_buf_hdr_t *ab;
+	list_t *list;
+	uint64_t n, passed, asize;
+
+	for (n = 0; n < arc_sublist_count; n++) {
+		sl = ARC_SUBLIST(state, n);
+		list = &sl->asl_list[type];
+		passed = 0;
+
+		mutex_enter(&sl->asl_mtx);
+		for (ab = list_tail(list); ab; ab = list_prev(list, ab)) {
+			passed += ab->b_size;
+			if (passed > headroom)
+				break;
+			if (ab->b_l2hdr != NULL || ab->b_datacnt == 0 ||
+			    HDR_IO_IN_PROGRESS(ab))
+				continue;
+
+			asize = P2ROUNDUP(ab->b_size, 1ULL << ashift);
+			if (*write_sz + asize > target ||
+			    nbufs == L2ARC_FEED_BUFS) {
+				mutex_exit(&sl->asl_mtx);
+				return (nbufs);
+			}
+
+			wl[nbufs].l2w_dva = ab->b_dva;
+			wl[nbufs].l2w_birth = ab->b_birth;
+			wl[nbufs].l2w_size = ab->b_size;
+			wl[nbufs].l2w_data = NULL;
+			wl[nbufs].l2w_error = 0;
+			nbufs++;
+			*write_sz += asize;
+		}
+		mutex_exit(&sl->asl_mtx);
+	}
+
+	return (nbufs);
+}
+
+/*
+ * Copy buffers from the ARC list tails to the device write hand.
+ */
+static void
+l2arc_feed(l2arc_dev_t *dev)
+{
+	spa_t *spa = dev->l2ad_spa;
+	vdev_t *vd = dev->l2ad_vdev;
+	l2arc_write_t *wl, *wp;
+	l2arc_buf_hdr_t *l2hdr;
+	arc_buf_hdr_t *hdr;
+	arc_buf_t *buf;
+	kmutex_t *hash_lock;
+	uint64_t target, headroom, write_sz, daddr;
+	int nbufs, i;
+	zio_t *pio;
+
+	if (vdev_is_dead(vd))
+		return;
+
+	/*
+	 * Make room at the write hand, wrapping around to the start of
+	 * the device when the end is reached.
+	 */
+	target = MIN(l2arc_write_max, dev->l2ad_end - dev->l2ad_start);
+	if (dev->l2ad_hand + target > dev->l2ad_end) {
+		l2arc_evict(dev, dev->l2ad_end - dev->l2ad_hand, B_FALSE);
+		dev->l2ad_hand = dev->l2ad_start;
+	}
+	l2arc_evict(dev, target, B_FALSE);
+
+	/*
+	 * Metadata first, then data; MFU before MRU within each.
+	 */
+	headroom = MAX(target * l2arc_headroom / arc_sublist_count,
+	    SPA_MAXBLOCKSIZE);
+	wl = kmem_alloc(L2ARC_FEED_BUFS * sizeof (l2arc_write_t), KM_SLEEP);
+	write_sz = 0;
+	nbufs = l2arc_feed_scan(arc_mfu, ARC_BUFC_METADATA, vd->vdev_ashift,
+	    headroom, target, &write_sz, wl, 0);
+	nbufs = l2arc_feed_scan(arc_mru, ARC_BUFC_METADATA, vd->vdev_ashift,
+	    headroom, target, &write_sz, wl, nbufs);
+	nbufs = l2arc_feed_scan(arc_mfu, ARC_BUFC_DATA, vd->vdev_ashift,
+	    headroom, target, &write_sz, wl, nbufs);
+	nbufs = l2arc_feed_scan(arc_mru, ARC_BUFC_DATA, vd->vdev_ashift,
+	    headroom, target, &write_sz, wl, nbufs);
+
+	/*
+	 * Copy out whatever is still cached, and write it.
+	 */
+	pio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	daddr = dev->l2ad_hand;
+	for (i = 0; i < nbufs; i++) {
+		wp = &wl[i];
+		wp->l2w_data = zio_data_buf_alloc(wp->l2w_size);
+
+		hdr = buf_hash_find(spa, &wp->l2w_dva, wp->l2w_birth,
+		    &hash_lock);
+		if (hdr == NULL || hdr->b_datacnt == 0 ||
+		    HDR_IO_IN_PROGRESS(hdr) || hdr->b_l2hdr != NULL ||
+		    hdr->b_size != wp->l2w_size ||
+		    (hdr->b_state != arc_mru && hdr->b_state != arc_mfu)) {
+			if (hdr != NULL)
+				mutex_exit(hash_lock);
+			zio_data_buf_free(wp->l2w_data, wp->l2w_size);
+			wp->l2w_data = NULL;
+			continue;
+		}
+		buf = hdr->b_buf;
+		while (buf->b_data == NULL) {
+			buf = buf->b_next;
+			ASSERT(buf);
+		}
+		bcopy(buf->b_data, wp->l2w_data, wp->l2w_size);
+		mutex_exit(hash_lock);
+
+		fletcher_4_native(wp->l2w_data, wp->l2w_size, &wp->l2w_cksum);
+		wp->l2w_daddr = daddr;
+		daddr += P2ROUNDUP(wp->l2w_size, 1ULL << vd->vdev_ashift);
+		ASSERT3U(daddr, <=, dev->l2ad_end);
+
+		zio_nowait(zio_write_phys(pio, vd, wp->l2w_daddr,
+		    wp->l2w_size, wp->l2w_data, ZIO_CHECKSUM_OFF,
+		    l2arc_write_done, wp, ZIO_PRIORITY_ASYNC_WRITE,
+		    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
+		    ZIO_FLAG_DONT_RETRY));
+		ARCSTAT_BUMP(arcstat_l2_writes_sent);
+		ARCSTAT_INCR(arcstat_l2_write_bytes, wp->l2w_size);
+	}
+	(void) zio_wait(pio);
+	dev->l2ad_hand = daddr;
+	ARCSTAT_BUMP(arcstat_l2_feeds);
+
+	/*
+	 * Attach the copies that made it to the buffers that are still
+	 * around.  The buflist is kept in write order.
+	 */
+	for (i = 0; i < nbufs; i++) {
+		wp = &wl[i];
+		if (wp->l2w_data == NULL)
+			continue;
+		if (wp->l2w_error != 0) {
+			ARCSTAT_BUMP(arcstat_l2_writes_error);
+			zio_data_buf_free(wp->l2w_data, wp->l2w_size);
+			continue;
+		}
+
+		l2hdr = kmem_alloc(sizeof (l2arc_buf_hdr_t), KM_SLEEP);
+		l2hdr->b_dev = dev;
+		l2hdr->b_daddr = wp->l2w_daddr;
+		l2hdr->b_cksum = wp->l2w_cksum;
+
+		hdr = buf_hash_find(spa, &wp->l2w_dva, wp->l2w_birth,
+		    &hash_lock);
+		if (hdr != NULL) {
+			if (hdr->b_l2hdr == NULL && !HDR_IO_IN_PROGRESS(hdr) &&
+			    hdr->b_size == wp->l2w_size) {
+				mutex_enter(&l2arc_buflist_mtx);
+				hdr->b_l2hdr = l2hdr;
+				list_insert_head(&dev->l2ad_buflist, hdr);
+				mutex_exit(&l2arc_buflist_mtx);
+				ARCSTAT_INCR(arcstat_l2_size, hdr->b_size);
+				ARCSTAT_INCR(arcstat_l2_hdr_size,
+				    sizeof (l2arc_buf_hdr_t));
+				l2hdr = NULL;
+			}
+			mutex_exit(hash_lock);
+		}
+		if (l2hdr != NULL)
+			kmem_free(l2hdr, sizeof (l2arc_buf_hdr_t));
+		zio_data_buf_free(wp->l2w_data, wp->l2w_size);
+	}
+
+	kmem_free(wl, L2ARC_FEED_BUFS * sizeof (l2arc_write_t));
+}
+
+/*
+ * A read from an L2ARC device has completed.  Verify the copy, and either
+ * hand it to arc_read_done() or reissue the read to the pool.
+ */
+static void
+l2arc_read_done(zio_t *zio)
+{
+	l2arc_read_callback_t *cb = zio->io_private;
+	arc_buf_t *buf = cb->l2rcb_buf;
+	arc_buf_hdr_t *hdr = buf->b_hdr;
+	kmutex_t *hash_lock;
+	zio_cksum_t zc;
+	int error = zio->io_error;
+
+	if (error == 0) {
+		fletcher_4_native(buf->b_data, zio->io_size, &zc);
+		if (!ZIO_CHECKSUM_EQUAL(zc, cb->l2rcb_cksum)) {
+			ARCSTAT_BUMP(arcstat_l2_cksum_bad);
+			error = ECKSUM;
+		}
+	} else {
+		ARCSTAT_BUMP(arcstat_l2_io_error);
+	}
+	l2arc_dev_rele(cb->l2rcb_dev);
+
+	if (error == 0) {
+		ARCSTAT_BUMP(arcstat_l2_hits);
+		ARCSTAT_INCR(arcstat_l2_read_bytes, zio->io_size);
+
+		/*
+		 * The cached copy was taken from the ARC, so it is already
+		 * in host byte order.
+		 */
+		zio->io_bp_copy = cb->l2rcb_bp;
+		BP_SET_BYTEORDER(&zio->io_bp_copy, ZFS_HOST_BYTEORDER);
+		zio->io_private = buf;
+		arc_read_done(zio);
+	} else {
+		ARCSTAT_BUMP(arcstat_l2_misses);
+
+		hash_lock = HDR_LOCK(hdr);
+		mutex_enter(hash_lock);
+		if (hdr->b_l2hdr != NULL)
+			l2arc_hdr_drop(hdr);
+		mutex_exit(hash_lock);
+
+		/*
+		 * Our parent is the null zio set up by arc_read(), so the
+		 * reissued read completes before our caller sees it done.
+		 */
+		zio_nowait(zio_read(zio->io_parent, cb->l2rcb_spa,
+		    &cb->l2rcb_bp, buf->b_data, zio->io_size, arc_read_done,
+		    buf, cb->l2rcb_priority, cb->l2rcb_flags, &cb->l2rcb_zb));
+	}
+
+	kmem_free(cb, sizeof (l2arc_read_callback_t));
+}
+
+/*
+ * This thread feeds the L2ARC devices at regular intervals.
+ */
+static void
+l2arc_feed_thread(void)
+{
+	callb_cpr_t cpr;
+	l2arc_dev_t *dev;
+
+	CALLB_CPR_INIT(&cpr, &l2arc_feed_thr_lock, callb_generic_cpr, FTAG);
+
+	mutex_enter(&l2arc_feed_thr_lock);
+
+	while (l2arc_thread_exit == 0) {
+		CALLB_CPR_SAFE_BEGIN(&cpr);
+		(void) cv_timedwait(&l2arc_feed_thr_cv, &l2arc_feed_thr_lock,
+		    lbolt + (hz * l2arc_feed_secs));
+		CALLB_CPR_SAFE_END(&cpr, &l2arc_feed_thr_lock);
+
+		/*
+		 * Leave memory to the reclaim thread when it is short, and
+		 * don't write to anything while pools are read-only.
+		 */
+		if (l2arc_thread_exit != 0 || arc_reclaim_needed() ||
+		    !(spa_mode & FWRITE))
+			continue;
+
+		if ((dev = l2arc_dev_get_next()) == NULL)
+			continue;
+
+		l2arc_feed(dev);
+		l2arc_dev_rele(dev);
+	}
+
+	l2arc_thread_exit = 0;
+	cv_broadcast(&l2arc_feed_thr_cv);
+	CALLB_CPR_EXIT(&cpr);		/* drops l2arc_feed_thr_lock */
+	thread_exit();
+}
+
+/*
+ * Add a vdev for use by the L2ARC.  By this point the spa has already
+ * validated the vdev and opened it.
+ */
+void
+l2arc_add_vdev(spa_t *spa, vdev_t *vd)
+{
+	l2arc_dev_t *adddev;
+
+	ASSERT(vd->vdev_isl2cache);
+
+	/* too small to hold even one buffer */
+	if (vd->vdev_psize < VDEV_LABEL_START_SIZE + VDEV_LABEL_END_SIZE +
+	    SPA_MAXBLOCKSIZE)
+		return;
+
+	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
+	adddev->l2ad_spa = spa;
+	adddev->l2ad_vdev = vd;
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	adddev->l2ad_end = vd->vdev_psize - VDEV_LABEL_END_SIZE;
+	adddev->l2ad_hand = adddev->l2ad_start;
+	mutex_init(&adddev->l2ad_mtx, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&adddev->l2ad_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&adddev->l2ad_buflist, sizeof (arc_buf_hdr_t),
+	    offsetof(arc_buf_hdr_t, b_l2node));
+
+	mutex_enter(&l2arc_dev_mtx);
+	list_insert_head(l2arc_dev_list, adddev);
+	l2arc_ndev++;
+	mutex_exit(&l2arc_dev_mtx);
+}
+
+/*
+ * Remove a vdev from the L2ARC, dropping everything cached on it.  The
+ * vdev is only compared, never dereferenced, so this may be called for a
+ * vdev that was never added.
+ */
+void
+l2arc_remove_vdev(vdev_t *vd)
+{
+	l2arc_dev_t *dev, *remdev = NULL;
+
+	mutex_enter(&l2arc_dev_mtx);
+	for (dev = list_head(l2arc_dev_list); dev != NULL;
+	    dev = list_next(l2arc_dev_list, dev)) {
+		if (dev->l2ad_vdev == vd) {
+			remdev = dev;
+			break;
+		}
+	}
+	if (remdev == NULL) {
+		mutex_exit(&l2arc_dev_mtx);
+		return;
+	}
+	list_remove(l2arc_dev_list, remdev);
+	if (l2arc_dev_last == remdev)
+		l2arc_dev_last = NULL;
+	l2arc_ndev--;
+	mutex_exit(&l2arc_dev_mtx);
+
+	/*
+	 * Wait for a feed in progress, drop the cached copies so no new
+	 * reads can start, then wait for the reads already issued.
+	 */
+	l2arc_dev_wait(remdev);
+	l2arc_evict(remdev, 0, B_TRUE);
+	l2arc_dev_wait(remdev);
+
+	list_destroy(&remdev->l2ad_buflist);
+	mutex_destroy(&remdev->l2ad_mtx);
+	cv_destroy(&remdev->l2ad_cv);
+	kmem_free(remdev, sizeof (l2arc_dev_t));
+}
+
+static void
+l2arc_init(void)
+{
+	l2arc_thread_exit = 0;
+	l2arc_ndev = 0;
+	l2arc_dev_last = NULL;
+
+	mutex_init(&l2arc_feed_thr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&l2arc_buflist_mtx, NULL, MUTEX_DEFAULT, NULL);
+
+	l2arc_dev_list = &L2ARC_dev_list;
+	list_create(l2arc_dev_list, sizeof (l2arc_dev_t),
+	    offsetof(l2arc_dev_t, l2ad_node));
+
+	(void) thread_create(NULL, 0, l2arc_feed_thread, NULL, 0, &p0,
+	    TS_RUN, minclsyspri);
+}
+
+static void
+l2arc_fini(void)
+{
+	mutex_enter(&l2arc_feed_thr_lock);
+	l2arc_thread_exit = 1;
+	cv_signal(&l2arc_feed_thr_cv);
+	while (l2arc_thread_exit != 0)
+		cv_wait(&l2arc_feed_thr_cv, &l2arc_feed_thr_lock);
+	mutex_exit(&l2arc_feed_thr_lock);
+
+	ASSERT(l2arc_ndev == 0);
+	list_destroy(l2arc_dev_list);
+
+	mutex_destroy(&l2arc_feed_thr_lock);
+	cv_destroy(&l2arc_feed_thr_cv);
+	mutex_destroy(&l2arc_dev_mtx);
+	mutex_destroy(&l2arc_buflist_mtx);
+}
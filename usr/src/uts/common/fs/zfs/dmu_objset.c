@@ -738,6 +738,88 @@ dmu_objset_sync_dnodes(list_t *list, dmu_tx_t *tx)
 	}
 }
 
+/*
+ * The dirty dnodes of a dataset are split into up to one list per
+ * dp_sync_taskq thread and synced concurrently.  Each dnode_sync() only
+ * writes into its own dnode and dbufs, and hangs its writes off its own
+ * dnode block's write; the dataset and space accounting done as blocks
+ * are born and killed is already safe against the zio threads.  The last
+ * list to finish issues the dnode blocks and the objset's root block.
+ */
+typedef struct dmu_objset_sync_list {
+	list_t		osl_dnodes;
+	struct dmu_objset_sync_arg *osl_osa;
+} dmu_objset_sync_list_t;
+
+typedef struct dmu_objset_sync_arg {
+	objset_impl_t	*osa_os;
+	zio_t		*osa_zio;	/* root block write */
+	dmu_tx_t	*osa_tx;
+	uint64_t	osa_remaining;	/* lists still being synced */
+	int		osa_nlists;
+	dmu_objset_sync_list_t *osa_lists;
+} dmu_objset_sync_arg_t;
+
+/*
+ * Issue the writes of the dnode blocks and then of the root block, once
+ * all of the dnodes have been synced.
+ */
+static void
+dmu_objset_sync_done(objset_impl_t *os, zio_t *zio, dmu_tx_t *tx)
+{
+	list_t *list;
+	dbuf_dirty_record_t *dr;
+
+	list = &os->os_meta_dnode->dn_dirty_records[tx->tx_txg & TXG_MASK];
+	while (dr = list_head(list)) {
+		ASSERT(dr->dr_dbuf->db_level == 0);
+		list_remove(list, dr);
+		if (dr->dr_zio)
+			zio_nowait(dr->dr_zio);
+	}
+	/*
+	 * Free intent log blocks up to this tx.
+	 */
+	zil_sync(os->os_zil, tx);
+	zio_nowait(zio);
+}
+
+static void
+dmu_objset_sync_dnodes_task(void *arg)
+{
+	dmu_objset_sync_list_t *osl = arg;
+	dmu_objset_sync_arg_t *osa = osl->osl_osa;
+	int i;
+
+	dmu_objset_sync_dnodes(&osl->osl_dnodes, osa->osa_tx);
+
+	if (atomic_add_64_nv(&osa->osa_remaining, -1) != 0)
+		return;
+
+	dmu_objset_sync_done(osa->osa_os, osa->osa_zio, osa->osa_tx);
+
+	for (i = 0; i < osa->osa_nlists; i++)
+		list_destroy(&osa->osa_lists[i].osl_dnodes);
+	kmem_free(osa->osa_lists,
+	    osa->osa_nlists * sizeof (dmu_objset_sync_list_t));
+	kmem_free(osa, sizeof (dmu_objset_sync_arg_t));
+}
+
+/*
+ * Deal the dnodes on 'list' out to the sync lists, round robin.
+ */
+static void
+dmu_objset_sync_split(dmu_objset_sync_arg_t *osa, list_t *list, int *next)
+{
+	dnode_t *dn;
+
+	while (dn = list_head(list)) {
+		list_remove(list, dn);
+		list_insert_tail(&osa->osa_lists[*next].osl_dnodes, dn);
+		*next = (*next + 1) % osa->osa_nlists;
+	}
+}
+
 /* ARGSUSED */
 static void
 ready(zio_t *zio, arc_buf_t *abuf, void *arg)
@@ -784,8 +866,9 @@ dmu_objset_sync(objset_impl_t *os, zio_t *pio, dmu_tx_t *tx)
 	int txgoff;
 	zbookmark_t zb;
 	zio_t *zio;
-	list_t *list;
-	dbuf_dirty_record_t *dr;
+	dsl_pool_t *dp = spa_get_dsl(os->os_spa);
+	dmu_objset_sync_arg_t *osa;
+	int i, next, busy;
 
 	dprintf_ds(os->os_dsl_dataset, "txg=%llu\n", tx->tx_txg);
 
@@ -828,21 +911,48 @@ dmu_objset_sync(objset_impl_t *os, zio_t *pio, dmu_tx_t *tx)
 
 	txgoff = tx->tx_txg & TXG_MASK;
 
-	dmu_objset_sync_dnodes(&os->os_free_dnodes[txgoff], tx);
-	dmu_objset_sync_dnodes(&os->os_dirty_dnodes[txgoff], tx);
+	/*
+	 * The MOS is synced in the txg sync thread: it is small, and
+	 * dsl_pool_sync() waits for it on its own, after the datasets.
+	 */
+	if (dp->dp_sync_taskq == NULL || os->os_dsl_dataset == NULL ||
+	    (list_is_empty(&os->os_free_dnodes[txgoff]) &&
+	    list_is_empty(&os->os_dirty_dnodes[txgoff]))) {
+		dmu_objset_sync_dnodes(&os->os_free_dnodes[txgoff], tx);
+		dmu_objset_sync_dnodes(&os->os_dirty_dnodes[txgoff], tx);
+		dmu_objset_sync_done(os, zio, tx);
+		return;
+	}
 
-	list = &os->os_meta_dnode->dn_dirty_records[txgoff];
-	while (dr = list_head(list)) {
-		ASSERT(dr->dr_dbuf->db_level == 0);
-		list_remove(list, dr);
-		if (dr->dr_zio)
-			zio_nowait(dr->dr_zio);
+	osa = kmem_alloc(sizeof (dmu_objset_sync_arg_t), KM_SLEEP);
+	osa->osa_os = os;
+	osa->osa_zio = zio;
+	osa->osa_tx = tx;
+	osa->osa_nlists = dp->dp_sync_threads;
+	osa->osa_lists = kmem_alloc(osa->osa_nlists *
+	    sizeof (dmu_objset_sync_list_t), KM_SLEEP);
+	for (i = 0; i < osa->osa_nlists; i++) {
+		list_create(&osa->osa_lists[i].osl_dnodes, sizeof (dnode_t),
+		    offsetof(dnode_t, dn_dirty_link[txgoff]));
+		osa->osa_lists[i].osl_osa = osa;
 	}
+
+	next = 0;
+	dmu_objset_sync_split(osa, &os->os_free_dnodes[txgoff], &next);
+	dmu_objset_sync_split(osa, &os->os_dirty_dnodes[txgoff], &next);
+
 	/*
-	 * Free intent log blocks up to this tx.
+	 * With fewer dnodes than lists, only the first few have any.
 	 */
-	zil_sync(os->os_zil, tx);
-	zio_nowait(zio);
+	for (busy = 0; busy < osa->osa_nlists; busy++) {
+		if (list_is_empty(&osa->osa_lists[busy].osl_dnodes))
+			break;
+	}
+	osa->osa_remaining = busy;
+	for (i = 0; i < busy; i++) {
+		(void) taskq_dispatch(dp->dp_sync_taskq,
+		    dmu_objset_sync_dnodes_task, &osa->osa_lists[i], TQ_SLEEP);
+	}
 }
 
 void
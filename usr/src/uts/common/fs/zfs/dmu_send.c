@@ -43,14 +43,44 @@
 #include <sys/zap.h>
 #include <sys/zio_checksum.h>
 
+/*
+ * A send is pipelined unless zfs_send_queue_max is zero.  The traversal
+ * calls backup_cb(), which turns each block into stream records and
+ * appends them to a queue.  For a data block, it queues the record first
+ * and then starts an asynchronous ARC read of the data.  backup_writer()
+ * takes the records off the queue in order, waits for each one's data,
+ * and writes it to the output vnode.  At most zfs_send_queue_max bytes
+ * of records are queued, which bounds both the memory used and the
+ * number of reads in flight.
+ */
+uint64_t zfs_send_queue_max = 16ULL << 20;
+
 struct backuparg {
 	dmu_replay_record_t *drr;
 	vnode_t *vp;
 	objset_t *os;
 	zio_cksum_t zc;
 	int err;
+	int pipelined;
+	kmutex_t lock;
+	kcondvar_t cv;		/* queue or read state change */
+	list_t recs;		/* backup_rec_t, in stream order */
+	uint64_t queued;	/* bytes of records in recs */
+	int done;		/* no more records coming */
+	kthread_t *writer;	/* backup_writer() */
 };
 
+typedef struct backup_rec {
+	list_node_t br_node;
+	struct backuparg *br_ba;
+	dmu_replay_record_t br_drr;
+	void *br_data;		/* copy of the payload, if any */
+	int br_len;		/* payload length */
+	blkptr_t br_bp;		/* DRR_WRITE block being read */
+	arc_buf_t *br_abuf;	/* its data, once read */
+	int br_reading;		/* read still in flight */
+} backup_rec_t;
+
 static int
 dump_bytes(struct backuparg *ba, void *buf, int len)
 {
@@ -75,6 +105,119 @@ dump_bytes(struct backuparg *ba, void *buf, int len)
 	return (ba->err);
 }
 
+static backup_rec_t *
+backup_rec_alloc(struct backuparg *ba, void *data, int len)
+{
+	backup_rec_t *br = kmem_zalloc(sizeof (backup_rec_t), KM_SLEEP);
+
+	br->br_ba = ba;
+	br->br_drr = *ba->drr;
+	br->br_len = len;
+	if (data != NULL && len != 0) {
+		br->br_data = kmem_alloc(len, KM_SLEEP);
+		bcopy(data, br->br_data, len);
+	}
+
+	return (br);
+}
+
+static void
+backup_rec_free(backup_rec_t *br)
+{
+	if (br->br_data != NULL)
+		kmem_free(br->br_data, br->br_len);
+	if (br->br_abuf != NULL)
+		(void) arc_buf_remove_ref(br->br_abuf, &br->br_abuf);
+	kmem_free(br, sizeof (backup_rec_t));
+}
+
+/*
+ * Append a record to the queue, waiting for room.  Once the writer has
+ * failed, the record is dropped and EINTR returned to stop the traversal.
+ */
+static int
+backup_enqueue(struct backuparg *ba, backup_rec_t *br)
+{
+	uint64_t size = sizeof (dmu_replay_record_t) + br->br_len;
+
+	mutex_enter(&ba->lock);
+	while (ba->err == 0 && ba->queued != 0 &&
+	    ba->queued + size > zfs_send_queue_max)
+		cv_wait(&ba->cv, &ba->lock);
+	if (ba->err != 0) {
+		mutex_exit(&ba->lock);
+		backup_rec_free(br);
+		return (EINTR);
+	}
+	ba->queued += size;
+	list_insert_tail(&ba->recs, br);
+	cv_broadcast(&ba->cv);
+	mutex_exit(&ba->lock);
+
+	return (0);
+}
+
+static void
+backup_writer(struct backuparg *ba)
+{
+	backup_rec_t *br;
+	void *data;
+
+	mutex_enter(&ba->lock);
+	for (;;) {
+		while ((br = list_head(&ba->recs)) == NULL && !ba->done)
+			cv_wait(&ba->cv, &ba->lock);
+		if (br == NULL)
+			break;
+		while (br->br_reading)
+			cv_wait(&ba->cv, &ba->lock);
+		list_remove(&ba->recs, br);
+		mutex_exit(&ba->lock);
+
+		/*
+		 * After an error, just drain the queue.  A block that
+		 * couldn't be read is left out, as in the serial path.
+		 */
+		data = (br->br_abuf != NULL) ?
+		    br->br_abuf->b_data : br->br_data;
+		if (ba->err == 0 && (data != NULL || br->br_len == 0) &&
+		    dump_bytes(ba, &br->br_drr,
+		    sizeof (dmu_replay_record_t)) == 0 && br->br_len != 0)
+			(void) dump_bytes(ba, data, br->br_len);
+
+		mutex_enter(&ba->lock);
+		ba->queued -= sizeof (dmu_replay_record_t) + br->br_len;
+		cv_broadcast(&ba->cv);
+		mutex_exit(&ba->lock);
+
+		backup_rec_free(br);
+
+		mutex_enter(&ba->lock);
+	}
+	ba->writer = NULL;
+	cv_broadcast(&ba->cv);
+	mutex_exit(&ba->lock);
+
+	thread_exit();
+}
+
+/*
+ * Write the record in ba->drr followed by 'len' bytes of 'data', or
+ * queue them for the writer.
+ */
+static int
+dump_record(struct backuparg *ba, void *data, int len)
+{
+	if (ba->pipelined)
+		return (backup_enqueue(ba, backup_rec_alloc(ba, data, len)));
+
+	if (dump_bytes(ba, ba->drr, sizeof (dmu_replay_record_t)))
+		return (EINTR);
+	if (len != 0 && dump_bytes(ba, data, len))
+		return (EINTR);
+	return (0);
+}
+
 static int
 dump_free(struct backuparg *ba, uint64_t object, uint64_t offset,
     uint64_t length)
@@ -86,9 +229,7 @@ dump_free(struct backuparg *ba, uint64_t object, uint64_t offset,
 	ba->drr->drr_u.drr_free.drr_offset = offset;
 	ba->drr->drr_u.drr_free.drr_length = length;
 
-	if (dump_bytes(ba, ba->drr, sizeof (dmu_replay_record_t)))
-		return (EINTR);
-	return (0);
+	return (dump_record(ba, NULL, 0));
 }
 
 static int
@@ -103,10 +244,56 @@ dump_data(struct backuparg *ba, dmu_object_type_t type,
 	ba->drr->drr_u.drr_write.drr_offset = offset;
 	ba->drr->drr_u.drr_write.drr_length = blksz;
 
-	if (dump_bytes(ba, ba->drr, sizeof (dmu_replay_record_t)))
-		return (EINTR);
-	if (dump_bytes(ba, data, blksz))
+	return (dump_record(ba, data, blksz));
+}
+
+static void
+backup_read_done(zio_t *zio, arc_buf_t *abuf, void *arg)
+{
+	backup_rec_t *br = arg;
+	struct backuparg *ba = br->br_ba;
+
+	if (zio != NULL && zio->io_error != 0) {
+		VERIFY(arc_buf_remove_ref(abuf, &abuf) == 1);
+		abuf = NULL;
+	}
+
+	mutex_enter(&ba->lock);
+	br->br_abuf = abuf;
+	br->br_reading = B_FALSE;
+	cv_broadcast(&ba->cv);
+	mutex_exit(&ba->lock);
+}
+
+/*
+ * Queue a DATA record for 'bp' and start reading the block into it.
+ */
+static int
+dump_data_async(struct backuparg *ba, spa_t *spa, blkptr_t *bp,
+    zbookmark_t *zb)
+{
+	dmu_object_type_t type = BP_GET_TYPE(bp);
+	int blksz = BP_GET_LSIZE(bp);
+	uint32_t aflags = ARC_NOWAIT;
+	backup_rec_t *br;
+
+	bzero(ba->drr, sizeof (dmu_replay_record_t));
+	ba->drr->drr_type = DRR_WRITE;
+	ba->drr->drr_u.drr_write.drr_object = zb->zb_object;
+	ba->drr->drr_u.drr_write.drr_type = type;
+	ba->drr->drr_u.drr_write.drr_offset = zb->zb_blkid * blksz;
+	ba->drr->drr_u.drr_write.drr_length = blksz;
+
+	br = backup_rec_alloc(ba, NULL, blksz);
+	br->br_bp = *bp;
+	br->br_reading = B_TRUE;
+	if (backup_enqueue(ba, br))
 		return (EINTR);
+
+	(void) arc_read(NULL, spa, &br->br_bp, dmu_ot[type].ot_byteswap,
+	    backup_read_done, br, ZIO_PRIORITY_ASYNC_READ,
+	    ZIO_FLAG_MUSTSUCCEED, &aflags, zb);
+
 	return (0);
 }
 
@@ -119,9 +306,7 @@ dump_freeobjects(struct backuparg *ba, uint64_t firstobj, uint64_t numobjs)
 	ba->drr->drr_u.drr_freeobjects.drr_firstobj = firstobj;
 	ba->drr->drr_u.drr_freeobjects.drr_numobjs = numobjs;
 
-	if (dump_bytes(ba, ba->drr, sizeof (dmu_replay_record_t)))
-		return (EINTR);
-	return (0);
+	return (dump_record(ba, NULL, 0));
 }
 
 static int
@@ -142,10 +327,7 @@ dump_dnode(struct backuparg *ba, uint64_t object, dnode_phys_t *dnp)
 	ba->drr->drr_u.drr_object.drr_checksum = dnp->dn_checksum;
 	ba->drr->drr_u.drr_object.drr_compress = dnp->dn_compress;
 
-	if (dump_bytes(ba, ba->drr, sizeof (dmu_replay_record_t)))
-		return (EINTR);
-
-	if (dump_bytes(ba, DN_BONUS(dnp), P2ROUNDUP(dnp->dn_bonuslen, 8)))
+	if (dump_record(ba, DN_BONUS(dnp), P2ROUNDUP(dnp->dn_bonuslen, 8)))
 		return (EINTR);
 
 	/* free anything past the end of the file */
@@ -176,7 +358,8 @@ backup_cb(traverse_blk_cache_t *bc, spa_t *spa, void *arg)
 	if (issig(JUSTLOOKING) && issig(FORREAL))
 		return (EINTR);
 
-	ASSERT(data || bp == NULL);
+	/* a pipelined send reads level 0 data blocks itself */
+	ASSERT(data || bp == NULL || (ba->pipelined && level == 0));
 
 	if (bp == NULL && object == 0) {
 		uint64_t span = BP_SPAN(bc->bc_dnode, level);
@@ -209,6 +392,8 @@ backup_cb(traverse_blk_cache_t *bc, spa_t *spa, void *arg)
 			zb.zb_object = object;
 			zb.zb_level = level;
 			zb.zb_blkid = blkid;
+			if (ba->pipelined)
+				return (dump_data_async(ba, spa, bp, &zb));
 			(void) arc_read(NULL, spa, bp,
 			    dmu_ot[type].ot_byteswap, arc_getbuf_func, &abuf,
 			    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_MUSTSUCCEED,
@@ -259,6 +444,7 @@ dmu_sendbackup(objset_t *tosnap, objset_t *fromsnap, vnode_t *vp)
 		drr->drr_u.drr_begin.drr_fromguid = fromds->ds_phys->ds_guid;
 	dsl_dataset_name(ds, drr->drr_u.drr_begin.drr_toname);
 
+	bzero(&ba, sizeof (ba));
 	ba.drr = drr;
 	ba.vp = vp;
 	ba.os = tosnap;
@@ -269,10 +455,39 @@ dmu_sendbackup(objset_t *tosnap, objset_t *fromsnap, vnode_t *vp)
 		return (ba.err);
 	}
 
+	if (zfs_send_queue_max != 0) {
+		ba.pipelined = B_TRUE;
+		mutex_init(&ba.lock, NULL, MUTEX_DEFAULT, NULL);
+		cv_init(&ba.cv, NULL, CV_DEFAULT, NULL);
+		list_create(&ba.recs, sizeof (backup_rec_t),
+		    offsetof(backup_rec_t, br_node));
+		ba.writer = thread_create(NULL, 0, backup_writer, &ba, 0, &p0,
+		    TS_RUN, minclsyspri);
+	}
+
 	err = traverse_dsl_dataset(ds,
 	    fromds ? fromds->ds_phys->ds_creation_txg : 0,
-	    ADVANCE_PRE | ADVANCE_HOLES | ADVANCE_DATA | ADVANCE_NOLOCK,
-	    backup_cb, &ba);
+	    ADVANCE_PRE | ADVANCE_HOLES | ADVANCE_NOLOCK |
+	    (ba.pipelined ? 0 : ADVANCE_DATA), backup_cb, &ba);
+
+	if (ba.pipelined) {
+		/*
+		 * Let the writer finish the queue; the END record follows.
+		 */
+		mutex_enter(&ba.lock);
+		ba.done = B_TRUE;
+		cv_broadcast(&ba.cv);
+		while (ba.writer != NULL)
+			cv_wait(&ba.cv, &ba.lock);
+		mutex_exit(&ba.lock);
+		ASSERT(list_is_empty(&ba.recs) && ba.queued == 0);
+		list_destroy(&ba.recs);
+		cv_destroy(&ba.cv);
+		mutex_destroy(&ba.lock);
+		ba.pipelined = B_FALSE;
+		if (err == 0 && ba.err != 0)
+			err = EINTR;
+	}
 
 	if (err) {
 		if (err == EINTR && ba.err)
@@ -295,6 +510,42 @@ dmu_sendbackup(objset_t *tosnap, objset_t *fromsnap, vnode_t *vp)
 	return (0);
 }
 
+/*
+ * A receive is applied in parallel unless zfs_recv_threads is zero.
+ * Records are copied out of the stream, into a batch, on one of
+ * zfs_recv_threads lists picked by object number, so that the records
+ * for any one object are still applied in stream order.  A
+ * DRR_FREEOBJECTS record is put on every list that owns an object in its
+ * range, and each list frees only its own objects.  A DRR_WRITE
+ * that continues the previous write to its object is appended to it, up
+ * to zfs_recv_write_max bytes, and the whole range is written in one
+ * transaction.  Once zfs_recv_batch_bytes have been queued the lists are
+ * applied concurrently while the stream is read into the next batch.
+ * DRR_END waits for all of them before checking the stream checksum.
+ */
+int zfs_recv_threads = 8;
+uint64_t zfs_recv_batch_bytes = 8 << 20;
+uint64_t zfs_recv_write_max = 1 << 20;
+
+typedef struct restore_rec {
+	list_node_t rr_node;
+	dmu_replay_record_t rr_drr;	/* header, in host byte order */
+	void *rr_data;			/* bonus or write data, if any */
+	uint64_t rr_size;		/* size of rr_data */
+} restore_rec_t;
+
+typedef struct restore_worker {
+	struct restorearg *rw_ra;
+	int rw_list;			/* index in rb_workers */
+	list_t rw_recs;			/* records to apply, in order */
+	int rw_err;			/* first error, if any */
+} restore_worker_t;
+
+typedef struct restore_batch {
+	restore_worker_t *rb_workers;
+	uint64_t rb_bytes;		/* memory used by queued records */
+} restore_batch_t;
+
 struct restorearg {
 	int err;
 	int byteswap;
@@ -305,6 +556,12 @@ struct restorearg {
 	int bufoff; /* next offset to read */
 	int bufsize; /* amount of memory allocated for buf */
 	zio_cksum_t zc;
+	objset_t *os;
+	taskq_t *tq;		/* NULL when applying serially */
+	int nworkers;
+	restore_batch_t batch[2];
+	restore_batch_t *filling;	/* batch being queued */
+	restore_batch_t *running;	/* batch being applied, if any */
 };
 
 /* ARGSUSED */
@@ -564,8 +821,67 @@ backup_byteswap(dmu_replay_record_t *drr)
 #undef DO32
 }
 
+/*
+ * Check the header of a record and read the data that follows it, if
+ * any, putting the data in host byte order.  The data is left in ra->buf,
+ * so it is only valid until the next restore_read().
+ */
+static int
+restore_read_data(struct restorearg *ra, dmu_replay_record_t *drr,
+    void **datap)
+{
+	struct drr_object *drro = &drr->drr_u.drr_object;
+	struct drr_freeobjects *drrfo = &drr->drr_u.drr_freeobjects;
+	struct drr_write *drrw = &drr->drr_u.drr_write;
+	void *data = NULL;
+
+	switch (drr->drr_type) {
+	case DRR_FREEOBJECTS:
+		if (drrfo->drr_firstobj + drrfo->drr_numobjs <
+		    drrfo->drr_firstobj)
+			return (EINVAL);
+		break;
+	case DRR_OBJECT:
+		if (drro->drr_type == DMU_OT_NONE ||
+		    drro->drr_type >= DMU_OT_NUMTYPES ||
+		    drro->drr_bonustype >= DMU_OT_NUMTYPES ||
+		    drro->drr_checksum >= ZIO_CHECKSUM_FUNCTIONS ||
+		    drro->drr_compress >= ZIO_COMPRESS_FUNCTIONS ||
+		    P2PHASE(drro->drr_blksz, SPA_MINBLOCKSIZE) ||
+		    drro->drr_blksz < SPA_MINBLOCKSIZE ||
+		    drro->drr_blksz > SPA_MAXBLOCKSIZE ||
+		    drro->drr_bonuslen > DN_MAX_BONUSLEN) {
+			return (EINVAL);
+		}
+		if (drro->drr_bonuslen == 0)
+			break;
+		data = restore_read(ra, P2ROUNDUP(drro->drr_bonuslen, 8));
+		if (data == NULL)
+			return (ra->err);
+		if (ra->byteswap) {
+			dmu_ot[drro->drr_bonustype].ot_byteswap(data,
+			    drro->drr_bonuslen);
+		}
+		break;
+	case DRR_WRITE:
+		if (drrw->drr_offset + drrw->drr_length < drrw->drr_offset ||
+		    drrw->drr_type >= DMU_OT_NUMTYPES)
+			return (EINVAL);
+		data = restore_read(ra, drrw->drr_length);
+		if (data == NULL)
+			return (ra->err);
+		if (ra->byteswap)
+			dmu_ot[drrw->drr_type].ot_byteswap(data,
+			    drrw->drr_length);
+		break;
+	}
+
+	*datap = data;
+	return (0);
+}
+
 static int
-restore_object(struct restorearg *ra, objset_t *os, struct drr_object *drro)
+restore_object(objset_t *os, struct drr_object *drro, void *data)
 {
 	int err;
 	dmu_tx_t *tx;
@@ -575,18 +891,6 @@ restore_object(struct restorearg *ra, objset_t *os, struct drr_object *drro)
 	if (err != 0 && err != ENOENT)
 		return (EINVAL);
 
-	if (drro->drr_type == DMU_OT_NONE ||
-	    drro->drr_type >= DMU_OT_NUMTYPES ||
-	    drro->drr_bonustype >= DMU_OT_NUMTYPES ||
-	    drro->drr_checksum >= ZIO_CHECKSUM_FUNCTIONS ||
-	    drro->drr_compress >= ZIO_COMPRESS_FUNCTIONS ||
-	    P2PHASE(drro->drr_blksz, SPA_MINBLOCKSIZE) ||
-	    drro->drr_blksz < SPA_MINBLOCKSIZE ||
-	    drro->drr_blksz > SPA_MAXBLOCKSIZE ||
-	    drro->drr_bonuslen > DN_MAX_BONUSLEN) {
-		return (EINVAL);
-	}
-
 	tx = dmu_tx_create(os);
 
 	if (err == ENOENT) {
@@ -629,43 +933,31 @@ restore_object(struct restorearg *ra, objset_t *os, struct drr_object *drro)
 
 	if (drro->drr_bonuslen) {
 		dmu_buf_t *db;
-		void *data;
 		VERIFY(0 == dmu_bonus_hold(os, drro->drr_object, FTAG, &db));
 		dmu_buf_will_dirty(db, tx);
 
 		ASSERT3U(db->db_size, >=, drro->drr_bonuslen);
-		data = restore_read(ra, P2ROUNDUP(drro->drr_bonuslen, 8));
-		if (data == NULL) {
-			dmu_tx_commit(tx);
-			return (ra->err);
-		}
 		bcopy(data, db->db_data, drro->drr_bonuslen);
-		if (ra->byteswap) {
-			dmu_ot[drro->drr_bonustype].ot_byteswap(db->db_data,
-			    drro->drr_bonuslen);
-		}
 		dmu_buf_rele(db, FTAG);
 	}
 	dmu_tx_commit(tx);
 	return (0);
 }
 
-/* ARGSUSED */
 static int
-restore_freeobjects(struct restorearg *ra, objset_t *os,
-    struct drr_freeobjects *drrfo)
+restore_freeobjects(objset_t *os, struct drr_freeobjects *drrfo,
+    int nlists, int list)
 {
 	uint64_t obj;
 
-	if (drrfo->drr_firstobj + drrfo->drr_numobjs < drrfo->drr_firstobj)
-		return (EINVAL);
-
 	for (obj = drrfo->drr_firstobj;
 	    obj < drrfo->drr_firstobj + drrfo->drr_numobjs;
 	    (void) dmu_object_next(os, &obj, FALSE, 0)) {
 		dmu_tx_t *tx;
 		int err;
 
+		if (obj % nlists != list)
+			continue;
 		if (dmu_object_info(os, obj, NULL) != 0)
 			continue;
 
@@ -685,21 +977,11 @@ restore_freeobjects(struct restorearg *ra, objset_t *os,
 }
 
 static int
-restore_write(struct restorearg *ra, objset_t *os,
-    struct drr_write *drrw)
+restore_write(objset_t *os, struct drr_write *drrw, void *data)
 {
 	dmu_tx_t *tx;
-	void *data;
 	int err;
 
-	if (drrw->drr_offset + drrw->drr_length < drrw->drr_offset ||
-	    drrw->drr_type >= DMU_OT_NUMTYPES)
-		return (EINVAL);
-
-	data = restore_read(ra, drrw->drr_length);
-	if (data == NULL)
-		return (ra->err);
-
 	if (dmu_object_info(os, drrw->drr_object, NULL) != 0)
 		return (EINVAL);
 
@@ -712,18 +994,14 @@ restore_write(struct restorearg *ra, objset_t *os,
 		dmu_tx_abort(tx);
 		return (err);
 	}
-	if (ra->byteswap)
-		dmu_ot[drrw->drr_type].ot_byteswap(data, drrw->drr_length);
 	dmu_write(os, drrw->drr_object,
 	    drrw->drr_offset, drrw->drr_length, data, tx);
 	dmu_tx_commit(tx);
 	return (0);
 }
 
-/* ARGSUSED */
 static int
-restore_free(struct restorearg *ra, objset_t *os,
-    struct drr_free *drrf)
+restore_free(objset_t *os, struct drr_free *drrf)
 {
 	dmu_tx_t *tx;
 	int err;
@@ -750,12 +1028,257 @@ restore_free(struct restorearg *ra, objset_t *os,
 	return (err);
 }
 
+/*
+ * Apply a record from list 'list' of 'nlists'.  A DRR_FREEOBJECTS record
+ * frees only the objects that belong to that list.
+ */
+static int
+restore_apply(objset_t *os, dmu_replay_record_t *drr, void *data,
+    int nlists, int list)
+{
+	switch (drr->drr_type) {
+	case DRR_OBJECT:
+		return (restore_object(os, &drr->drr_u.drr_object, data));
+	case DRR_FREEOBJECTS:
+		return (restore_freeobjects(os, &drr->drr_u.drr_freeobjects,
+		    nlists, list));
+	case DRR_WRITE:
+		return (restore_write(os, &drr->drr_u.drr_write, data));
+	case DRR_FREE:
+		return (restore_free(os, &drr->drr_u.drr_free));
+	}
+	return (EINVAL);
+}
+
+static void
+restore_worker(void *arg)
+{
+	restore_worker_t *rw = arg;
+	restore_rec_t *rr;
+
+	for (rr = list_head(&rw->rw_recs); rr != NULL;
+	    rr = list_next(&rw->rw_recs, rr)) {
+		rw->rw_err = restore_apply(rw->rw_ra->os, &rr->rr_drr,
+		    rr->rr_data, rw->rw_ra->nworkers, rw->rw_list);
+		if (rw->rw_err != 0)
+			break;
+	}
+}
+
+static void
+restore_batch_init(restore_batch_t *rb, struct restorearg *ra)
+{
+	int w;
+
+	bzero(rb, sizeof (restore_batch_t));
+	rb->rb_workers = kmem_zalloc(ra->nworkers *
+	    sizeof (restore_worker_t), KM_SLEEP);
+	for (w = 0; w < ra->nworkers; w++) {
+		rb->rb_workers[w].rw_ra = ra;
+		rb->rb_workers[w].rw_list = w;
+		list_create(&rb->rb_workers[w].rw_recs,
+		    sizeof (restore_rec_t), offsetof(restore_rec_t, rr_node));
+	}
+}
+
+static void
+restore_batch_clear(restore_batch_t *rb, int nworkers)
+{
+	restore_worker_t *rw;
+	restore_rec_t *rr;
+	int w;
+
+	for (w = 0; w < nworkers; w++) {
+		rw = &rb->rb_workers[w];
+		while ((rr = list_head(&rw->rw_recs)) != NULL) {
+			list_remove(&rw->rw_recs, rr);
+			if (rr->rr_size != 0)
+				kmem_free(rr->rr_data, rr->rr_size);
+			kmem_free(rr, sizeof (restore_rec_t));
+		}
+		rw->rw_err = 0;
+	}
+	rb->rb_bytes = 0;
+}
+
+static void
+restore_batch_fini(restore_batch_t *rb, int nworkers)
+{
+	int w;
+
+	restore_batch_clear(rb, nworkers);
+	for (w = 0; w < nworkers; w++)
+		list_destroy(&rb->rb_workers[w].rw_recs);
+	kmem_free(rb->rb_workers, nworkers * sizeof (restore_worker_t));
+}
+
+/*
+ * Wait for the running batch and pick up the first error, if any.
+ */
+static void
+restore_batch_finish(struct restorearg *ra)
+{
+	restore_batch_t *rb = ra->running;
+	int w;
+
+	taskq_wait(ra->tq);
+	ra->running = NULL;
+
+	for (w = 0; w < ra->nworkers; w++) {
+		if (ra->err == 0)
+			ra->err = rb->rb_workers[w].rw_err;
+	}
+	restore_batch_clear(rb, ra->nworkers);
+}
+
+/*
+ * Finish the running batch, if any, and start applying the one that has
+ * been queued; further records are queued into the other batch.
+ */
+static void
+restore_batch_start(struct restorearg *ra)
+{
+	restore_batch_t *rb = ra->filling;
+	int w;
+
+	if (ra->running != NULL)
+		restore_batch_finish(ra);
+
+	ra->filling = (rb == &ra->batch[0]) ? &ra->batch[1] : &ra->batch[0];
+
+	if (rb->rb_bytes == 0 || ra->err != 0) {
+		restore_batch_clear(rb, ra->nworkers);
+		return;
+	}
+
+	for (w = 0; w < ra->nworkers; w++) {
+		if (!list_is_empty(&rb->rb_workers[w].rw_recs)) {
+			(void) taskq_dispatch(ra->tq, restore_worker,
+			    &rb->rb_workers[w], TQ_SLEEP);
+		}
+	}
+	ra->running = rb;
+}
+
+/*
+ * Apply everything queued so far, either because the next record can't
+ * be queued or because we have reached the end of the stream.
+ */
+static void
+restore_drain(struct restorearg *ra)
+{
+	restore_batch_start(ra);
+	if (ra->running != NULL)
+		restore_batch_finish(ra);
+}
+
+static boolean_t
+restore_write_continues(restore_rec_t *rr, struct drr_write *drrw)
+{
+	struct drr_write *prev = &rr->rr_drr.drr_u.drr_write;
+
+	return (rr->rr_drr.drr_type == DRR_WRITE &&
+	    prev->drr_object == drrw->drr_object &&
+	    prev->drr_type == drrw->drr_type &&
+	    prev->drr_offset + prev->drr_length == drrw->drr_offset &&
+	    prev->drr_length + drrw->drr_length <= zfs_recv_write_max);
+}
+
+/*
+ * Copy a record and 'len' bytes of its data onto list 'rw' of the filling
+ * batch.  A write that continues the last record on the list is appended
+ * to it instead.
+ */
+static void
+restore_queue_rec(restore_batch_t *rb, restore_worker_t *rw,
+    dmu_replay_record_t *drr, void *data, uint64_t len)
+{
+	struct drr_write *drrw = &drr->drr_u.drr_write;
+	restore_rec_t *rr = list_tail(&rw->rw_recs);
+
+	if (drr->drr_type == DRR_WRITE && rr != NULL &&
+	    restore_write_continues(rr, drrw)) {
+		struct drr_write *prev = &rr->rr_drr.drr_u.drr_write;
+
+		if (prev->drr_length + len > rr->rr_size) {
+			uint64_t size = MIN(MAX(rr->rr_size * 2,
+			    prev->drr_length + len), zfs_recv_write_max);
+			void *buf = kmem_alloc(size, KM_SLEEP);
+
+			bcopy(rr->rr_data, buf, prev->drr_length);
+			if (rr->rr_size != 0)
+				kmem_free(rr->rr_data, rr->rr_size);
+			rb->rb_bytes += size - rr->rr_size;
+			rr->rr_data = buf;
+			rr->rr_size = size;
+		}
+		bcopy(data, (char *)rr->rr_data + prev->drr_length, len);
+		prev->drr_length += len;
+	} else {
+		rr = kmem_alloc(sizeof (restore_rec_t), KM_SLEEP);
+		rr->rr_drr = *drr;
+		rr->rr_data = NULL;
+		rr->rr_size = len;
+		if (len != 0) {
+			rr->rr_data = kmem_alloc(len, KM_SLEEP);
+			bcopy(data, rr->rr_data, len);
+		}
+		list_insert_tail(&rw->rw_recs, rr);
+		rb->rb_bytes += sizeof (restore_rec_t) + len;
+	}
+}
+
+/*
+ * Queue a record on the list for its object.  A DRR_FREEOBJECTS record
+ * may cover objects of any list, so it is queued on each list that one of
+ * its objects belongs to, and each list frees its own; the record needs
+ * no barrier.
+ */
+static void
+restore_queue(struct restorearg *ra, dmu_replay_record_t *drr, void *data)
+{
+	restore_batch_t *rb = ra->filling;
+	struct drr_freeobjects *drrfo = &drr->drr_u.drr_freeobjects;
+	uint64_t object, len, n;
+
+	switch (drr->drr_type) {
+	case DRR_OBJECT:
+		object = drr->drr_u.drr_object.drr_object;
+		len = drr->drr_u.drr_object.drr_bonuslen;
+		break;
+	case DRR_FREEOBJECTS:
+		n = MIN(drrfo->drr_numobjs, ra->nworkers);
+		for (object = drrfo->drr_firstobj;
+		    object < drrfo->drr_firstobj + n; object++) {
+			restore_queue_rec(rb,
+			    &rb->rb_workers[object % ra->nworkers], drr,
+			    NULL, 0);
+		}
+		goto out;
+	case DRR_WRITE:
+		object = drr->drr_u.drr_write.drr_object;
+		len = drr->drr_u.drr_write.drr_length;
+		break;
+	default:
+		ASSERT3U(drr->drr_type, ==, DRR_FREE);
+		object = drr->drr_u.drr_free.drr_object;
+		len = 0;
+		break;
+	}
+	restore_queue_rec(rb, &rb->rb_workers[object % ra->nworkers],
+	    drr, data, len);
+out:
+	if (rb->rb_bytes >= zfs_recv_batch_bytes)
+		restore_batch_start(ra);
+}
+
 int
 dmu_recvbackup(char *tosnap, struct drr_begin *drrb, uint64_t *sizep,
     boolean_t force, vnode_t *vp, uint64_t voffset)
 {
 	struct restorearg ra;
-	dmu_replay_record_t *drr;
+	dmu_replay_record_t *drr, rec;
+	void *data;
 	char *cp;
 	objset_t *os = NULL;
 	zio_cksum_t pzc;
@@ -882,6 +1405,17 @@ dmu_recvbackup(char *tosnap, struct drr_begin *drrb, uint64_t *sizep,
 	*cp = '@';
 	ASSERT3U(ra.err, ==, 0);
 
+	ra.os = os;
+	if (zfs_recv_threads != 0) {
+		ra.nworkers = zfs_recv_threads;
+		ra.tq = taskq_create("zfs_recv", ra.nworkers, minclsyspri,
+		    ra.nworkers, INT_MAX, TASKQ_PREPOPULATE);
+		restore_batch_init(&ra.batch[0], &ra);
+		restore_batch_init(&ra.batch[1], &ra);
+		ra.filling = &ra.batch[0];
+		ra.running = NULL;
+	}
+
 	/*
 	 * Read records and process them.
 	 */
@@ -896,40 +1430,34 @@ dmu_recvbackup(char *tosnap, struct drr_begin *drrb, uint64_t *sizep,
 		if (ra.byteswap)
 			backup_byteswap(drr);
 
-		switch (drr->drr_type) {
-		case DRR_OBJECT:
-		{
-			/*
-			 * We need to make a copy of the record header,
-			 * because restore_{object,write} may need to
-			 * restore_read(), which will invalidate drr.
-			 */
-			struct drr_object drro = drr->drr_u.drr_object;
-			ra.err = restore_object(&ra, os, &drro);
+		/*
+		 * We need to make a copy of the record header, because
+		 * reading its data will invalidate drr.
+		 */
+		rec = *drr;
+		ra.err = restore_read_data(&ra, &rec, &data);
+		if (ra.err)
 			break;
-		}
+
+		switch (rec.drr_type) {
+		case DRR_OBJECT:
 		case DRR_FREEOBJECTS:
-		{
-			struct drr_freeobjects drrfo =
-			    drr->drr_u.drr_freeobjects;
-			ra.err = restore_freeobjects(&ra, os, &drrfo);
-			break;
-		}
 		case DRR_WRITE:
-		{
-			struct drr_write drrw = drr->drr_u.drr_write;
-			ra.err = restore_write(&ra, os, &drrw);
-			break;
-		}
 		case DRR_FREE:
-		{
-			struct drr_free drrf = drr->drr_u.drr_free;
-			ra.err = restore_free(&ra, os, &drrf);
+			if (ra.tq != NULL)
+				restore_queue(&ra, &rec, data);
+			else
+				ra.err = restore_apply(os, &rec, data, 1, 0);
 			break;
-		}
 		case DRR_END:
 		{
-			struct drr_end drre = drr->drr_u.drr_end;
+			struct drr_end drre = rec.drr_u.drr_end;
+
+			if (ra.tq != NULL) {
+				restore_drain(&ra);
+				if (ra.err)
+					goto out;
+			}
 			/*
 			 * We compare against the *previous* checksum
 			 * value, because the stored checksum is of
@@ -954,6 +1482,12 @@ dmu_recvbackup(char *tosnap, struct drr_begin *drrb, uint64_t *sizep,
 	}
 
 out:
+	if (ra.tq != NULL) {
+		restore_drain(&ra);
+		taskq_destroy(ra.tq);
+		restore_batch_fini(&ra.batch[0], ra.nworkers);
+		restore_batch_fini(&ra.batch[1], ra.nworkers);
+	}
 	if (os)
 		dmu_objset_close(os);
 
@@ -760,6 +760,38 @@ traverse_more(traverse_handle_t *th)
 	return (rc);
 }
 
+/*
+ * Return the bookmark that the next traverse_more() will start from, or
+ * B_FALSE if the traversal is done.  Everything before it has been passed
+ * to the callback.
+ */
+boolean_t
+traverse_get_position(traverse_handle_t *th, zbookmark_t *zb)
+{
+	zseg_t *zseg = list_head(&th->th_seglist);
+
+	if (zseg == NULL)
+		return (B_FALSE);
+
+	*zb = zseg->seg_start;
+	return (B_TRUE);
+}
+
+/*
+ * Skip the current segment ahead to a bookmark returned by
+ * traverse_get_position(), to resume an earlier traversal of it.  Like
+ * a traversal that spans several txgs, the resumed one sees the block
+ * tree as of the latest synced txg.
+ */
+void
+traverse_set_position(traverse_handle_t *th, const zbookmark_t *zb)
+{
+	zseg_t *zseg = list_head(&th->th_seglist);
+
+	ASSERT(zseg != NULL);
+	zseg->seg_start = *zb;
+}
+
 /*
  * Note: (mintxg, maxtxg) is an open interval; mintxg and maxtxg themselves
  * are not included.  The blocks covered by this segment will all have
@@ -868,6 +868,19 @@ dmu_tx_assign(dmu_tx_t *tx, uint64_t txg_how)
 	ASSERT(txg_how != 0);
 	ASSERT(!dsl_pool_sync_context(tx->tx_pool));
 
+	/*
+	 * Slow the writer down if the open txg is filling up faster than
+	 * the pool can sync it; see dsl_pool_delay().  This is a bounded
+	 * sleep that does not wait on the sync thread, so TXG_NOWAIT
+	 * callers holding locks are delayed here too.  Replay (a specific
+	 * txg) is never delayed.
+	 */
+	if (txg_how < TXG_INITIAL && !tx->tx_dirty_delayed &&
+	    tx->tx_pool != NULL) {
+		dsl_pool_delay(tx->tx_pool);
+		tx->tx_dirty_delayed = TRUE;
+	}
+
 	while ((err = dmu_tx_try_assign(tx, txg_how)) != 0) {
 		dmu_tx_unassign(tx);
 
@@ -680,6 +680,7 @@ dsl_dir_space_available(dsl_dir_t *dd,
 
 struct tempreserve {
 	list_node_t tr_node;
+	dsl_pool_t *tr_dp;
 	dsl_dir_t *tr_ds;
 	uint64_t tr_size;
 };
@@ -766,6 +767,7 @@ dsl_dir_tempreserve_impl(dsl_dir_t *dd, uint64_t asize,
 	mutex_exit(&dd->dd_lock);
 
 	tr = kmem_alloc(sizeof (struct tempreserve), KM_SLEEP);
+	tr->tr_dp = NULL;
 	tr->tr_ds = dd;
 	tr->tr_size = asize;
 	list_insert_tail(tr_list, tr);
@@ -809,9 +811,20 @@ dsl_dir_tempreserve_space(dsl_dir_t *dd, uint64_t lsize,
 		err = arc_tempreserve_space(lsize);
 		if (err == 0) {
 			tr = kmem_alloc(sizeof (struct tempreserve), KM_SLEEP);
+			tr->tr_dp = NULL;
 			tr->tr_ds = NULL;
 			tr->tr_size = lsize;
 			list_insert_tail(tr_list, tr);
+
+			err = dsl_pool_tempreserve_space(dd->dd_pool,
+			    asize, tx);
+		}
+		if (err == 0) {
+			tr = kmem_alloc(sizeof (struct tempreserve), KM_SLEEP);
+			tr->tr_dp = dd->dd_pool;
+			tr->tr_ds = NULL;
+			tr->tr_size = asize;
+			list_insert_tail(tr_list, tr);
 		}
 	}
 
@@ -836,7 +849,9 @@ dsl_dir_tempreserve_clear(void *tr_cookie, dmu_tx_t *tx)
 	ASSERT3U(tx->tx_txg, !=, 0);
 
 	while (tr = list_head(tr_list)) {
-		if (tr->tr_ds == NULL) {
+		if (tr->tr_dp != NULL) {
+			dsl_pool_tempreserve_clear(tr->tr_dp, tr->tr_size, tx);
+		} else if (tr->tr_ds == NULL) {
 			arc_tempreserve_clear(tr->tr_size);
 		} else {
 			mutex_enter(&tr->tr_ds->dd_lock);
@@ -852,13 +867,8 @@ dsl_dir_tempreserve_clear(void *tr_cookie, dmu_tx_t *tx)
 	kmem_free(tr_list, sizeof (list_t));
 }
 
-/*
- * Call in open context when we think we're going to write/free space,
- * eg. when dirtying data.  Be conservative (ie. OK to write less than
- * this or free more than this, but don't write more or free less).
- */
-void
-dsl_dir_willuse_space(dsl_dir_t *dd, int64_t space, dmu_tx_t *tx)
+static void
+dsl_dir_willuse_space_impl(dsl_dir_t *dd, int64_t space, dmu_tx_t *tx)
 {
 	int64_t parent_space;
 	uint64_t est_used;
@@ -876,7 +886,19 @@ dsl_dir_willuse_space(dsl_dir_t *dd, int64_t space, dmu_tx_t *tx)
 
 	/* XXX this is potentially expensive and unnecessary... */
 	if (parent_space && dd->dd_parent)
-		dsl_dir_willuse_space(dd->dd_parent, parent_space, tx);
+		dsl_dir_willuse_space_impl(dd->dd_parent, parent_space, tx);
+}
+
+/*
+ * Call in open context when we think we're going to write/free space,
+ * eg. when dirtying data.  Be conservative (ie. OK to write less than
+ * this or free more than this, but don't write more or free less).
+ */
+void
+dsl_dir_willuse_space(dsl_dir_t *dd, int64_t space, dmu_tx_t *tx)
+{
+	dsl_pool_willuse_space(dd->dd_pool, space, tx);
+	dsl_dir_willuse_space_impl(dd, space, tx);
 }
 
 /* call from syncing context when we actually write/free space for this dd */
@@ -52,6 +52,59 @@ dsl_pool_open_mos_dir(dsl_pool_t *dp, dsl_dir_t **ddp)
 	return (dsl_dir_open_obj(dp, obj, MOS_DIR_NAME, dp, ddp));
 }
 
+/*
+ * Write throttle.
+ *
+ * Each txg may dirty at most dp_write_limit bytes.  A tx whose reservation
+ * would take the open txg past it waits for the next txg, which also
+ * pushes the open one out to sync early.  The limit is what the pool can
+ * write in zfs_txg_synctime seconds, using the throughput measured by
+ * dsl_pool_sync(), kept within [zfs_write_limit_min, zfs_write_limit_max].
+ *
+ * Writers are slowed down well before they hit it: once the open txg has
+ * more than zfs_delay_min_dirty_percent of the limit dirty, each tx
+ * assignment is delayed by
+ *
+ *	zfs_delay_scale * (dirty - min) / (limit - dirty)
+ *
+ * nanoseconds, up to zfs_delay_max_ns.  The delay grows smoothly as dirty
+ * data approaches the limit, so incoming writes settle at the rate the
+ * pool syncs them instead of alternating between full speed and a stop.
+ * Delays shorter than a clock tick are accumulated per pool and slept off
+ * a tick at a time, so they still add up to the right average.
+ */
+int zfs_txg_synctime = 2;			/* seconds */
+uint64_t zfs_write_limit_min = 32 << 20;
+uint64_t zfs_write_limit_max = 0;		/* 0 is 1/8 of memory */
+int zfs_delay_min_dirty_percent = 60;
+uint64_t zfs_delay_scale = 500000;		/* ns */
+uint64_t zfs_delay_max_ns = 100000000;		/* 100 ms */
+
+/*
+ * Threads used to sync the dirty dnodes of each dataset in parallel; see
+ * dmu_objset_sync().  0 is one per CPU, up to 16; 1 syncs them in the txg
+ * sync thread, as it always used to.
+ */
+int zfs_sync_threads = 0;
+
+static dsl_pool_txg_stats_t dsl_pool_txg_stats = {
+	{ "txg",		KSTAT_DATA_UINT64 },
+	{ "dirty_bytes",	KSTAT_DATA_UINT64 },
+	{ "sync_time_ns",	KSTAT_DATA_UINT64 },
+	{ "delays",		KSTAT_DATA_UINT64 },
+	{ "throttles",		KSTAT_DATA_UINT64 },
+	{ "throughput",		KSTAT_DATA_UINT64 },
+	{ "write_limit",	KSTAT_DATA_UINT64 }
+};
+
+static uint64_t
+dsl_pool_write_limit_max(void)
+{
+	if (zfs_write_limit_max != 0)
+		return (zfs_write_limit_max);
+	return (MAX((uint64_t)physmem * PAGESIZE / 8, zfs_write_limit_min));
+}
+
 static dsl_pool_t *
 dsl_pool_open_impl(spa_t *spa, uint64_t txg)
 {
@@ -62,8 +115,27 @@ dsl_pool_open_impl(spa_t *spa, uint64_t txg)
 	dp->dp_spa = spa;
 	dp->dp_meta_rootbp = *bp;
 	rw_init(&dp->dp_config_rwlock, NULL, RW_DEFAULT, NULL);
+	mutex_init(&dp->dp_lock, NULL, MUTEX_DEFAULT, NULL);
+	dp->dp_write_limit = dsl_pool_write_limit_max();
 	txg_init(dp, txg);
 
+	dp->dp_txg_stats = dsl_pool_txg_stats;
+	dp->dp_txg_ksp = kstat_create(spa_name(spa), 0, "txg", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dsl_pool_txg_stats_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (dp->dp_txg_ksp != NULL) {
+		dp->dp_txg_ksp->ks_data = &dp->dp_txg_stats;
+		kstat_install(dp->dp_txg_ksp);
+	}
+
+	dp->dp_sync_threads = zfs_sync_threads != 0 ?
+	    zfs_sync_threads : MIN(max_ncpus, 16);
+	if (dp->dp_sync_threads > 1) {
+		dp->dp_sync_taskq = taskq_create("dp_sync_taskq",
+		    dp->dp_sync_threads, minclsyspri, dp->dp_sync_threads,
+		    INT_MAX, TASKQ_PREPOPULATE);
+	}
+
 	txg_list_create(&dp->dp_dirty_datasets,
 	    offsetof(dsl_dataset_t, ds_dirty_link));
 	txg_list_create(&dp->dp_dirty_dirs,
@@ -133,6 +205,11 @@ dsl_pool_close(dsl_pool_t *dp)
 
 	arc_flush();
 	txg_fini(dp);
+	if (dp->dp_sync_taskq != NULL)
+		taskq_destroy(dp->dp_sync_taskq);
+	if (dp->dp_txg_ksp != NULL)
+		kstat_delete(dp->dp_txg_ksp);
+	mutex_destroy(&dp->dp_lock);
 	rw_destroy(&dp->dp_config_rwlock);
 	kmem_free(dp, sizeof (dsl_pool_t));
 }
@@ -165,6 +242,55 @@ dsl_pool_create(spa_t *spa, uint64_t txg)
 	return (dp);
 }
 
+/*
+ * Called from syncing context with the time it took to write out the
+ * datasets dirtied in 'txg': update the throughput estimate, the write
+ * limit and the kstats.
+ */
+static void
+dsl_pool_sync_throttle(dsl_pool_t *dp, uint64_t txg, hrtime_t write_time)
+{
+	dsl_pool_txg_stats_t *dpts = &dp->dp_txg_stats;
+	int t = txg & TXG_MASK;
+	uint64_t dirty, throughput;
+
+	mutex_enter(&dp->dp_lock);
+	ASSERT3U(dp->dp_tempreserved[t], ==, 0);
+	dirty = dp->dp_space_towrite[t];
+	dp->dp_space_towrite[t] = 0;
+
+	if (spa_sync_pass(dp->dp_spa) != 1) {
+		mutex_exit(&dp->dp_lock);
+		return;
+	}
+
+	/*
+	 * Small txgs are dominated by fixed costs and say little about
+	 * how fast the pool can write, so only learn from large ones.
+	 */
+	if (dirty >= zfs_write_limit_min / 4 && write_time > 0) {
+		throughput = dirty * MICROSEC / write_time;
+		if (dp->dp_throughput == 0)
+			dp->dp_throughput = throughput;
+		else
+			dp->dp_throughput = (dp->dp_throughput + throughput) / 2;
+		dp->dp_write_limit = MIN(MAX(dp->dp_throughput *
+		    zfs_txg_synctime * MILLISEC, zfs_write_limit_min),
+		    dsl_pool_write_limit_max());
+	}
+
+	dpts->dpts_txg.value.ui64 = txg;
+	dpts->dpts_dirty.value.ui64 = dirty;
+	dpts->dpts_sync_time.value.ui64 = write_time;
+	dpts->dpts_delays.value.ui64 = dp->dp_delays[t];
+	dpts->dpts_throttles.value.ui64 = dp->dp_throttles[t];
+	dpts->dpts_throughput.value.ui64 = dp->dp_throughput;
+	dpts->dpts_write_limit.value.ui64 = dp->dp_write_limit;
+	dp->dp_delays[t] = 0;
+	dp->dp_throttles[t] = 0;
+	mutex_exit(&dp->dp_lock);
+}
+
 void
 dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 {
@@ -174,10 +300,12 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 	dsl_dataset_t *ds;
 	dsl_sync_task_group_t *dstg;
 	objset_impl_t *mosi = dp->dp_meta_objset->os;
+	hrtime_t start, write_time;
 	int err;
 
 	tx = dmu_tx_create_assigned(dp, txg);
 
+	start = gethrtime();
 	zio = zio_root(dp->dp_spa, NULL, NULL, ZIO_FLAG_MUSTSUCCEED);
 	while (ds = txg_list_remove(&dp->dp_dirty_datasets, txg)) {
 		if (!list_link_active(&ds->ds_synced_link))
@@ -186,9 +314,21 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 			dmu_buf_rele(ds->ds_dbuf, ds);
 		dsl_dataset_sync(ds, zio, tx);
 	}
+	/*
+	 * The datasets' dnodes are synced by dp_sync_taskq, which issues
+	 * each objset's root block write once its dnodes are done.  Wait
+	 * for that before waiting for the writes.
+	 */
+	if (dp->dp_sync_taskq != NULL)
+		taskq_wait(dp->dp_sync_taskq);
 	err = zio_wait(zio);
 	ASSERT(err == 0);
+	write_time = gethrtime() - start;
+
+	dsl_pool_sync_throttle(dp, txg, write_time);
+	spa_sync_time(dp->dp_spa, SPA_SYNC_DATASETS, write_time);
 
+	start = gethrtime();
 	while (dstg = txg_list_remove(&dp->dp_sync_tasks, txg))
 		dsl_sync_task_group_sync(dstg, tx);
 	while (dd = txg_list_remove(&dp->dp_dirty_dirs, txg))
@@ -203,6 +343,7 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 		dprintf_bp(&dp->dp_meta_rootbp, "meta objset rootbp is %s", "");
 		spa_set_rootblkptr(dp->dp_spa, &dp->dp_meta_rootbp);
 	}
+	spa_sync_time(dp->dp_spa, SPA_SYNC_MOS, gethrtime() - start);
 
 	dmu_tx_commit(tx);
 }
@@ -220,6 +361,114 @@ dsl_pool_zil_clean(dsl_pool_t *dp)
 	}
 }
 
+/*
+ * Reserve 'space' bytes of dirty data in tx's txg.  Returns ERESTART,
+ * so that the caller waits for the next txg, if that would take the txg
+ * past dp_write_limit.
+ */
+int
+dsl_pool_tempreserve_space(dsl_pool_t *dp, uint64_t space, dmu_tx_t *tx)
+{
+	int t = tx->tx_txg & TXG_MASK;
+	uint64_t reserved;
+
+	mutex_enter(&dp->dp_lock);
+	reserved = dp->dp_space_towrite[t] + dp->dp_tempreserved[t];
+
+	/*
+	 * Let the first tx of a txg through whatever its size, so that
+	 * nothing can be held off forever.
+	 */
+	if (reserved != 0 && reserved + space > dp->dp_write_limit) {
+		dp->dp_throttles[t]++;
+		mutex_exit(&dp->dp_lock);
+		return (ERESTART);
+	}
+
+	dp->dp_tempreserved[t] += space;
+	mutex_exit(&dp->dp_lock);
+
+	return (0);
+}
+
+/*
+ * Give back a reservation made by dsl_pool_tempreserve_space().
+ */
+void
+dsl_pool_tempreserve_clear(dsl_pool_t *dp, int64_t space, dmu_tx_t *tx)
+{
+	int t = tx->tx_txg & TXG_MASK;
+
+	mutex_enter(&dp->dp_lock);
+	ASSERT3U(dp->dp_tempreserved[t], >=, space);
+	dp->dp_tempreserved[t] -= space;
+	mutex_exit(&dp->dp_lock);
+}
+
+/*
+ * Account for dirty data that tx's txg will write.
+ */
+void
+dsl_pool_willuse_space(dsl_pool_t *dp, int64_t space, dmu_tx_t *tx)
+{
+	if (space <= 0)
+		return;
+
+	mutex_enter(&dp->dp_lock);
+	dp->dp_space_towrite[tx->tx_txg & TXG_MASK] += space;
+	mutex_exit(&dp->dp_lock);
+}
+
+/*
+ * How long a tx assignment in the open txg should be delayed, in ns.
+ */
+static hrtime_t
+dsl_pool_delay_time(dsl_pool_t *dp)
+{
+	int t = dp->dp_tx.tx_open_txg & TXG_MASK;
+	uint64_t limit = dp->dp_write_limit;
+	uint64_t min = limit / 100 * zfs_delay_min_dirty_percent;
+	uint64_t dirty;
+
+	ASSERT(MUTEX_HELD(&dp->dp_lock));
+
+	dirty = dp->dp_space_towrite[t] + dp->dp_tempreserved[t];
+	if (zfs_delay_scale == 0 || dirty <= min)
+		return (0);
+	if (dirty >= limit)
+		return (zfs_delay_max_ns);
+
+	return (MIN(zfs_delay_scale * (dirty - min) / (limit - dirty),
+	    zfs_delay_max_ns));
+}
+
+/*
+ * Delay a tx assignment by dsl_pool_delay_time().  Delays shorter than
+ * a clock tick are accumulated until they add up to one.
+ */
+void
+dsl_pool_delay(dsl_pool_t *dp)
+{
+	hrtime_t tick = NANOSEC / hz;
+	hrtime_t wait;
+	clock_t ticks;
+
+	mutex_enter(&dp->dp_lock);
+	wait = dsl_pool_delay_time(dp);
+	if (wait == 0) {
+		mutex_exit(&dp->dp_lock);
+		return;
+	}
+	dp->dp_delays[dp->dp_tx.tx_open_txg & TXG_MASK]++;
+	dp->dp_delay_debt += wait;
+	ticks = dp->dp_delay_debt / tick;
+	dp->dp_delay_debt -= ticks * tick;
+	mutex_exit(&dp->dp_lock);
+
+	if (ticks > 0)
+		delay(ticks);
+}
+
 /*
  * TRUE if the current thread is the tx_sync_thread or if we
  * are being called from SPA context during pool initialization.
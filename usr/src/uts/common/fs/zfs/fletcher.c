@@ -31,9 +31,8 @@
 #include <sys/sysmacros.h>
 #include <sys/byteorder.h>
 #include <sys/spa.h>
-#ifdef __APPLE__
 #include <sys/zio_checksum.h>
-#endif
+#include <sys/zfs_simd.h>
 
 void
 fletcher_2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
@@ -69,40 +68,6 @@ fletcher_2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	ZIO_SET_CHECKSUM(zcp, a0, a1, b0, b1);
 }
 
-void
-fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
-{
-	const uint32_t *ip = buf;
-	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
-	uint64_t a, b, c, d;
-
-	for (a = b = c = d = 0; ip < ipend; ip++) {
-		a += ip[0];
-		b += a;
-		c += b;
-		d += c;
-	}
-
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
-}
-
-void
-fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
-{
-	const uint32_t *ip = buf;
-	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
-	uint64_t a, b, c, d;
-
-	for (a = b = c = d = 0; ip < ipend; ip++) {
-		a += BSWAP_32(ip[0]);
-		b += a;
-		c += b;
-		d += c;
-	}
-
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
-}
-
 void
 fletcher_4_incremental_native(const void *buf, uint64_t size,
     zio_cksum_t *zcp)
@@ -148,3 +113,229 @@ fletcher_4_incremental_byteswap(const void *buf, uint64_t size,
 
 	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
 }
+
+/*
+ * Fletcher-4 implementations.
+ *
+ * Fletcher-4 is inherently serial: every word feeds all four running sums.
+ * It can nonetheless be split across N independent lanes, lane j summing
+ * words j, j + N, j + 2N, ... with its own a, b, c and d. Because every sum
+ * is a linear combination of the input words (modulo 2^64), the serial
+ * result can be recovered exactly from the lane sums by a fixed linear
+ * combination; see fletcher_4_combine_2() and fletcher_4_combine_4(). The
+ * lanes map directly onto the 64-bit elements of a vector register, so a
+ * vector unit computes 2 or 4 words per step instead of 1. Words past the
+ * last full stride are folded in serially afterwards.
+ *
+ * The scalar implementation is the reference; the others must produce
+ * bit-identical results on every buffer (ztest -b checksum verifies this).
+ * The implementation is chosen once, by fletcher_4_init(), from the fastest
+ * one the processor supports, or by zfs_fletcher_4_impl if that is set to
+ * the index of a supported entry in fletcher_4_impls[].
+ */
+typedef struct fletcher_4_ops {
+	zio_checksum_t	*fc4_native;
+	zio_checksum_t	*fc4_byteswap;
+	boolean_t	(*fc4_supported)(void);
+	const char	*fc4_name;
+} fletcher_4_ops_t;
+
+static void
+fletcher_4_scalar_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_4_incremental_native(buf, size, zcp);
+}
+
+static void
+fletcher_4_scalar_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_4_incremental_byteswap(buf, size, zcp);
+}
+
+static boolean_t
+fletcher_4_scalar_supported(void)
+{
+	return (B_TRUE);
+}
+
+static const fletcher_4_ops_t fletcher_4_scalar_impl = {
+	fletcher_4_scalar_native,
+	fletcher_4_scalar_byteswap,
+	fletcher_4_scalar_supported,
+	"scalar"
+};
+
+#ifdef ZFS_SIMD
+
+/*
+ * Combine the sums of 2 lanes into the serial fletcher-4 of the words seen.
+ */
+static void
+fletcher_4_combine_2(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+    const uint64_t *d, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp,
+	    a[0] + a[1],
+	    2 * (b[0] + b[1]) - a[1],
+	    4 * (c[0] + c[1]) - b[0] - 3 * b[1],
+	    8 * (d[0] + d[1]) - 4 * c[0] - 8 * c[1] + b[1]);
+}
+
+/*
+ * Combine the sums of 4 lanes into the serial fletcher-4 of the words seen.
+ */
+static void
+fletcher_4_combine_4(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+    const uint64_t *d, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp,
+	    a[0] + a[1] + a[2] + a[3],
+	    4 * (b[0] + b[1] + b[2] + b[3]) - a[1] - 2 * a[2] - 3 * a[3],
+	    16 * (c[0] + c[1] + c[2] + c[3]) -
+	    6 * b[0] - 10 * b[1] - 14 * b[2] - 18 * b[3] + a[2] + 3 * a[3],
+	    64 * (d[0] + d[1] + d[2] + d[3]) -
+	    48 * c[0] - 64 * c[1] - 80 * c[2] - 96 * c[3] +
+	    4 * b[0] + 10 * b[1] + 20 * b[2] + 34 * b[3] - a[3]);
+}
+
+typedef uint64_t fletcher_4_v2_t __attribute__((vector_size(16)));
+typedef uint64_t fletcher_4_v4_t __attribute__((vector_size(32)));
+
+#define	FLETCHER_4_NOSWAP(x)	(x)
+
+#define	FLETCHER_4_LOAD_2(ip, swap)	{ swap(ip[0]), swap(ip[1]) }
+#define	FLETCHER_4_LOAD_4(ip, swap)	\
+	{ swap(ip[0]), swap(ip[1]), swap(ip[2]), swap(ip[3]) }
+
+/*
+ * Generate the lane-parallel loop for one byte order. Each 32-bit word is
+ * zero-extended into its 64-bit lane; the lane sums are then combined and
+ * any remaining words are handled by the scalar incremental code.
+ */
+#define	FLETCHER_4_VEC_FUNC(name, order, vtype, width, isa, swap)	\
+static void __attribute__((target(isa)))				\
+fletcher_4_##name##_##order(const void *buf, uint64_t size,		\
+    zio_cksum_t *zcp)							\
+{									\
+	const uint32_t *ip = buf;					\
+	const uint32_t *ipend = ip +					\
+	    P2ALIGN(size / sizeof (uint32_t), (width));			\
+	vtype a = { 0 }, b = { 0 }, c = { 0 }, d = { 0 };		\
+	uint64_t la[width], lb[width], lc[width], ld[width];		\
+	int i;								\
+									\
+	for (; ip < ipend; ip += (width)) {				\
+		vtype w = FLETCHER_4_LOAD_##width(ip, swap);		\
+		a += w;							\
+		b += a;							\
+		c += b;							\
+		d += c;							\
+	}								\
+									\
+	for (i = 0; i < (width); i++) {					\
+		la[i] = a[i];						\
+		lb[i] = b[i];						\
+		lc[i] = c[i];						\
+		ld[i] = d[i];						\
+	}								\
+	fletcher_4_combine_##width(la, lb, lc, ld, zcp);		\
+	fletcher_4_incremental_##order(ip,				\
+	    size - ((uintptr_t)ip - (uintptr_t)buf), zcp);		\
+}
+
+#define	FLETCHER_4_VEC_IMPL(name, vtype, width, isa)			\
+FLETCHER_4_VEC_FUNC(name, native, vtype, width, isa, FLETCHER_4_NOSWAP) \
+FLETCHER_4_VEC_FUNC(name, byteswap, vtype, width, isa, BSWAP_32)	\
+									\
+static const fletcher_4_ops_t fletcher_4_##name##_impl = {		\
+	fletcher_4_##name##_native,					\
+	fletcher_4_##name##_byteswap,					\
+	zfs_##name##_available,						\
+	#name								\
+};
+
+FLETCHER_4_VEC_IMPL(sse2, fletcher_4_v2_t, 2, "sse2")
+FLETCHER_4_VEC_IMPL(avx2, fletcher_4_v4_t, 4, "avx2")
+
+#endif	/* ZFS_SIMD */
+
+/*
+ * Implementations in increasing order of preference.
+ */
+static const fletcher_4_ops_t *fletcher_4_impls[] = {
+	&fletcher_4_scalar_impl,
+#ifdef ZFS_SIMD
+	&fletcher_4_sse2_impl,
+	&fletcher_4_avx2_impl,
+#endif
+};
+
+#define	FLETCHER_4_IMPLS	\
+	(sizeof (fletcher_4_impls) / sizeof (fletcher_4_impls[0]))
+
+int zfs_fletcher_4_impl = -1;		/* -1: fastest supported */
+
+static const fletcher_4_ops_t *fletcher_4_impl = &fletcher_4_scalar_impl;
+
+/*
+ * Select the fletcher-4 implementation. This is called from
+ * zio_checksum_init(), and again whenever zfs_fletcher_4_impl is changed.
+ */
+void
+fletcher_4_init(void)
+{
+	const fletcher_4_ops_t *impl = &fletcher_4_scalar_impl;
+	int i;
+
+	if (zfs_fletcher_4_impl >= 0 &&
+	    zfs_fletcher_4_impl < FLETCHER_4_IMPLS &&
+	    fletcher_4_impls[zfs_fletcher_4_impl]->fc4_supported()) {
+		impl = fletcher_4_impls[zfs_fletcher_4_impl];
+	} else {
+		for (i = FLETCHER_4_IMPLS - 1; i >= 0; i--) {
+			if (fletcher_4_impls[i]->fc4_supported()) {
+				impl = fletcher_4_impls[i];
+				break;
+			}
+		}
+	}
+
+	fletcher_4_impl = impl;
+}
+
+/*
+ * Return the name of fletcher-4 implementation 'impl', or NULL if there is
+ * no such implementation.
+ */
+const char *
+fletcher_4_impl_name(int impl)
+{
+	if (impl < 0 || impl >= FLETCHER_4_IMPLS)
+		return (NULL);
+	return (fletcher_4_impls[impl]->fc4_name);
+}
+
+/*
+ * Return B_TRUE if fletcher-4 implementation 'impl' can run here.
+ */
+boolean_t
+fletcher_4_impl_supported(int impl)
+{
+	if (impl < 0 || impl >= FLETCHER_4_IMPLS)
+		return (B_FALSE);
+	return (fletcher_4_impls[impl]->fc4_supported());
+}
+
+void
+fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	fletcher_4_impl->fc4_native(buf, size, zcp);
+}
+
+void
+fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	fletcher_4_impl->fc4_byteswap(buf, size, zcp);
+}
@@ -33,9 +33,82 @@
 #include <sys/metaslab_impl.h>
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
+#include <sys/arc.h>
 
 uint64_t metaslab_aliquot = 512ULL << 10;
 
+/*
+ * A loaded metaslab's space map object is rewritten from its in-core map
+ * once it grows to metaslab_condense_pct percent of its condensed size,
+ * provided it is at least metaslab_condense_min_blocks blocks long.
+ */
+int metaslab_condense_pct = 200;
+int metaslab_condense_min_blocks = 4;
+
+/*
+ * Free space in segments smaller than this counts for less in
+ * metaslab_weight().
+ */
+uint64_t metaslab_frag_segsize = SPA_MAXBLOCKSIZE;
+
+/*
+ * After each txg syncs, each metaslab group's preload thread loads the
+ * space maps of its metaslab_preload_limit highest-weight metaslabs, so
+ * that allocations rarely wait for space_map_load() in metaslab_activate().
+ * A map stays loaded for metaslab_unload_delay txgs after it was last
+ * preloaded or allocated from, unless the ARC reports memory pressure,
+ * in which case inactive maps are unloaded and nothing new is preloaded.
+ */
+int metaslab_preload_enabled = 1;
+int metaslab_preload_limit = 3;
+int metaslab_unload_delay = TXG_SIZE * 2;
+
+typedef struct metaslab_stats {
+	kstat_named_t	mss_preloads;
+	kstat_named_t	mss_preload_hits;
+	kstat_named_t	mss_load_stalls;
+	kstat_named_t	mss_load_stall_time;
+	kstat_named_t	mss_unloads;
+	kstat_named_t	mss_pressure_unloads;
+} metaslab_stats_t;
+
+static metaslab_stats_t metaslab_stats = {
+	{ "preloads",		KSTAT_DATA_UINT64 },
+	{ "preload_hits",	KSTAT_DATA_UINT64 },
+	{ "load_stalls",	KSTAT_DATA_UINT64 },
+	{ "load_stall_time_ns",	KSTAT_DATA_UINT64 },
+	{ "unloads",		KSTAT_DATA_UINT64 },
+	{ "pressure_unloads",	KSTAT_DATA_UINT64 }
+};
+
+#define	MSSTAT_INCR(stat, val) \
+	atomic_add_64(&metaslab_stats.stat.value.ui64, (val));
+
+#define	MSSTAT_BUMP(stat)	MSSTAT_INCR(stat, 1)
+
+static kstat_t *metaslab_ksp;
+
+void
+metaslab_stat_init(void)
+{
+	metaslab_ksp = kstat_create("zfs", 0, "metaslabstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (metaslab_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (metaslab_ksp != NULL) {
+		metaslab_ksp->ks_data = &metaslab_stats;
+		kstat_install(metaslab_ksp);
+	}
+}
+
+void
+metaslab_stat_fini(void)
+{
+	if (metaslab_ksp != NULL) {
+		kstat_delete(metaslab_ksp);
+		metaslab_ksp = NULL;
+	}
+}
+
 /*
  * ==========================================================================
  * Metaslab classes
@@ -150,6 +223,8 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 	    sizeof (metaslab_t), offsetof(struct metaslab, ms_group_node));
 	mg->mg_aliquot = metaslab_aliquot * MAX(1, vd->vdev_children);
 	mg->mg_vd = vd;
+	mg->mg_taskq = taskq_create("metaslab_preload", 1, minclsyspri,
+	    1, INT_MAX, TASKQ_PREPOPULATE);
 	metaslab_class_add(mc, mg);
 
 	return (mg);
@@ -158,6 +233,7 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 void
 metaslab_group_destroy(metaslab_group_t *mg)
 {
+	taskq_destroy(mg->mg_taskq);
 	avl_destroy(&mg->mg_metaslab_tree);
 	mutex_destroy(&mg->mg_lock);
 	kmem_free(mg, sizeof (metaslab_group_t));
@@ -204,29 +280,106 @@ metaslab_group_sort(metaslab_group_t *mg, metaslab_t *msp, uint64_t weight)
 
 /*
  * ==========================================================================
- * The first-fit block allocator
+ * Common allocator routines
  * ==========================================================================
  */
+/*
+ * Both allocators keep, as picker-private data, an allocation cursor per
+ * alignment, and a second AVL tree of the free segments sorted by size,
+ * which space_map_add() and space_map_remove() maintain.
+ */
+static int
+metaslab_segsize_compare(const void *x1, const void *x2)
+{
+	const space_seg_t *s1 = x1;
+	const space_seg_t *s2 = x2;
+	uint64_t ss_size1 = s1->ss_end - s1->ss_start;
+	uint64_t ss_size2 = s2->ss_end - s2->ss_start;
+
+	if (ss_size1 < ss_size2)
+		return (-1);
+	if (ss_size1 > ss_size2)
+		return (1);
+
+	if (s1->ss_start < s2->ss_start)
+		return (-1);
+	if (s1->ss_start > s2->ss_start)
+		return (1);
+
+	return (0);
+}
+
 static void
-metaslab_ff_load(space_map_t *sm)
+metaslab_pp_load(space_map_t *sm)
 {
+	space_seg_t *ss;
+
 	ASSERT(sm->sm_ppd == NULL);
 	sm->sm_ppd = kmem_zalloc(64 * sizeof (uint64_t), KM_SLEEP);
+
+	sm->sm_pp_root = kmem_alloc(sizeof (avl_tree_t), KM_SLEEP);
+	avl_create(sm->sm_pp_root, metaslab_segsize_compare,
+	    sizeof (space_seg_t), offsetof(struct space_seg, ss_pp_node));
+
+	for (ss = avl_first(&sm->sm_root); ss; ss = AVL_NEXT(&sm->sm_root, ss))
+		avl_add(sm->sm_pp_root, ss);
 }
 
 static void
-metaslab_ff_unload(space_map_t *sm)
+metaslab_pp_unload(space_map_t *sm)
 {
+	void *cookie = NULL;
+
 	kmem_free(sm->sm_ppd, 64 * sizeof (uint64_t));
 	sm->sm_ppd = NULL;
+
+	while (avl_destroy_nodes(sm->sm_pp_root, &cookie) != NULL) {
+		/* The segments themselves belong to sm_root */
+	}
+
+	avl_destroy(sm->sm_pp_root);
+	kmem_free(sm->sm_pp_root, sizeof (avl_tree_t));
+	sm->sm_pp_root = NULL;
+}
+
+/* ARGSUSED */
+static void
+metaslab_pp_claim(space_map_t *sm, uint64_t start, uint64_t size)
+{
+	/* No need to update cursor */
 }
 
+/* ARGSUSED */
+static void
+metaslab_pp_free(space_map_t *sm, uint64_t start, uint64_t size)
+{
+	/* No need to update cursor */
+}
+
+/*
+ * Return the size of the largest free segment.
+ */
 static uint64_t
-metaslab_ff_alloc(space_map_t *sm, uint64_t size)
+metaslab_pp_maxsize(space_map_t *sm)
+{
+	space_seg_t *ss;
+
+	if (sm->sm_pp_root == NULL || (ss = avl_last(sm->sm_pp_root)) == NULL)
+		return (0);
+
+	return (ss->ss_end - ss->ss_start);
+}
+
+/*
+ * Find a block of 'size' bytes, aligned to 'align', in the segments of
+ * tree 't', starting at *cursor and wrapping around once.  For sm_root
+ * this is first-fit by offset; for the size-sorted tree, with *cursor at
+ * zero, it is best-fit.
+ */
+static uint64_t
+metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
+    uint64_t align)
 {
-	avl_tree_t *t = &sm->sm_root;
-	uint64_t align = size & -size;
-	uint64_t *cursor = (uint64_t *)sm->sm_ppd + highbit(align) - 1;
 	space_seg_t *ss, ssearch;
 	avl_index_t where;
 
@@ -255,31 +408,84 @@ metaslab_ff_alloc(space_map_t *sm, uint64_t size)
 		return (-1ULL);
 
 	*cursor = 0;
-	return (metaslab_ff_alloc(sm, size));
+	return (metaslab_block_picker(t, cursor, size, align));
 }
 
-/* ARGSUSED */
-static void
-metaslab_ff_claim(space_map_t *sm, uint64_t start, uint64_t size)
+/*
+ * ==========================================================================
+ * The first-fit block allocator
+ * ==========================================================================
+ */
+static uint64_t
+metaslab_ff_alloc(space_map_t *sm, uint64_t size)
 {
-	/* No need to update cursor */
+	uint64_t align = size & -size;
+	uint64_t *cursor = (uint64_t *)sm->sm_ppd + highbit(align) - 1;
+
+	return (metaslab_block_picker(&sm->sm_root, cursor, size, align));
 }
 
-/* ARGSUSED */
-static void
-metaslab_ff_free(space_map_t *sm, uint64_t start, uint64_t size)
+space_map_ops_t metaslab_ff_ops = {
+	metaslab_pp_load,
+	metaslab_pp_unload,
+	metaslab_ff_alloc,
+	metaslab_pp_claim,
+	metaslab_pp_free
+};
+
+/*
+ * ==========================================================================
+ * The dynamic-fit block allocator
+ * ==========================================================================
+ */
+/*
+ * First-fit from the per-alignment cursor is fast and keeps allocations
+ * close together while the metaslab has plenty of large free segments.
+ * Once it is fragmented, that is, once its largest free segment is below
+ * metaslab_df_alloc_threshold or less than metaslab_df_free_pct percent of
+ * it is free, first-fit degenerates into long scans over small segments,
+ * so switch to best-fit from the size-sorted tree, which goes straight to
+ * the smallest segment that can hold the block.  Either way, a request
+ * larger than the largest free segment fails without searching.
+ */
+uint64_t metaslab_df_alloc_threshold = SPA_MAXBLOCKSIZE;
+int metaslab_df_free_pct = 30;
+
+static uint64_t
+metaslab_df_alloc(space_map_t *sm, uint64_t size)
 {
-	/* No need to update cursor */
+	avl_tree_t *t = &sm->sm_root;
+	uint64_t align = size & -size;
+	uint64_t *cursor = (uint64_t *)sm->sm_ppd + highbit(align) - 1;
+	uint64_t max_size = metaslab_pp_maxsize(sm);
+	int free_pct = sm->sm_space * 100 / sm->sm_size;
+
+	ASSERT(MUTEX_HELD(sm->sm_lock));
+	ASSERT3U(avl_numnodes(&sm->sm_root), ==,
+	    avl_numnodes(sm->sm_pp_root));
+
+	if (max_size < size)
+		return (-1ULL);
+
+	if (max_size < metaslab_df_alloc_threshold ||
+	    free_pct < metaslab_df_free_pct) {
+		t = sm->sm_pp_root;
+		*cursor = 0;
+	}
+
+	return (metaslab_block_picker(t, cursor, size, align));
 }
 
-static space_map_ops_t metaslab_ff_ops = {
-	metaslab_ff_load,
-	metaslab_ff_unload,
-	metaslab_ff_alloc,
-	metaslab_ff_claim,
-	metaslab_ff_free
+space_map_ops_t metaslab_df_ops = {
+	metaslab_pp_load,
+	metaslab_pp_unload,
+	metaslab_df_alloc,
+	metaslab_pp_claim,
+	metaslab_pp_free
 };
 
+space_map_ops_t *zfs_metaslab_ops = &metaslab_df_ops;
+
 /*
  * ==========================================================================
  * Metaslabs
@@ -306,6 +512,7 @@ metaslab_init(metaslab_group_t *mg, space_map_obj_t *smo,
 	 */
 	space_map_create(&msp->ms_map, start, size,
 	    vd->vdev_ashift, &msp->ms_lock);
+	msp->ms_maxsize = size;
 
 	metaslab_group_add(mg, msp);
 
@@ -340,6 +547,8 @@ metaslab_fini(metaslab_t *msp)
 	metaslab_group_t *mg = msp->ms_group;
 	int t;
 
+	metaslab_group_preload_wait(mg);
+
 	vdev_space_update(mg->mg_vd, -msp->ms_map.sm_size,
 	    -msp->ms_smo.smo_alloc);
 
@@ -367,6 +576,22 @@ metaslab_fini(metaslab_t *msp)
 	(METASLAB_WEIGHT_PRIMARY | METASLAB_WEIGHT_SECONDARY)
 #define	METASLAB_SMO_BONUS_MULTIPLIER	2
 
+/*
+ * The histogram of free segment sizes comes from the in-core map while it
+ * is loaded, and from the copy taken when it was last unloaded otherwise.
+ * All zeroes means it was never loaded, or has been freed into since it
+ * was unloaded, and nothing is known.
+ */
+static uint64_t *
+metaslab_histogram(metaslab_t *msp)
+{
+	space_map_t *sm = &msp->ms_map;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	return (sm->sm_loaded ? sm->sm_histogram : msp->ms_histogram);
+}
+
 static uint64_t
 metaslab_weight(metaslab_t *msp)
 {
@@ -374,7 +599,9 @@ metaslab_weight(metaslab_t *msp)
 	space_map_t *sm = &msp->ms_map;
 	space_map_obj_t *smo = &msp->ms_smo;
 	vdev_t *vd = mg->mg_vd;
-	uint64_t weight, space;
+	uint64_t *histogram = metaslab_histogram(msp);
+	uint64_t weight, space, segsize, total, contig;
+	int b, top;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 
@@ -405,6 +632,35 @@ metaslab_weight(metaslab_t *msp)
 	ASSERT(weight >= space &&
 	    weight <= 2 * METASLAB_SMO_BONUS_MULTIPLIER * space);
 
+	/*
+	 * A metaslab whose free space is shredded into small segments
+	 * makes for slow allocations and scattered blocks.  Using the
+	 * histogram, scale the weight by between 1/2 and 1 according to
+	 * the fraction of free space in segments of at least
+	 * metaslab_frag_segsize, and note the largest segment there can
+	 * be, so that metaslab_group_alloc() can pass over metaslabs that
+	 * cannot hold a block contiguously.
+	 */
+	total = contig = 0;
+	top = -1;
+	for (b = 0; b < SPACE_MAP_HISTOGRAM_SIZE; b++) {
+		if (histogram[b] == 0)
+			continue;
+		segsize = 1ULL << (b + sm->sm_shift);
+		total += histogram[b] * segsize;
+		if (segsize >= metaslab_frag_segsize)
+			contig += histogram[b] * segsize;
+		top = b;
+	}
+
+	if (top < 0 || top == SPACE_MAP_HISTOGRAM_SIZE - 1) {
+		msp->ms_maxsize = sm->sm_size;
+	} else {
+		msp->ms_maxsize = (1ULL << (top + 1 + sm->sm_shift)) - 1;
+		weight = weight / 2 +
+		    (weight / 2) * (contig * 100 / total) / 100;
+	}
+
 	/*
 	 * If this metaslab is one we're actively using, adjust its weight to
 	 * make it preferable to any inactive metaslab so we'll polish it off.
@@ -422,9 +678,20 @@ metaslab_activate(metaslab_t *msp, uint64_t activation_weight)
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 
 	if ((msp->ms_weight & METASLAB_ACTIVE_MASK) == 0) {
-		int error = space_map_load(sm, &metaslab_ff_ops,
+		hrtime_t start = 0;
+		int error;
+
+		if (sm->sm_loaded) {
+			MSSTAT_BUMP(mss_preload_hits);
+		} else {
+			MSSTAT_BUMP(mss_load_stalls);
+			start = gethrtime();
+		}
+		error = space_map_load(sm, zfs_metaslab_ops,
 		    SM_FREE, &msp->ms_smo,
 		    msp->ms_group->mg_vd->vdev_spa->spa_meta_objset);
+		if (start != 0)
+			MSSTAT_INCR(mss_load_stall_time, gethrtime() - start);
 		if (error) {
 			metaslab_group_sort(msp->ms_group, msp, 0);
 			return (error);
@@ -451,6 +718,29 @@ metaslab_passivate(metaslab_t *msp, uint64_t size)
 	ASSERT((msp->ms_weight & METASLAB_ACTIVE_MASK) == 0);
 }
 
+/*
+ * Rewrite the space map object from the in-core map, rather than append
+ * to it, once it is at least metaslab_condense_pct percent (200%) of the
+ * size its condensed form would be, and at least
+ * metaslab_condense_min_blocks (4) space map blocks long.  This requires
+ * the map to be loaded.
+ */
+static boolean_t
+metaslab_should_condense(metaslab_t *msp)
+{
+	space_map_t *sm = &msp->ms_map;
+	space_map_obj_t *smo = &msp->ms_smo_syncing;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (!sm->sm_loaded || smo->smo_objsize <
+	    ((uint64_t)metaslab_condense_min_blocks << SPACE_MAP_BLOCKSHIFT))
+		return (B_FALSE);
+
+	return (smo->smo_objsize * 100 >=
+	    space_map_condensed_size(sm) * metaslab_condense_pct);
+}
+
 /*
  * Write a metaslab to disk in the context of the specified transaction group.
  */
@@ -497,11 +787,10 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	space_map_walk(freemap, space_map_add, freed_map);
 
-	if (sm->sm_loaded && spa_sync_pass(spa) == 1 && smo->smo_objsize >=
-	    2 * sizeof (uint64_t) * avl_numnodes(&sm->sm_root)) {
+	if (spa_sync_pass(spa) == 1 && metaslab_should_condense(msp)) {
 		/*
-		 * The in-core space map representation is twice as compact
-		 * as the on-disk one, so it's time to condense the latter
+		 * The on-disk space map has accumulated enough records that
+		 * cancel each other out, so it's time to condense it
 		 * by generating a pure allocmap from first principles.
 		 *
 		 * This metaslab is 100% allocated,
@@ -522,6 +811,11 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 			space_map_walk(&msp->ms_allocmap[(txg + t) & TXG_MASK],
 			    space_map_remove, allocmap);
 
+		dprintf("condensing vdev %llu offset %llx: %llu bytes, "
+		    "%llu segments\n", (u_longlong_t)vd->vdev_id,
+		    (u_longlong_t)sm->sm_start, (u_longlong_t)smo->smo_objsize,
+		    (u_longlong_t)avl_numnodes(&sm->sm_root));
+
 		mutex_exit(&msp->ms_lock);
 		space_map_truncate(smo, mos, tx);
 		mutex_enter(&msp->ms_lock);
@@ -541,6 +835,39 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	dmu_tx_commit(tx);
 }
 
+/*
+ * If the map is loaded but no longer active, and it has not been
+ * preloaded or allocated from recently (or memory is short), evict
+ * it as soon as all future allocations have synced.  (If we unloaded
+ * it now and then loaded a moment later, the map wouldn't reflect
+ * those allocations.)  Keep its histogram for metaslab_weight().
+ */
+static void
+metaslab_evict(metaslab_t *msp, uint64_t txg, int pressure)
+{
+	space_map_t *sm = &msp->ms_map;
+	int t;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (!sm->sm_loaded || (msp->ms_weight & METASLAB_ACTIVE_MASK))
+		return;
+
+	if (msp->ms_access_txg > txg && !pressure)
+		return;
+
+	for (t = 1; t < TXG_CONCURRENT_STATES; t++)
+		if (msp->ms_allocmap[(txg + t) & TXG_MASK].sm_space)
+			return;
+
+	bcopy(sm->sm_histogram, msp->ms_histogram, sizeof (msp->ms_histogram));
+	space_map_unload(sm);
+
+	MSSTAT_BUMP(mss_unloads);
+	if (msp->ms_access_txg > txg)
+		MSSTAT_BUMP(mss_pressure_unloads);
+}
+
 /*
  * Called after a transaction group has completely synced to mark
  * all of the metaslab's free space as usable.
@@ -587,25 +914,98 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 
 	*smo = *smosync;
 
-	/*
-	 * If the map is loaded but no longer active, evict it as soon as all
-	 * future allocations have synced.  (If we unloaded it now and then
-	 * loaded a moment later, the map wouldn't reflect those allocations.)
-	 */
-	if (sm->sm_loaded && (msp->ms_weight & METASLAB_ACTIVE_MASK) == 0) {
-		int evictable = 1;
+	metaslab_evict(msp, txg, arc_reclaim_needed());
 
-		for (t = 1; t < TXG_CONCURRENT_STATES; t++)
-			if (msp->ms_allocmap[(txg + t) & TXG_MASK].sm_space)
-				evictable = 0;
+	metaslab_group_sort(mg, msp, metaslab_weight(msp));
 
-		if (evictable)
-			space_map_unload(sm);
-	}
+	mutex_exit(&msp->ms_lock);
+}
 
-	metaslab_group_sort(mg, msp, metaslab_weight(msp));
+static void
+metaslab_preload(void *arg)
+{
+	metaslab_t *msp = arg;
+	metaslab_group_t *mg = msp->ms_group;
+	spa_t *spa = mg->mg_vd->vdev_spa;
+	space_map_t *sm = &msp->ms_map;
 
+	mutex_enter(&msp->ms_lock);
+	if (!sm->sm_loaded && space_map_load(sm, zfs_metaslab_ops,
+	    SM_FREE, &msp->ms_smo, spa->spa_meta_objset) == 0)
+		MSSTAT_BUMP(mss_preloads);
+	msp->ms_access_txg = spa_last_synced_txg(spa) + 1 +
+	    metaslab_unload_delay;
 	mutex_exit(&msp->ms_lock);
+
+	mutex_enter(&mg->mg_lock);
+	msp->ms_preloading = B_FALSE;
+	mutex_exit(&mg->mg_lock);
+}
+
+/*
+ * Queue loads of the space maps of the metaslabs we're most likely to
+ * allocate from next.
+ */
+static void
+metaslab_group_preload(metaslab_group_t *mg)
+{
+	avl_tree_t *t = &mg->mg_metaslab_tree;
+	metaslab_t *msp;
+	int m = 0;
+
+	mutex_enter(&mg->mg_lock);
+	for (msp = avl_first(t); msp != NULL && m < metaslab_preload_limit;
+	    msp = AVL_NEXT(t, msp), m++) {
+		if (msp->ms_weight == 0)
+			break;
+
+		/*
+		 * Unlocked checks of ms_map: at worst we queue a preload
+		 * that finds the map already loaded.
+		 */
+		if (msp->ms_preloading || msp->ms_map.sm_loaded ||
+		    (msp->ms_weight & METASLAB_ACTIVE_MASK))
+			continue;
+
+		msp->ms_preloading = B_TRUE;
+		if (taskq_dispatch(mg->mg_taskq, metaslab_preload,
+		    msp, TQ_NOSLEEP) == 0)
+			msp->ms_preloading = B_FALSE;
+	}
+	mutex_exit(&mg->mg_lock);
+}
+
+/*
+ * Called from syncing context once 'txg' has synced and all its dirty
+ * metaslabs have been through metaslab_sync_done(): unload the maps that
+ * have gone unused, then preload the ones we'll want next.
+ */
+void
+metaslab_sync_reassess(metaslab_group_t *mg, uint64_t txg)
+{
+	vdev_t *vd = mg->mg_vd;
+	int pressure = arc_reclaim_needed();
+	int m;
+
+	for (m = 0; m < vd->vdev_ms_count; m++) {
+		metaslab_t *msp = vd->vdev_ms[m];
+
+		if (!msp->ms_map.sm_loaded)
+			continue;
+
+		mutex_enter(&msp->ms_lock);
+		metaslab_evict(msp, txg, pressure);
+		mutex_exit(&msp->ms_lock);
+	}
+
+	if (metaslab_preload_enabled && !pressure)
+		metaslab_group_preload(mg);
+}
+
+void
+metaslab_group_preload_wait(metaslab_group_t *mg)
+{
+	taskq_wait(mg->mg_taskq);
 }
 
 static uint64_t
@@ -649,6 +1049,9 @@ metaslab_group_alloc(metaslab_group_t *mg, uint64_t size, uint64_t txg,
 				return (-1ULL);
 			}
 
+			if (msp->ms_maxsize < size)
+				continue;
+
 			if (activation_weight == METASLAB_WEIGHT_PRIMARY)
 				break;
 
@@ -703,6 +1106,8 @@ metaslab_group_alloc(metaslab_group_t *mg, uint64_t size, uint64_t txg,
 	if (msp->ms_allocmap[txg & TXG_MASK].sm_space == 0)
 		vdev_dirty(mg->mg_vd, VDD_METASLAB, msp, txg);
 
+	msp->ms_access_txg = txg + metaslab_unload_delay;
+
 	space_map_add(&msp->ms_allocmap[txg & TXG_MASK], offset, size);
 
 	mutex_exit(&msp->ms_lock);
@@ -876,6 +1281,17 @@ metaslab_free_dva(spa_t *spa, const dva_t *dva, uint64_t txg, boolean_t now)
 
 	mutex_enter(&msp->ms_lock);
 
+	/*
+	 * A free into an unloaded map may join free segments, so the
+	 * histogram taken at unload no longer bounds what the map holds.
+	 * Forget it, so that the metaslab is neither passed over for large
+	 * allocations nor weighted as fragmented until it is loaded again.
+	 */
+	if (!msp->ms_map.sm_loaded) {
+		bzero(msp->ms_histogram, sizeof (msp->ms_histogram));
+		msp->ms_maxsize = msp->ms_map.sm_size;
+	}
+
 	if (now) {
 		space_map_remove(&msp->ms_allocmap[txg & TXG_MASK],
 		    offset, size);
@@ -997,6 +1413,15 @@ metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize, blkptr_t *bp,
 	ASSERT(error == 0);
 	ASSERT(BP_GET_NDVAS(bp) == ndvas);
 
+	/*
+	 * Charge allocations made by spa_sync() to its txg history record.
+	 */
+	if (txg == spa->spa_syncing_txg) {
+		for (d = 0; d < ndvas; d++)
+			atomic_add_64(&spa->spa_sync_written,
+			    DVA_GET_ASIZE(&dva[d]));
+	}
+
 	return (0);
 }
 
@@ -1011,6 +1436,9 @@ metaslab_free(spa_t *spa, const blkptr_t *bp, uint64_t txg, boolean_t now)
 
 	for (d = 0; d < ndvas; d++)
 		metaslab_free_dva(spa, &dva[d], txg, now);
+
+	if (!now && txg == spa->spa_syncing_txg)
+		atomic_add_64(&spa->spa_sync_freed, 1);
 }
 
 int
@@ -29,6 +29,11 @@
 #include <sys/zfs_context.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
+#include <sys/zfs_simd.h>
+
+#ifdef ZFS_SIMD
+#include <immintrin.h>
+#endif
 
 /*
  * SHA-256 checksum, as specified in FIPS 180-3, available at:
@@ -36,6 +41,10 @@
  *
  * This is a very compact implementation of SHA-256.
  * It is designed to be simple and portable, not to be fast.
+ *
+ * Where the processor has the SHA extensions, the compression function is
+ * instead run on those (see SHA256TransformSHANI()). The generic C code
+ * remains the reference; ztest checks that the implementations agree.
  */
 
 /*
@@ -99,28 +108,170 @@ SHA256Transform(uint32_t *H, const uint8_t *cp)
 	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
 }
 
+static void
+SHA256TransformGeneric(uint32_t *H, const uint8_t *cp, uint64_t blocks)
+{
+	for (; blocks != 0; blocks--, cp += 64)
+		SHA256Transform(H, cp);
+}
+
+static boolean_t
+sha256_generic_supported(void)
+{
+	return (B_TRUE);
+}
+
+#ifdef ZFS_SIMD
+
+/*
+ * SHA-256 compression using the SHA extensions. The state is kept in two
+ * registers in the order the sha256rnds2 instruction wants (ABEF and CDGH)
+ * across all blocks, and each instruction pair performs four rounds. The
+ * message schedule is computed four words at a time in W[i & 3].
+ */
+static void __attribute__((target("sha,ssse3,sse4.1")))
+SHA256TransformSHANI(uint32_t *H, const uint8_t *cp, uint64_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	    0x0405060700010203ULL);
+	__m128i state0, state1, abef, cdgh, msg, tmp, W[4];
+	int i;
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&H[0]), 0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&H[4]),
+	    0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for (; blocks != 0; blocks--, cp += 64) {
+		abef = state0;
+		cdgh = state1;
+
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				W[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+				    (const __m128i *)(cp + 16 * i)), bswap);
+			} else {
+				tmp = _mm_sha256msg1_epu32(W[i & 3],
+				    W[(i + 1) & 3]);
+				tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(
+				    W[(i + 3) & 3], W[(i + 2) & 3], 4));
+				W[i & 3] = _mm_sha256msg2_epu32(tmp,
+				    W[(i + 3) & 3]);
+			}
+			msg = _mm_add_epi32(W[i & 3],
+			    _mm_loadu_si128((const __m128i *)&SHA256_K[4 * i]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *)&H[0], state0);
+	_mm_storeu_si128((__m128i *)&H[4], state1);
+}
+
+#endif	/* ZFS_SIMD */
+
+typedef struct sha256_ops {
+	void		(*sha_transform)(uint32_t *, const uint8_t *, uint64_t);
+	boolean_t	(*sha_supported)(void);
+	const char	*sha_name;
+} sha256_ops_t;
+
+/*
+ * Implementations in increasing order of preference.
+ */
+static const sha256_ops_t sha256_impls[] = {
+	{ SHA256TransformGeneric,	sha256_generic_supported,	"generic" },
+#ifdef ZFS_SIMD
+	{ SHA256TransformSHANI,		zfs_shani_available,		"shani" },
+#endif
+};
+
+#define	SHA256_IMPLS	(sizeof (sha256_impls) / sizeof (sha256_impls[0]))
+
+int zfs_sha256_impl = -1;		/* -1: fastest supported */
+
+static const sha256_ops_t *sha256_impl = &sha256_impls[0];
+
+/*
+ * Select the SHA-256 implementation. This is called from
+ * zio_checksum_init(), and again whenever zfs_sha256_impl is changed.
+ */
 void
-zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
+sha256_init(void)
+{
+	const sha256_ops_t *impl = &sha256_impls[0];
+	int i;
+
+	if (zfs_sha256_impl >= 0 && zfs_sha256_impl < SHA256_IMPLS &&
+	    sha256_impls[zfs_sha256_impl].sha_supported()) {
+		impl = &sha256_impls[zfs_sha256_impl];
+	} else {
+		for (i = SHA256_IMPLS - 1; i >= 0; i--) {
+			if (sha256_impls[i].sha_supported()) {
+				impl = &sha256_impls[i];
+				break;
+			}
+		}
+	}
+
+	sha256_impl = impl;
+}
+
+/*
+ * Return the name of SHA-256 implementation 'impl', or NULL if there is no
+ * such implementation.
+ */
+const char *
+sha256_impl_name(int impl)
+{
+	if (impl < 0 || impl >= SHA256_IMPLS)
+		return (NULL);
+	return (sha256_impls[impl].sha_name);
+}
+
+/*
+ * Return B_TRUE if SHA-256 implementation 'impl' can run here.
+ */
+boolean_t
+sha256_impl_supported(int impl)
+{
+	if (impl < 0 || impl >= SHA256_IMPLS)
+		return (B_FALSE);
+	return (sha256_impls[impl].sha_supported());
+}
+
+static void
+zio_checksum_SHA256_common(const sha256_ops_t *ops, const void *buf,
+    uint64_t size, zio_cksum_t *zcp)
 {
 	uint32_t H[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
 	    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
 	uint8_t pad[128];
-	int i, padsize;
+	uint64_t i;
+	int padsize;
 
-	for (i = 0; i < (size & ~63ULL); i += 64)
-		SHA256Transform(H, (uint8_t *)buf + i);
+	ops->sha_transform(H, buf, size >> 6);
 
-	for (padsize = 0; i < size; i++)
+	for (padsize = 0, i = size & ~63ULL; i < size; i++)
 		pad[padsize++] = *((uint8_t *)buf + i);
 
 	for (pad[padsize++] = 0x80; (padsize & 63) != 56; padsize++)
 		pad[padsize] = 0;
 
-	for (i = 56; i >= 0; i -= 8)
-		pad[padsize++] = (size << 3) >> i;
+	for (i = 0; i < 64; i += 8)
+		pad[padsize++] = (size << 3) >> (56 - i);
 
-	for (i = 0; i < padsize; i += 64)
-		SHA256Transform(H, pad + i);
+	ops->sha_transform(H, pad, padsize >> 6);
 
 	ZIO_SET_CHECKSUM(zcp,
 	    (uint64_t)H[0] << 32 | H[1],
@@ -128,3 +279,26 @@ zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	    (uint64_t)H[4] << 32 | H[5],
 	    (uint64_t)H[6] << 32 | H[7]);
 }
+
+/*
+ * Checksum 'buf' with a specific implementation, for verification and
+ * benchmarking. Returns ENOTSUP if the processor can't run it.
+ */
+int
+sha256_impl_checksum(int impl, const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	if (impl < 0 || impl >= SHA256_IMPLS)
+		return (EINVAL);
+	if (!sha256_impl_supported(impl))
+		return (ENOTSUP);
+
+	zio_checksum_SHA256_common(&sha256_impls[impl], buf, size, zcp);
+	return (0);
+}
+
+void
+zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	zio_checksum_SHA256_common(sha256_impl, buf, size, zcp);
+}
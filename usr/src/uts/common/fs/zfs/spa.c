@@ -40,6 +40,7 @@
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
 #include <sys/zio_compress.h>
+#include <sys/arc.h>
 #include <sys/dmu.h>
 #include <sys/dmu_tx.h>
 #include <sys/zap.h>
@@ -64,6 +65,27 @@
 
 int zio_taskq_threads = 8;
 
+/*
+ * Number of synced txgs kept in each pool's spa_txg_history ring;
+ * zero disables the history.
+ */
+int zfs_txg_history = 128;
+
+static spa_sync_stats_t spa_sync_stats_template = {
+	{ "txg",		KSTAT_DATA_UINT64 },
+	{ "passes",		KSTAT_DATA_UINT64 },
+	{ "total_ns",		KSTAT_DATA_UINT64 },
+	{
+		{ "deferred_ns",	KSTAT_DATA_UINT64 },
+		{ "config_ns",		KSTAT_DATA_UINT64 },
+		{ "datasets_ns",	KSTAT_DATA_UINT64 },
+		{ "mos_ns",		KSTAT_DATA_UINT64 },
+		{ "vdevs_ns",		KSTAT_DATA_UINT64 },
+		{ "uberblock_ns",	KSTAT_DATA_UINT64 },
+		{ "cleanup_ns",		KSTAT_DATA_UINT64 }
+	}
+};
+
 /*
  * ==========================================================================
  * SPA state manipulation (open/create/destroy/import/export)
@@ -144,6 +166,23 @@ spa_activate(spa_t *spa)
 	avl_create(&spa->spa_errlist_last,
 	    spa_error_entry_compare, sizeof (spa_error_entry_t),
 	    offsetof(spa_error_entry_t, se_avl));
+
+	spa->spa_sync_stats = spa_sync_stats_template;
+	spa->spa_sync_ksp = kstat_create(spa_name(spa), 0, "sync", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (spa_sync_stats_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (spa->spa_sync_ksp != NULL) {
+		spa->spa_sync_ksp->ks_data = &spa->spa_sync_stats;
+		kstat_install(spa->spa_sync_ksp);
+	}
+
+	if (zfs_txg_history > 0) {
+		spa->spa_txg_history_size = zfs_txg_history;
+		spa->spa_txg_history = kmem_zalloc(zfs_txg_history *
+		    sizeof (spa_txg_stat_t), KM_SLEEP);
+	}
+	spa->spa_txg_history_next = 0;
+	spa->spa_txg_history_count = 0;
 }
 
 /*
@@ -187,6 +226,21 @@ spa_deactivate(spa_t *spa)
 	avl_destroy(&spa->spa_errlist_scrub);
 	avl_destroy(&spa->spa_errlist_last);
 
+	if (spa->spa_sync_ksp != NULL) {
+		kstat_delete(spa->spa_sync_ksp);
+		spa->spa_sync_ksp = NULL;
+	}
+
+	if (spa->spa_txg_history != NULL) {
+		mutex_enter(&spa->spa_txg_history_lock);
+		kmem_free(spa->spa_txg_history, spa->spa_txg_history_size *
+		    sizeof (spa_txg_stat_t));
+		spa->spa_txg_history = NULL;
+		spa->spa_txg_history_size = 0;
+		spa->spa_txg_history_count = 0;
+		mutex_exit(&spa->spa_txg_history_lock);
+	}
+
 	spa->spa_state = POOL_STATE_UNINITIALIZED;
 }
 
@@ -245,6 +299,12 @@ spa_unload(spa_t *spa)
 	 */
 	spa_async_suspend(spa);
 
+	/*
+	 * Stop the level 2 ARC from using our cache devices.
+	 */
+	for (i = 0; i < spa->spa_nl2cache; i++)
+		l2arc_remove_vdev(spa->spa_l2cache[i]);
+
 	/*
 	 * Stop syncing.
 	 */
@@ -253,6 +313,19 @@ spa_unload(spa_t *spa)
 		spa->spa_sync_on = B_FALSE;
 	}
 
+	/*
+	 * Wait for metaslab preloads, which read the MOS, to complete.
+	 */
+	if (spa->spa_root_vdev != NULL) {
+		vdev_t *rvd = spa->spa_root_vdev;
+		int c;
+
+		for (c = 0; c < rvd->vdev_children; c++)
+			if (rvd->vdev_child[c]->vdev_mg != NULL)
+				metaslab_group_preload_wait(
+				    rvd->vdev_child[c]->vdev_mg);
+	}
+
 	/*
 	 * Wait for any outstanding prefetch I/O to complete.
 	 */
@@ -285,6 +358,19 @@ spa_unload(spa_t *spa)
 		spa->spa_sparelist = NULL;
 	}
 
+	for (i = 0; i < spa->spa_nl2cache; i++)
+		vdev_free(spa->spa_l2cache[i]);
+	if (spa->spa_l2cache) {
+		kmem_free(spa->spa_l2cache,
+		    spa->spa_nl2cache * sizeof (void *));
+		spa->spa_l2cache = NULL;
+	}
+	spa->spa_nl2cache = 0;
+	if (spa->spa_l2cachelist) {
+		nvlist_free(spa->spa_l2cachelist);
+		spa->spa_l2cachelist = NULL;
+	}
+
 	spa->spa_async_suspended = 0;
 }
 
@@ -394,6 +480,105 @@ spa_load_spares(spa_t *spa)
 	kmem_free(spares, spa->spa_nspares * sizeof (void *));
 }
 
+/*
+ * Load (or re-load) the current list of level 2 ARC devices for this pool
+ * from 'spa_l2cachelist'.  Unlike spares, devices which are still on the list
+ * keep their vdev, so that what they hold remains valid in the L2ARC.  New
+ * devices are opened and handed to the L2ARC, and devices which have left the
+ * list are freed.  As with spares, the list is then re-generated with status
+ * information.
+ */
+static void
+spa_load_l2cache(spa_t *spa)
+{
+	nvlist_t **l2cache;
+	uint_t nl2cache;
+	int i, j, oldnvdevs;
+	uint64_t guid;
+	vdev_t *vd, **oldvdevs, **newvdevs;
+
+	ASSERT(spa_config_held(spa, RW_WRITER));
+
+	if (spa->spa_l2cachelist == NULL)
+		nl2cache = 0;
+	else
+		VERIFY(nvlist_lookup_nvlist_array(spa->spa_l2cachelist,
+		    ZPOOL_CONFIG_L2CACHE, &l2cache, &nl2cache) == 0);
+
+	oldvdevs = spa->spa_l2cache;
+	oldnvdevs = spa->spa_nl2cache;
+	newvdevs = NULL;
+	if (nl2cache != 0)
+		newvdevs = kmem_alloc(nl2cache * sizeof (void *), KM_SLEEP);
+
+	for (i = 0; i < nl2cache; i++) {
+		VERIFY(nvlist_lookup_uint64(l2cache[i], ZPOOL_CONFIG_GUID,
+		    &guid) == 0);
+
+		vd = NULL;
+		for (j = 0; j < oldnvdevs; j++) {
+			if (oldvdevs[j] != NULL &&
+			    oldvdevs[j]->vdev_guid == guid) {
+				vd = oldvdevs[j];
+				oldvdevs[j] = NULL;
+				break;
+			}
+		}
+
+		if (vd == NULL) {
+			VERIFY(spa_config_parse(spa, &vd, l2cache[i], NULL, 0,
+			    VDEV_ALLOC_L2CACHE) == 0);
+			ASSERT(vd != NULL);
+			spa_l2cache_add(vd);
+			vd->vdev_top = vd;
+
+			/*
+			 * A pool which is only being examined for import must
+			 * not have its cache devices written to.
+			 */
+			if (vdev_open(vd) == 0 && (spa_mode & FWRITE) &&
+			    spa->spa_load_state != SPA_LOAD_TRYIMPORT)
+				l2arc_add_vdev(spa, vd);
+		}
+
+		newvdevs[i] = vd;
+	}
+
+	/*
+	 * Whatever is left has been removed from the pool.  spa_vdev_remove()
+	 * will already have taken it out of the L2ARC, since that must not
+	 * wait for the device's I/O with the config lock held as writer.
+	 */
+	for (j = 0; j < oldnvdevs; j++) {
+		if ((vd = oldvdevs[j]) == NULL)
+			continue;
+		l2arc_remove_vdev(vd);
+		vdev_close(vd);
+		vdev_free(vd);
+	}
+	if (oldvdevs)
+		kmem_free(oldvdevs, oldnvdevs * sizeof (void *));
+
+	spa->spa_l2cache = newvdevs;
+	spa->spa_nl2cache = (int)nl2cache;
+
+	if (nl2cache == 0)
+		return;
+
+	VERIFY(nvlist_remove(spa->spa_l2cachelist, ZPOOL_CONFIG_L2CACHE,
+	    DATA_TYPE_NVLIST_ARRAY) == 0);
+
+	l2cache = kmem_alloc(nl2cache * sizeof (void *), KM_SLEEP);
+	for (i = 0; i < nl2cache; i++)
+		l2cache[i] = vdev_config_generate(spa, newvdevs[i],
+		    B_TRUE, B_TRUE);
+	VERIFY(nvlist_add_nvlist_array(spa->spa_l2cachelist,
+	    ZPOOL_CONFIG_L2CACHE, l2cache, nl2cache) == 0);
+	for (i = 0; i < nl2cache; i++)
+		nvlist_free(l2cache[i]);
+	kmem_free(l2cache, nl2cache * sizeof (void *));
+}
+
 static int
 load_nvlist(spa_t *spa, uint64_t obj, nvlist_t **value)
 {
@@ -711,6 +896,48 @@ spa_load(spa_t *spa, nvlist_t *config, spa_load_state_t state, int mosconfig)
 		spa_config_exit(spa, FTAG);
 	}
 
+	/*
+	 * Load any level 2 ARC devices for this pool.
+	 */
+	error = zap_lookup(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_L2CACHE, sizeof (uint64_t), 1, &spa->spa_l2cache_object);
+	if (error != 0 && error != ENOENT) {
+		vdev_set_state(rvd, B_TRUE, VDEV_STATE_CANT_OPEN,
+		    VDEV_AUX_CORRUPT_DATA);
+		error = EIO;
+		goto out;
+	}
+	if (error == 0) {
+		if (load_nvlist(spa, spa->spa_l2cache_object,
+		    &spa->spa_l2cachelist) != 0) {
+			vdev_set_state(rvd, B_TRUE, VDEV_STATE_CANT_OPEN,
+			    VDEV_AUX_CORRUPT_DATA);
+			error = EIO;
+			goto out;
+		}
+
+		spa_config_enter(spa, RW_WRITER, FTAG);
+		spa_load_l2cache(spa);
+		spa_config_exit(spa, FTAG);
+	}
+
+	/*
+	 * Load the position of an interrupted scrub or resilver, if any.
+	 * spa_scrub() resumes from it if it still applies.  A position we
+	 * can't read just means starting over, so errors are ignored.  The
+	 * entry needs no version: older code never looks it up, and a
+	 * position it leaves behind is only resumed if the scrub it
+	 * describes still applies.
+	 */
+	error = zap_lookup(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_SCRUB_POSITION, sizeof (uint64_t),
+	    sizeof (pool_scrub_position_t) / sizeof (uint64_t),
+	    &spa->spa_scrub_saved);
+	spa->spa_scrub_saved_valid = (error == 0);
+	spa->spa_scrub_saved_dirty = B_FALSE;
+	spa->spa_scrub_saved_txg = 0;
+	bzero(&spa->spa_scrub_resumed, sizeof (pool_scrub_position_t));
+
 	spa->spa_delegation = zfs_prop_default_numeric(ZPOOL_PROP_DELEGATION);
 
 	error = zap_lookup(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
@@ -822,6 +1049,20 @@ out:
 	return (error);
 }
 
+/*
+ * The scrub to start when a pool is loaded: the saved scrub if there is
+ * one, otherwise a resilver of anything that's out of date.
+ */
+static pool_scrub_type_t
+spa_scrub_load_type(spa_t *spa)
+{
+	if (spa->spa_scrub_saved_valid &&
+	    spa->spa_scrub_saved.psp_type == POOL_SCRUB_EVERYTHING)
+		return (POOL_SCRUB_EVERYTHING);
+
+	return (POOL_SCRUB_RESILVER);
+}
+
 /*
  * Pool Open/Import
  *
@@ -914,10 +1155,11 @@ spa_open_common(const char *pool, spa_t **spapp, void *tag, nvlist_t **config)
 	spa_open_ref(spa, tag);
 
 	/*
-	 * If we just loaded the pool, resilver anything that's out of date.
+	 * If we just loaded the pool, resilver anything that's out of date,
+	 * or resume the scrub that was running when it was last exported.
 	 */
 	if (loaded && (spa_mode & FWRITE))
-		VERIFY(spa_scrub(spa, POOL_SCRUB_RESILVER, B_TRUE) == 0);
+		VERIFY(spa_scrub(spa, spa_scrub_load_type(spa), B_TRUE) == 0);
 
 	if (locked)
 		mutex_exit(&spa_namespace_lock);
@@ -1010,6 +1252,59 @@ spa_add_spares(spa_t *spa, nvlist_t *config)
 	}
 }
 
+static void
+spa_add_l2cache(spa_t *spa, nvlist_t *config)
+{
+	nvlist_t **l2cache;
+	uint_t i, j, nl2cache;
+	nvlist_t *nvroot;
+	uint64_t guid;
+	vdev_t *vd;
+	vdev_stat_t *vs;
+	uint_t vsc;
+
+	if (spa->spa_nl2cache == 0)
+		return;
+
+	spa_config_enter(spa, RW_READER, FTAG);
+
+	VERIFY(nvlist_lookup_nvlist(config,
+	    ZPOOL_CONFIG_VDEV_TREE, &nvroot) == 0);
+	VERIFY(nvlist_lookup_nvlist_array(spa->spa_l2cachelist,
+	    ZPOOL_CONFIG_L2CACHE, &l2cache, &nl2cache) == 0);
+	if (nl2cache != 0) {
+		VERIFY(nvlist_add_nvlist_array(nvroot,
+		    ZPOOL_CONFIG_L2CACHE, l2cache, nl2cache) == 0);
+		VERIFY(nvlist_lookup_nvlist_array(nvroot,
+		    ZPOOL_CONFIG_L2CACHE, &l2cache, &nl2cache) == 0);
+
+		/*
+		 * The stashed list only has the status from when the devices
+		 * were loaded.  Update it from the live vdevs, so that the
+		 * I/O the L2ARC has done to them shows up.
+		 */
+		for (i = 0; i < nl2cache; i++) {
+			VERIFY(nvlist_lookup_uint64(l2cache[i],
+			    ZPOOL_CONFIG_GUID, &guid) == 0);
+
+			vd = NULL;
+			for (j = 0; j < spa->spa_nl2cache; j++) {
+				if (spa->spa_l2cache[j]->vdev_guid == guid) {
+					vd = spa->spa_l2cache[j];
+					break;
+				}
+			}
+			ASSERT(vd != NULL);
+
+			VERIFY(nvlist_lookup_uint64_array(l2cache[i],
+			    ZPOOL_CONFIG_STATS, (uint64_t **)&vs, &vsc) == 0);
+			vdev_get_stats(vd, vs);
+		}
+	}
+
+	spa_config_exit(spa, FTAG);
+}
+
 int
 spa_get_stats(const char *name, nvlist_t **config, char *altroot, size_t buflen)
 {
@@ -1024,6 +1319,16 @@ spa_get_stats(const char *name, nvlist_t **config, char *altroot, size_t buflen)
 		    spa_get_errlog_size(spa)) == 0);
 
 		spa_add_spares(spa, *config);
+		spa_add_l2cache(spa, *config);
+
+		mutex_enter(&spa->spa_scrub_lock);
+		if (spa->spa_scrub_resumed.psp_type != POOL_SCRUB_NONE)
+			VERIFY(nvlist_add_uint64_array(*config,
+			    ZPOOL_CONFIG_SCRUB_RESUMED,
+			    (uint64_t *)&spa->spa_scrub_resumed,
+			    sizeof (pool_scrub_position_t) /
+			    sizeof (uint64_t)) == 0);
+		mutex_exit(&spa->spa_scrub_lock);
 	}
 
 	/*
@@ -1052,77 +1357,101 @@ spa_get_stats(const char *name, nvlist_t **config, char *altroot, size_t buflen)
 }
 
 /*
- * Validate that the 'spares' array is well formed.  We must have an array of
- * nvlists, each which describes a valid leaf vdev.  If this is an import (mode
- * is VDEV_ALLOC_SPARE), then we allow corrupted spares to be specified, as long
- * as they are well-formed.
+ * Validate that an array of auxiliary devices ('spares' or 'l2cache') is well
+ * formed.  We must have an array of nvlists, each which describes a valid leaf
+ * vdev.  If this is an import (mode is VDEV_ALLOC_SPARE), then we allow
+ * corrupted spares to be specified, as long as they are well-formed.
  */
 static int
-spa_validate_spares(spa_t *spa, nvlist_t *nvroot, uint64_t crtxg, int mode)
+spa_validate_aux_devs(spa_t *spa, nvlist_t *nvroot, uint64_t crtxg, int mode,
+    const char *config, vdev_labeltype_t label)
 {
-	nvlist_t **spares;
-	uint_t i, nspares;
+	nvlist_t **dev;
+	uint_t i, ndev;
 	vdev_t *vd;
 	int error;
 
 	/*
-	 * It's acceptable to have no spares specified.
+	 * It's acceptable to have no devices specified.
 	 */
-	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES,
-	    &spares, &nspares) != 0)
+	if (nvlist_lookup_nvlist_array(nvroot, config, &dev, &ndev) != 0)
 		return (0);
 
-	if (nspares == 0)
+	if (ndev == 0)
 		return (EINVAL);
 
-	/*
-	 * Make sure the pool is formatted with a version that supports hot
-	 * spares.
-	 */
-	if (spa_version(spa) < SPA_VERSION_SPARES)
-		return (ENOTSUP);
-
-	/*
-	 * Set the pending spare list so we correctly handle device in-use
-	 * checking.
-	 */
-	spa->spa_pending_spares = spares;
-	spa->spa_pending_nspares = nspares;
-
-	for (i = 0; i < nspares; i++) {
-		if ((error = spa_config_parse(spa, &vd, spares[i], NULL, 0,
+	for (i = 0; i < ndev; i++) {
+		if ((error = spa_config_parse(spa, &vd, dev[i], NULL, 0,
 		    mode)) != 0)
-			goto out;
+			return (error);
 
 		if (!vd->vdev_ops->vdev_op_leaf) {
 			vdev_free(vd);
-			error = EINVAL;
-			goto out;
+			return (EINVAL);
 		}
 
 		vd->vdev_top = vd;
 
 		if ((error = vdev_open(vd)) == 0 &&
-		    (error = vdev_label_init(vd, crtxg,
-		    VDEV_LABEL_SPARE)) == 0) {
-			VERIFY(nvlist_add_uint64(spares[i], ZPOOL_CONFIG_GUID,
+		    (error = vdev_label_init(vd, crtxg, label)) == 0) {
+			VERIFY(nvlist_add_uint64(dev[i], ZPOOL_CONFIG_GUID,
 			    vd->vdev_guid) == 0);
 		}
 
 		vdev_free(vd);
 
 		if (error && mode != VDEV_ALLOC_SPARE)
-			goto out;
-		else
-			error = 0;
+			return (error);
 	}
 
-out:
+	return (0);
+}
+
+static int
+spa_validate_spares(spa_t *spa, nvlist_t *nvroot, uint64_t crtxg, int mode)
+{
+	nvlist_t **spares;
+	uint_t nspares;
+	int error;
+
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES,
+	    &spares, &nspares) != 0)
+		return (0);
+
+	/*
+	 * Make sure the pool is formatted with a version that supports hot
+	 * spares.
+	 */
+	if (spa_version(spa) < SPA_VERSION_SPARES)
+		return (ENOTSUP);
+
+	/*
+	 * Set the pending spare list so we correctly handle device in-use
+	 * checking.
+	 */
+	spa->spa_pending_spares = spares;
+	spa->spa_pending_nspares = nspares;
+
+	error = spa_validate_aux_devs(spa, nvroot, crtxg, mode,
+	    ZPOOL_CONFIG_SPARES, VDEV_LABEL_SPARE);
+
 	spa->spa_pending_spares = NULL;
 	spa->spa_pending_nspares = 0;
 	return (error);
 }
 
+/*
+ * Level 2 ARC devices hold nothing the pool depends on, so they need no
+ * particular pool version.  In-use checking of devices listed twice is handled
+ * by vdev_label_init(), which tracks each device as it is labeled.
+ */
+static int
+spa_validate_l2cache(spa_t *spa, nvlist_t *nvroot, uint64_t crtxg, int mode)
+{
+	return (spa_validate_aux_devs(spa, nvroot, crtxg, mode,
+	    ZPOOL_CONFIG_L2CACHE, VDEV_LABEL_L2CACHE));
+}
+
 /*
  * Pool Creation
  */
@@ -1136,8 +1465,8 @@ spa_create(const char *pool, nvlist_t *nvroot, const char *altroot,
 	dmu_tx_t *tx;
 	int c, error = 0;
 	uint64_t txg = TXG_INITIAL;
-	nvlist_t **spares;
-	uint_t nspares;
+	nvlist_t **spares, **l2cache;
+	uint_t nspares, nl2cache;
 	nvlist_t *props = 0;
 
 	/*
@@ -1175,6 +1504,8 @@ spa_create(const char *pool, nvlist_t *nvroot, const char *altroot,
 	if (error == 0 &&
 	    (error = vdev_create(rvd, txg, B_FALSE)) == 0 &&
 	    (error = spa_validate_spares(spa, nvroot, txg,
+	    VDEV_ALLOC_ADD)) == 0 &&
+	    (error = spa_validate_l2cache(spa, nvroot, txg,
 	    VDEV_ALLOC_ADD)) == 0) {
 		for (c = 0; c < rvd->vdev_children; c++)
 			vdev_init(rvd->vdev_child[c], txg);
@@ -1206,6 +1537,21 @@ spa_create(const char *pool, nvlist_t *nvroot, const char *altroot,
 		spa->spa_sync_spares = B_TRUE;
 	}
 
+	/*
+	 * Get the list of level 2 ARC devices, if specified.
+	 */
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
+	    &l2cache, &nl2cache) == 0) {
+		VERIFY(nvlist_alloc(&spa->spa_l2cachelist, NV_UNIQUE_NAME,
+		    KM_SLEEP) == 0);
+		VERIFY(nvlist_add_nvlist_array(spa->spa_l2cachelist,
+		    ZPOOL_CONFIG_L2CACHE, l2cache, nl2cache) == 0);
+		spa_config_enter(spa, RW_WRITER, FTAG);
+		spa_load_l2cache(spa);
+		spa_config_exit(spa, FTAG);
+		spa->spa_sync_l2cache = B_TRUE;
+	}
+
 	spa->spa_dsl_pool = dp = dsl_pool_create(spa, txg);
 	spa->spa_meta_objset = dp->dp_meta_objset;
 
@@ -1379,10 +1725,10 @@ spa_import(const char *pool, nvlist_t *config, const char *altroot)
 		spa_config_update(spa, SPA_CONFIG_UPDATE_POOL);
 
 	/*
-	 * Resilver anything that's out of date.
+	 * Resilver anything that's out of date, or resume an interrupted scrub.
 	 */
 	if (spa_mode & FWRITE)
-		VERIFY(spa_scrub(spa, POOL_SCRUB_RESILVER, B_TRUE) == 0);
+		VERIFY(spa_scrub(spa, spa_scrub_load_type(spa), B_TRUE) == 0);
 
 	mutex_exit(&spa_namespace_lock);
 
@@ -1583,6 +1929,43 @@ spa_reset(char *pool)
  * ==========================================================================
  */
 
+/*
+ * Append the devices in 'devs' to the 'config' array of the auxiliary device
+ * list at *listp, creating the list if there is none yet.
+ */
+static void
+spa_add_aux_devs(nvlist_t **listp, const char *config, nvlist_t **devs,
+    uint_t ndevs)
+{
+	nvlist_t **olddevs, **newdevs;
+	uint_t i, oldndevs;
+
+	if (*listp == NULL) {
+		VERIFY(nvlist_alloc(listp, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+		VERIFY(nvlist_add_nvlist_array(*listp, config, devs,
+		    ndevs) == 0);
+		return;
+	}
+
+	VERIFY(nvlist_lookup_nvlist_array(*listp, config, &olddevs,
+	    &oldndevs) == 0);
+
+	newdevs = kmem_alloc(sizeof (void *) * (ndevs + oldndevs), KM_SLEEP);
+	for (i = 0; i < oldndevs; i++)
+		VERIFY(nvlist_dup(olddevs[i], &newdevs[i], KM_SLEEP) == 0);
+	for (i = 0; i < ndevs; i++)
+		VERIFY(nvlist_dup(devs[i], &newdevs[i + oldndevs],
+		    KM_SLEEP) == 0);
+
+	VERIFY(nvlist_remove(*listp, config, DATA_TYPE_NVLIST_ARRAY) == 0);
+
+	VERIFY(nvlist_add_nvlist_array(*listp, config, newdevs,
+	    ndevs + oldndevs) == 0);
+	for (i = 0; i < oldndevs + ndevs; i++)
+		nvlist_free(newdevs[i]);
+	kmem_free(newdevs, (oldndevs + ndevs) * sizeof (void *));
+}
+
 /*
  * Add a device to a storage pool.
  */
@@ -1593,8 +1976,8 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 	int c, error;
 	vdev_t *rvd = spa->spa_root_vdev;
 	vdev_t *vd, *tvd;
-	nvlist_t **spares;
-	uint_t i, nspares;
+	nvlist_t **spares, **l2cache;
+	uint_t nspares, nl2cache;
 
 	txg = spa_vdev_enter(spa);
 
@@ -1608,7 +1991,11 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 	    &spares, &nspares) != 0)
 		nspares = 0;
 
-	if (vd->vdev_children == 0 && nspares == 0) {
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
+	    &l2cache, &nl2cache) != 0)
+		nl2cache = 0;
+
+	if (vd->vdev_children == 0 && nspares == 0 && nl2cache == 0) {
 		spa->spa_pending_vdev = NULL;
 		return (spa_vdev_exit(spa, vd, txg, EINVAL));
 	}
@@ -1621,10 +2008,12 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 	}
 
 	/*
-	 * We must validate the spares after checking the children.  Otherwise,
-	 * vdev_inuse() will blindly overwrite the spare.
+	 * We must validate the spares and cache devices after checking the
+	 * children.  Otherwise, vdev_inuse() will blindly overwrite them.
 	 */
 	if ((error = spa_validate_spares(spa, nvroot, txg,
+	    VDEV_ALLOC_ADD)) != 0 ||
+	    (error = spa_validate_l2cache(spa, nvroot, txg,
 	    VDEV_ALLOC_ADD)) != 0) {
 		spa->spa_pending_vdev = NULL;
 		return (spa_vdev_exit(spa, vd, txg, error));
@@ -1644,45 +2033,19 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 	}
 
 	if (nspares != 0) {
-		if (spa->spa_sparelist != NULL) {
-			nvlist_t **oldspares;
-			uint_t oldnspares;
-			nvlist_t **newspares;
-
-			VERIFY(nvlist_lookup_nvlist_array(spa->spa_sparelist,
-			    ZPOOL_CONFIG_SPARES, &oldspares, &oldnspares) == 0);
-
-			newspares = kmem_alloc(sizeof (void *) *
-			    (nspares + oldnspares), KM_SLEEP);
-			for (i = 0; i < oldnspares; i++)
-				VERIFY(nvlist_dup(oldspares[i],
-				    &newspares[i], KM_SLEEP) == 0);
-			for (i = 0; i < nspares; i++)
-				VERIFY(nvlist_dup(spares[i],
-				    &newspares[i + oldnspares],
-				    KM_SLEEP) == 0);
-
-			VERIFY(nvlist_remove(spa->spa_sparelist,
-			    ZPOOL_CONFIG_SPARES, DATA_TYPE_NVLIST_ARRAY) == 0);
-
-			VERIFY(nvlist_add_nvlist_array(spa->spa_sparelist,
-			    ZPOOL_CONFIG_SPARES, newspares,
-			    nspares + oldnspares) == 0);
-			for (i = 0; i < oldnspares + nspares; i++)
-				nvlist_free(newspares[i]);
-			kmem_free(newspares, (oldnspares + nspares) *
-			    sizeof (void *));
-		} else {
-			VERIFY(nvlist_alloc(&spa->spa_sparelist,
-			    NV_UNIQUE_NAME, KM_SLEEP) == 0);
-			VERIFY(nvlist_add_nvlist_array(spa->spa_sparelist,
-			    ZPOOL_CONFIG_SPARES, spares, nspares) == 0);
-		}
-
+		spa_add_aux_devs(&spa->spa_sparelist, ZPOOL_CONFIG_SPARES,
+		    spares, nspares);
 		spa_load_spares(spa);
 		spa->spa_sync_spares = B_TRUE;
 	}
 
+	if (nl2cache != 0) {
+		spa_add_aux_devs(&spa->spa_l2cachelist, ZPOOL_CONFIG_L2CACHE,
+		    l2cache, nl2cache);
+		spa_load_l2cache(spa);
+		spa->spa_sync_l2cache = B_TRUE;
+	}
+
 	/*
 	 * We have to be careful when adding new vdevs to an existing pool.
 	 * If other threads start allocating from these vdevs before we
@@ -2089,18 +2452,61 @@ spa_vdev_detach(spa_t *spa, uint64_t guid, int replace_done)
 	return (error);
 }
 
+/*
+ * Remove the device 'dev' from the 'config' array of an auxiliary device list,
+ * whose current contents are 'devs'.
+ */
+static void
+spa_remove_aux_dev(nvlist_t *list, const char *config, nvlist_t **devs,
+    uint_t ndevs, nvlist_t *dev)
+{
+	nvlist_t **newdevs;
+	uint_t i, j;
+
+	if (ndevs == 1) {
+		newdevs = NULL;
+	} else {
+		newdevs = kmem_alloc((ndevs - 1) * sizeof (void *), KM_SLEEP);
+		for (i = 0, j = 0; i < ndevs; i++) {
+			if (devs[i] != dev)
+				VERIFY(nvlist_dup(devs[i],
+				    &newdevs[j++], KM_SLEEP) == 0);
+		}
+	}
+
+	VERIFY(nvlist_remove(list, config, DATA_TYPE_NVLIST_ARRAY) == 0);
+	VERIFY(nvlist_add_nvlist_array(list, config, newdevs, ndevs - 1) == 0);
+	for (i = 0; i < ndevs - 1; i++)
+		nvlist_free(newdevs[i]);
+	kmem_free(newdevs, (ndevs - 1) * sizeof (void *));
+}
+
 /*
  * Remove a device from the pool.  Currently, this supports removing only hot
- * spares.
+ * spares and level 2 ARC devices.
  */
 int
 spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
 {
 	vdev_t *vd;
-	nvlist_t **spares, *nv, **newspares;
-	uint_t i, j, nspares;
+	nvlist_t **spares, **l2cache, *nv;
+	uint_t i, nspares, nl2cache;
 	int ret = 0;
 
+	/*
+	 * A level 2 ARC device is first taken out of the L2ARC, which waits for
+	 * the I/O in flight to it.  That I/O may need the config lock, so this
+	 * is done holding it only as reader, which also keeps the vdev around.
+	 */
+	spa_config_enter(spa, RW_READER, FTAG);
+	for (i = 0; i < spa->spa_nl2cache; i++) {
+		if (spa->spa_l2cache[i]->vdev_guid == guid) {
+			l2arc_remove_vdev(spa->spa_l2cache[i]);
+			break;
+		}
+	}
+	spa_config_exit(spa, FTAG);
+
 	spa_config_enter(spa, RW_WRITER, FTAG);
 
 	vd = spa_lookup_by_guid(spa, guid);
@@ -2121,6 +2527,30 @@ spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
 		}
 	}
 
+	/*
+	 * Cache devices are never in use by the pool itself, so they can always
+	 * be removed.
+	 */
+	if (nv == NULL && spa->spa_l2cache != NULL &&
+	    nvlist_lookup_nvlist_array(spa->spa_l2cachelist,
+	    ZPOOL_CONFIG_L2CACHE, &l2cache, &nl2cache) == 0) {
+		for (i = 0; i < nl2cache; i++) {
+			uint64_t theguid;
+
+			VERIFY(nvlist_lookup_uint64(l2cache[i],
+			    ZPOOL_CONFIG_GUID, &theguid) == 0);
+			if (theguid != guid)
+				continue;
+
+			spa_remove_aux_dev(spa->spa_l2cachelist,
+			    ZPOOL_CONFIG_L2CACHE, l2cache, nl2cache,
+			    l2cache[i]);
+			spa_load_l2cache(spa);
+			spa->spa_sync_l2cache = B_TRUE;
+			goto out;
+		}
+	}
+
 	/*
 	 * We only support removing a hot spare, and only if it's not currently
 	 * in use in this pool.
@@ -2140,25 +2570,8 @@ spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
 		goto out;
 	}
 
-	if (nspares == 1) {
-		newspares = NULL;
-	} else {
-		newspares = kmem_alloc((nspares - 1) * sizeof (void *),
-		    KM_SLEEP);
-		for (i = 0, j = 0; i < nspares; i++) {
-			if (spares[i] != nv)
-				VERIFY(nvlist_dup(spares[i],
-				    &newspares[j++], KM_SLEEP) == 0);
-		}
-	}
-
-	VERIFY(nvlist_remove(spa->spa_sparelist, ZPOOL_CONFIG_SPARES,
-	    DATA_TYPE_NVLIST_ARRAY) == 0);
-	VERIFY(nvlist_add_nvlist_array(spa->spa_sparelist, ZPOOL_CONFIG_SPARES,
-	    newspares, nspares - 1) == 0);
-	for (i = 0; i < nspares - 1; i++)
-		nvlist_free(newspares[i]);
-	kmem_free(newspares, (nspares - 1) * sizeof (void *));
+	spa_remove_aux_dev(spa->spa_sparelist, ZPOOL_CONFIG_SPARES, spares,
+	    nspares, nv);
 	spa_load_spares(spa);
 	spa->spa_sync_spares = B_TRUE;
 
@@ -2370,6 +2783,266 @@ spa_scrub_io_start(spa_t *spa, blkptr_t *bp, int priority, int flags,
 	    spa_scrub_io_done, NULL, priority, flags, zb));
 }
 
+/*
+ * Account for a block that the scrub has finished with: either its read
+ * has been issued, or it doesn't need one.
+ */
+static void
+spa_scrub_issued(spa_t *spa, const blkptr_t *bp)
+{
+	const dva_t *dva = bp->blk_dva;
+	vdev_t *vd;
+	int d;
+
+	for (d = 0; d < BP_GET_NDVAS(bp); d++) {
+		vd = vdev_lookup_top(spa, DVA_GET_VDEV(&dva[d]));
+		if (vd == NULL)
+			continue;
+		mutex_enter(&vd->vdev_stat_lock);
+		vd->vdev_stat.vs_scrub_issued += DVA_GET_ASIZE(&dva[d]);
+		mutex_exit(&vd->vdev_stat_lock);
+	}
+}
+
+static void
+spa_scrub_issue(spa_t *spa, blkptr_t *bp, zbookmark_t *zb)
+{
+	spa_scrub_issued(spa, bp);
+
+	if (spa->spa_scrub_type == POOL_SCRUB_EVERYTHING)
+		spa_scrub_io_start(spa, bp, ZIO_PRIORITY_SCRUB,
+		    ZIO_FLAG_SCRUB, zb);
+	else
+		spa_scrub_io_start(spa, bp, ZIO_PRIORITY_RESILVER,
+		    ZIO_FLAG_RESILVER, zb);
+}
+
+/*
+ * Sorted scrub.  Reading blocks back in the order the traversal finds
+ * them turns a scrub of a fragmented pool into a stream of random reads.
+ * Instead, the traversal only gathers block pointers into a queue per
+ * top-level vdev, sorted by offset, and the queues are then read back in
+ * offset order, which the vdev queue aggregates into large sequential
+ * reads.  The queues are bounded by zfs_scrub_queue_max bytes of memory.
+ *
+ * A queued block must be read before it can be reallocated.  A block
+ * found in the pool as of ubsync txg T may be freed in T + 1, and that
+ * space is not handed back to the allocator until spa_sync() of T + 2
+ * calls vdev_sync_done(), after it has suspended the scrub.  So gathering
+ * stops as soon as T + 1 has synced, and from then on the queues are
+ * drained without letting spa_scrub_suspend() in.
+ */
+int zfs_scrub_sorted = 1;			/* sort scrub reads */
+uint64_t zfs_scrub_queue_max = 16ULL << 20;	/* queue memory, bytes */
+int zfs_scrub_issue_chunk = 64;			/* reads per vdev per turn */
+
+static int
+spa_scrub_ent_compare(const void *a, const void *b)
+{
+	const spa_scrub_ent_t *s1 = a;
+	const spa_scrub_ent_t *s2 = b;
+
+	if (s1->sse_offset < s2->sse_offset)
+		return (-1);
+	if (s1->sse_offset > s2->sse_offset)
+		return (1);
+	if ((uintptr_t)s1 < (uintptr_t)s2)
+		return (-1);
+	if ((uintptr_t)s1 > (uintptr_t)s2)
+		return (1);
+	return (0);
+}
+
+static spa_scrub_queue_t *
+spa_scrub_queue_create(spa_t *spa)
+{
+	spa_scrub_queue_t *sq;
+	uint64_t v;
+
+	sq = kmem_zalloc(sizeof (spa_scrub_queue_t), KM_SLEEP);
+	sq->sq_vdevs = spa->spa_root_vdev->vdev_children;
+	sq->sq_tree = kmem_alloc(sq->sq_vdevs * sizeof (avl_tree_t),
+	    KM_SLEEP);
+	for (v = 0; v < sq->sq_vdevs; v++)
+		avl_create(&sq->sq_tree[v], spa_scrub_ent_compare,
+		    sizeof (spa_scrub_ent_t),
+		    offsetof(spa_scrub_ent_t, sse_node));
+
+	return (sq);
+}
+
+/*
+ * Free the queue along with any blocks still in it, which is only the
+ * case if the scrub was stopped or restarted.
+ */
+static void
+spa_scrub_queue_destroy(spa_scrub_queue_t *sq)
+{
+	spa_scrub_ent_t *sse;
+	void *cookie;
+	uint64_t v;
+
+	for (v = 0; v < sq->sq_vdevs; v++) {
+		cookie = NULL;
+		while ((sse = avl_destroy_nodes(&sq->sq_tree[v],
+		    &cookie)) != NULL)
+			kmem_free(sse, sizeof (spa_scrub_ent_t));
+		avl_destroy(&sq->sq_tree[v]);
+	}
+	kmem_free(sq->sq_tree, sq->sq_vdevs * sizeof (avl_tree_t));
+	kmem_free(sq, sizeof (spa_scrub_queue_t));
+}
+
+/*
+ * Queue a block to be read later, or return B_FALSE if it must be read
+ * now.  Intent log blocks are read at once: they may be reused as soon
+ * as the log is cleaned, and they are few.
+ */
+static boolean_t
+spa_scrub_enqueue(spa_t *spa, blkptr_t *bp, zbookmark_t *zb)
+{
+	spa_scrub_queue_t *sq = spa->spa_scrub_queue;
+	spa_scrub_ent_t *sse;
+	uint64_t v = DVA_GET_VDEV(&bp->blk_dva[0]);
+
+	if (sq == NULL || v >= sq->sq_vdevs ||
+	    (zb->zb_level == -1 && BP_GET_TYPE(bp) != DMU_OT_OBJSET))
+		return (B_FALSE);
+
+	if (sq->sq_count == 0)
+		sq->sq_txg = spa_last_synced_txg(spa);
+
+	sse = kmem_alloc(sizeof (spa_scrub_ent_t), KM_SLEEP);
+	sse->sse_offset = DVA_GET_OFFSET(&bp->blk_dva[0]);
+	sse->sse_bp = *bp;
+	sse->sse_zb = *zb;
+	avl_add(&sq->sq_tree[v], sse);
+
+	if (++sq->sq_count * sizeof (spa_scrub_ent_t) >= zfs_scrub_queue_max)
+		sq->sq_draining = B_TRUE;
+
+	return (B_TRUE);
+}
+
+/*
+ * Have the queued blocks been held for as long as they safely can be?
+ * Once this is true, the queues must be drained before spa_sync() may
+ * suspend the scrub again.
+ */
+static boolean_t
+spa_scrub_queue_due(spa_t *spa)
+{
+	spa_scrub_queue_t *sq = spa->spa_scrub_queue;
+
+	return (sq != NULL && sq->sq_count != 0 &&
+	    spa_last_synced_txg(spa) > sq->sq_txg);
+}
+
+/*
+ * Issue the next zfs_scrub_issue_chunk reads from each vdev's queue, in
+ * offset order.
+ */
+static void
+spa_scrub_queue_issue(spa_t *spa)
+{
+	spa_scrub_queue_t *sq = spa->spa_scrub_queue;
+	spa_scrub_ent_t *sse;
+	avl_tree_t *t;
+	uint64_t v;
+	int i;
+
+	for (v = 0; v < sq->sq_vdevs; v++) {
+		t = &sq->sq_tree[(sq->sq_rotor + v) % sq->sq_vdevs];
+		for (i = 0; i < zfs_scrub_issue_chunk; i++) {
+			if ((sse = avl_first(t)) == NULL)
+				break;
+			avl_remove(t, sse);
+			sq->sq_count--;
+			spa_scrub_issue(spa, &sse->sse_bp, &sse->sse_zb);
+			kmem_free(sse, sizeof (spa_scrub_ent_t));
+		}
+	}
+	sq->sq_rotor++;
+
+	if (sq->sq_count == 0)
+		sq->sq_draining = B_FALSE;
+}
+
+/*
+ * The scrub position is saved in the MOS so that a scrub or resilver
+ * interrupted by export or a crash resumes where it left off instead of
+ * starting over.  spa_scrub_cursor only advances to points before which
+ * every block has been issued, and is only copied to spa_scrub_saved
+ * once those reads have completed.  While the scrub runs, the saved
+ * copy is written every zfs_scrub_save_txgs txgs.
+ */
+int zfs_scrub_save_txgs = 4;
+
+static void
+spa_scrub_position_set(pool_scrub_position_t *psp, const zbookmark_t *zb,
+    uint64_t examined)
+{
+	psp->psp_objset = zb->zb_objset;
+	psp->psp_object = zb->zb_object;
+	psp->psp_level = zb->zb_level;
+	psp->psp_blkid = zb->zb_blkid;
+	psp->psp_examined = examined;
+}
+
+static void
+spa_scrub_position_get(const pool_scrub_position_t *psp, zbookmark_t *zb)
+{
+	zb->zb_objset = psp->psp_objset;
+	zb->zb_object = psp->psp_object;
+	zb->zb_level = psp->psp_level;
+	zb->zb_blkid = psp->psp_blkid;
+}
+
+/*
+ * Advance the cursor to the traversal's position, unless blocks from
+ * before it are still waiting in the sorted queue.
+ */
+static void
+spa_scrub_cursor_update(spa_t *spa)
+{
+	spa_scrub_queue_t *sq = spa->spa_scrub_queue;
+
+	ASSERT(MUTEX_HELD(&spa->spa_scrub_lock));
+
+	if ((sq == NULL || sq->sq_count == 0) &&
+	    traverse_get_position(spa->spa_scrub_th, &spa->spa_scrub_cursor))
+		spa->spa_scrub_cursor_examined = spa->spa_scrub_examined;
+}
+
+/*
+ * With no scrub reads in flight, everything before the cursor has been
+ * read, so the cursor can be saved.
+ */
+static void
+spa_scrub_cursor_save(spa_t *spa)
+{
+	ASSERT(MUTEX_HELD(&spa->spa_scrub_lock));
+	ASSERT(spa->spa_scrub_inflight == 0);
+
+	if (spa->spa_scrub_thread == NULL || !spa->spa_scrub_saved_valid)
+		return;
+
+	spa_scrub_position_set(&spa->spa_scrub_saved, &spa->spa_scrub_cursor,
+	    spa->spa_scrub_cursor_examined);
+	spa->spa_scrub_saved_dirty = B_TRUE;
+}
+
+static void
+spa_scrub_saved_clear(spa_t *spa)
+{
+	ASSERT(MUTEX_HELD(&spa->spa_scrub_lock));
+
+	if (spa->spa_scrub_saved_valid) {
+		spa->spa_scrub_saved_valid = B_FALSE;
+		spa->spa_scrub_saved_dirty = B_TRUE;
+	}
+}
+
 /* ARGSUSED */
 static int
 spa_scrub_cb(traverse_blk_cache_t *bc, spa_t *spa, void *a)
@@ -2410,6 +3083,7 @@ spa_scrub_cb(traverse_blk_cache_t *bc, spa_t *spa, void *a)
 		mutex_enter(&vd->vdev_stat_lock);
 		vd->vdev_stat.vs_scrub_examined += DVA_GET_ASIZE(&dva[d]);
 		mutex_exit(&vd->vdev_stat_lock);
+		spa->spa_scrub_examined += DVA_GET_ASIZE(&dva[d]);
 
 		if (spa->spa_scrub_type == POOL_SCRUB_RESILVER) {
 			if (DVA_GET_GANG(&dva[d])) {
@@ -2429,12 +3103,10 @@ spa_scrub_cb(traverse_blk_cache_t *bc, spa_t *spa, void *a)
 		}
 	}
 
-	if (spa->spa_scrub_type == POOL_SCRUB_EVERYTHING)
-		spa_scrub_io_start(spa, bp, ZIO_PRIORITY_SCRUB,
-		    ZIO_FLAG_SCRUB, &bc->bc_bookmark);
-	else if (needs_resilver)
-		spa_scrub_io_start(spa, bp, ZIO_PRIORITY_RESILVER,
-		    ZIO_FLAG_RESILVER, &bc->bc_bookmark);
+	if (spa->spa_scrub_type == POOL_SCRUB_RESILVER && !needs_resilver)
+		spa_scrub_issued(spa, bp);
+	else if (!spa_scrub_enqueue(spa, bp, &bc->bc_bookmark))
+		spa_scrub_issue(spa, bp, &bc->bc_bookmark);
 
 	return (0);
 }
@@ -2447,7 +3119,7 @@ spa_scrub_thread(spa_t *spa)
 	vdev_t *rvd = spa->spa_root_vdev;
 	pool_scrub_type_t scrub_type = spa->spa_scrub_type;
 	int error = 0;
-	boolean_t complete;
+	boolean_t complete, traversed = B_FALSE;
 
 	CALLB_CPR_INIT(&cprinfo, &spa->spa_scrub_lock, callb_generic_cpr, FTAG);
 
@@ -2465,6 +3137,19 @@ spa_scrub_thread(spa_t *spa)
 	vdev_reopen(rvd);		/* purge all vdev caches */
 	vdev_config_dirty(rvd);		/* rewrite all disk labels */
 	vdev_scrub_stat_update(rvd, scrub_type, B_FALSE);
+	if (spa->spa_scrub_resumed.psp_type != POOL_SCRUB_NONE) {
+		/*
+		 * Count what was examined before we were interrupted.
+		 */
+		mutex_enter(&rvd->vdev_stat_lock);
+		rvd->vdev_stat.vs_scrub_examined =
+		    spa->spa_scrub_resumed.psp_examined;
+		rvd->vdev_stat.vs_scrub_issued =
+		    spa->spa_scrub_resumed.psp_examined;
+		mutex_exit(&rvd->vdev_stat_lock);
+	}
+	if (zfs_scrub_sorted && zfs_scrub_queue_max != 0)
+		spa->spa_scrub_queue = spa_scrub_queue_create(spa);
 	spa_config_exit(spa, FTAG);
 
 	mutex_enter(&spa->spa_scrub_lock);
@@ -2474,7 +3159,10 @@ spa_scrub_thread(spa_t *spa)
 
 	while (!spa->spa_scrub_stop) {
 		CALLB_CPR_SAFE_BEGIN(&cprinfo);
-		while (spa->spa_scrub_suspended) {
+		/*
+		 * spa_scrub_suspend() waits for due blocks to be issued.
+		 */
+		while (spa->spa_scrub_suspended && !spa_scrub_queue_due(spa)) {
 			spa->spa_scrub_active = 0;
 			cv_broadcast(&spa->spa_scrub_cv);
 			cv_wait(&spa->spa_scrub_cv, &spa->spa_scrub_lock);
@@ -2486,15 +3174,33 @@ spa_scrub_thread(spa_t *spa)
 			break;
 
 		mutex_exit(&spa->spa_scrub_lock);
-		error = traverse_more(th);
+		if (spa->spa_scrub_queue != NULL &&
+		    spa->spa_scrub_queue->sq_count != 0 &&
+		    (traversed || spa->spa_scrub_queue->sq_draining ||
+		    spa_scrub_queue_due(spa))) {
+			spa->spa_scrub_queue->sq_draining = B_TRUE;
+			spa_scrub_queue_issue(spa);
+		} else if (traversed) {
+			mutex_enter(&spa->spa_scrub_lock);
+			break;
+		} else {
+			error = traverse_more(th);
+			traversed = (error == 0);
+		}
 		mutex_enter(&spa->spa_scrub_lock);
-		if (error != EAGAIN)
+		spa_scrub_cursor_update(spa);
+		if (error != EAGAIN && !traversed)
 			break;
 	}
 
 	while (spa->spa_scrub_inflight)
 		cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
 
+	if (spa->spa_scrub_queue != NULL) {
+		spa_scrub_queue_destroy(spa->spa_scrub_queue);
+		spa->spa_scrub_queue = NULL;
+	}
+
 	spa->spa_scrub_active = 0;
 	cv_broadcast(&spa->spa_scrub_cv);
 
@@ -2526,6 +3232,18 @@ spa_scrub_thread(spa_t *spa)
 	 */
 	complete = (error == 0);
 
+	/*
+	 * Keep the saved position only if we were stopped by export or by
+	 * a forced restart, which may resume it.  A scrub restarted for a
+	 * snapshot create/delete starts over, since its position may refer
+	 * to blocks that are gone.
+	 */
+	if (error == EINTR)
+		spa_scrub_cursor_save(spa);
+	else
+		spa_scrub_saved_clear(spa);
+	bzero(&spa->spa_scrub_resumed, sizeof (pool_scrub_position_t));
+
 	dprintf("end %s to maxtxg=%llu %s, traverse=%d, %llu errors, stop=%u\n",
 	    scrub_type == POOL_SCRUB_RESILVER ? "resilver" : "scrub",
 	    spa->spa_scrub_maxtxg, complete ? "done" : "FAILED",
@@ -2575,12 +3293,13 @@ spa_scrub_suspend(spa_t *spa)
 {
 	mutex_enter(&spa->spa_scrub_lock);
 	spa->spa_scrub_suspended++;
-	while (spa->spa_scrub_active) {
+	while (spa->spa_scrub_active || spa_scrub_queue_due(spa)) {
 		cv_broadcast(&spa->spa_scrub_cv);
 		cv_wait(&spa->spa_scrub_cv, &spa->spa_scrub_lock);
 	}
 	while (spa->spa_scrub_inflight)
 		cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
+	spa_scrub_cursor_save(spa);
 	mutex_exit(&spa->spa_scrub_lock);
 }
 
@@ -2613,6 +3332,10 @@ spa_scrub(spa_t *spa, pool_scrub_type_t type, boolean_t force)
 	space_seg_t *ss;
 	uint64_t mintxg, maxtxg;
 	vdev_t *rvd = spa->spa_root_vdev;
+	pool_scrub_position_t *psp = &spa->spa_scrub_saved;
+	boolean_t stop = (type == POOL_SCRUB_NONE);
+	boolean_t resume;
+	zbookmark_t zb;
 
 	ASSERT(MUTEX_HELD(&spa_namespace_lock));
 	ASSERT(!spa_config_held(spa, RW_WRITER));
@@ -2702,13 +3425,53 @@ spa_scrub(spa_t *spa, pool_scrub_type_t type, boolean_t force)
 	spa->spa_scrub_type = type;
 	spa->spa_scrub_restart_txg = 0;
 
+	/*
+	 * A scrub stopped by the user, or a resilver with nothing left to
+	 * do, isn't resumed.  One stopped by export is.
+	 */
+	if (type == POOL_SCRUB_NONE && !(stop && force))
+		spa_scrub_saved_clear(spa);
+
 	if (type != POOL_SCRUB_NONE) {
+		/*
+		 * Resume the saved scrub if it covers the same txgs.  A scrub
+		 * only needs to cover the blocks that existed when it began,
+		 * but a resilver must cover exactly the DTL.
+		 */
+		resume = (force && spa->spa_scrub_saved_valid &&
+		    psp->psp_type == type && psp->psp_mintxg == mintxg &&
+		    (type == POOL_SCRUB_RESILVER ? psp->psp_maxtxg == maxtxg :
+		    psp->psp_maxtxg <= maxtxg));
+		if (resume)
+			maxtxg = psp->psp_maxtxg;
+
 		spa->spa_scrub_mintxg = mintxg;
 		spa->spa_scrub_maxtxg = maxtxg;
 		spa->spa_scrub_th = traverse_init(spa, spa_scrub_cb, NULL,
 		    ADVANCE_PRE | ADVANCE_PRUNE | ADVANCE_ZIL,
 		    ZIO_FLAG_CANFAIL);
 		traverse_add_pool(spa->spa_scrub_th, mintxg, maxtxg);
+
+		if (resume) {
+			spa_scrub_position_get(psp, &zb);
+			traverse_set_position(spa->spa_scrub_th, &zb);
+			spa->spa_scrub_resumed = *psp;
+		} else {
+			VERIFY(traverse_get_position(spa->spa_scrub_th, &zb));
+			psp->psp_type = type;
+			psp->psp_mintxg = mintxg;
+			psp->psp_maxtxg = maxtxg;
+			spa_scrub_position_set(psp, &zb, 0);
+			spa->spa_scrub_saved_valid = B_TRUE;
+			spa->spa_scrub_saved_dirty = B_TRUE;
+			spa->spa_scrub_saved_txg = 0;	/* write it now */
+			bzero(&spa->spa_scrub_resumed,
+			    sizeof (pool_scrub_position_t));
+		}
+		spa->spa_scrub_cursor = zb;
+		spa->spa_scrub_cursor_examined = psp->psp_examined;
+		spa->spa_scrub_examined = psp->psp_examined;
+
 		spa->spa_scrub_thread = thread_create(NULL, 0,
 		    spa_scrub_thread, spa, 0, &p0, TS_RUN, minclsyspri);
 	}
@@ -2913,53 +3676,105 @@ spa_sync_nvlist(spa_t *spa, uint64_t obj, nvlist_t *nv, dmu_tx_t *tx)
 	dmu_buf_rele(db, FTAG);
 }
 
+/*
+ * Update the MOS nvlist describing an auxiliary device list.  The validation
+ * functions will have already made sure the list is valid and the vdevs are
+ * labeled appropriately.
+ */
 static void
-spa_sync_spares(spa_t *spa, dmu_tx_t *tx)
+spa_sync_aux_dev(spa_t *spa, uint64_t *objp, const char *entry,
+    const char *config, vdev_t **vdevs, int nvdevs, dmu_tx_t *tx)
 {
 	nvlist_t *nvroot;
-	nvlist_t **spares;
+	nvlist_t **list;
 	int i;
 
-	if (!spa->spa_sync_spares)
-		return;
-
-	/*
-	 * Update the MOS nvlist describing the list of available spares.
-	 * spa_validate_spares() will have already made sure this nvlist is
-	 * valid and the vdevs are labeled appropriately.
-	 */
-	if (spa->spa_spares_object == 0) {
-		spa->spa_spares_object = dmu_object_alloc(spa->spa_meta_objset,
+	if (*objp == 0) {
+		*objp = dmu_object_alloc(spa->spa_meta_objset,
 		    DMU_OT_PACKED_NVLIST, 1 << 14,
 		    DMU_OT_PACKED_NVLIST_SIZE, sizeof (uint64_t), tx);
 		VERIFY(zap_update(spa->spa_meta_objset,
-		    DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_SPARES,
-		    sizeof (uint64_t), 1, &spa->spa_spares_object, tx) == 0);
+		    DMU_POOL_DIRECTORY_OBJECT, entry,
+		    sizeof (uint64_t), 1, objp, tx) == 0);
 	}
 
 	VERIFY(nvlist_alloc(&nvroot, NV_UNIQUE_NAME, KM_SLEEP) == 0);
-	if (spa->spa_nspares == 0) {
-		VERIFY(nvlist_add_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES,
+	if (nvdevs == 0) {
+		VERIFY(nvlist_add_nvlist_array(nvroot, config,
 		    NULL, 0) == 0);
 	} else {
-		spares = kmem_alloc(spa->spa_nspares * sizeof (void *),
-		    KM_SLEEP);
-		for (i = 0; i < spa->spa_nspares; i++)
-			spares[i] = vdev_config_generate(spa,
-			    spa->spa_spares[i], B_FALSE, B_TRUE);
-		VERIFY(nvlist_add_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES,
-		    spares, spa->spa_nspares) == 0);
-		for (i = 0; i < spa->spa_nspares; i++)
-			nvlist_free(spares[i]);
-		kmem_free(spares, spa->spa_nspares * sizeof (void *));
+		list = kmem_alloc(nvdevs * sizeof (void *), KM_SLEEP);
+		for (i = 0; i < nvdevs; i++)
+			list[i] = vdev_config_generate(spa, vdevs[i],
+			    B_FALSE, B_TRUE);
+		VERIFY(nvlist_add_nvlist_array(nvroot, config,
+		    list, nvdevs) == 0);
+		for (i = 0; i < nvdevs; i++)
+			nvlist_free(list[i]);
+		kmem_free(list, nvdevs * sizeof (void *));
 	}
 
-	spa_sync_nvlist(spa, spa->spa_spares_object, nvroot, tx);
+	spa_sync_nvlist(spa, *objp, nvroot, tx);
 	nvlist_free(nvroot);
+}
+
+static void
+spa_sync_spares(spa_t *spa, dmu_tx_t *tx)
+{
+	if (!spa->spa_sync_spares)
+		return;
+
+	spa_sync_aux_dev(spa, &spa->spa_spares_object, DMU_POOL_SPARES,
+	    ZPOOL_CONFIG_SPARES, spa->spa_spares, spa->spa_nspares, tx);
 
 	spa->spa_sync_spares = B_FALSE;
 }
 
+static void
+spa_sync_l2cache(spa_t *spa, dmu_tx_t *tx)
+{
+	if (!spa->spa_sync_l2cache)
+		return;
+
+	spa_sync_aux_dev(spa, &spa->spa_l2cache_object, DMU_POOL_L2CACHE,
+	    ZPOOL_CONFIG_L2CACHE, spa->spa_l2cache, spa->spa_nl2cache, tx);
+
+	spa->spa_sync_l2cache = B_FALSE;
+}
+
+/*
+ * Write the scrub position to the MOS, or remove it once the scrub is over.
+ */
+static void
+spa_sync_scrub_position(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	pool_scrub_position_t psp;
+	boolean_t valid;
+
+	mutex_enter(&spa->spa_scrub_lock);
+	if (!spa->spa_scrub_saved_dirty || (spa->spa_scrub_saved_valid &&
+	    spa->spa_scrub_thread != NULL && dmu_tx_get_txg(tx) <
+	    spa->spa_scrub_saved_txg + zfs_scrub_save_txgs)) {
+		mutex_exit(&spa->spa_scrub_lock);
+		return;
+	}
+	psp = spa->spa_scrub_saved;
+	valid = spa->spa_scrub_saved_valid;
+	spa->spa_scrub_saved_dirty = B_FALSE;
+	spa->spa_scrub_saved_txg = dmu_tx_get_txg(tx);
+	mutex_exit(&spa->spa_scrub_lock);
+
+	if (valid) {
+		VERIFY(zap_update(mos, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_SCRUB_POSITION, sizeof (uint64_t),
+		    sizeof (psp) / sizeof (uint64_t), &psp, tx) == 0);
+	} else {
+		(void) zap_remove(mos, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_SCRUB_POSITION, tx);
+	}
+}
+
 static void
 spa_sync_config_object(spa_t *spa, dmu_tx_t *tx)
 {
@@ -3047,6 +3862,118 @@ spa_sync_props(void *arg1, void *arg2, cred_t *cr, dmu_tx_t *tx)
 	}
 }
 
+void
+spa_sync_time(spa_t *spa, spa_sync_phase_t phase, hrtime_t ns)
+{
+	spa->spa_sync_times[phase] += ns;
+}
+
+static hrtime_t
+spa_sync_phase_end(spa_t *spa, spa_sync_phase_t phase, hrtime_t start)
+{
+	hrtime_t now = gethrtime();
+
+	spa_sync_time(spa, phase, now - start);
+	return (now);
+}
+
+static void
+spa_sync_publish(spa_t *spa, uint64_t txg, uint64_t time, hrtime_t total)
+{
+	spa_sync_stats_t *sss = &spa->spa_sync_stats;
+	spa_txg_stat_t *sts;
+	int p;
+
+	sss->sss_txg.value.ui64 = txg;
+	sss->sss_passes.value.ui64 = spa->spa_sync_pass;
+	sss->sss_total.value.ui64 = total;
+	for (p = 0; p < SPA_SYNC_PHASES; p++)
+		sss->sss_phase[p].value.ui64 = spa->spa_sync_times[p];
+
+	mutex_enter(&spa->spa_txg_history_lock);
+	if (spa->spa_txg_history != NULL) {
+		sts = &spa->spa_txg_history[spa->spa_txg_history_next];
+		sts->sts_txg = txg;
+		sts->sts_time = time;
+		sts->sts_total = total;
+		sts->sts_passes = spa->spa_sync_pass;
+		sts->sts_written = spa->spa_sync_written;
+		sts->sts_freed = spa->spa_sync_freed;
+		for (p = 0; p < SPA_SYNC_PHASES; p++)
+			sts->sts_phase[p] = spa->spa_sync_times[p];
+		for (p = 0; p < SPA_TXG_PASSES; p++)
+			sts->sts_pass[p] = spa->spa_sync_pass_times[p];
+		if (++spa->spa_txg_history_next == spa->spa_txg_history_size)
+			spa->spa_txg_history_next = 0;
+		if (spa->spa_txg_history_count < spa->spa_txg_history_size)
+			spa->spa_txg_history_count++;
+	}
+	mutex_exit(&spa->spa_txg_history_lock);
+}
+
+/*
+ * Return the txg history ring as an nvlist array of ZPOOL_TXG_RECORDs,
+ * oldest first.
+ */
+int
+spa_txg_history_get(spa_t *spa, nvlist_t **nvp)
+{
+	spa_txg_stat_t *sts;
+	nvlist_t **records;
+	int count, i, idx;
+	int error = 0;
+
+	VERIFY(nvlist_alloc(nvp, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+
+	mutex_enter(&spa->spa_txg_history_lock);
+	count = spa->spa_txg_history_count;
+	if (count == 0) {
+		mutex_exit(&spa->spa_txg_history_lock);
+		return (0);
+	}
+	records = kmem_zalloc(count * sizeof (nvlist_t *), KM_SLEEP);
+	idx = spa->spa_txg_history_next - count;
+	if (idx < 0)
+		idx += spa->spa_txg_history_size;
+	for (i = 0; i < count; i++) {
+		sts = &spa->spa_txg_history[idx];
+		VERIFY(nvlist_alloc(&records[i], NV_UNIQUE_NAME,
+		    KM_SLEEP) == 0);
+		VERIFY(nvlist_add_uint64(records[i], ZPOOL_TXG_TXG,
+		    sts->sts_txg) == 0);
+		VERIFY(nvlist_add_uint64(records[i], ZPOOL_TXG_TIME,
+		    sts->sts_time) == 0);
+		VERIFY(nvlist_add_uint64(records[i], ZPOOL_TXG_TOTAL,
+		    sts->sts_total) == 0);
+		VERIFY(nvlist_add_uint64(records[i], ZPOOL_TXG_PASSES,
+		    sts->sts_passes) == 0);
+		VERIFY(nvlist_add_uint64(records[i], ZPOOL_TXG_WRITTEN,
+		    sts->sts_written) == 0);
+		VERIFY(nvlist_add_uint64(records[i], ZPOOL_TXG_FREED,
+		    sts->sts_freed) == 0);
+		VERIFY(nvlist_add_uint64_array(records[i], ZPOOL_TXG_PHASE_NS,
+		    sts->sts_phase, SPA_SYNC_PHASES) == 0);
+		VERIFY(nvlist_add_uint64_array(records[i], ZPOOL_TXG_PASS_NS,
+		    sts->sts_pass, MIN(sts->sts_passes, SPA_TXG_PASSES)) == 0);
+		if (++idx == spa->spa_txg_history_size)
+			idx = 0;
+	}
+	mutex_exit(&spa->spa_txg_history_lock);
+
+	error = nvlist_add_nvlist_array(*nvp, ZPOOL_TXG_RECORD, records,
+	    count);
+
+	for (i = 0; i < count; i++)
+		nvlist_free(records[i]);
+	kmem_free(records, count * sizeof (nvlist_t *));
+
+	if (error != 0) {
+		nvlist_free(*nvp);
+		*nvp = NULL;
+	}
+	return (error);
+}
+
 /*
  * Sync the specified transaction group.  New blocks may be dirtied as
  * part of the process, so we iterate until it converges.
@@ -3061,6 +3988,15 @@ spa_sync(spa_t *spa, uint64_t txg)
 	vdev_t *vd;
 	dmu_tx_t *tx;
 	int dirty_vdevs;
+	uint64_t time;
+	hrtime_t start, phase, pass;
+
+	time = gethrestime_sec();
+	start = phase = gethrtime();
+	bzero(spa->spa_sync_times, sizeof (spa->spa_sync_times));
+	bzero(spa->spa_sync_pass_times, sizeof (spa->spa_sync_pass_times));
+	spa->spa_sync_written = 0;
+	spa->spa_sync_freed = 0;
 
 	/*
 	 * Lock out configuration changes.
@@ -3104,17 +4040,24 @@ spa_sync(spa_t *spa, uint64_t txg)
 	    !txg_list_empty(&dp->dp_dirty_dirs, txg) ||
 	    !txg_list_empty(&dp->dp_sync_tasks, txg))
 		spa_sync_deferred_frees(spa, txg);
+	phase = spa_sync_phase_end(spa, SPA_SYNC_DEFERRED, phase);
 
 	/*
-	 * Iterate to convergence.
+	 * Iterate to convergence.  dsl_pool_sync() times its own phases.
 	 */
 	do {
 		spa->spa_sync_pass++;
+		pass = phase;
 
 		spa_sync_config_object(spa, tx);
 		spa_sync_spares(spa, tx);
+		spa_sync_l2cache(spa, tx);
+		spa_sync_scrub_position(spa, tx);
 		spa_errlog_sync(spa, txg);
+		phase = spa_sync_phase_end(spa, SPA_SYNC_CONFIG, phase);
+
 		dsl_pool_sync(dp, txg);
+		phase = gethrtime();
 
 		dirty_vdevs = 0;
 		while (vd = txg_list_remove(&spa->spa_vdev_txg_list, txg)) {
@@ -3123,6 +4066,9 @@ spa_sync(spa_t *spa, uint64_t txg)
 		}
 
 		bplist_sync(bpl, tx);
+		phase = spa_sync_phase_end(spa, SPA_SYNC_VDEVS, phase);
+		spa->spa_sync_pass_times[MIN(spa->spa_sync_pass,
+		    SPA_TXG_PASSES) - 1] += phase - pass;
 	} while (dirty_vdevs);
 
 	bplist_close(bpl);
@@ -3157,6 +4103,7 @@ spa_sync(spa_t *spa, uint64_t txg)
 	}
 
 	dmu_tx_commit(tx);
+	phase = spa_sync_phase_end(spa, SPA_SYNC_UBERBLOCK, phase);
 
 	/*
 	 * Clear the dirty config list.
@@ -3215,6 +4162,9 @@ spa_sync(spa_t *spa, uint64_t txg)
 	 * If any async tasks have been requested, kick them off.
 	 */
 	spa_async_dispatch(spa);
+
+	(void) spa_sync_phase_end(spa, SPA_SYNC_CLEANUP, phase);
+	spa_sync_publish(spa, txg, time, gethrtime() - start);
 }
 
 /*
@@ -180,6 +180,8 @@ int spa_max_replication_override = SPA_DVAS_PER_BP;
 
 static kmutex_t spa_spare_lock;
 static avl_tree_t spa_spare_avl;
+static kmutex_t spa_l2cache_lock;
+static avl_tree_t spa_l2cache_avl;
 
 kmem_cache_t *spa_buffer_pool;
 int spa_mode;
@@ -264,6 +266,7 @@ spa_add(const char *name, const char *altroot)
 	mutex_init(&spa->spa_sync_bplist.bpl_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_history_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_props_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_txg_history_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	cv_init(&spa->spa_async_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_scrub_cv, NULL, CV_DEFAULT, NULL);
@@ -334,6 +337,7 @@ spa_remove(spa_t *spa)
 	mutex_destroy(&spa->spa_sync_bplist.bpl_lock);
 	mutex_destroy(&spa->spa_history_lock);
 	mutex_destroy(&spa->spa_props_lock);
+	mutex_destroy(&spa->spa_txg_history_lock);
 
 	kmem_free(spa, sizeof (spa_t));
 }
@@ -538,6 +542,92 @@ spa_spare_activate(vdev_t *vd)
 	mutex_exit(&spa_spare_lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA level 2 ARC device tracking
+ * ==========================================================================
+ */
+
+/*
+ * Level 2 ARC devices are tracked globally, in the same sort of reference
+ * counted AVL tree as the spares, so that vdev_inuse() can tell that a device
+ * labeled as a cache device is still in use.  Unlike a spare, a cache device
+ * belongs to a single pool; the reference count only covers the transient
+ * vdevs used to validate a device while it is being added, and the vdev
+ * opened for a tryimport.  The tree is protected by 'spa_l2cache_lock'.
+ */
+void
+spa_l2cache_add(vdev_t *vd)
+{
+	avl_index_t where;
+	spa_spare_t search;
+	spa_spare_t *l2cache;
+
+	mutex_enter(&spa_l2cache_lock);
+	ASSERT(!vd->vdev_isl2cache);
+
+	search.spare_guid = vd->vdev_guid;
+	if ((l2cache = avl_find(&spa_l2cache_avl, &search, &where)) != NULL) {
+		l2cache->spare_count++;
+	} else {
+		l2cache = kmem_zalloc(sizeof (spa_spare_t), KM_SLEEP);
+		l2cache->spare_guid = vd->vdev_guid;
+		l2cache->spare_pool = spa_guid(vd->vdev_spa);
+		l2cache->spare_count = 1;
+		avl_insert(&spa_l2cache_avl, l2cache, where);
+	}
+	vd->vdev_isl2cache = B_TRUE;
+
+	mutex_exit(&spa_l2cache_lock);
+}
+
+void
+spa_l2cache_remove(vdev_t *vd)
+{
+	spa_spare_t search;
+	spa_spare_t *l2cache;
+	avl_index_t where;
+
+	mutex_enter(&spa_l2cache_lock);
+
+	search.spare_guid = vd->vdev_guid;
+	l2cache = avl_find(&spa_l2cache_avl, &search, &where);
+
+	ASSERT(vd->vdev_isl2cache);
+	ASSERT(l2cache != NULL);
+
+	if (--l2cache->spare_count == 0) {
+		avl_remove(&spa_l2cache_avl, l2cache);
+		kmem_free(l2cache, sizeof (spa_spare_t));
+	}
+
+	vd->vdev_isl2cache = B_FALSE;
+	mutex_exit(&spa_l2cache_lock);
+}
+
+boolean_t
+spa_l2cache_exists(uint64_t guid, uint64_t *pool)
+{
+	spa_spare_t search, *found;
+	avl_index_t where;
+
+	mutex_enter(&spa_l2cache_lock);
+
+	search.spare_guid = guid;
+	found = avl_find(&spa_l2cache_avl, &search, &where);
+
+	if (pool) {
+		if (found)
+			*pool = found->spare_pool;
+		else
+			*pool = 0ULL;
+	}
+
+	mutex_exit(&spa_l2cache_lock);
+
+	return (found != NULL);
+}
+
 /*
  * ==========================================================================
  * SPA config locking
@@ -1066,6 +1156,7 @@ spa_init(int mode)
 {
 	mutex_init(&spa_namespace_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa_spare_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa_l2cache_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&spa_namespace_cv, NULL, CV_DEFAULT, NULL);
 
 	avl_create(&spa_namespace_avl, spa_name_compare, sizeof (spa_t),
@@ -1074,6 +1165,9 @@ spa_init(int mode)
 	avl_create(&spa_spare_avl, spa_spare_compare, sizeof (spa_spare_t),
 	    offsetof(spa_spare_t, spare_avl));
 
+	avl_create(&spa_l2cache_avl, spa_spare_compare, sizeof (spa_spare_t),
+	    offsetof(spa_spare_t, spare_avl));
+
 	spa_mode = mode;
 
 	refcount_init();
@@ -1081,6 +1175,7 @@ spa_init(int mode)
 	zio_init();
 	dmu_init();
 	zil_init();
+	metaslab_stat_init();
 	zfs_prop_init();
 	spa_config_load();
 }
@@ -1090,6 +1185,7 @@ spa_fini(void)
 {
 	spa_evict_all();
 
+	metaslab_stat_fini();
 	zil_fini();
 	dmu_fini();
 	zio_fini();
@@ -1098,10 +1194,12 @@ spa_fini(void)
 
 	avl_destroy(&spa_namespace_avl);
 	avl_destroy(&spa_spare_avl);
+	avl_destroy(&spa_l2cache_avl);
 
 	cv_destroy(&spa_namespace_cv);
 	mutex_destroy(&spa_namespace_lock);
 	mutex_destroy(&spa_spare_lock);
+	mutex_destroy(&spa_l2cache_lock);
 }
 
 /*
@@ -34,6 +34,13 @@
 /*
  * Space map routines.
  * NOTE: caller is responsible for all locking.
+ *
+ * A block picker may keep the segments in a second AVL tree of its own
+ * (sm_pp_root, linked through ss_pp_node), set up and torn down by its
+ * load and unload ops.  While it exists, space_map_add() and
+ * space_map_remove() keep it in step with sm_root, as they do the
+ * segment size histogram.  Both are keyed on segment size, so a segment
+ * is unlinked from them before it changes and relinked afterwards.
  */
 static int
 space_map_seg_compare(const void *x1, const void *x2)
@@ -54,6 +61,31 @@ space_map_seg_compare(const void *x1, const void *x2)
 	return (0);
 }
 
+static int
+space_map_histogram_bucket(space_map_t *sm, space_seg_t *ss)
+{
+	int b = highbit(ss->ss_end - ss->ss_start) - 1 - sm->sm_shift;
+
+	return (MIN(b, SPACE_MAP_HISTOGRAM_SIZE - 1));
+}
+
+static void
+space_map_seg_link(space_map_t *sm, space_seg_t *ss)
+{
+	sm->sm_histogram[space_map_histogram_bucket(sm, ss)]++;
+	if (sm->sm_pp_root != NULL)
+		avl_add(sm->sm_pp_root, ss);
+}
+
+static void
+space_map_seg_unlink(space_map_t *sm, space_seg_t *ss)
+{
+	ASSERT(sm->sm_histogram[space_map_histogram_bucket(sm, ss)] != 0);
+	sm->sm_histogram[space_map_histogram_bucket(sm, ss)]--;
+	if (sm->sm_pp_root != NULL)
+		avl_remove(sm->sm_pp_root, ss);
+}
+
 void
 space_map_create(space_map_t *sm, uint64_t start, uint64_t size, uint8_t shift,
 	kmutex_t *lp)
@@ -118,13 +150,20 @@ space_map_add(space_map_t *sm, uint64_t start, uint64_t size)
 	merge_after = (ss_after != NULL && ss_after->ss_start == end);
 
 	if (merge_before && merge_after) {
+		space_map_seg_unlink(sm, ss_before);
+		space_map_seg_unlink(sm, ss_after);
 		avl_remove(&sm->sm_root, ss_before);
 		ss_after->ss_start = ss_before->ss_start;
 		kmem_free(ss_before, sizeof (*ss_before));
+		ss = ss_after;
 	} else if (merge_before) {
+		space_map_seg_unlink(sm, ss_before);
 		ss_before->ss_end = end;
+		ss = ss_before;
 	} else if (merge_after) {
+		space_map_seg_unlink(sm, ss_after);
 		ss_after->ss_start = start;
+		ss = ss_after;
 	} else {
 		ss = kmem_alloc(sizeof (*ss), KM_SLEEP);
 		ss->ss_start = start;
@@ -132,6 +171,8 @@ space_map_add(space_map_t *sm, uint64_t start, uint64_t size)
 		avl_insert(&sm->sm_root, ss, where);
 	}
 
+	space_map_seg_link(sm, ss);
+
 	sm->sm_space += size;
 }
 
@@ -166,12 +207,15 @@ space_map_remove(space_map_t *sm, uint64_t start, uint64_t size)
 	left_over = (ss->ss_start != start);
 	right_over = (ss->ss_end != end);
 
+	space_map_seg_unlink(sm, ss);
+
 	if (left_over && right_over) {
 		newseg = kmem_alloc(sizeof (*newseg), KM_SLEEP);
 		newseg->ss_start = end;
 		newseg->ss_end = ss->ss_end;
 		ss->ss_end = start;
 		avl_insert_here(&sm->sm_root, newseg, ss, AVL_AFTER);
+		space_map_seg_link(sm, newseg);
 	} else if (left_over) {
 		ss->ss_end = start;
 	} else if (right_over) {
@@ -179,8 +223,12 @@ space_map_remove(space_map_t *sm, uint64_t start, uint64_t size)
 	} else {
 		avl_remove(&sm->sm_root, ss);
 		kmem_free(ss, sizeof (*ss));
+		ss = NULL;
 	}
 
+	if (ss != NULL)
+		space_map_seg_link(sm, ss);
+
 	sm->sm_space -= size;
 }
 
@@ -210,6 +258,7 @@ space_map_vacate(space_map_t *sm, space_map_func_t *func, space_map_t *mdest)
 	void *cookie = NULL;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
+	ASSERT(sm->sm_pp_root == NULL);
 
 	while ((ss = avl_destroy_nodes(&sm->sm_root, &cookie)) != NULL) {
 		if (func != NULL)
@@ -217,6 +266,7 @@ space_map_vacate(space_map_t *sm, space_map_func_t *func, space_map_t *mdest)
 		kmem_free(ss, sizeof (*ss));
 	}
 	sm->sm_space = 0;
+	bzero(sm->sm_histogram, sizeof (sm->sm_histogram));
 }
 
 void
@@ -501,3 +551,17 @@ space_map_truncate(space_map_obj_t *smo, objset_t *os, dmu_tx_t *tx)
 	smo->smo_objsize = 0;
 	smo->smo_alloc = 0;
 }
+
+/*
+ * Estimate the on-disk size of the loaded free map 'sm' once condensed:
+ * one allocation record for each gap between free segments, plus the
+ * debug record.  Runs longer than SM_RUN_MAX need more, so this is a
+ * lower bound.
+ */
+uint64_t
+space_map_condensed_size(space_map_t *sm)
+{
+	ASSERT(sm->sm_loaded);
+
+	return ((avl_numnodes(&sm->sm_root) + 2) * sizeof (uint64_t));
+}
@@ -102,10 +102,17 @@ int arc_buf_evict(arc_buf_t *buf);
 void arc_flush(void);
 void arc_tempreserve_clear(uint64_t tempreserve);
 int arc_tempreserve_space(uint64_t tempreserve);
+int arc_reclaim_needed(void);
 
 void arc_init(void);
 void arc_fini(void);
 
+/*
+ * Level 2 ARC
+ */
+void l2arc_add_vdev(spa_t *spa, vdev_t *vd);
+void l2arc_remove_vdev(vdev_t *vd);
+
 #ifdef	__cplusplus
 }
 #endif
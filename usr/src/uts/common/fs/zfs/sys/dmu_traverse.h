@@ -112,6 +112,8 @@ void traverse_add_objset(traverse_handle_t *th,
 void traverse_add_pool(traverse_handle_t *th, uint64_t mintxg, uint64_t maxtxg);
 
 int traverse_more(traverse_handle_t *th);
+boolean_t traverse_get_position(traverse_handle_t *th, zbookmark_t *zb);
+void traverse_set_position(traverse_handle_t *th, const zbookmark_t *zb);
 
 #ifdef	__cplusplus
 }
@@ -40,6 +40,20 @@ extern "C" {
 struct objset;
 struct dsl_dir;
 
+/*
+ * Per-pool write throttle statistics, exported as the named kstat
+ * <pool>:0:txg.  The first five describe the last synced txg.
+ */
+typedef struct dsl_pool_txg_stats {
+	kstat_named_t	dpts_txg;		/* txg */
+	kstat_named_t	dpts_dirty;		/* bytes dirtied */
+	kstat_named_t	dpts_sync_time;		/* write phase, ns */
+	kstat_named_t	dpts_delays;		/* txs delayed */
+	kstat_named_t	dpts_throttles;		/* txs pushed to next txg */
+	kstat_named_t	dpts_throughput;	/* bytes per ms, averaged */
+	kstat_named_t	dpts_write_limit;	/* current dirty limit */
+} dsl_pool_txg_stats_t;
+
 typedef struct dsl_pool {
 	/* Immutable */
 	spa_t *dp_spa;
@@ -65,6 +79,22 @@ typedef struct dsl_pool {
 	 * nobody else could possibly have it for write.
 	 */
 	krwlock_t dp_config_rwlock;
+
+	/* Write throttle, protected by dp_lock */
+	kmutex_t dp_lock;
+	uint64_t dp_space_towrite[TXG_SIZE];	/* bytes dirtied */
+	uint64_t dp_tempreserved[TXG_SIZE];	/* bytes reserved */
+	uint64_t dp_delays[TXG_SIZE];		/* txs delayed */
+	uint64_t dp_throttles[TXG_SIZE];	/* txs pushed to next txg */
+	uint64_t dp_write_limit;		/* max bytes dirty per txg */
+	uint64_t dp_throughput;			/* sync bytes per ms */
+	hrtime_t dp_delay_debt;			/* delay not yet slept, ns */
+	dsl_pool_txg_stats_t dp_txg_stats;
+	kstat_t *dp_txg_ksp;
+
+	/* Syncs dirty dnodes in parallel; NULL if single-threaded */
+	taskq_t *dp_sync_taskq;
+	int dp_sync_threads;
 } dsl_pool_t;
 
 int dsl_pool_open(spa_t *spa, uint64_t txg, dsl_pool_t **dpp);
@@ -74,6 +104,10 @@ void dsl_pool_sync(dsl_pool_t *dp, uint64_t txg);
 void dsl_pool_zil_clean(dsl_pool_t *dp);
 int dsl_pool_sync_context(dsl_pool_t *dp);
 uint64_t dsl_pool_adjustedsize(dsl_pool_t *dp, boolean_t netfree);
+int dsl_pool_tempreserve_space(dsl_pool_t *dp, uint64_t space, dmu_tx_t *tx);
+void dsl_pool_tempreserve_clear(dsl_pool_t *dp, int64_t space, dmu_tx_t *tx);
+void dsl_pool_willuse_space(dsl_pool_t *dp, int64_t space, dmu_tx_t *tx);
+void dsl_pool_delay(dsl_pool_t *dp);
 
 #ifdef	__cplusplus
 }
@@ -41,6 +41,10 @@ extern "C" {
 typedef struct metaslab_class metaslab_class_t;
 typedef struct metaslab_group metaslab_group_t;
 
+extern space_map_ops_t metaslab_ff_ops;
+extern space_map_ops_t metaslab_df_ops;
+extern space_map_ops_t *zfs_metaslab_ops;
+
 extern metaslab_t *metaslab_init(metaslab_group_t *mg, space_map_obj_t *smo,
     uint64_t start, uint64_t size, uint64_t txg);
 extern void metaslab_fini(metaslab_t *msp);
@@ -62,6 +66,11 @@ extern void metaslab_class_remove(metaslab_class_t *mc, metaslab_group_t *mg);
 extern metaslab_group_t *metaslab_group_create(metaslab_class_t *mc,
     vdev_t *vd);
 extern void metaslab_group_destroy(metaslab_group_t *mg);
+extern void metaslab_sync_reassess(metaslab_group_t *mg, uint64_t txg);
+extern void metaslab_group_preload_wait(metaslab_group_t *mg);
+
+extern void metaslab_stat_init(void);
+extern void metaslab_stat_fini(void);
 
 #ifdef	__cplusplus
 }
@@ -52,6 +52,7 @@ struct metaslab_group {
 	vdev_t			*mg_vd;
 	metaslab_group_t	*mg_prev;
 	metaslab_group_t	*mg_next;
+	taskq_t			*mg_taskq;	/* preloads space maps */
 };
 
 /*
@@ -69,9 +70,13 @@ struct metaslab {
 	space_map_t	ms_freemap[TXG_SIZE];	/* freed this txg	*/
 	space_map_t	ms_map;		/* in-core free space map	*/
 	uint64_t	ms_weight;	/* weight vs. others in group	*/
+	uint64_t	ms_maxsize;	/* no free segment is larger	*/
+	uint64_t	ms_histogram[SPACE_MAP_HISTOGRAM_SIZE]; /* as of unload */
 	metaslab_group_t *ms_group;	/* metaslab group		*/
 	avl_node_t	ms_group_node;	/* node in metaslab group tree	*/
 	txg_node_t	ms_txg_node;	/* per-txg dirty metaslab links	*/
+	uint64_t	ms_access_txg;	/* keep map loaded until then	*/
+	boolean_t	ms_preloading;	/* preload queued (mg_lock)	*/
 };
 
 #ifdef	__cplusplus
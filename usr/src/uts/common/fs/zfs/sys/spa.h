@@ -354,6 +354,11 @@ extern void spa_spare_remove(vdev_t *vd);
 extern boolean_t spa_spare_exists(uint64_t guid, uint64_t *pool);
 extern void spa_spare_activate(vdev_t *vd);
 
+/* level 2 ARC device state (which is global across all pools) */
+extern void spa_l2cache_add(vdev_t *vd);
+extern void spa_l2cache_remove(vdev_t *vd);
+extern boolean_t spa_l2cache_exists(uint64_t guid, uint64_t *pool);
+
 /* scrubbing */
 extern int spa_scrub(spa_t *spa, pool_scrub_type_t type, boolean_t force);
 extern void spa_scrub_suspend(spa_t *spa);
@@ -364,6 +369,9 @@ extern void spa_scrub_restart(spa_t *spa, uint64_t txg);
 extern void spa_sync(spa_t *spa, uint64_t txg); /* only for DMU use */
 extern void spa_sync_allpools(void);
 
+extern void spa_sync_time(spa_t *spa, spa_sync_phase_t phase, hrtime_t ns);
+extern int spa_txg_history_get(spa_t *spa, nvlist_t **nvp);
+
 /*
  * SPA configuration functions in spa_config.c
  */
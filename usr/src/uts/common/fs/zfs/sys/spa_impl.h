@@ -58,6 +58,58 @@ typedef struct spa_history_phys {
 	uint64_t sh_records_lost;	/* num of records overwritten */
 } spa_history_phys_t;
 
+/*
+ * Time spent in each phase of the last txg sync, exported as the named
+ * kstat <pool>:0:sync.
+ */
+typedef struct spa_sync_stats {
+	kstat_named_t	sss_txg;		/* txg */
+	kstat_named_t	sss_passes;		/* passes to converge */
+	kstat_named_t	sss_total;		/* whole sync, ns */
+	kstat_named_t	sss_phase[SPA_SYNC_PHASES]; /* each phase, ns */
+} spa_sync_stats_t;
+
+/*
+ * One synced txg in the spa_txg_history ring.  Passes beyond
+ * SPA_TXG_PASSES are charged to the last slot of sts_pass.
+ */
+#define	SPA_TXG_PASSES	8
+
+typedef struct spa_txg_stat {
+	uint64_t	sts_txg;		/* txg */
+	uint64_t	sts_time;		/* sync start, wall clock sec */
+	uint64_t	sts_total;		/* whole sync, ns */
+	uint64_t	sts_passes;		/* passes to converge */
+	uint64_t	sts_written;		/* bytes allocated */
+	uint64_t	sts_freed;		/* blocks freed */
+	uint64_t	sts_phase[SPA_SYNC_PHASES]; /* each phase, ns */
+	uint64_t	sts_pass[SPA_TXG_PASSES]; /* each pass, ns */
+} spa_txg_stat_t;
+
+/*
+ * A block waiting in the sorted scrub queue of its top-level vdev.
+ */
+typedef struct spa_scrub_ent {
+	avl_node_t	sse_node;		/* spa_scrub_queue_t tree */
+	uint64_t	sse_offset;		/* DVA_GET_OFFSET of dva[0] */
+	blkptr_t	sse_bp;			/* block to read */
+	zbookmark_t	sse_zb;			/* its bookmark */
+} spa_scrub_ent_t;
+
+/*
+ * Blocks found by the scrub traversal, sorted by offset on each top-level
+ * vdev so that they can be read back sequentially.  Owned by the scrub
+ * thread.
+ */
+typedef struct spa_scrub_queue {
+	avl_tree_t	*sq_tree;		/* one per top-level vdev */
+	uint64_t	sq_vdevs;		/* number of trees */
+	uint64_t	sq_rotor;		/* tree to drain next */
+	uint64_t	sq_count;		/* queued blocks */
+	uint64_t	sq_txg;			/* ubsync txg of oldest block */
+	boolean_t	sq_draining;		/* issuing, not gathering */
+} spa_scrub_queue_t;
+
 typedef struct spa_props {
 	nvlist_t	*spa_props_nvp;
 	list_node_t	spa_list_node;
@@ -97,6 +149,11 @@ struct spa {
 	vdev_t		**spa_spares;		/* available hot spares */
 	int		spa_nspares;		/* number of hot spares */
 	boolean_t	spa_sync_spares;	/* sync the spares list */
+	uint64_t	spa_l2cache_object;	/* MOS object for l2cache list */
+	nvlist_t	*spa_l2cachelist;	/* cached l2cache config */
+	vdev_t		**spa_l2cache;		/* level 2 ARC devices */
+	int		spa_nl2cache;		/* number of l2cache devices */
+	boolean_t	spa_sync_l2cache;	/* sync the l2cache list */
 	uint64_t	spa_config_object;	/* MOS object for pool config */
 	uint64_t	spa_syncing_txg;	/* txg currently syncing */
 	uint64_t	spa_sync_bplist_obj;	/* object for deferred frees */
@@ -120,6 +177,15 @@ struct spa {
 	uint8_t		spa_scrub_active;	/* active or suspended? */
 	uint8_t		spa_scrub_type;		/* type of scrub we're doing */
 	uint8_t		spa_scrub_finished;	/* indicator to rotate logs */
+	spa_scrub_queue_t *spa_scrub_queue;	/* sorted scrub queue */
+	zbookmark_t	spa_scrub_cursor;	/* all reads before it issued */
+	uint64_t	spa_scrub_cursor_examined; /* examined before cursor */
+	uint64_t	spa_scrub_examined;	/* bytes examined so far */
+	pool_scrub_position_t spa_scrub_saved;	/* position saved in MOS */
+	boolean_t	spa_scrub_saved_valid;	/* spa_scrub_saved is in use */
+	boolean_t	spa_scrub_saved_dirty;	/* MOS copy is out of date */
+	uint64_t	spa_scrub_saved_txg;	/* txg it was last written */
+	pool_scrub_position_t spa_scrub_resumed; /* where we resumed from */
 	kmutex_t	spa_async_lock;		/* protect async state */
 	kthread_t	*spa_async_thread;	/* thread doing async task */
 	int		spa_async_suspended;	/* async tasks suspended */
@@ -145,6 +211,17 @@ struct spa {
 	uint64_t	spa_pool_props_object;	/* object for properties */
 	uint64_t	spa_bootfs;		/* default boot filesystem */
 	boolean_t	spa_delegation;		/* delegation on/off */
+	hrtime_t	spa_sync_times[SPA_SYNC_PHASES]; /* this txg, ns */
+	spa_sync_stats_t spa_sync_stats;	/* last txg's times */
+	kstat_t		*spa_sync_ksp;		/* spa_sync_stats kstat */
+	hrtime_t	spa_sync_pass_times[SPA_TXG_PASSES]; /* this txg, ns */
+	uint64_t	spa_sync_written;	/* this txg, bytes allocated */
+	uint64_t	spa_sync_freed;		/* this txg, blocks freed */
+	kmutex_t	spa_txg_history_lock;	/* protects the ring below */
+	spa_txg_stat_t	*spa_txg_history;	/* last synced txgs */
+	int		spa_txg_history_size;	/* ring entries */
+	int		spa_txg_history_next;	/* next entry to fill */
+	int		spa_txg_history_count;	/* valid entries */
 	/*
 	 * spa_refcnt & spa_config_lock must be the last elements
 	 * because refcount_t changes size based on compilation options.
@@ -37,6 +37,13 @@ extern "C" {
 
 typedef struct space_map_ops space_map_ops_t;
 
+/*
+ * sm_histogram[i] is the number of segments in the map whose size is
+ * between 2^(i + sm_shift) and 2^(i + sm_shift + 1) - 1 bytes; the last
+ * bucket also counts anything larger.
+ */
+#define	SPACE_MAP_HISTOGRAM_SIZE	32
+
 typedef struct space_map {
 	avl_tree_t	sm_root;	/* AVL tree of map segments */
 	uint64_t	sm_space;	/* sum of all segments in the map */
@@ -49,11 +56,14 @@ typedef struct space_map {
 	kcondvar_t	sm_load_cv;	/* map load completion */
 	space_map_ops_t	*sm_ops;	/* space map block picker ops vector */
 	void		*sm_ppd;	/* picker-private data */
+	avl_tree_t	*sm_pp_root;	/* picker-private AVL tree */
+	uint64_t	sm_histogram[SPACE_MAP_HISTOGRAM_SIZE]; /* seg sizes */
 	kmutex_t	*sm_lock;	/* pointer to lock that protects map */
 } space_map_t;
 
 typedef struct space_seg {
 	avl_node_t	ss_node;	/* AVL node */
+	avl_node_t	ss_pp_node;	/* AVL picker-private node */
 	uint64_t	ss_start;	/* starting offset of this segment */
 	uint64_t	ss_end;		/* ending offset (non-inclusive) */
 } space_seg_t;
@@ -154,6 +164,7 @@ extern void space_map_sync(space_map_t *sm, uint8_t maptype,
     space_map_obj_t *smo, objset_t *os, dmu_tx_t *tx);
 extern void space_map_truncate(space_map_obj_t *smo,
     objset_t *os, dmu_tx_t *tx);
+extern uint64_t space_map_condensed_size(space_map_t *sm);
 
 #ifdef	__cplusplus
 }
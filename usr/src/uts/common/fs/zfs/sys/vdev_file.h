@@ -39,8 +39,15 @@ extern "C" {
 
 typedef struct vdev_file {
 	vnode_t		*vf_vnode;
+	taskq_t		*vf_taskq;	/* async read/write threads */
 } vdev_file_t;
 
+extern int zfs_vdev_file_async;
+#ifndef _KERNEL
+extern uint64_t vdev_file_slow_guid;
+extern int vdev_file_slow_ticks;
+#endif
+
 #ifdef	__cplusplus
 }
 #endif
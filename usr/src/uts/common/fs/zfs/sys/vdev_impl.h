@@ -96,11 +96,27 @@ struct vdev_cache {
 	kmutex_t	vc_lock;
 };
 
+/*
+ * The vdev queue keeps one deadline-ordered queue per I/O class (the
+ * classes of vdev_lat_class_t) and schedules between them; see
+ * vdev_queue.c.
+ */
+typedef struct vdev_queue_class {
+	avl_tree_t	vqc_tree;	/* queued I/Os, deadline order */
+	uint32_t	vqc_active;	/* I/Os of this class issued */
+	uint32_t	vqc_limit;	/* current max active I/Os */
+} vdev_queue_class_t;
+
 struct vdev_queue {
-	avl_tree_t	vq_deadline_tree;
+	vdev_queue_class_t vq_class[VDEV_LAT_CLASSES];
 	avl_tree_t	vq_read_tree;
 	avl_tree_t	vq_write_tree;
 	avl_tree_t	vq_pending_tree;
+	hrtime_t	vq_sync_lat;	/* average sync I/O service time */
+	hrtime_t	vq_sync_time;	/* last sync I/O completion */
+	hrtime_t	vq_adapt_time;	/* last async limit adjustment */
+	hrtime_t	vq_read_lat;	/* average read service time */
+	uint64_t	vq_last_offset;	/* end of the last I/O issued */
 	kmutex_t	vq_lock;
 };
 
@@ -128,6 +144,7 @@ struct vdev {
 	space_map_t	vdev_dtl_map;	/* dirty time log in-core state	*/
 	space_map_t	vdev_dtl_scrub;	/* DTL for scrub repair writes	*/
 	vdev_stat_t	vdev_stat;	/* virtual device statistics	*/
+	vdev_lat_stat_t	vdev_lat_stat;	/* leaf latency histograms	*/
 
 	/*
 	 * Top-level vdev state.
@@ -166,11 +183,13 @@ struct vdev {
 	uint8_t		vdev_tmpoffline; /* device taken offline temporarily? */
 	uint8_t		vdev_detached;	/* device detached?		*/
 	uint64_t	vdev_isspare;	/* was a hot spare		*/
+	uint64_t	vdev_isl2cache;	/* was a level 2 ARC device	*/
 	vdev_queue_t	vdev_queue;	/* I/O deadline schedule queue	*/
 	vdev_cache_t	vdev_cache;	/* physical block cache		*/
 	uint64_t	vdev_not_present; /* not present during import	*/
 	hrtime_t	vdev_last_try;	/* last reopen time		*/
 	boolean_t	vdev_nowritecache; /* true if flushwritecache failed */
+	boolean_t	vdev_nonrot;	/* non-rotational media (SSD)	*/
 	uint64_t	vdev_unspare;	/* unspare when resilvering done */
 	boolean_t	vdev_checkremove; /* temporary online test	*/
 	boolean_t	vdev_forcefault; /* force online fault		*/
@@ -246,6 +265,7 @@ typedef struct vdev_label {
 #define	VDEV_ALLOC_LOAD		0
 #define	VDEV_ALLOC_ADD		1
 #define	VDEV_ALLOC_SPARE	2
+#define	VDEV_ALLOC_L2CACHE	3
 
 /*
  * Allocate or free a vdev
@@ -289,11 +309,24 @@ extern vdev_ops_t vdev_spare_ops;
 extern uint64_t vdev_default_asize(vdev_t *vd, uint64_t psize);
 extern uint64_t vdev_get_rsize(vdev_t *vd);
 
+/*
+ * RAID-Z parity implementation selection and benchmarking
+ */
+extern int zfs_vdev_raidz_impl;
+extern const char *vdev_raidz_impl_name(int impl);
+extern int vdev_raidz_bench(int impl, int nparity, int cols, uint64_t colsize,
+    int iters, hrtime_t *gen, hrtime_t *rec);
+
 /*
  * zdb uses this tunable, so it must be declared here to make lint happy.
  */
 extern int zfs_vdev_cache_size;
 
+/*
+ * Queue depth limit, also used to size the file vdev I/O taskqs.
+ */
+extern int zfs_vdev_max_pending;
+
 #ifdef	__cplusplus
 }
 #endif
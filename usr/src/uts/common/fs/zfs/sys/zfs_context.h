@@ -286,7 +286,8 @@ extern void recalc_target_footprint(int);
 
 
 extern void kmem_cache_stats(kmem_cache_stats_t *cache_stats, int max_stats, int *act_stats);
-extern void arc_get_stats(zfs_memory_stats_t *stats);
+extern void arc_get_stats(zfs_memory_stats_t *stats,
+    zfs_hash_stats_t *hash_stats);
 
 
 #endif
@@ -0,0 +1,122 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_ZFS_SIMD_H
+#define	_SYS_ZFS_SIMD_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Processor feature probes for the vectorized parity and checksum code.
+ *
+ * The vector kernels are written with the compiler's generic vector types
+ * and per-function target attributes, so they are only built where the
+ * compiler supports both; ZFS_SIMD is defined when that is the case. They
+ * are confined to userland (libzpool): the kernel does not preserve the
+ * vector register state for us, so the kext always uses the scalar code.
+ */
+#if defined(__x86_64__) && !defined(_KERNEL) && \
+	(defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define	ZFS_SIMD
+#endif
+
+#ifdef ZFS_SIMD
+
+static inline void
+zfs_cpuid(uint32_t leaf, uint32_t *regs)
+{
+	__asm__ __volatile__("cpuid"
+	    : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+	    : "a" (leaf), "c" (0));
+}
+
+static inline boolean_t
+zfs_sse2_available(void)
+{
+	uint32_t r[4];
+
+	zfs_cpuid(1, r);
+	return ((r[3] & (1U << 26)) != 0);
+}
+
+/*
+ * The AVX family needs both the instructions and an operating system that
+ * saves the YMM state on context switch (OSXSAVE, and XCR0 bits 1 and 2).
+ */
+static inline boolean_t
+zfs_ymm_enabled(void)
+{
+	uint32_t r[4], xcr0_lo, xcr0_hi;
+
+	zfs_cpuid(1, r);
+	if ((r[2] & (1U << 27)) == 0 || (r[2] & (1U << 28)) == 0)
+		return (B_FALSE);
+
+	__asm__ __volatile__("xgetbv"
+	    : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+	return ((xcr0_lo & 0x6) == 0x6);
+}
+
+static inline boolean_t
+zfs_avx2_available(void)
+{
+	uint32_t r[4];
+
+	zfs_cpuid(0, r);
+	if (r[0] < 7 || !zfs_ymm_enabled())
+		return (B_FALSE);
+
+	zfs_cpuid(7, r);
+	return ((r[1] & (1U << 5)) != 0);
+}
+
+/*
+ * The SHA extensions; the code using them also needs SSSE3 and SSE4.1
+ * for shuffling the message and state words.
+ */
+static inline boolean_t
+zfs_shani_available(void)
+{
+	uint32_t r[4];
+
+	zfs_cpuid(0, r);
+	if (r[0] < 7)
+		return (B_FALSE);
+
+	zfs_cpuid(1, r);
+	if ((r[2] & (1U << 9)) == 0 || (r[2] & (1U << 19)) == 0)
+		return (B_FALSE);
+
+	zfs_cpuid(7, r);
+	return ((r[1] & (1U << 29)) != 0);
+}
+
+#endif	/* ZFS_SIMD */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_ZFS_SIMD_H */
@@ -267,6 +267,7 @@ extern int	zil_suspend(zilog_t *zilog);
 extern void	zil_resume(zilog_t *zilog);
 
 extern void	zil_add_vdev(zilog_t *zilog, uint64_t vdev);
+extern ssize_t	zil_immediate_write_sz(zilog_t *zilog, ssize_t max);
 
 extern int zil_disable;
 
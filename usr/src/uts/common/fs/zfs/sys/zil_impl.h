@@ -56,11 +56,30 @@ typedef struct lwb {
  */
 
 #define	ZIL_VDEV_BMSZ 16 /* 16 * 8 = 128 vdevs */
+
+/*
+ * Number of recent commit sizes kept to size log blocks (a power of 2).
+ */
+#define	ZIL_PREV_COMMITS 16
 typedef struct zil_vdev {
 	uint64_t	vdev;		/* device written */
 	list_node_t	vdev_seq_node;	/* zilog->zl_vdev_list linkage */
 } zil_vdev_t;
 
+/*
+ * Commit round: the log blocks issued by one writer in zil_commit().
+ * Rounds are retired strictly in order, so a round only counts as
+ * stable once all earlier ones are.
+ */
+typedef struct zil_round {
+	uint64_t	zr_id;		/* round number */
+	uint64_t	zr_commit_seq;	/* all itxs below this pushed */
+	zio_t		*zr_root_zio;	/* parent of this round's lwb writes */
+	uint8_t		zr_sync;	/* boolean: must wait for txg sync */
+	uint8_t		zr_done;	/* boolean: writes and flushes done */
+	list_node_t	zr_node;	/* zilog->zl_round_list linkage */
+} zil_round_t;
+
 /*
  * Stable storage intent log management structure.  One per dataset.
  */
@@ -85,11 +104,17 @@ struct zilog {
 	uint8_t		zl_stop_replay;	/* don't replay any further */
 	uint8_t		zl_stop_sync;	/* for debugging */
 	uint8_t		zl_writer;	/* boolean: write setup in progress */
-	uint8_t		zl_log_error;	/* boolean: log write error */
+	uint8_t		zl_flushing;	/* boolean: vdev flush in progress */
+	uint32_t	zl_commit_waiters; /* committers waiting for a round */
+	uint64_t	zl_issued_seq;	/* zr_commit_seq of newest round */
+	uint64_t	zl_round_id;	/* id of newest round */
+	uint64_t	zl_round_done;	/* id of newest retired round */
+	list_t		zl_round_list;	/* in-flight commit rounds */
 	list_t		zl_itx_list;	/* in-memory itx list */
 	uint64_t	zl_itx_list_sz;	/* total size of records on list */
 	uint64_t	zl_cur_used;	/* current commit log size used */
-	uint64_t	zl_prev_used;	/* previous commit log size used */
+	uint64_t	zl_prev_used[ZIL_PREV_COMMITS]; /* recent commit sizes */
+	uint_t		zl_prev_rotor;	/* next zl_prev_used slot */
 	list_t		zl_lwb_list;	/* in-flight log write list */
 	list_t		zl_vdev_list;	/* list of [vdev, seq] pairs */
 	uint8_t		zl_vdev_bmap[ZIL_VDEV_BMSZ]; /* bitmap of vdevs */
@@ -222,7 +222,6 @@ struct zio {
 	zio_done_func_t	*io_ready;
 	zio_done_func_t	*io_done;
 	void		*io_private;
-	blkptr_t	io_bp_orig;
 
 	/* Data represented by this I/O */
 	void		*io_data;
@@ -234,8 +233,9 @@ struct zio {
 	uint64_t	io_offset;
 	uint64_t	io_deadline;
 	uint64_t	io_timestamp;
-	avl_node_t	io_offset_node;
-	avl_node_t	io_deadline_node;
+	hrtime_t	io_queue_timestamp;	/* entered vdev queue */
+	hrtime_t	io_issue_timestamp;	/* issued to device */
+	int		io_vq_class;	/* queue class it was issued for */
 	avl_tree_t	*io_vdev_tree;
 	zio_t		*io_delegate_list;
 	zio_t		*io_delegate_next;
@@ -246,7 +246,6 @@ struct zio {
 	enum zio_stage	io_stage;
 	uint8_t		io_stalled;
 	uint8_t		io_priority;
-	struct dk_callback io_dk_callback;
 	int		io_cmd;
 	int		io_retries;
 	int		io_error;
@@ -256,13 +255,34 @@ struct zio {
 	uint64_t	io_children_notready;
 	uint64_t	io_children_notdone;
 	void		*io_waiter;
-	kmutex_t	io_lock;
-	kcondvar_t	io_cv;
 
 	/* FMA state */
 	uint64_t	io_ena;
+
+	/*
+	 * Nothing below is cleared by zio_create().  The lock and cv are
+	 * set up once by the zio cache constructor; the rest is written
+	 * by whoever uses it before it is read.
+	 */
+	blkptr_t	io_bp_orig;		/* set when io_bp is */
+	avl_node_t	io_offset_node;		/* vdev queue */
+	avl_node_t	io_deadline_node;	/* vdev queue */
+	struct dk_callback io_dk_callback;	/* vdev_disk ioctls */
+	zio_transform_t	io_transform_base;	/* first transform pushed */
+	kmutex_t	io_lock;
+	kcondvar_t	io_cv;
 };
 
+/*
+ * Allocation counts for the zio and transform caches.
+ */
+typedef struct zio_alloc_stats {
+	uint64_t	zas_zio;		/* zios created */
+	uint64_t	zas_zio_kmem;		/* ... allocated from kmem */
+	uint64_t	zas_transform;		/* extra transforms pushed */
+	uint64_t	zas_transform_kmem;	/* ... allocated from kmem */
+} zio_alloc_stats_t;
+
 extern zio_t *zio_null(zio_t *pio, spa_t *spa,
     zio_done_func_t *done, void *private, int flags);
 
@@ -308,6 +328,8 @@ extern void zio_flush_vdev(spa_t *spa, uint64_t vdev, zio_t **zio);
 extern int zio_wait(zio_t *zio);
 extern void zio_nowait(zio_t *zio);
 
+extern void zio_alloc_stats(zio_alloc_stats_t *zas);
+
 extern void *zio_buf_alloc(size_t size);
 extern void zio_buf_free(void *buf, size_t size);
 extern void *zio_data_buf_alloc(size_t size);
@@ -64,6 +64,25 @@ extern zio_checksum_t fletcher_4_incremental_byteswap;
 
 extern zio_checksum_t zio_checksum_SHA256;
 
+/*
+ * Fletcher-4 implementation selection (see fletcher.c).
+ */
+extern int zfs_fletcher_4_impl;
+extern void fletcher_4_init(void);
+extern const char *fletcher_4_impl_name(int impl);
+extern boolean_t fletcher_4_impl_supported(int impl);
+
+/*
+ * SHA-256 implementation selection (see sha256.c).
+ */
+extern int zfs_sha256_impl;
+extern void sha256_init(void);
+extern const char *sha256_impl_name(int impl);
+extern boolean_t sha256_impl_supported(int impl);
+extern int sha256_impl_checksum(int impl, const void *buf, uint64_t size,
+    zio_cksum_t *zcp);
+
+extern void zio_checksum_init(void);
 extern void zio_checksum(uint_t checksum, zio_cksum_t *zcp,
     void *data, uint64_t size);
 extern int zio_checksum_error(zio_t *zio);
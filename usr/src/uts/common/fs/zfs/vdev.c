@@ -360,7 +360,8 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 
 		if (nvlist_lookup_uint64(nv, ZPOOL_CONFIG_GUID, &guid) != 0)
 			return (EINVAL);
-	} else if (alloctype == VDEV_ALLOC_SPARE) {
+	} else if (alloctype == VDEV_ALLOC_SPARE ||
+	    alloctype == VDEV_ALLOC_L2CACHE) {
 		if (nvlist_lookup_uint64(nv, ZPOOL_CONFIG_GUID, &guid) != 0)
 			return (EINVAL);
 	}
@@ -550,6 +551,8 @@ vdev_free(vdev_t *vd)
 
 	if (vd->vdev_isspare)
 		spa_spare_remove(vd);
+	if (vd->vdev_isl2cache)
+		spa_l2cache_remove(vd);
 
 	txg_list_destroy(&vd->vdev_ms_list);
 	txg_list_destroy(&vd->vdev_dtl_list);
@@ -827,8 +830,20 @@ vdev_open(vdev_t *vd)
 		return (ENXIO);
 	}
 
+	vd->vdev_nonrot = B_FALSE;	/* set by the leaf's open routine */
+
 	error = vd->vdev_ops->vdev_op_open(vd, &osize, &ashift);
 
+	/*
+	 * An interior vdev is non-rotational only if all its children are.
+	 */
+	if (error == 0 && vd->vdev_children != 0) {
+		vd->vdev_nonrot = B_TRUE;
+		for (c = 0; c < vd->vdev_children; c++)
+			if (!vd->vdev_child[c]->vdev_nonrot)
+				vd->vdev_nonrot = B_FALSE;
+	}
+
 	if (zio_injection_enabled && error == 0)
 		error = zio_handle_device_injection(vd, ENXIO);
 
@@ -1390,6 +1405,9 @@ vdev_sync_done(vdev_t *vd, uint64_t txg)
 
 	while (msp = txg_list_remove(&vd->vdev_ms_list, TXG_CLEAN(txg)))
 		metaslab_sync_done(msp, txg);
+
+	if (vd->vdev_mg != NULL)
+		metaslab_sync_reassess(vd->vdev_mg, txg);
 }
 
 void
@@ -1761,12 +1779,46 @@ vdev_get_stats(vdev_t *vd, vdev_stat_t *vs)
 			vs->vs_write_errors += cvs->vs_write_errors;
 			vs->vs_checksum_errors += cvs->vs_checksum_errors;
 			vs->vs_scrub_examined += cvs->vs_scrub_examined;
+			vs->vs_scrub_issued += cvs->vs_scrub_issued;
 			vs->vs_scrub_errors += cvs->vs_scrub_errors;
 			mutex_exit(&vd->vdev_stat_lock);
 		}
 	}
 }
 
+static void
+vdev_lat_stats_add(vdev_t *vd, vdev_lat_stat_t *vls)
+{
+	vdev_lat_stat_t *cvls = &vd->vdev_lat_stat;
+	int c, b;
+
+	for (c = 0; c < vd->vdev_children; c++)
+		vdev_lat_stats_add(vd->vdev_child[c], vls);
+
+	if (!vd->vdev_ops->vdev_op_leaf)
+		return;
+
+	mutex_enter(&vd->vdev_queue.vq_lock);
+	for (c = 0; c < VDEV_LAT_CLASSES; c++) {
+		for (b = 0; b < VDEV_LAT_BUCKETS; b++) {
+			vls->vls_queue[c][b] += cvls->vls_queue[c][b];
+			vls->vls_disk[c][b] += cvls->vls_disk[c][b];
+		}
+	}
+	mutex_exit(&vd->vdev_queue.vq_lock);
+}
+
+/*
+ * Latency histograms are only collected on leaf vdevs, where the queue is;
+ * for any other vdev, report the sum over all the leaves beneath it.
+ */
+void
+vdev_get_lat_stats(vdev_t *vd, vdev_lat_stat_t *vls)
+{
+	bzero(vls, sizeof (*vls));
+	vdev_lat_stats_add(vd, vls);
+}
+
 void
 vdev_stat_update(zio_t *zio)
 {
@@ -1852,6 +1904,7 @@ vdev_scrub_stat_update(vdev_t *vd, pool_scrub_type_t type, boolean_t complete)
 		vs->vs_scrub_type = type;
 		vs->vs_scrub_complete = 0;
 		vs->vs_scrub_examined = 0;
+		vs->vs_scrub_issued = 0;
 		vs->vs_scrub_repaired = 0;
 		vs->vs_scrub_errors = 0;
 		vs->vs_scrub_start = gethrestime_sec();
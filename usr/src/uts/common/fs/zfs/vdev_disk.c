@@ -144,6 +144,19 @@ vdev_disk_open(vdev_t *vd, uint64_t *psize, uint64_t *ashift)
 	}
 	*psize = blkcnt * (uint64_t)blksize;
 
+#ifdef DKIOCISSOLIDSTATE
+	/*
+	 * Note whether the device is solid state, for mirror reads.
+	 */
+	{
+		uint32_t ssd = 0;
+
+		if (VNOP_IOCTL(devvp, DKIOCISSOLIDSTATE, (caddr_t)&ssd, 0,
+		    context) == 0 && ssd != 0)
+			vd->vdev_nonrot = B_TRUE;
+	}
+#endif
+
 	/*
 	 *  ### APPLE TODO ###
 	 * If we own the whole disk, try to enable disk write caching.
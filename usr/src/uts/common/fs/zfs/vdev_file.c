@@ -38,6 +38,30 @@
  * Virtual device vector for files.
  */
 
+/*
+ * vn_rdwr() blocks until the I/O is done, so performing reads and writes
+ * directly from vdev_file_io_start() would limit each file vdev to one I/O
+ * per zio issue thread, no matter how deep vdev_queue is willing to go.
+ * Instead each file vdev gets its own taskq with zfs_vdev_max_pending
+ * threads: vdev_file_io_start() hands the zio to it, and the thread that
+ * performs the I/O completes the zio through the interrupt taskq, just as
+ * a disk driver's completion callback would. The vdev_queue admission
+ * limit is thus the only bound on concurrency.
+ *
+ * Setting zfs_vdev_file_async to 0 before a vdev is opened restores the
+ * synchronous path.
+ */
+int zfs_vdev_file_async = 1;
+
+#ifndef _KERNEL
+/*
+ * For testing: reads from the file vdev whose guid is vdev_file_slow_guid
+ * take vdev_file_slow_ticks longer.  Used by ztest -b mirror.
+ */
+uint64_t vdev_file_slow_guid = 0;
+int vdev_file_slow_ticks = 0;
+#endif
+
 static int
 vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *ashift)
 {
@@ -123,6 +147,12 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *ashift)
 #endif /* __APPLE__ */
 	*ashift = SPA_MINBLOCKSHIFT;
 
+	if (zfs_vdev_file_async) {
+		vf->vf_taskq = taskq_create("vdev_file_taskq",
+		    zfs_vdev_max_pending, maxclsyspri, zfs_vdev_max_pending,
+		    INT_MAX, TASKQ_PREPOPULATE);
+	}
+
 	return (0);
 }
 
@@ -134,6 +164,13 @@ vdev_file_close(vdev_t *vd)
 	if (vf == NULL)
 		return;
 
+	/*
+	 * Wait for any reads and writes still in the taskq before the vnode
+	 * goes away underneath them.
+	 */
+	if (vf->vf_taskq != NULL)
+		taskq_destroy(vf->vf_taskq);
+
 	if (vf->vf_vnode != NULL) {
 #ifdef __APPLE__
 		vfs_context_t context;
@@ -154,12 +191,35 @@ vdev_file_close(vdev_t *vd)
 	vd->vdev_tsd = NULL;
 }
 
+static void
+vdev_file_io_strategy(void *arg)
+{
+	zio_t *zio = arg;
+	vdev_file_t *vf = zio->io_vd->vdev_tsd;
+	ssize_t resid;
+
+#ifndef _KERNEL
+	if (vdev_file_slow_guid != 0 && zio->io_type == ZIO_TYPE_READ &&
+	    zio->io_vd->vdev_guid == vdev_file_slow_guid)
+		delay(vdev_file_slow_ticks);
+#endif
+
+	zio->io_error = vn_rdwr(zio->io_type == ZIO_TYPE_READ ?
+	    UIO_READ : UIO_WRITE, vf->vf_vnode, zio->io_data,
+	    zio->io_size, zio->io_offset, UIO_SYSSPACE,
+	    0, RLIM64_INFINITY, kcred, &resid);
+
+	if (resid != 0 && zio->io_error == 0)
+		zio->io_error = ENOSPC;
+
+	zio_next_stage_async(zio);
+}
+
 static void
 vdev_file_io_start(zio_t *zio)
 {
 	vdev_t *vd = zio->io_vd;
 	vdev_file_t *vf = vd->vdev_tsd;
-	ssize_t resid;
 	int error;
 
 	if (zio->io_type == ZIO_TYPE_IOCTL) {
@@ -207,15 +267,13 @@ vdev_file_io_start(zio_t *zio)
 		return;
 	}
 
-	zio->io_error = vn_rdwr(zio->io_type == ZIO_TYPE_READ ?
-	    UIO_READ : UIO_WRITE, vf->vf_vnode, zio->io_data,
-	    zio->io_size, zio->io_offset, UIO_SYSSPACE,
-	    0, RLIM64_INFINITY, kcred, &resid);
-
-	if (resid != 0 && zio->io_error == 0)
-		zio->io_error = ENOSPC;
+	if (vf->vf_taskq != NULL) {
+		(void) taskq_dispatch(vf->vf_taskq, vdev_file_io_strategy,
+		    zio, TQ_SLEEP);
+		return;
+	}
 
-	zio_next_stage_async(zio);
+	vdev_file_io_strategy(zio);
 }
 
 static void
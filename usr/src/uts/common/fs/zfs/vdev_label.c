@@ -264,9 +264,17 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 
 	if (getstats) {
 		vdev_stat_t vs;
+		vdev_lat_stat_t *vls;
+
 		vdev_get_stats(vd, &vs);
 		VERIFY(nvlist_add_uint64_array(nv, ZPOOL_CONFIG_STATS,
 		    (uint64_t *)&vs, sizeof (vs) / sizeof (uint64_t)) == 0);
+
+		vls = kmem_alloc(sizeof (vdev_lat_stat_t), KM_SLEEP);
+		vdev_get_lat_stats(vd, vls);
+		VERIFY(nvlist_add_uint64_array(nv, ZPOOL_CONFIG_LAT_STATS,
+		    (uint64_t *)vls, sizeof (*vls) / sizeof (uint64_t)) == 0);
+		kmem_free(vls, sizeof (vdev_lat_stat_t));
 	}
 
 	if (!vd->vdev_ops->vdev_op_leaf) {
@@ -384,6 +392,15 @@ vdev_inuse(vdev_t *vd, uint64_t crtxg, vdev_labeltype_t reason,
 		return (B_FALSE);
 	}
 
+	/*
+	 * Level 2 ARC devices carry only a minimal label, and cannot be shared
+	 * between pools.  They are in use as long as some pool has them.
+	 */
+	if (state == POOL_STATE_L2CACHE) {
+		nvlist_free(label);
+		return (spa_l2cache_exists(device_guid, NULL));
+	}
+
 	if (state != POOL_STATE_SPARE &&
 	    (nvlist_lookup_uint64(label, ZPOOL_CONFIG_POOL_GUID,
 	    &pool_guid) != 0 ||
@@ -549,6 +566,20 @@ vdev_label_init(vdev_t *vd, uint64_t crtxg, vdev_labeltype_t reason)
 		    POOL_STATE_SPARE) == 0);
 		VERIFY(nvlist_add_uint64(label, ZPOOL_CONFIG_GUID,
 		    vd->vdev_guid) == 0);
+	} else if (reason == VDEV_LABEL_L2CACHE ||
+	    (reason == VDEV_LABEL_REMOVE && vd->vdev_isl2cache)) {
+		/*
+		 * Level 2 ARC devices get the same sort of minimal label as
+		 * inactive hot spares, with their own pool state.
+		 */
+		VERIFY(nvlist_alloc(&label, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+
+		VERIFY(nvlist_add_uint64(label, ZPOOL_CONFIG_VERSION,
+		    spa_version(spa)) == 0);
+		VERIFY(nvlist_add_uint64(label, ZPOOL_CONFIG_POOL_STATE,
+		    POOL_STATE_L2CACHE) == 0);
+		VERIFY(nvlist_add_uint64(label, ZPOOL_CONFIG_GUID,
+		    vd->vdev_guid) == 0);
 	} else {
 		label = spa_config_generate(spa, vd, 0ULL, B_FALSE);
 
@@ -630,6 +661,14 @@ vdev_label_init(vdev_t *vd, uint64_t crtxg, vdev_labeltype_t reason)
 	    spa_spare_exists(vd->vdev_guid, NULL)))
 		spa_spare_add(vd);
 
+	/*
+	 * Likewise, track a newly labeled level 2 ARC device so that a second
+	 * attempt to add it (possibly in the same request) is refused.
+	 */
+	if (error == 0 && !vd->vdev_isl2cache &&
+	    reason == VDEV_LABEL_L2CACHE)
+		spa_l2cache_add(vd);
+
 	return (error);
 }
 
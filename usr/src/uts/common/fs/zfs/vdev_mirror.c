@@ -53,6 +53,19 @@ typedef struct mirror_map {
 
 int vdev_mirror_shift = 21;
 
+/*
+ * Reads go to the child expected to answer first, rather than the one
+ * picked by offset.  A child's expected wait is the number of I/Os in
+ * its queue, plus one, times its average read service time.  Until it
+ * has completed a read, the service time is assumed from its media; on
+ * rotating media, a read near the end of the last I/O issued avoids
+ * most of a seek and counts for half.  All times are in microseconds.
+ */
+int vdev_mirror_balance = 1;
+int vdev_mirror_rotating_lat = 8000;
+int vdev_mirror_nonrotating_lat = 100;
+uint64_t vdev_mirror_seek_near = 1ULL << 20;
+
 static mirror_map_t *
 vdev_mirror_map_alloc(zio_t *zio)
 {
@@ -203,8 +216,76 @@ vdev_mirror_repair_done(zio_t *zio)
 }
 
 /*
- * Try to find a child whose DTL doesn't contain the block we want to read.
- * If we can't, try the read on any vdev we haven't already tried.
+ * Estimate how long a read at 'offset' would wait on 'vd', in ns.  For
+ * an interior vdev (a top-level vdev holding a ditto copy, or a mirror
+ * under a replacing vdev) this is the average over its children.
+ */
+static hrtime_t
+vdev_mirror_load(vdev_t *vd, uint64_t offset)
+{
+	hrtime_t lat, load;
+	uint64_t last;
+	int c;
+
+	if (vd->vdev_children != 0) {
+		load = 0;
+		for (c = 0; c < vd->vdev_children; c++)
+			load += vdev_mirror_load(vd->vdev_child[c], offset);
+		return (load / vd->vdev_children);
+	}
+
+	lat = vd->vdev_queue.vq_read_lat;
+	if (lat == 0)
+		lat = (hrtime_t)(vd->vdev_nonrot ? vdev_mirror_nonrotating_lat :
+		    vdev_mirror_rotating_lat) * 1000;
+
+	load = vdev_queue_length(vd) * lat;
+
+	offset += VDEV_LABEL_START_SIZE;
+	last = vd->vdev_queue.vq_last_offset;
+	if (!vd->vdev_nonrot && offset >= last &&
+	    offset - last <= vdev_mirror_seek_near)
+		return (load + lat / 2);
+
+	return (load + lat);
+}
+
+/*
+ * Of the children that can supply the block, return the one with the
+ * least load, or -1 if there is none.  Ties go to mm_preferred, then to
+ * the children after it.
+ */
+static int
+vdev_mirror_child_select_load(zio_t *zio)
+{
+	mirror_map_t *mm = zio->io_vsd;
+	mirror_child_t *mc;
+	uint64_t txg = zio->io_txg;
+	hrtime_t load, best_load = 0;
+	int i, c, best = -1;
+
+	for (i = 0, c = mm->mm_preferred; i < mm->mm_children; i++, c++) {
+		if (c >= mm->mm_children)
+			c = 0;
+		mc = &mm->mm_child[c];
+		if (mc->mc_tried || mc->mc_skipped ||
+		    vdev_is_dead(mc->mc_vd) ||
+		    vdev_dtl_contains(&mc->mc_vd->vdev_dtl_map, txg, 1))
+			continue;
+		load = vdev_mirror_load(mc->mc_vd, mc->mc_offset);
+		if (best == -1 || load < best_load) {
+			best = c;
+			best_load = load;
+		}
+	}
+
+	return (best);
+}
+
+/*
+ * Try to find a child whose DTL doesn't contain the block we want to read,
+ * preferring the least loaded one.  If we can't, try the read on any vdev
+ * we haven't already tried.
  */
 static int
 vdev_mirror_child_select(zio_t *zio)
@@ -216,6 +297,14 @@ vdev_mirror_child_select(zio_t *zio)
 
 	ASSERT(zio->io_bp == NULL || zio->io_bp->blk_birth == txg);
 
+	/*
+	 * A replacing or spare vdev reads from the old device by choice.
+	 */
+	if (vdev_mirror_balance && !mm->mm_replacing &&
+	    mm->mm_children > 1 &&
+	    (c = vdev_mirror_child_select_load(zio)) != -1)
+		return (c);
+
 	/*
 	 * Try to find a child whose DTL doesn't contain the block to read.
 	 * If a child is known to be completely inaccessible (indicated by
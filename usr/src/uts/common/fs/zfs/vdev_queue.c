@@ -32,23 +32,59 @@
 #include <sys/avl.h>
 
 /*
+ * I/O scheduling.
+ *
+ * Queued I/Os are split into the classes of vdev_lat_class_t: sync read,
+ * sync write, async read, async write and scrub.  Each class has its own
+ * queue, ordered by deadline, and a limit on how many of its I/Os may be
+ * issued to the device at once.  When a slot frees up, the first class
+ * (in the order above) with queued I/O that is below its minimum gets to
+ * issue; failing that, the first one below its current limit.  Every
+ * class's minimum is thus always available to it, so a scrub or a large
+ * txg sync can no longer fill the device queue ahead of a sync read.
+ *
+ * The limits of the sync classes are fixed at their maximum.  Those of
+ * the async classes adapt between minimum and maximum to the observed
+ * service time of sync I/O: while it is above zfs_vdev_sync_lat_target
+ * they are halved, while it is below half of that they grow by one, and
+ * with no sync I/O at all they open up completely.
+ *
  * These tunables are for performance analysis.
  */
 /*
  * zfs_vdev_max_pending is the maximum number of i/os concurrently
- * pending to each device.  zfs_vdev_min_pending is the initial number
- * of i/os pending to each device (before it starts ramping up to
- * max_pending).
+ * pending to each device, over all classes.
  */
 int zfs_vdev_max_pending = 35;
-int zfs_vdev_min_pending = 4;
+
+int zfs_vdev_min_active[VDEV_LAT_CLASSES] = {
+	10,	/* VDEV_LAT_SYNC_READ	*/
+	10,	/* VDEV_LAT_SYNC_WRITE	*/
+	1,	/* VDEV_LAT_ASYNC_READ	*/
+	1,	/* VDEV_LAT_ASYNC_WRITE	*/
+	1,	/* VDEV_LAT_SCRUB	*/
+};
+
+int zfs_vdev_max_active[VDEV_LAT_CLASSES] = {
+	10,	/* VDEV_LAT_SYNC_READ	*/
+	10,	/* VDEV_LAT_SYNC_WRITE	*/
+	3,	/* VDEV_LAT_ASYNC_READ	*/
+	10,	/* VDEV_LAT_ASYNC_WRITE	*/
+	2,	/* VDEV_LAT_SCRUB	*/
+};
+
+/* adapt the async limits to sync I/O latency (0 pins them at max) */
+int zfs_vdev_adaptive = 1;
+
+/* sync I/O service time to aim for, in microseconds */
+int zfs_vdev_sync_lat_target = 20000;
+
+/* minimum interval between adjustments, in microseconds */
+int zfs_vdev_adapt_interval = 10000;
 
 /* deadline = pri + (lbolt >> time_shift) */
 int zfs_vdev_time_shift = 6;
 
-/* exponential I/O issue ramp-up rate */
-int zfs_vdev_ramp_rate = 2;
-
 /*
  * i/os will be aggregated into a single large i/o up to
  * zfs_vdev_aggregation_limit bytes long.
@@ -105,11 +141,16 @@ void
 vdev_queue_init(vdev_t *vd)
 {
 	vdev_queue_t *vq = &vd->vdev_queue;
+	int c;
 
 	mutex_init(&vq->vq_lock, NULL, MUTEX_DEFAULT, NULL);
 
-	avl_create(&vq->vq_deadline_tree, vdev_queue_deadline_compare,
-	    sizeof (zio_t), offsetof(struct zio, io_deadline_node));
+	for (c = 0; c < VDEV_LAT_CLASSES; c++) {
+		avl_create(&vq->vq_class[c].vqc_tree,
+		    vdev_queue_deadline_compare, sizeof (zio_t),
+		    offsetof(struct zio, io_deadline_node));
+		vq->vq_class[c].vqc_limit = zfs_vdev_max_active[c];
+	}
 
 	avl_create(&vq->vq_read_tree, vdev_queue_offset_compare,
 	    sizeof (zio_t), offsetof(struct zio, io_offset_node));
@@ -125,8 +166,10 @@ void
 vdev_queue_fini(vdev_t *vd)
 {
 	vdev_queue_t *vq = &vd->vdev_queue;
+	int c;
 
-	avl_destroy(&vq->vq_deadline_tree);
+	for (c = 0; c < VDEV_LAT_CLASSES; c++)
+		avl_destroy(&vq->vq_class[c].vqc_tree);
 	avl_destroy(&vq->vq_read_tree);
 	avl_destroy(&vq->vq_write_tree);
 	avl_destroy(&vq->vq_pending_tree);
@@ -134,20 +177,107 @@ vdev_queue_fini(vdev_t *vd)
 	mutex_destroy(&vq->vq_lock);
 }
 
+static vdev_lat_class_t
+vdev_queue_class(zio_t *zio)
+{
+	if (zio->io_flags & ZIO_FLAG_SCRUB_THREAD)
+		return (VDEV_LAT_SCRUB);
+
+	if (zio->io_type == ZIO_TYPE_READ)
+		return (zio->io_priority == ZIO_PRIORITY_ASYNC_READ ?
+		    VDEV_LAT_ASYNC_READ : VDEV_LAT_SYNC_READ);
+
+	return (zio->io_priority == ZIO_PRIORITY_ASYNC_WRITE ?
+	    VDEV_LAT_ASYNC_WRITE : VDEV_LAT_SYNC_WRITE);
+}
+
 static void
 vdev_queue_io_add(vdev_queue_t *vq, zio_t *zio)
 {
-	avl_add(&vq->vq_deadline_tree, zio);
+	avl_add(&vq->vq_class[vdev_queue_class(zio)].vqc_tree, zio);
 	avl_add(zio->io_vdev_tree, zio);
 }
 
 static void
 vdev_queue_io_remove(vdev_queue_t *vq, zio_t *zio)
 {
-	avl_remove(&vq->vq_deadline_tree, zio);
+	avl_remove(&vq->vq_class[vdev_queue_class(zio)].vqc_tree, zio);
 	avl_remove(zio->io_vdev_tree, zio);
 }
 
+/*
+ * Return the class allowed to issue next, or VDEV_LAT_CLASSES if none is.
+ */
+static int
+vdev_queue_class_to_issue(vdev_queue_t *vq)
+{
+	vdev_queue_class_t *vqc;
+	int c;
+
+	if (avl_numnodes(&vq->vq_pending_tree) >= zfs_vdev_max_pending)
+		return (VDEV_LAT_CLASSES);
+
+	for (c = 0; c < VDEV_LAT_CLASSES; c++) {
+		vqc = &vq->vq_class[c];
+		if (avl_numnodes(&vqc->vqc_tree) != 0 &&
+		    vqc->vqc_active < zfs_vdev_min_active[c])
+			return (c);
+	}
+
+	for (c = 0; c < VDEV_LAT_CLASSES; c++) {
+		vqc = &vq->vq_class[c];
+		if (avl_numnodes(&vqc->vqc_tree) != 0 &&
+		    vqc->vqc_active < vqc->vqc_limit)
+			return (c);
+	}
+
+	return (VDEV_LAT_CLASSES);
+}
+
+/*
+ * Called on every completion: fold a sync I/O's service time into the
+ * average, and adjust the class limits at most once per interval.
+ */
+static void
+vdev_queue_adapt(vdev_queue_t *vq, vdev_lat_class_t c, hrtime_t service,
+    hrtime_t now)
+{
+	hrtime_t target = (hrtime_t)zfs_vdev_sync_lat_target * 1000;
+	hrtime_t interval = (hrtime_t)zfs_vdev_adapt_interval * 1000;
+	vdev_queue_class_t *vqc;
+	int a, limit;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (c == VDEV_LAT_SYNC_READ || c == VDEV_LAT_SYNC_WRITE) {
+		if (vq->vq_sync_lat == 0)
+			vq->vq_sync_lat = service;
+		vq->vq_sync_lat += (service - vq->vq_sync_lat) / 8;
+		vq->vq_sync_time = now;
+	}
+
+	if (now - vq->vq_adapt_time < interval)
+		return;
+	vq->vq_adapt_time = now;
+
+	for (a = 0; a < VDEV_LAT_CLASSES; a++) {
+		vqc = &vq->vq_class[a];
+		limit = vqc->vqc_limit;
+
+		if (a == VDEV_LAT_SYNC_READ || a == VDEV_LAT_SYNC_WRITE ||
+		    !zfs_vdev_adaptive ||
+		    now - vq->vq_sync_time > 10 * interval)
+			limit = zfs_vdev_max_active[a];
+		else if (vq->vq_sync_lat > target)
+			limit /= 2;
+		else if (vq->vq_sync_lat < target / 2)
+			limit++;
+
+		vqc->vqc_limit = MIN(MAX(limit, zfs_vdev_min_active[a]),
+		    zfs_vdev_max_active[a]);
+	}
+}
+
 static void
 vdev_queue_agg_io_done(zio_t *aio)
 {
@@ -175,22 +305,28 @@ vdev_queue_agg_io_done(zio_t *aio)
 typedef void zio_issue_func_t(zio_t *);
 
 static zio_t *
-vdev_queue_io_to_issue(vdev_queue_t *vq, uint64_t pending_limit,
-	zio_issue_func_t **funcp)
+vdev_queue_io_to_issue(vdev_queue_t *vq, zio_issue_func_t **funcp)
 {
 	zio_t *fio, *lio, *aio, *dio;
 	avl_tree_t *tree;
 	uint64_t size;
+	int c;
 
 	ASSERT(MUTEX_HELD(&vq->vq_lock));
 
 	*funcp = NULL;
 
-	if (avl_numnodes(&vq->vq_pending_tree) >= pending_limit ||
-	    avl_numnodes(&vq->vq_deadline_tree) == 0)
+	if ((c = vdev_queue_class_to_issue(vq)) == VDEV_LAT_CLASSES)
 		return (NULL);
 
-	fio = lio = avl_first(&vq->vq_deadline_tree);
+	/*
+	 * Adjacent I/Os of other classes are aggregated along with the one
+	 * picked, and the aggregate counts against that class.  The class is
+	 * recorded in the zio we issue, so that vdev_queue_io_done() gives
+	 * the slot back to the class that took it.
+	 */
+	fio = lio = avl_first(&vq->vq_class[c].vqc_tree);
+	vq->vq_class[c].vqc_active++;
 
 	tree = fio->io_vdev_tree;
 	size = fio->io_size;
@@ -209,6 +345,8 @@ vdev_queue_io_to_issue(vdev_queue_t *vq, uint64_t pending_limit,
 		size += dio->io_size;
 	}
 
+	vq->vq_last_offset = fio->io_offset + size;
+
 	if (fio != lio) {
 		char *buf = zio_buf_alloc(size);
 		uint64_t offset = 0;
@@ -224,6 +362,8 @@ vdev_queue_io_to_issue(vdev_queue_t *vq, uint64_t pending_limit,
 		    vdev_queue_agg_io_done, NULL);
 
 		aio->io_delegate_list = fio;
+		aio->io_issue_timestamp = gethrtime();
+		aio->io_vq_class = c;
 
 		for (dio = fio; dio != NULL; dio = dio->io_delegate_next) {
 			ASSERT(dio->io_type == aio->io_type);
@@ -253,6 +393,8 @@ vdev_queue_io_to_issue(vdev_queue_t *vq, uint64_t pending_limit,
 	vdev_queue_io_remove(vq, fio);
 
 	avl_add(&vq->vq_pending_tree, fio);
+	fio->io_issue_timestamp = gethrtime();
+	fio->io_vq_class = c;
 
 	*funcp = zio_next_stage;
 
@@ -282,10 +424,11 @@ vdev_queue_io(zio_t *zio)
 
 	zio->io_deadline = (zio->io_timestamp >> zfs_vdev_time_shift) +
 	    zio->io_priority;
+	zio->io_queue_timestamp = gethrtime();
 
 	vdev_queue_io_add(vq, zio);
 
-	nio = vdev_queue_io_to_issue(vq, zfs_vdev_min_pending, &func);
+	nio = vdev_queue_io_to_issue(vq, &func);
 
 	mutex_exit(&vq->vq_lock);
 
@@ -296,20 +439,101 @@ vdev_queue_io(zio_t *zio)
 	return (NULL);
 }
 
+/*
+ * Latency histograms.
+ *
+ * Every I/O that passes through the queue is timestamped when it is queued
+ * and when it (or the aggregate I/O it was merged into) is issued to the
+ * device. On completion, the two intervals are added to the histograms of
+ * the I/O's class in vdev_lat_stat, under vq_lock.
+ */
+static int
+vdev_queue_lat_bucket(hrtime_t delta)
+{
+	int b = 0;
+
+	while (delta > 1 && b < VDEV_LAT_BUCKETS - 1) {
+		delta >>= 1;
+		b++;
+	}
+
+	return (b);
+}
+
+/*
+ * Account for 'zio', which was issued to the device as part of 'pio'
+ * (either the zio itself or the aggregate I/O it was merged into).
+ */
+static void
+vdev_queue_lat_update(vdev_t *vd, zio_t *zio, zio_t *pio, hrtime_t now)
+{
+	vdev_lat_stat_t *vls = &vd->vdev_lat_stat;
+	vdev_lat_class_t c;
+
+	ASSERT(MUTEX_HELD(&vd->vdev_queue.vq_lock));
+
+	if (zio->io_queue_timestamp == 0 || pio->io_issue_timestamp == 0)
+		return;
+
+	c = vdev_queue_class(zio);
+	vls->vls_queue[c][vdev_queue_lat_bucket(pio->io_issue_timestamp -
+	    zio->io_queue_timestamp)]++;
+	vls->vls_disk[c][vdev_queue_lat_bucket(now -
+	    pio->io_issue_timestamp)]++;
+}
+
+/*
+ * The number of I/Os queued or issued to a leaf vdev.  This is read
+ * without vq_lock, so it is only an estimate.
+ */
+uint64_t
+vdev_queue_length(vdev_t *vd)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+
+	return (avl_numnodes(&vq->vq_pending_tree) +
+	    avl_numnodes(&vq->vq_read_tree) + avl_numnodes(&vq->vq_write_tree));
+}
+
 void
 vdev_queue_io_done(zio_t *zio)
 {
-	vdev_queue_t *vq = &zio->io_vd->vdev_queue;
-	zio_t *nio;
+	vdev_t *vd = zio->io_vd;
+	vdev_queue_t *vq = &vd->vdev_queue;
+	hrtime_t now = gethrtime();
+	zio_t *nio, *dio;
 	zio_issue_func_t *func;
-	int i;
+	vdev_lat_class_t c;
 
 	mutex_enter(&vq->vq_lock);
 
 	avl_remove(&vq->vq_pending_tree, zio);
 
-	for (i = 0; i < zfs_vdev_ramp_rate; i++) {
-		nio = vdev_queue_io_to_issue(vq, zfs_vdev_max_pending, &func);
+	c = zio->io_vq_class;
+	if (zio->io_delegate_list == NULL) {
+		vdev_queue_lat_update(vd, zio, zio, now);
+	} else {
+		for (dio = zio->io_delegate_list; dio != NULL;
+		    dio = dio->io_delegate_next)
+			vdev_queue_lat_update(vd, dio, zio, now);
+	}
+
+	ASSERT(vq->vq_class[c].vqc_active != 0);
+	vq->vq_class[c].vqc_active--;
+	vdev_queue_adapt(vq, c, now - zio->io_issue_timestamp, now);
+
+	/*
+	 * The average read service time guides vdev_mirror_child_select().
+	 */
+	if (zio->io_type == ZIO_TYPE_READ) {
+		if (vq->vq_read_lat == 0)
+			vq->vq_read_lat = now - zio->io_issue_timestamp;
+		vq->vq_read_lat += (now - zio->io_issue_timestamp -
+		    vq->vq_read_lat) / 8;
+	}
+
+	for (;;) {
+		nio = vdev_queue_io_to_issue(vq, &func);
 		if (nio == NULL)
 			break;
 		mutex_exit(&vq->vq_lock);
@@ -33,6 +33,7 @@
 #include <sys/zio_checksum.h>
 #include <sys/fs/zfs.h>
 #include <sys/fm/fs/zfs.h>
+#include <sys/zfs_simd.h>
 
 /*
  * Virtual device vector for RAID-Z.
@@ -292,10 +293,270 @@ vdev_raidz_map_free(zio_t *zio)
 	zio->io_vsd = NULL;
 }
 
+/*
+ * Parity kernels.
+ *
+ * All of the bulk work in generating and reconstructing parity reduces to a
+ * handful of primitives over arrays of 64-bit words: copying, XOR-ing one
+ * array into another and, for Q, multiplying every byte of an array by 2
+ * (optionally XOR-ing in a source array at the same time). The implementation
+ * of these primitives is kept in a vector of operations so that processors
+ * with wide integer units can process 2 or 4 words per instruction instead of
+ * 1. The portable scalar implementation is always available and is the
+ * reference against which the others are verified (see vdev_raidz_bench()).
+ *
+ * The implementation is chosen by probing the processor each time a RAID-Z
+ * vdev is opened; zfs_vdev_raidz_impl can be set to the index of an entry in
+ * vdev_raidz_impls[] to force a particular one. Since every implementation
+ * produces identical results, switching between them while I/O is in flight
+ * is harmless; callers simply pick up vdev_raidz_impl once per operation.
+ */
+typedef struct raidz_impl_ops {
+	void		(*rzi_copy)(uint64_t *, const uint64_t *, uint64_t);
+	void		(*rzi_xor)(uint64_t *, const uint64_t *, uint64_t);
+	void		(*rzi_mul2)(uint64_t *, uint64_t);
+	void		(*rzi_mul2_xor)(uint64_t *, const uint64_t *, uint64_t);
+	void		(*rzi_pq)(uint64_t *, uint64_t *, const uint64_t *,
+	    uint64_t);
+	boolean_t	(*rzi_supported)(void);
+	const char	*rzi_name;
+} raidz_impl_ops_t;
+
+/*
+ * Rather than multiplying each byte individually (as described above), we
+ * are able to handle 8 at once by generating a mask based on the high bit in
+ * each byte and using that to conditionally XOR in 0x1d.
+ */
+#define	VDEV_RAIDZ_64MUL_2(x, mask)					\
+{									\
+	(mask) = (x) & 0x8080808080808080ULL;				\
+	(mask) = ((mask) << 1) - ((mask) >> 7);				\
+	(x) = (((x) << 1) & 0xfefefefefefefefeULL) ^			\
+	    ((mask) & 0x1d1d1d1d1d1d1d1dULL);				\
+}
+
+static void
+vdev_raidz_scalar_copy(uint64_t *dst, const uint64_t *src, uint64_t cnt)
+{
+	uint64_t i;
+
+	for (i = 0; i < cnt; i++)
+		dst[i] = src[i];
+}
+
+static void
+vdev_raidz_scalar_xor(uint64_t *dst, const uint64_t *src, uint64_t cnt)
+{
+	uint64_t i;
+
+	for (i = 0; i < cnt; i++)
+		dst[i] ^= src[i];
+}
+
+static void
+vdev_raidz_scalar_mul2(uint64_t *dst, uint64_t cnt)
+{
+	uint64_t i, mask;
+
+	for (i = 0; i < cnt; i++)
+		VDEV_RAIDZ_64MUL_2(dst[i], mask);
+}
+
+static void
+vdev_raidz_scalar_mul2_xor(uint64_t *dst, const uint64_t *src, uint64_t cnt)
+{
+	uint64_t i, mask;
+
+	for (i = 0; i < cnt; i++) {
+		VDEV_RAIDZ_64MUL_2(dst[i], mask);
+		dst[i] ^= src[i];
+	}
+}
+
+static void
+vdev_raidz_scalar_pq(uint64_t *p, uint64_t *q, const uint64_t *src,
+    uint64_t cnt)
+{
+	uint64_t i, mask;
+
+	for (i = 0; i < cnt; i++) {
+		VDEV_RAIDZ_64MUL_2(q[i], mask);
+		q[i] ^= src[i];
+		p[i] ^= src[i];
+	}
+}
+
+static boolean_t
+vdev_raidz_scalar_supported(void)
+{
+	return (B_TRUE);
+}
+
+static const raidz_impl_ops_t vdev_raidz_scalar_impl = {
+	vdev_raidz_scalar_copy,
+	vdev_raidz_scalar_xor,
+	vdev_raidz_scalar_mul2,
+	vdev_raidz_scalar_mul2_xor,
+	vdev_raidz_scalar_pq,
+	vdev_raidz_scalar_supported,
+	"scalar"
+};
+
+#ifdef ZFS_SIMD
+
+/*
+ * Column buffers are only guaranteed to be 8-byte aligned, so the vector
+ * types are declared with that alignment to get unaligned loads and stores.
+ */
+typedef uint64_t raidz_v2_t __attribute__((vector_size(16), aligned(8),
+    __may_alias__));
+typedef uint64_t raidz_v4_t __attribute__((vector_size(32), aligned(8),
+    __may_alias__));
+
+/*
+ * Generate the five primitives for a vector type of 'width' 64-bit words.
+ * Any remainder that doesn't fill a vector is handed to the scalar code;
+ * in practice columns are a multiple of 512 bytes so there never is one.
+ */
+#define	VDEV_RAIDZ_VEC_IMPL(name, vtype, width, isa)			\
+									\
+static void __attribute__((target(isa)))				\
+vdev_raidz_##name##_copy(uint64_t *dst, const uint64_t *src, uint64_t cnt) \
+{									\
+	for (; cnt >= (width); cnt -= (width), dst += (width),		\
+	    src += (width))						\
+		*(vtype *)dst = *(const vtype *)src;			\
+	vdev_raidz_scalar_copy(dst, src, cnt);				\
+}									\
+									\
+static void __attribute__((target(isa)))				\
+vdev_raidz_##name##_xor(uint64_t *dst, const uint64_t *src, uint64_t cnt) \
+{									\
+	for (; cnt >= (width); cnt -= (width), dst += (width),		\
+	    src += (width))						\
+		*(vtype *)dst ^= *(const vtype *)src;			\
+	vdev_raidz_scalar_xor(dst, src, cnt);				\
+}									\
+									\
+static void __attribute__((target(isa)))				\
+vdev_raidz_##name##_mul2(uint64_t *dst, uint64_t cnt)			\
+{									\
+	vtype x, mask;							\
+									\
+	for (; cnt >= (width); cnt -= (width), dst += (width)) {	\
+		x = *(vtype *)dst;					\
+		VDEV_RAIDZ_64MUL_2(x, mask);				\
+		*(vtype *)dst = x;					\
+	}								\
+	vdev_raidz_scalar_mul2(dst, cnt);				\
+}									\
+									\
+static void __attribute__((target(isa)))				\
+vdev_raidz_##name##_mul2_xor(uint64_t *dst, const uint64_t *src,	\
+    uint64_t cnt)							\
+{									\
+	vtype x, mask;							\
+									\
+	for (; cnt >= (width); cnt -= (width), dst += (width),		\
+	    src += (width)) {						\
+		x = *(vtype *)dst;					\
+		VDEV_RAIDZ_64MUL_2(x, mask);				\
+		*(vtype *)dst = x ^ *(const vtype *)src;		\
+	}								\
+	vdev_raidz_scalar_mul2_xor(dst, src, cnt);			\
+}									\
+									\
+static void __attribute__((target(isa)))				\
+vdev_raidz_##name##_pq(uint64_t *p, uint64_t *q, const uint64_t *src,	\
+    uint64_t cnt)							\
+{									\
+	vtype d, x, mask;						\
+									\
+	for (; cnt >= (width); cnt -= (width), p += (width),		\
+	    q += (width), src += (width)) {				\
+		d = *(const vtype *)src;				\
+		x = *(vtype *)q;					\
+		VDEV_RAIDZ_64MUL_2(x, mask);				\
+		*(vtype *)q = x ^ d;					\
+		*(vtype *)p ^= d;					\
+	}								\
+	vdev_raidz_scalar_pq(p, q, src, cnt);				\
+}									\
+									\
+static const raidz_impl_ops_t vdev_raidz_##name##_impl = {		\
+	vdev_raidz_##name##_copy,					\
+	vdev_raidz_##name##_xor,					\
+	vdev_raidz_##name##_mul2,					\
+	vdev_raidz_##name##_mul2_xor,					\
+	vdev_raidz_##name##_pq,						\
+	zfs_##name##_available,						\
+	#name								\
+};
+
+VDEV_RAIDZ_VEC_IMPL(sse2, raidz_v2_t, 2, "sse2")
+VDEV_RAIDZ_VEC_IMPL(avx2, raidz_v4_t, 4, "avx2")
+
+#endif	/* ZFS_SIMD */
+
+/*
+ * Implementations in increasing order of preference.
+ */
+static const raidz_impl_ops_t *vdev_raidz_impls[] = {
+	&vdev_raidz_scalar_impl,
+#ifdef ZFS_SIMD
+	&vdev_raidz_sse2_impl,
+	&vdev_raidz_avx2_impl,
+#endif
+};
+
+#define	VDEV_RAIDZ_IMPLS	\
+	(sizeof (vdev_raidz_impls) / sizeof (vdev_raidz_impls[0]))
+
+int zfs_vdev_raidz_impl = -1;		/* -1: fastest supported */
+
+static const raidz_impl_ops_t *vdev_raidz_impl = &vdev_raidz_scalar_impl;
+
+static void
+vdev_raidz_impl_select(void)
+{
+	const raidz_impl_ops_t *impl = &vdev_raidz_scalar_impl;
+	int i;
+
+	if (zfs_vdev_raidz_impl >= 0 &&
+	    zfs_vdev_raidz_impl < VDEV_RAIDZ_IMPLS &&
+	    vdev_raidz_impls[zfs_vdev_raidz_impl]->rzi_supported()) {
+		impl = vdev_raidz_impls[zfs_vdev_raidz_impl];
+	} else {
+		for (i = VDEV_RAIDZ_IMPLS - 1; i >= 0; i--) {
+			if (vdev_raidz_impls[i]->rzi_supported()) {
+				impl = vdev_raidz_impls[i];
+				break;
+			}
+		}
+	}
+
+	if (impl != vdev_raidz_impl)
+		dprintf("raidz parity implementation %s\n", impl->rzi_name);
+	vdev_raidz_impl = impl;
+}
+
+/*
+ * Return the name of parity implementation 'impl', or NULL if there is no
+ * such implementation.
+ */
+const char *
+vdev_raidz_impl_name(int impl)
+{
+	if (impl < 0 || impl >= VDEV_RAIDZ_IMPLS)
+		return (NULL);
+	return (vdev_raidz_impls[impl]->rzi_name);
+}
+
 static void
 vdev_raidz_generate_parity_p(raidz_map_t *rm)
 {
-	uint64_t *p, *src, pcount, ccount, i;
+	const raidz_impl_ops_t *ops = vdev_raidz_impl;
+	uint64_t *p, *src, pcount, ccount;
 	int c;
 
 	pcount = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (src[0]);
@@ -307,14 +568,10 @@ vdev_raidz_generate_parity_p(raidz_map_t *rm)
 
 		if (c == rm->rm_firstdatacol) {
 			ASSERT(ccount == pcount);
-			for (i = 0; i < ccount; i++, p++, src++) {
-				*p = *src;
-			}
+			ops->rzi_copy(p, src, ccount);
 		} else {
 			ASSERT(ccount <= pcount);
-			for (i = 0; i < ccount; i++, p++, src++) {
-				*p ^= *src;
-			}
+			ops->rzi_xor(p, src, ccount);
 		}
 	}
 }
@@ -322,7 +579,8 @@ vdev_raidz_generate_parity_p(raidz_map_t *rm)
 static void
 vdev_raidz_generate_parity_pq(raidz_map_t *rm)
 {
-	uint64_t *q, *p, *src, pcount, ccount, mask, i;
+	const raidz_impl_ops_t *ops = vdev_raidz_impl;
+	uint64_t *q, *p, *src, pcount, ccount;
 	int c;
 
 	pcount = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (src[0]);
@@ -337,41 +595,19 @@ vdev_raidz_generate_parity_pq(raidz_map_t *rm)
 
 		if (c == rm->rm_firstdatacol) {
 			ASSERT(ccount == pcount || ccount == 0);
-			for (i = 0; i < ccount; i++, p++, q++, src++) {
-				*q = *src;
-				*p = *src;
-			}
-			for (; i < pcount; i++, p++, q++, src++) {
-				*q = 0;
-				*p = 0;
-			}
+			ops->rzi_copy(q, src, ccount);
+			ops->rzi_copy(p, src, ccount);
+			bzero(q + ccount, (pcount - ccount) * sizeof (q[0]));
+			bzero(p + ccount, (pcount - ccount) * sizeof (p[0]));
 		} else {
 			ASSERT(ccount <= pcount);
 
-			/*
-			 * Rather than multiplying each byte individually (as
-			 * described above), we are able to handle 8 at once
-			 * by generating a mask based on the high bit in each
-			 * byte and using that to conditionally XOR in 0x1d.
-			 */
-			for (i = 0; i < ccount; i++, p++, q++, src++) {
-				mask = *q & 0x8080808080808080ULL;
-				mask = (mask << 1) - (mask >> 7);
-				*q = ((*q << 1) & 0xfefefefefefefefeULL) ^
-				    (mask & 0x1d1d1d1d1d1d1d1dULL);
-				*q ^= *src;
-				*p ^= *src;
-			}
+			ops->rzi_pq(p, q, src, ccount);
 
 			/*
 			 * Treat short columns as though they are full of 0s.
 			 */
-			for (; i < pcount; i++, q++) {
-				mask = *q & 0x8080808080808080ULL;
-				mask = (mask << 1) - (mask >> 7);
-				*q = ((*q << 1) & 0xfefefefefefefefeULL) ^
-				    (mask & 0x1d1d1d1d1d1d1d1dULL);
-			}
+			ops->rzi_mul2(q + ccount, pcount - ccount);
 		}
 	}
 }
@@ -379,7 +615,8 @@ vdev_raidz_generate_parity_pq(raidz_map_t *rm)
 static void
 vdev_raidz_reconstruct_p(raidz_map_t *rm, int x)
 {
-	uint64_t *dst, *src, xcount, ccount, count, i;
+	const raidz_impl_ops_t *ops = vdev_raidz_impl;
+	uint64_t *dst, *src, xcount, ccount, count;
 	int c;
 
 	xcount = rm->rm_col[x].rc_size / sizeof (src[0]);
@@ -388,9 +625,7 @@ vdev_raidz_reconstruct_p(raidz_map_t *rm, int x)
 
 	src = rm->rm_col[VDEV_RAIDZ_P].rc_data;
 	dst = rm->rm_col[x].rc_data;
-	for (i = 0; i < xcount; i++, dst++, src++) {
-		*dst = *src;
-	}
+	ops->rzi_copy(dst, src, xcount);
 
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
 		src = rm->rm_col[c].rc_data;
@@ -402,16 +637,15 @@ vdev_raidz_reconstruct_p(raidz_map_t *rm, int x)
 		ccount = rm->rm_col[c].rc_size / sizeof (src[0]);
 		count = MIN(ccount, xcount);
 
-		for (i = 0; i < count; i++, dst++, src++) {
-			*dst ^= *src;
-		}
+		ops->rzi_xor(dst, src, count);
 	}
 }
 
 static void
 vdev_raidz_reconstruct_q(raidz_map_t *rm, int x)
 {
-	uint64_t *dst, *src, xcount, ccount, count, mask, i;
+	const raidz_impl_ops_t *ops = vdev_raidz_impl;
+	uint64_t *dst, *src, xcount, ccount, count, i;
 	uint8_t *b;
 	int c, j, exp;
 
@@ -430,32 +664,15 @@ vdev_raidz_reconstruct_q(raidz_map_t *rm, int x)
 		count = MIN(ccount, xcount);
 
 		if (c == rm->rm_firstdatacol) {
-			for (i = 0; i < count; i++, dst++, src++) {
-				*dst = *src;
-			}
-			for (; i < xcount; i++, dst++) {
-				*dst = 0;
-			}
-
+			ops->rzi_copy(dst, src, count);
+			bzero(dst + count, (xcount - count) * sizeof (dst[0]));
 		} else {
 			/*
-			 * For an explanation of this, see the comment in
-			 * vdev_raidz_generate_parity_pq() above.
+			 * For an explanation of this, see the comment at
+			 * VDEV_RAIDZ_64MUL_2() above.
 			 */
-			for (i = 0; i < count; i++, dst++, src++) {
-				mask = *dst & 0x8080808080808080ULL;
-				mask = (mask << 1) - (mask >> 7);
-				*dst = ((*dst << 1) & 0xfefefefefefefefeULL) ^
-				    (mask & 0x1d1d1d1d1d1d1d1dULL);
-				*dst ^= *src;
-			}
-
-			for (; i < xcount; i++, dst++) {
-				mask = *dst & 0x8080808080808080ULL;
-				mask = (mask << 1) - (mask >> 7);
-				*dst = ((*dst << 1) & 0xfefefefefefefefeULL) ^
-				    (mask & 0x1d1d1d1d1d1d1d1dULL);
-			}
+			ops->rzi_mul2_xor(dst, src, count);
+			ops->rzi_mul2(dst + count, xcount - count);
 		}
 	}
 
@@ -463,8 +680,8 @@ vdev_raidz_reconstruct_q(raidz_map_t *rm, int x)
 	dst = rm->rm_col[x].rc_data;
 	exp = 255 - (rm->rm_cols - 1 - x);
 
-	for (i = 0; i < xcount; i++, dst++, src++) {
-		*dst ^= *src;
+	ops->rzi_xor(dst, src, xcount);
+	for (i = 0; i < xcount; i++, dst++) {
 		for (j = 0, b = (uint8_t *)dst; j < 8; j++, b++) {
 			*b = vdev_raidz_exp2(*b, exp);
 		}
@@ -557,6 +774,97 @@ vdev_raidz_reconstruct_pq(raidz_map_t *rm, int x, int y)
 	rm->rm_col[VDEV_RAIDZ_Q].rc_data = qdata;
 }
 
+/*
+ * Time the parity kernels of implementation 'impl' on a synthetic map of
+ * 'cols' columns (including 'nparity' parity columns) of 'colsize' bytes
+ * each. Parity is generated 'iters' times, then the first one or two data
+ * columns are destroyed and reconstructed 'iters' times; the elapsed times
+ * are returned in *gen and *rec. The reconstructed data is compared against
+ * the original so that the vector kernels are checked as well as timed.
+ * Returns ENOTSUP if the implementation can't run on this processor and
+ * ECKSUM if reconstruction produced the wrong data. Used by ztest -b raidz.
+ */
+int
+vdev_raidz_bench(int impl, int nparity, int cols, uint64_t colsize,
+    int iters, hrtime_t *gen, hrtime_t *rec)
+{
+	const raidz_impl_ops_t *saved = vdev_raidz_impl;
+	raidz_map_t *rm;
+	void *orig[VDEV_RAIDZ_MAXPARITY];
+	uint64_t *w, seed = 0x2545f4914f6cdd1dULL;
+	hrtime_t start;
+	int c, i, x, error = 0;
+
+	if (impl < 0 || impl >= VDEV_RAIDZ_IMPLS ||
+	    !vdev_raidz_impls[impl]->rzi_supported())
+		return (ENOTSUP);
+	if (nparity < 1 || nparity > VDEV_RAIDZ_MAXPARITY ||
+	    cols < nparity + 1 || (colsize & (sizeof (uint64_t) - 1)) != 0)
+		return (EINVAL);
+
+	rm = kmem_zalloc(offsetof(raidz_map_t, rm_col[cols]), KM_SLEEP);
+	rm->rm_cols = cols;
+	rm->rm_firstdatacol = nparity;
+	for (c = 0; c < cols; c++) {
+		rm->rm_col[c].rc_size = colsize;
+		rm->rm_col[c].rc_data = zio_buf_alloc(colsize);
+		for (w = rm->rm_col[c].rc_data, i = 0;
+		    i < colsize / sizeof (uint64_t); i++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			w[i] = seed;
+		}
+	}
+
+	/*
+	 * The timed section runs with the requested implementation; all
+	 * other RAID-Z I/O in the process briefly uses it too, which is
+	 * harmless since the results are identical.
+	 */
+	vdev_raidz_impl = vdev_raidz_impls[impl];
+
+	start = gethrtime();
+	for (i = 0; i < iters; i++) {
+		if (nparity == 1)
+			vdev_raidz_generate_parity_p(rm);
+		else
+			vdev_raidz_generate_parity_pq(rm);
+	}
+	*gen = gethrtime() - start;
+
+	x = nparity;
+	for (c = 0; c < nparity && x + c < cols; c++) {
+		orig[c] = zio_buf_alloc(colsize);
+		bcopy(rm->rm_col[x + c].rc_data, orig[c], colsize);
+	}
+
+	start = gethrtime();
+	for (i = 0; i < iters; i++) {
+		bzero(rm->rm_col[x].rc_data, colsize);
+		if (nparity == 1 || x + 1 == cols) {
+			vdev_raidz_reconstruct_p(rm, x);
+		} else {
+			bzero(rm->rm_col[x + 1].rc_data, colsize);
+			vdev_raidz_reconstruct_pq(rm, x, x + 1);
+		}
+	}
+	*rec = gethrtime() - start;
+
+	vdev_raidz_impl = saved;
+
+	for (c = 0; c < nparity && x + c < cols; c++) {
+		if (bcmp(rm->rm_col[x + c].rc_data, orig[c], colsize) != 0)
+			error = ECKSUM;
+		zio_buf_free(orig[c], colsize);
+	}
+
+	for (c = 0; c < cols; c++)
+		zio_buf_free(rm->rm_col[c].rc_data, colsize);
+	kmem_free(rm, offsetof(raidz_map_t, rm_col[cols]));
+
+	return (error);
+}
 
 static int
 vdev_raidz_open(vdev_t *vd, uint64_t *asize, uint64_t *ashift)
@@ -569,6 +877,8 @@ vdev_raidz_open(vdev_t *vd, uint64_t *asize, uint64_t *ashift)
 
 	ASSERT(nparity > 0);
 
+	vdev_raidz_impl_select();
+
 	if (nparity > VDEV_RAIDZ_MAXPARITY ||
 	    vd->vdev_children < nparity + 1) {
 		vd->vdev_stat.vs_aux = VDEV_AUX_BAD_LABEL;
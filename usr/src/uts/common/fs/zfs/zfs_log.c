@@ -233,10 +233,11 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, int txtype,
 	 * Writes are handled in three different ways:
 	 *
 	 * WR_INDIRECT:
-	 *    If the write is greater than zfs_immediate_write_sz and there are
-	 *    no separate logs in this pool then later *if* we need to log the
-	 *    write then dmu_sync() is used to immediately write the block and
-	 *    its block pointer is put in the log record.
+	 *    If the write is greater than zil_immediate_write_sz() (at most
+	 *    zfs_immediate_write_sz, less while commits are large) and there
+	 *    are no separate logs in this pool then later *if* we need to log
+	 *    the write then dmu_sync() is used to immediately write the block
+	 *    and its block pointer is put in the log record.
 	 * WR_COPIED:
 	 *    If we know we'll immediately be committing the
 	 *    transaction (FDSYNC (O_DSYNC)), the we allocate a larger
@@ -247,7 +248,8 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, int txtype,
 	 *    we retrieve the data using the dmu.
 	 */
 	slogging = spa_has_slogs(zilog->zl_spa);
-	if (resid > zfs_immediate_write_sz && !slogging)
+	if (resid > zil_immediate_write_sz(zilog, zfs_immediate_write_sz) &&
+	    !slogging)
 		write_state = WR_INDIRECT;
 	else if (ioflag & FDSYNC)
 		write_state = WR_COPIED;
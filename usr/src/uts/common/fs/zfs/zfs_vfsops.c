@@ -2090,7 +2090,8 @@ zfs_vfs_sysctl(int *name, __unused u_int namelen, user_addr_t oldp, size_t *oldl
 		footprint->memory_stats.highest = zfs_footprint.highest;
 		footprint->memory_stats.maximum = zfs_footprint.maximum;
 
-		arc_get_stats(&footprint->arc_stats);
+		arc_get_stats(&footprint->arc_stats,
+		    &footprint->arc_hash_stats);
 
 		kmem_cache_stats(&footprint->cache_stats[0], max_caches, &act_caches);
 		footprint->caches_count = act_caches;
@@ -78,6 +78,43 @@ int zil_disable = 0;	/* disable intent logging */
  */
 boolean_t zfs_nocacheflush = B_FALSE;
 
+/*
+ * Let the next commit round be assembled and issued while earlier rounds'
+ * log blocks are still being written.  With this off, each round is
+ * written and flushed before the next one starts.
+ */
+int zil_commit_parallel = 1;
+
+/*
+ * Smallest write that zil_immediate_write_sz() will log indirectly.
+ */
+ssize_t zil_immediate_write_min = 8192;
+
+typedef struct zil_stats {
+	kstat_named_t	zs_commits;
+	kstat_named_t	zs_log_blocks;
+	kstat_named_t	zs_bytes_logged;
+	kstat_named_t	zs_bytes_padded;
+	kstat_named_t	zs_writes_copied;
+	kstat_named_t	zs_writes_indirect;
+} zil_stats_t;
+
+static zil_stats_t zil_stats = {
+	{ "commits",		KSTAT_DATA_UINT64 },
+	{ "log_blocks",		KSTAT_DATA_UINT64 },
+	{ "bytes_logged",	KSTAT_DATA_UINT64 },
+	{ "bytes_padded",	KSTAT_DATA_UINT64 },
+	{ "writes_copied",	KSTAT_DATA_UINT64 },
+	{ "writes_indirect",	KSTAT_DATA_UINT64 }
+};
+
+#define	ZILSTAT_INCR(stat, val) \
+	atomic_add_64(&zil_stats.stat.value.ui64, (val))
+
+#define	ZILSTAT_BUMP(stat)	ZILSTAT_INCR(stat, 1)
+
+static kstat_t *zil_ksp;
+
 static kmem_cache_t *zil_lwb_cache;
 
 static int
@@ -532,8 +569,11 @@ zil_add_vdev(zilog_t *zilog, uint64_t vdev)
 		return;
 
 	if (vdev < bmap_sz) {
+		/* zl_lock keeps the bit from slipping past zil_flush_vdevs() */
+		mutex_enter(&zilog->zl_lock);
 		cp = zilog->zl_vdev_bmap + (vdev / 8);
-		atomic_or_8(cp, 1 << (vdev % 8));
+		*cp |= 1 << (vdev % 8);
+		mutex_exit(&zilog->zl_lock);
 	} else  {
 		/*
 		 * insert into ordered list
@@ -566,20 +606,39 @@ zil_add_vdev(zilog_t *zilog, uint64_t vdev)
 	}
 }
 
+/*
+ * Flush the write caches of all vdevs written to since the last flush.
+ * Vdevs are only recorded once a write to them has completed, and flushes
+ * are serialized, so when this returns every log write that had completed
+ * by the time it was called is on stable storage, even if another commit
+ * round took its vdev and did the flush.
+ */
 static void
 zil_flush_vdevs(zilog_t *zilog)
 {
 	zil_vdev_t *zv;
 	zio_t *zio = NULL;
 	spa_t *spa = zilog->zl_spa;
+	uint8_t bmap[ZIL_VDEV_BMSZ];
+	list_t vdevs;
 	uint64_t vdev;
 	uint8_t b;
 	int i, j;
 
-	ASSERT(zilog->zl_writer);
+	list_create(&vdevs, sizeof (zil_vdev_t),
+	    offsetof(zil_vdev_t, vdev_seq_node));
+
+	mutex_enter(&zilog->zl_lock);
+	while (zilog->zl_flushing)
+		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+	zilog->zl_flushing = B_TRUE;
+	bcopy(zilog->zl_vdev_bmap, bmap, sizeof (bmap));
+	bzero(zilog->zl_vdev_bmap, sizeof (zilog->zl_vdev_bmap));
+	list_move_tail(&vdevs, &zilog->zl_vdev_list);
+	mutex_exit(&zilog->zl_lock);
 
-	for (i = 0; i < sizeof (zilog->zl_vdev_bmap); i++) {
-		b = zilog->zl_vdev_bmap[i];
+	for (i = 0; i < sizeof (bmap); i++) {
+		b = bmap[i];
 		if (b == 0)
 			continue;
 		for (j = 0; j < 8; j++) {
@@ -588,20 +647,25 @@ zil_flush_vdevs(zilog_t *zilog)
 				zio_flush_vdev(spa, vdev, &zio);
 			}
 		}
-		zilog->zl_vdev_bmap[i] = 0;
 	}
 
-	while ((zv = list_head(&zilog->zl_vdev_list)) != NULL) {
+	while ((zv = list_head(&vdevs)) != NULL) {
 		zio_flush_vdev(spa, zv->vdev, &zio);
-		list_remove(&zilog->zl_vdev_list, zv);
+		list_remove(&vdevs, zv);
 		kmem_free(zv, sizeof (zil_vdev_t));
 	}
+	list_destroy(&vdevs);
 	/*
 	 * Wait for all the flushes to complete.  Not all devices actually
 	 * support the DKIOCFLUSHWRITECACHE ioctl, so it's OK if it fails.
 	 */
 	if (zio)
 		(void) zio_wait(zio);
+
+	mutex_enter(&zilog->zl_lock);
+	zilog->zl_flushing = B_FALSE;
+	cv_broadcast(&zilog->zl_cv_writer);
+	mutex_exit(&zilog->zl_lock);
 }
 
 /*
@@ -620,11 +684,17 @@ zil_lwb_write_done(zio_t *zio)
 	 */
 	txg_rele_to_sync(&lwb->lwb_txgh);
 
+	/*
+	 * Record the vdev for flushing now that the write is done (see
+	 * zil_flush_vdevs()).  Errors propagate to the commit round's
+	 * root zio; rounds are retired in order by zil_commit_retire().
+	 */
+	if (zio->io_error == 0)
+		zil_add_vdev(zilog, DVA_GET_VDEV(BP_IDENTITY(&lwb->lwb_blk)));
+
 	zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
 	mutex_enter(&zilog->zl_lock);
 	lwb->lwb_buf = NULL;
-	if (zio->io_error)
-		zilog->zl_log_error = B_TRUE;
 	mutex_exit(&zilog->zl_lock);
 }
 
@@ -669,7 +739,7 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	blkptr_t *bp = &ztp->zit_next_blk;
 	uint64_t txg;
 	uint64_t zil_blksz;
-	int error;
+	int i, error;
 
 	ASSERT(lwb->lwb_nused <= ZIL_BLK_DATA_SZ(lwb));
 
@@ -684,17 +754,23 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	txg_rele_to_quiesce(&lwb->lwb_txgh);
 
 	/*
-	 * Pick a ZIL blocksize. We request a size that is the
-	 * maximum of the previous used size, the current used size and
-	 * the amount waiting in the queue.
+	 * Pick a ZIL blocksize: big enough for the largest of the last
+	 * ZIL_PREV_COMMITS commits, or for this one so far if it is larger.
+	 * A workload of small commits then gets small blocks, while one of
+	 * large commits gets blocks big enough to take a commit in one go.
 	 */
-	zil_blksz = MAX(zilog->zl_prev_used,
-	    zilog->zl_cur_used + sizeof (*ztp));
-	zil_blksz = MAX(zil_blksz, zilog->zl_itx_list_sz + sizeof (*ztp));
-	zil_blksz = P2ROUNDUP_TYPED(zil_blksz, ZIL_MIN_BLKSZ, uint64_t);
+	zil_blksz = zilog->zl_cur_used;
+	for (i = 0; i < ZIL_PREV_COMMITS; i++)
+		zil_blksz = MAX(zil_blksz, zilog->zl_prev_used[i]);
+	zil_blksz = P2ROUNDUP_TYPED(zil_blksz + sizeof (*ztp), ZIL_MIN_BLKSZ,
+	    uint64_t);
 	if (zil_blksz > ZIL_MAX_BLKSZ)
 		zil_blksz = ZIL_MAX_BLKSZ;
 
+	ZILSTAT_BUMP(zs_log_blocks);
+	ZILSTAT_INCR(zs_bytes_logged, lwb->lwb_nused);
+	ZILSTAT_INCR(zs_bytes_padded, ZIL_BLK_DATA_SZ(lwb) - lwb->lwb_nused);
+
 	BP_ZERO(bp);
 	/* pass the old blkptr in order to spread log blocks across devs */
 	error = zio_alloc_blk(spa, zil_blksz, bp, &lwb->lwb_blk, txg);
@@ -752,9 +828,6 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	list_insert_tail(&zilog->zl_lwb_list, nlwb);
 	mutex_exit(&zilog->zl_lock);
 
-	/* Record the vdev for later flushing */
-	zil_add_vdev(zilog, DVA_GET_VDEV(BP_IDENTITY(&(lwb->lwb_blk))));
-
 	/*
 	 * kick off the write for the old log block
 	 */
@@ -786,6 +859,13 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 
 	zilog->zl_cur_used += (reclen + dlen);
 
+	if (lrc->lrc_txtype == TX_WRITE) {
+		if (itx->itx_wr_state == WR_INDIRECT)
+			ZILSTAT_BUMP(zs_writes_indirect);
+		else
+			ZILSTAT_BUMP(zs_writes_copied);
+	}
+
 	zil_lwb_write_init(zilog, lwb);
 
 	/*
@@ -848,6 +928,33 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 	return (lwb);
 }
 
+/*
+ * Writes larger than the returned size should be logged WR_INDIRECT:
+ * written in place with dmu_sync() and logged as a block pointer, rather
+ * than copied into the log.  While this dataset's recent commits fit in a
+ * single log block, copying writes of up to 'max' keeps commit latency
+ * down.  Once commits grow past that, copying only makes them span more
+ * log blocks and writes the data twice, so the threshold drops with the
+ * average commit size, to no less than zil_immediate_write_min.
+ */
+ssize_t
+zil_immediate_write_sz(zilog_t *zilog, ssize_t max)
+{
+	uint64_t avg = 0;
+	ssize_t sz;
+	int i;
+
+	for (i = 0; i < ZIL_PREV_COMMITS; i++)
+		avg += zilog->zl_prev_used[i];
+	avg /= ZIL_PREV_COMMITS;
+
+	if (avg <= ZIL_MAX_BLKSZ)
+		return (max);
+
+	sz = (ssize_t)(max * ZIL_MAX_BLKSZ / avg);
+	return (MAX(sz, MIN(max, zil_immediate_write_min)));
+}
+
 itx_t *
 zil_itx_create(int txtype, size_t lrsize)
 {
@@ -942,7 +1049,12 @@ zil_clean(zilog_t *zilog)
 	mutex_exit(&zilog->zl_lock);
 }
 
-static void
+/*
+ * Assemble and issue a commit round.  Called with zl_lock held; returns
+ * with it held and the round queued on zl_round_list, or NULL if there
+ * was nothing to do.
+ */
+static zil_round_t *
 zil_commit_writer(zilog_t *zilog, uint64_t seq, uint64_t foid)
 {
 	uint64_t txg;
@@ -951,11 +1063,21 @@ zil_commit_writer(zilog_t *zilog, uint64_t seq, uint64_t foid)
 	itx_t *itx, *itx_next = (itx_t *)-1;
 	lwb_t *lwb;
 	spa_t *spa;
+	zil_round_t *zr;
 
 	zilog->zl_writer = B_TRUE;
 	zilog->zl_root_zio = NULL;
 	spa = zilog->zl_spa;
 
+	/*
+	 * If others are waiting to commit, push everything on their behalf
+	 * so that they can all share this round.
+	 */
+	if (zilog->zl_commit_waiters != 0) {
+		seq = zilog->zl_itx_seq;
+		foid = 0;
+	}
+
 	if (zilog->zl_suspend) {
 		lwb = NULL;
 	} else {
@@ -967,7 +1089,7 @@ zil_commit_writer(zilog_t *zilog, uint64_t seq, uint64_t foid)
 			 */
 			if (list_is_empty(&zilog->zl_itx_list)) {
 				zilog->zl_writer = B_FALSE;
-				return;
+				return (NULL);
 			}
 			mutex_exit(&zilog->zl_lock);
 			zil_create(zilog);
@@ -1038,52 +1160,140 @@ zil_commit_writer(zilog_t *zilog, uint64_t seq, uint64_t foid)
 		zilog->zl_itx_list_sz -= reclen;
 	}
 	DTRACE_PROBE1(zil__cw2, zilog_t *, zilog);
-	/* determine commit sequence number */
+	/*
+	 * Determine commit sequence number: every itx below it has now
+	 * been pushed, by this round or an earlier one.
+	 */
 	itx = list_head(&zilog->zl_itx_list);
 	if (itx)
 		commit_seq = itx->itx_lr.lrc_seq;
 	else
-		commit_seq = zilog->zl_itx_seq;
+		commit_seq = zilog->zl_itx_seq + 1;
 	mutex_exit(&zilog->zl_lock);
 
 	/* write the last block out */
 	if (lwb != NULL && lwb->lwb_zio != NULL)
 		lwb = zil_lwb_write_start(zilog, lwb);
 
-	zilog->zl_prev_used = zilog->zl_cur_used;
+	if (zilog->zl_cur_used != 0) {
+		zilog->zl_prev_used[zilog->zl_prev_rotor] = zilog->zl_cur_used;
+		zilog->zl_prev_rotor =
+		    (zilog->zl_prev_rotor + 1) & (ZIL_PREV_COMMITS - 1);
+	}
 	zilog->zl_cur_used = 0;
 
+	ZILSTAT_BUMP(zs_commits);
+
+	zr = kmem_zalloc(sizeof (zil_round_t), KM_SLEEP);
+	zr->zr_commit_seq = commit_seq;
+	zr->zr_root_zio = zilog->zl_root_zio;
+	zr->zr_sync = (lwb == NULL);
+	zilog->zl_root_zio = NULL;
+
+	mutex_enter(&zilog->zl_lock);
+	zr->zr_id = ++zilog->zl_round_id;
+	ASSERT3U(commit_seq, >=, zilog->zl_issued_seq);
+	zilog->zl_issued_seq = commit_seq;
+	list_insert_tail(&zilog->zl_round_list, zr);
+
 	/*
-	 * Wait if necessary for the log blocks to be on stable storage.
+	 * The next round can be assembled while this one is being written.
 	 */
-	if (zilog->zl_root_zio) {
+	if (zil_commit_parallel) {
+		zilog->zl_writer = B_FALSE;
+		cv_broadcast(&zilog->zl_cv_writer);
+	}
+
+	return (zr);
+}
+
+/*
+ * Retire, in order, the commit rounds at the head of zl_round_list whose
+ * log blocks are all on stable storage.
+ */
+static void
+zil_commit_retire(zilog_t *zilog)
+{
+	zil_round_t *zr;
+
+	ASSERT(MUTEX_HELD(&zilog->zl_lock));
+
+	while ((zr = list_head(&zilog->zl_round_list)) != NULL &&
+	    zr->zr_done) {
+		list_remove(&zilog->zl_round_list, zr);
+		ASSERT3U(zr->zr_commit_seq, >=, zilog->zl_commit_seq);
+		zilog->zl_commit_seq = zr->zr_commit_seq;
+		zilog->zl_round_done = zr->zr_id;
+		kmem_free(zr, sizeof (zil_round_t));
+	}
+	cv_broadcast(&zilog->zl_cv_writer);
+}
+
+/*
+ * Wait for a commit round we issued to reach stable storage, then for
+ * all earlier rounds to be retired.  Called and returns with zl_lock held.
+ */
+static void
+zil_commit_round_wait(zilog_t *zilog, zil_round_t *zr)
+{
+	uint64_t id = zr->zr_id;
+	int error = 0;
+
+	mutex_exit(&zilog->zl_lock);
+
+	if (zr->zr_root_zio != NULL) {
 		DTRACE_PROBE1(zil__cw3, zilog_t *, zilog);
-		(void) zio_wait(zilog->zl_root_zio);
+		error = zio_wait(zr->zr_root_zio);
 		DTRACE_PROBE1(zil__cw4, zilog_t *, zilog);
 		if (!zfs_nocacheflush)
 			zil_flush_vdevs(zilog);
 	}
 
-	if (zilog->zl_log_error || lwb == NULL) {
-		zilog->zl_log_error = 0;
+	if (error || zr->zr_sync)
 		txg_wait_synced(zilog->zl_dmu_pool, 0);
-	}
 
 	mutex_enter(&zilog->zl_lock);
-	zilog->zl_writer = B_FALSE;
+	zr->zr_done = B_TRUE;
+	zil_commit_retire(zilog);
+	while (zilog->zl_round_done < id)
+		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+
+	if (!zil_commit_parallel) {
+		zilog->zl_writer = B_FALSE;
+		cv_broadcast(&zilog->zl_cv_writer);
+	}
+}
 
-	ASSERT3U(commit_seq, >=, zilog->zl_commit_seq);
-	zilog->zl_commit_seq = commit_seq;
+/*
+ * Wait for any commit round being assembled or written.
+ */
+static void
+zil_commit_wait_all(zilog_t *zilog)
+{
+	ASSERT(MUTEX_HELD(&zilog->zl_lock));
+
+	while (zilog->zl_writer || !list_is_empty(&zilog->zl_round_list))
+		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
 }
 
 /*
  * Push zfs transactions to stable storage up to the supplied sequence number.
  * If foid is 0 push out all transactions, otherwise push only those
  * for that file or might have been used to create that file.
+ *
+ * Committers are grouped into rounds.  One thread at a time (the writer)
+ * gathers the pending itxs into log blocks and issues them; it then waits
+ * for them outside of zl_writer, so the next round can be assembled and
+ * issued while the earlier ones are still being written.  A committer
+ * whose records went out in a round already in flight just waits for that
+ * round, and one that arrives while a round is being assembled has its
+ * records included in the next round.
  */
 void
 zil_commit(zilog_t *zilog, uint64_t seq, uint64_t foid)
 {
+	zil_round_t *zr;
+
 	if (zilog == NULL || seq == 0)
 		return;
 
@@ -1091,16 +1301,26 @@ zil_commit(zilog_t *zilog, uint64_t seq, uint64_t foid)
 
 	seq = MIN(seq, zilog->zl_itx_seq);	/* cap seq at largest itx seq */
 
-	while (zilog->zl_writer) {
-		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+	for (;;) {
 		if (seq < zilog->zl_commit_seq) {
 			mutex_exit(&zilog->zl_lock);
 			return;
 		}
+		if (seq < zilog->zl_issued_seq) {
+			/* our records are in a round in flight */
+			cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+			continue;
+		}
+		if (!zilog->zl_writer)
+			break;
+		zilog->zl_commit_waiters++;
+		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+		zilog->zl_commit_waiters--;
 	}
-	zil_commit_writer(zilog, seq, foid); /* drops zl_lock */
-	/* wake up others waiting on the commit */
-	cv_broadcast(&zilog->zl_cv_writer);
+
+	zr = zil_commit_writer(zilog, seq, foid);
+	if (zr != NULL)
+		zil_commit_round_wait(zilog, zr);
 	mutex_exit(&zilog->zl_lock);
 }
 
@@ -1174,11 +1394,22 @@ zil_init(void)
 {
 	zil_lwb_cache = kmem_cache_create("zil_lwb_cache",
 	    sizeof (struct lwb), 0, NULL, NULL, NULL, NULL, NULL, 0);
+
+	zil_ksp = kstat_create("zfs", 0, "zil", "misc", KSTAT_TYPE_NAMED,
+	    sizeof (zil_stats) / sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (zil_ksp != NULL) {
+		zil_ksp->ks_data = &zil_stats;
+		kstat_install(zil_ksp);
+	}
 }
 
 void
 zil_fini(void)
 {
+	if (zil_ksp != NULL) {
+		kstat_delete(zil_ksp);
+		zil_ksp = NULL;
+	}
 	kmem_cache_destroy(zil_lwb_cache);
 }
 
@@ -1209,6 +1440,9 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	list_create(&zilog->zl_vdev_list, sizeof (zil_vdev_t),
 	    offsetof(zil_vdev_t, vdev_seq_node));
 
+	list_create(&zilog->zl_round_list, sizeof (zil_round_t),
+	    offsetof(zil_round_t, zr_node));
+
 	return (zilog);
 }
 
@@ -1234,6 +1468,9 @@ zil_free(zilog_t *zilog)
 	}
 	list_destroy(&zilog->zl_vdev_list);
 
+	ASSERT(list_is_empty(&zilog->zl_round_list));
+	list_destroy(&zilog->zl_round_list);
+
 	ASSERT(list_head(&zilog->zl_itx_list) == NULL);
 	list_destroy(&zilog->zl_itx_list);
 	mutex_destroy(&zilog->zl_lock);
@@ -1342,8 +1579,7 @@ zil_suspend(zilog_t *zilog)
 	 * Wait for any in-flight log writes to complete.
 	 */
 	mutex_enter(&zilog->zl_lock);
-	while (zilog->zl_writer)
-		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+	zil_commit_wait_all(zilog);
 	mutex_exit(&zilog->zl_lock);
 
 	zil_destroy(zilog, B_FALSE);
@@ -1366,6 +1602,46 @@ zil_resume(zilog_t *zilog)
 	mutex_exit(&zilog->zl_lock);
 }
 
+/*
+ * Parallel replay.  Records that change only the object they name (writes,
+ * truncates, setattrs and ACLs) are queued into a batch, on one of
+ * zil_replay_threads lists picked by object number, so that the records
+ * for any one object are still replayed in log order.  The data of each
+ * indirect write is read asynchronously as its record is queued.  Once
+ * zil_replay_batch_bytes have been queued the lists are replayed
+ * concurrently, all into one txg, and the log header is updated once for
+ * the whole batch; meanwhile the log is parsed into the next batch.
+ * Any other record is replayed on its own, once all the records before it
+ * have been.  Logs that need byteswapping are always replayed serially.
+ */
+int zil_replay_parallel = 1;
+int zil_replay_threads = 8;
+uint64_t zil_replay_batch_bytes = 8 << 20;
+
+typedef struct zil_replay_rec {
+	list_node_t	zrr_node;
+	uint64_t	zrr_seq;
+	uint64_t	zrr_txtype;
+	char		*zrr_buf;	/* the record, then any write data */
+	size_t		zrr_size;	/* size of zrr_buf */
+	uint64_t	zrr_blkoff;	/* offset of write data in block read */
+	uint64_t	zrr_wlen;	/* write data still to move into place */
+} zil_replay_rec_t;
+
+typedef struct zil_replay_worker {
+	struct zil_replay_arg *zrw_zr;
+	list_t		zrw_recs;	/* records to replay, in log order */
+	zil_replay_rec_t *zrw_failed;	/* first record not replayed */
+} zil_replay_worker_t;
+
+typedef struct zil_replay_batch {
+	zil_replay_worker_t *zrb_workers;
+	zio_t		*zrb_prefetch;	/* reads of indirect write data */
+	dmu_tx_t	*zrb_tx;	/* holds the batch's txg open */
+	uint64_t	zrb_bytes;	/* memory used by queued records */
+	uint64_t	zrb_max_seq;	/* last record queued */
+} zil_replay_batch_t;
+
 typedef struct zil_replay_arg {
 	objset_t	*zr_os;
 	zil_replay_func_t **zr_replay;
@@ -1373,76 +1649,24 @@ typedef struct zil_replay_arg {
 	uint64_t	*zr_txgp;
 	boolean_t	zr_byteswap;
 	char		*zr_lrbuf;
+	taskq_t		*zr_taskq;	/* NULL when replaying serially */
+	int		zr_nworkers;
+	zil_replay_batch_t zr_batch[2];
+	zil_replay_batch_t *zr_filling;	/* batch being queued */
+	zil_replay_batch_t *zr_running;	/* batch being replayed, if any */
 } zil_replay_arg_t;
 
-static void
-zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
+/*
+ * Replay a record that has been copied to 'buf' and made ready for its
+ * replay vector, and update the log header to show that we did so.
+ */
+static int
+zil_replay_apply(zilog_t *zilog, zil_replay_arg_t *zr, uint64_t seq,
+    uint64_t txtype, char *buf)
 {
-	zil_replay_arg_t *zr = zra;
-	const zil_header_t *zh = zilog->zl_header;
-	uint64_t reclen = lr->lrc_reclen;
-	uint64_t txtype = lr->lrc_txtype;
 	char *name;
 	int pass, error, sunk;
 
-	if (zilog->zl_stop_replay)
-		return;
-
-	if (lr->lrc_txg < claim_txg)		/* already committed */
-		return;
-
-	if (lr->lrc_seq <= zh->zh_replay_seq)	/* already replayed */
-		return;
-
-	/*
-	 * Make a copy of the data so we can revise and extend it.
-	 */
-	bcopy(lr, zr->zr_lrbuf, reclen);
-
-	/*
-	 * The log block containing this lr may have been byteswapped
-	 * so that we can easily examine common fields like lrc_txtype.
-	 * However, the log is a mix of different data types, and only the
-	 * replay vectors know how to byteswap their records.  Therefore, if
-	 * the lr was byteswapped, undo it before invoking the replay vector.
-	 */
-	if (zr->zr_byteswap)
-		byteswap_uint64_array(zr->zr_lrbuf, reclen);
-
-	/*
-	 * If this is a TX_WRITE with a blkptr, suck in the data.
-	 */
-	if (txtype == TX_WRITE && reclen == sizeof (lr_write_t)) {
-		lr_write_t *lrw = (lr_write_t *)lr;
-		blkptr_t *wbp = &lrw->lr_blkptr;
-		uint64_t wlen = lrw->lr_length;
-		char *wbuf = zr->zr_lrbuf + reclen;
-
-		if (BP_IS_HOLE(wbp)) {	/* compressed to a hole */
-			bzero(wbuf, wlen);
-		} else {
-			/*
-			 * A subsequent write may have overwritten this block,
-			 * in which case wbp may have been been freed and
-			 * reallocated, and our read of wbp may fail with a
-			 * checksum error.  We can safely ignore this because
-			 * the later write will provide the correct data.
-			 */
-			zbookmark_t zb;
-
-			zb.zb_objset = dmu_objset_id(zilog->zl_os);
-			zb.zb_object = lrw->lr_foid;
-			zb.zb_level = -1;
-			zb.zb_blkid = lrw->lr_offset / BP_GET_LSIZE(wbp);
-
-			(void) zio_wait(zio_read(NULL, zilog->zl_spa,
-			    wbp, wbuf, BP_GET_LSIZE(wbp), NULL, NULL,
-			    ZIO_PRIORITY_SYNC_READ,
-			    ZIO_FLAG_CANFAIL | ZIO_FLAG_SPECULATIVE, &zb));
-			(void) memmove(wbuf, wbuf + lrw->lr_blkoff, wlen);
-		}
-	}
-
 	/*
 	 * We must now do two things atomically: replay this log record,
 	 * and update the log header to reflect the fact that we did so.
@@ -1470,21 +1694,20 @@ zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 			 * to ensure that those code paths remain well tested.
 			 */
 			*zr->zr_txgp = replay_txg - (pass == 1);
-			error = zr->zr_replay[txtype](zr->zr_arg, zr->zr_lrbuf,
+			error = zr->zr_replay[txtype](zr->zr_arg, buf,
 			    zr->zr_byteswap);
 			*zr->zr_txgp = TXG_NOWAIT;
 		}
 
 		if (error == 0) {
 			dsl_dataset_dirty(dmu_objset_ds(zr->zr_os), replay_tx);
-			zilog->zl_replay_seq[replay_txg & TXG_MASK] =
-			    lr->lrc_seq;
+			zilog->zl_replay_seq[replay_txg & TXG_MASK] = seq;
 		}
 
 		dmu_tx_commit(replay_tx);
 
 		if (!error)
-			return;
+			return (0);
 
 		/*
 		 * The DMU's dnode layer doesn't see removes until the txg
@@ -1514,9 +1737,387 @@ zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 	dmu_objset_name(zr->zr_os, name);
 	cmn_err(CE_WARN, "ZFS replay transaction error %d, "
 	    "dataset %s, seq 0x%llx, txtype %llu\n",
-	    error, name, (u_longlong_t)lr->lrc_seq, (u_longlong_t)txtype);
+	    error, name, (u_longlong_t)seq, (u_longlong_t)txtype);
 	zilog->zl_stop_replay = 1;
 	kmem_free(name, MAXNAMELEN);
+
+	return (error);
+}
+
+/*
+ * Move an indirect write's data to just after its record, where the
+ * replay vector expects it.
+ */
+static void
+zil_replay_rec_prepare(zil_replay_rec_t *zrr)
+{
+	char *wbuf = zrr->zrr_buf + sizeof (lr_write_t);
+
+	if (zrr->zrr_wlen != 0) {
+		(void) memmove(wbuf, wbuf + zrr->zrr_blkoff, zrr->zrr_wlen);
+		zrr->zrr_wlen = 0;
+	}
+}
+
+static void
+zil_replay_worker(void *arg)
+{
+	zil_replay_worker_t *zrw = arg;
+	zil_replay_arg_t *zr = zrw->zrw_zr;
+	zil_replay_rec_t *zrr;
+
+	for (zrr = list_head(&zrw->zrw_recs); zrr != NULL;
+	    zrr = list_next(&zrw->zrw_recs, zrr)) {
+		zil_replay_rec_prepare(zrr);
+		if (zr->zr_replay[zrr->zrr_txtype](zr->zr_arg, zrr->zrr_buf,
+		    B_FALSE) != 0) {
+			zrw->zrw_failed = zrr;
+			break;
+		}
+	}
+}
+
+static void
+zil_replay_batch_init(zil_replay_batch_t *zrb, zil_replay_arg_t *zr)
+{
+	int w;
+
+	bzero(zrb, sizeof (zil_replay_batch_t));
+	zrb->zrb_workers = kmem_zalloc(zr->zr_nworkers *
+	    sizeof (zil_replay_worker_t), KM_SLEEP);
+	for (w = 0; w < zr->zr_nworkers; w++) {
+		zrb->zrb_workers[w].zrw_zr = zr;
+		list_create(&zrb->zrb_workers[w].zrw_recs,
+		    sizeof (zil_replay_rec_t),
+		    offsetof(zil_replay_rec_t, zrr_node));
+	}
+}
+
+static void
+zil_replay_batch_clear(zil_replay_batch_t *zrb, int nworkers)
+{
+	zil_replay_worker_t *zrw;
+	zil_replay_rec_t *zrr;
+	int w;
+
+	ASSERT(zrb->zrb_prefetch == NULL);
+	ASSERT(zrb->zrb_tx == NULL);
+
+	for (w = 0; w < nworkers; w++) {
+		zrw = &zrb->zrb_workers[w];
+		while ((zrr = list_head(&zrw->zrw_recs)) != NULL) {
+			list_remove(&zrw->zrw_recs, zrr);
+			kmem_free(zrr->zrr_buf, zrr->zrr_size);
+			kmem_free(zrr, sizeof (zil_replay_rec_t));
+		}
+		zrw->zrw_failed = NULL;
+	}
+	zrb->zrb_bytes = 0;
+	zrb->zrb_max_seq = 0;
+}
+
+static void
+zil_replay_batch_fini(zil_replay_batch_t *zrb, int nworkers)
+{
+	int w;
+
+	zil_replay_batch_clear(zrb, nworkers);
+	for (w = 0; w < nworkers; w++)
+		list_destroy(&zrb->zrb_workers[w].zrw_recs);
+	kmem_free(zrb->zrb_workers, nworkers * sizeof (zil_replay_worker_t));
+}
+
+/*
+ * Wait for the running batch and commit its txg.  A worker stops at the
+ * first record it fails to replay (typically ERESTART, when the txg is
+ * short of space); that record and the rest of its list are replayed
+ * afterwards, one at a time and in log order, as any other record would
+ * be.  Until they are, the log header must not claim them, so it only
+ * goes as far as the first of them.  Records past that point which were
+ * replayed will be replayed again if we crash, which is harmless for
+ * the idempotent record types we batch.
+ */
+static void
+zil_replay_batch_finish(zilog_t *zilog, zil_replay_arg_t *zr)
+{
+	zil_replay_batch_t *zrb = zr->zr_running;
+	zil_replay_worker_t *zrw;
+	zil_replay_rec_t *zrr;
+	uint64_t seq = zrb->zrb_max_seq;
+	int w, fw;
+
+	taskq_wait(zr->zr_taskq);
+	*zr->zr_txgp = TXG_NOWAIT;
+	zr->zr_running = NULL;
+
+	for (w = 0; w < zr->zr_nworkers; w++) {
+		zrw = &zrb->zrb_workers[w];
+		if (zrw->zrw_failed != NULL)
+			seq = MIN(seq, zrw->zrw_failed->zrr_seq - 1);
+	}
+
+	if (zrb->zrb_tx != NULL) {
+		uint64_t txg = dmu_tx_get_txg(zrb->zrb_tx);
+
+		dsl_dataset_dirty(dmu_objset_ds(zr->zr_os), zrb->zrb_tx);
+		zilog->zl_replay_seq[txg & TXG_MASK] = seq;
+		dmu_tx_commit(zrb->zrb_tx);
+		zrb->zrb_tx = NULL;
+	}
+
+	while (!zilog->zl_stop_replay) {
+		zrr = NULL;
+		fw = 0;
+		for (w = 0; w < zr->zr_nworkers; w++) {
+			zrw = &zrb->zrb_workers[w];
+			if (zrw->zrw_failed != NULL && (zrr == NULL ||
+			    zrw->zrw_failed->zrr_seq < zrr->zrr_seq)) {
+				zrr = zrw->zrw_failed;
+				fw = w;
+			}
+		}
+		if (zrr == NULL)
+			break;
+		zrw = &zrb->zrb_workers[fw];
+		zrw->zrw_failed = list_next(&zrw->zrw_recs, zrr);
+
+		zil_replay_rec_prepare(zrr);
+		(void) zil_replay_apply(zilog, zr, zrr->zrr_seq,
+		    zrr->zrr_txtype, zrr->zrr_buf);
+	}
+
+	zil_replay_batch_clear(zrb, zr->zr_nworkers);
+}
+
+/*
+ * Finish the running batch, if any, and start replaying the one that has
+ * been queued; further records are queued into the other batch.
+ */
+static void
+zil_replay_batch_start(zilog_t *zilog, zil_replay_arg_t *zr)
+{
+	zil_replay_batch_t *zrb = zr->zr_filling;
+	dmu_tx_t *tx;
+	int w;
+
+	if (zr->zr_running != NULL)
+		zil_replay_batch_finish(zilog, zr);
+
+	zr->zr_filling = (zrb == &zr->zr_batch[0]) ?
+	    &zr->zr_batch[1] : &zr->zr_batch[0];
+
+	if (zrb->zrb_prefetch != NULL) {
+		(void) zio_wait(zrb->zrb_prefetch);
+		zrb->zrb_prefetch = NULL;
+	}
+
+	if (zrb->zrb_bytes == 0 || zilog->zl_stop_replay) {
+		zil_replay_batch_clear(zrb, zr->zr_nworkers);
+		return;
+	}
+
+	/*
+	 * If we can't get a txg, fail every list so that the whole batch
+	 * is replayed serially by zil_replay_batch_finish().
+	 */
+	tx = dmu_tx_create(zr->zr_os);
+	if (dmu_tx_assign(tx, TXG_WAIT) != 0) {
+		dmu_tx_abort(tx);
+		for (w = 0; w < zr->zr_nworkers; w++) {
+			zrb->zrb_workers[w].zrw_failed =
+			    list_head(&zrb->zrb_workers[w].zrw_recs);
+		}
+		zr->zr_running = zrb;
+		return;
+	}
+
+	zrb->zrb_tx = tx;
+	*zr->zr_txgp = dmu_tx_get_txg(tx);
+	for (w = 0; w < zr->zr_nworkers; w++) {
+		if (!list_is_empty(&zrb->zrb_workers[w].zrw_recs)) {
+			(void) taskq_dispatch(zr->zr_taskq, zil_replay_worker,
+			    &zrb->zrb_workers[w], TQ_SLEEP);
+		}
+	}
+	zr->zr_running = zrb;
+}
+
+/*
+ * Replay everything queued so far, either because the next record can't
+ * be batched or because we have reached the end of the log.
+ */
+static void
+zil_replay_drain(zilog_t *zilog, zil_replay_arg_t *zr)
+{
+	zil_replay_batch_start(zilog, zr);
+	if (zr->zr_running != NULL)
+		zil_replay_batch_finish(zilog, zr);
+}
+
+static boolean_t
+zil_replay_batchable(lr_t *lr)
+{
+	switch (lr->lrc_txtype) {
+	case TX_WRITE:
+	case TX_TRUNCATE:
+	case TX_SETATTR:
+	case TX_ACL:
+		return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+/*
+ * Copy a record into the batch being queued, and start reading the data
+ * of an indirect write.
+ */
+static void
+zil_replay_queue(zilog_t *zilog, zil_replay_arg_t *zr, lr_t *lr)
+{
+	zil_replay_batch_t *zrb = zr->zr_filling;
+	uint64_t reclen = lr->lrc_reclen;
+	uint64_t foid;
+	zil_replay_rec_t *zrr;
+	size_t size = reclen;
+
+	/*
+	 * All of the batched record types name their object first.
+	 */
+	foid = ((lr_truncate_t *)lr)->lr_foid;
+
+	zrr = kmem_zalloc(sizeof (zil_replay_rec_t), KM_SLEEP);
+	zrr->zrr_seq = lr->lrc_seq;
+	zrr->zrr_txtype = lr->lrc_txtype;
+
+	if (lr->lrc_txtype == TX_WRITE && reclen == sizeof (lr_write_t)) {
+		lr_write_t *lrw = (lr_write_t *)lr;
+		blkptr_t *wbp = &lrw->lr_blkptr;
+
+		if (BP_IS_HOLE(wbp)) {	/* compressed to a hole */
+			size += lrw->lr_length;
+		} else {
+			size += BP_GET_LSIZE(wbp);
+			zrr->zrr_blkoff = lrw->lr_blkoff;
+			zrr->zrr_wlen = lrw->lr_length;
+		}
+	}
+
+	zrr->zrr_size = size;
+	zrr->zrr_buf = kmem_alloc(size, KM_SLEEP);
+	bcopy(lr, zrr->zrr_buf, reclen);
+
+	if (zrr->zrr_wlen != 0) {
+		lr_write_t *lrw = (lr_write_t *)lr;
+		blkptr_t *wbp = &lrw->lr_blkptr;
+		zbookmark_t zb;
+
+		/*
+		 * As in zil_replay_log_record(), a failed read just means
+		 * that a later write will provide the correct data.
+		 */
+		zb.zb_objset = dmu_objset_id(zilog->zl_os);
+		zb.zb_object = lrw->lr_foid;
+		zb.zb_level = -1;
+		zb.zb_blkid = lrw->lr_offset / BP_GET_LSIZE(wbp);
+
+		if (zrb->zrb_prefetch == NULL) {
+			zrb->zrb_prefetch = zio_root(zilog->zl_spa, NULL, NULL,
+			    ZIO_FLAG_CANFAIL);
+		}
+		zio_nowait(zio_read(zrb->zrb_prefetch, zilog->zl_spa, wbp,
+		    zrr->zrr_buf + reclen, BP_GET_LSIZE(wbp), NULL, NULL,
+		    ZIO_PRIORITY_SYNC_READ,
+		    ZIO_FLAG_CANFAIL | ZIO_FLAG_SPECULATIVE, &zb));
+	} else if (size > reclen) {
+		bzero(zrr->zrr_buf + reclen, size - reclen);
+	}
+
+	list_insert_tail(&zrb->zrb_workers[foid % zr->zr_nworkers].zrw_recs,
+	    zrr);
+	zrb->zrb_bytes += sizeof (zil_replay_rec_t) + size;
+	zrb->zrb_max_seq = lr->lrc_seq;
+
+	if (zrb->zrb_bytes >= zil_replay_batch_bytes)
+		zil_replay_batch_start(zilog, zr);
+}
+
+static void
+zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
+{
+	zil_replay_arg_t *zr = zra;
+	const zil_header_t *zh = zilog->zl_header;
+	uint64_t reclen = lr->lrc_reclen;
+	uint64_t txtype = lr->lrc_txtype;
+
+	if (zilog->zl_stop_replay)
+		return;
+
+	if (lr->lrc_txg < claim_txg)		/* already committed */
+		return;
+
+	if (lr->lrc_seq <= zh->zh_replay_seq)	/* already replayed */
+		return;
+
+	if (zr->zr_taskq != NULL) {
+		if (zil_replay_batchable(lr)) {
+			zil_replay_queue(zilog, zr, lr);
+			return;
+		}
+		zil_replay_drain(zilog, zr);
+		if (zilog->zl_stop_replay)
+			return;
+	}
+
+	/*
+	 * Make a copy of the data so we can revise and extend it.
+	 */
+	bcopy(lr, zr->zr_lrbuf, reclen);
+
+	/*
+	 * The log block containing this lr may have been byteswapped
+	 * so that we can easily examine common fields like lrc_txtype.
+	 * However, the log is a mix of different data types, and only the
+	 * replay vectors know how to byteswap their records.  Therefore, if
+	 * the lr was byteswapped, undo it before invoking the replay vector.
+	 */
+	if (zr->zr_byteswap)
+		byteswap_uint64_array(zr->zr_lrbuf, reclen);
+
+	/*
+	 * If this is a TX_WRITE with a blkptr, suck in the data.
+	 */
+	if (txtype == TX_WRITE && reclen == sizeof (lr_write_t)) {
+		lr_write_t *lrw = (lr_write_t *)lr;
+		blkptr_t *wbp = &lrw->lr_blkptr;
+		uint64_t wlen = lrw->lr_length;
+		char *wbuf = zr->zr_lrbuf + reclen;
+
+		if (BP_IS_HOLE(wbp)) {	/* compressed to a hole */
+			bzero(wbuf, wlen);
+		} else {
+			/*
+			 * A subsequent write may have overwritten this block,
+			 * in which case wbp may have been been freed and
+			 * reallocated, and our read of wbp may fail with a
+			 * checksum error.  We can safely ignore this because
+			 * the later write will provide the correct data.
+			 */
+			zbookmark_t zb;
+
+			zb.zb_objset = dmu_objset_id(zilog->zl_os);
+			zb.zb_object = lrw->lr_foid;
+			zb.zb_level = -1;
+			zb.zb_blkid = lrw->lr_offset / BP_GET_LSIZE(wbp);
+
+			(void) zio_wait(zio_read(NULL, zilog->zl_spa,
+			    wbp, wbuf, BP_GET_LSIZE(wbp), NULL, NULL,
+			    ZIO_PRIORITY_SYNC_READ,
+			    ZIO_FLAG_CANFAIL | ZIO_FLAG_SPECULATIVE, &zb));
+			(void) memmove(wbuf, wbuf + lrw->lr_blkoff, wlen);
+		}
+	}
+
+	(void) zil_replay_apply(zilog, zr, lr->lrc_seq, txtype, zr->zr_lrbuf);
 }
 
 /* ARGSUSED */
@@ -1548,6 +2149,17 @@ zil_replay(objset_t *os, void *arg, uint64_t *txgp,
 	zr.zr_txgp = txgp;
 	zr.zr_byteswap = BP_SHOULD_BYTESWAP(&zh->zh_log);
 	zr.zr_lrbuf = kmem_alloc(2 * SPA_MAXBLOCKSIZE, KM_SLEEP);
+	zr.zr_taskq = NULL;
+
+	if (zil_replay_parallel && !zr.zr_byteswap) {
+		zr.zr_nworkers = MAX(zil_replay_threads, 1);
+		zr.zr_taskq = taskq_create("zil_replay", zr.zr_nworkers,
+		    minclsyspri, zr.zr_nworkers, INT_MAX, TASKQ_PREPOPULATE);
+		zil_replay_batch_init(&zr.zr_batch[0], &zr);
+		zil_replay_batch_init(&zr.zr_batch[1], &zr);
+		zr.zr_filling = &zr.zr_batch[0];
+		zr.zr_running = NULL;
+	}
 
 	/*
 	 * Wait for in-progress removes to sync before starting replay.
@@ -1559,6 +2171,13 @@ zil_replay(objset_t *os, void *arg, uint64_t *txgp,
 	ASSERT(zilog->zl_replay_blks == 0);
 	(void) zil_parse(zilog, zil_incr_blks, zil_replay_log_record, &zr,
 	    zh->zh_claim_txg);
+
+	if (zr.zr_taskq != NULL) {
+		zil_replay_drain(zilog, &zr);
+		taskq_destroy(zr.zr_taskq);
+		zil_replay_batch_fini(&zr.zr_batch[0], zr.zr_nworkers);
+		zil_replay_batch_fini(&zr.zr_batch[1], zr.zr_nworkers);
+	}
 	kmem_free(zr.zr_lrbuf, 2 * SPA_MAXBLOCKSIZE);
 
 	zil_destroy(zilog, B_FALSE);
@@ -1574,8 +2193,7 @@ zil_is_committed(zilog_t *zilog)
 	int ret;
 
 	mutex_enter(&zilog->zl_lock);
-	while (zilog->zl_writer)
-		cv_wait(&zilog->zl_cv_writer, &zilog->zl_lock);
+	zil_commit_wait_all(zilog);
 
 	/* recent unpushed intent log transactions? */
 	if (!list_is_empty(&zilog->zl_itx_list)) {
@@ -87,6 +87,7 @@ zio_sync_pass_t zio_sync_pass = {
  * ==========================================================================
  */
 kmem_cache_t *zio_cache;
+kmem_cache_t *zio_transform_cache;
 kmem_cache_t *zio_buf_cache[SPA_MAXBLOCKSIZE >> SPA_MINBLOCKSHIFT];
 kmem_cache_t *zio_data_buf_cache[SPA_MAXBLOCKSIZE >> SPA_MINBLOCKSHIFT];
 
@@ -94,6 +95,154 @@ kmem_cache_t *zio_data_buf_cache[SPA_MAXBLOCKSIZE >> SPA_MINBLOCKSHIFT];
 extern vmem_t *zio_alloc_arena;
 #endif
 
+/*
+ * Every I/O, down to each column of a RAID-Z or mirror write, creates at
+ * least one zio, so zios are allocated and freed at a very high rate on
+ * every CPU.  Each CPU keeps a small magazine of free zios, and one of
+ * free transforms, in front of the kmem caches; a magazine that is empty
+ * (on allocation) or full (on free) passes the request on to kmem.
+ *
+ * Cached zios are kept constructed: io_lock and io_cv are set up once by
+ * zio_cons(), and zio_create() only clears the first ZIO_CLEAR_SIZE bytes
+ * of the structure.  The first transform pushed on a zio is embedded in it.
+ */
+#define	ZIO_MAG_ROUNDS	32
+#define	ZIO_CLEAR_SIZE	offsetof(zio_t, io_bp_orig)
+
+typedef struct zio_mag {
+	kmutex_t	zm_lock;
+	int		zm_rounds;		/* objects in zm_obj[] */
+	void		*zm_obj[ZIO_MAG_ROUNDS];
+	uint64_t	zm_allocs;		/* objects handed out */
+	uint64_t	zm_kmem;		/* ... that came from kmem */
+} zio_mag_t;
+
+typedef struct zio_mag_cpu {
+	zio_mag_t	zmc_zio;
+	zio_mag_t	zmc_transform;
+	char		zmc_pad[64];
+} zio_mag_cpu_t;
+
+/*
+ * On Mac OS X CPU_SEQID is always 0, so every thread would share the one
+ * magazine and its lock; there, allocations go straight to kmem unless
+ * the magazines are turned on explicitly.
+ */
+#ifdef __APPLE__
+int zio_cache_magazines = 0;		/* 0 sends every allocation to kmem */
+#else
+int zio_cache_magazines = 1;		/* 0 sends every allocation to kmem */
+#endif
+static zio_mag_cpu_t *zio_mag_cpu;
+
+#define	ZIO_MAG_CPU()	(&zio_mag_cpu[CPU_SEQID])
+
+static void *
+zio_mag_alloc(zio_mag_t *zm, kmem_cache_t *cache)
+{
+	void *obj = NULL;
+
+	/*
+	 * Without magazines, stay off zm_lock; the counts are only
+	 * statistics.
+	 */
+	if (!zio_cache_magazines) {
+		atomic_add_64(&zm->zm_allocs, 1);
+		atomic_add_64(&zm->zm_kmem, 1);
+		return (kmem_cache_alloc(cache, KM_SLEEP));
+	}
+
+	mutex_enter(&zm->zm_lock);
+	zm->zm_allocs++;
+	if (zm->zm_rounds > 0)
+		obj = zm->zm_obj[--zm->zm_rounds];
+	else
+		zm->zm_kmem++;
+	mutex_exit(&zm->zm_lock);
+
+	if (obj == NULL)
+		obj = kmem_cache_alloc(cache, KM_SLEEP);
+
+	return (obj);
+}
+
+static void
+zio_mag_free(zio_mag_t *zm, kmem_cache_t *cache, void *obj)
+{
+	if (!zio_cache_magazines) {
+		kmem_cache_free(cache, obj);
+		return;
+	}
+
+	mutex_enter(&zm->zm_lock);
+	if (zm->zm_rounds < ZIO_MAG_ROUNDS) {
+		zm->zm_obj[zm->zm_rounds++] = obj;
+		obj = NULL;
+	}
+	mutex_exit(&zm->zm_lock);
+
+	if (obj != NULL)
+		kmem_cache_free(cache, obj);
+}
+
+static void
+zio_mag_fini(zio_mag_t *zm, kmem_cache_t *cache)
+{
+	while (zm->zm_rounds > 0)
+		kmem_cache_free(cache, zm->zm_obj[--zm->zm_rounds]);
+	mutex_destroy(&zm->zm_lock);
+}
+
+/* ARGSUSED */
+static int
+zio_cons(void *vzio, void *unused, int kmflag)
+{
+	zio_t *zio = vzio;
+
+	mutex_init(&zio->io_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zio->io_cv, NULL, CV_DEFAULT, NULL);
+	return (0);
+}
+
+/* ARGSUSED */
+static void
+zio_dest(void *vzio, void *unused)
+{
+	zio_t *zio = vzio;
+
+	mutex_destroy(&zio->io_lock);
+	cv_destroy(&zio->io_cv);
+}
+
+static void
+zio_destroy(zio_t *zio)
+{
+	ASSERT(zio->io_transform_stack == NULL);
+	zio_mag_free(&ZIO_MAG_CPU()->zmc_zio, zio_cache, zio);
+}
+
+void
+zio_alloc_stats(zio_alloc_stats_t *zas)
+{
+	zio_mag_cpu_t *zmc;
+	int c;
+
+	bzero(zas, sizeof (zio_alloc_stats_t));
+	for (c = 0; c < max_ncpus; c++) {
+		zmc = &zio_mag_cpu[c];
+
+		mutex_enter(&zmc->zmc_zio.zm_lock);
+		zas->zas_zio += zmc->zmc_zio.zm_allocs;
+		zas->zas_zio_kmem += zmc->zmc_zio.zm_kmem;
+		mutex_exit(&zmc->zmc_zio.zm_lock);
+
+		mutex_enter(&zmc->zmc_transform.zm_lock);
+		zas->zas_transform += zmc->zmc_transform.zm_allocs;
+		zas->zas_transform_kmem += zmc->zmc_transform.zm_kmem;
+		mutex_exit(&zmc->zmc_transform.zm_lock);
+	}
+}
+
 void
 zio_init(void)
 {
@@ -105,7 +254,20 @@ zio_init(void)
 #endif
 
 	zio_cache = kmem_cache_create("zio_cache", sizeof (zio_t), 0,
-	    NULL, NULL, NULL, NULL, NULL, 0);
+	    zio_cons, zio_dest, NULL, NULL, NULL, 0);
+	zio_transform_cache = kmem_cache_create("zio_transform_cache",
+	    sizeof (zio_transform_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+
+	zio_mag_cpu = kmem_zalloc(max_ncpus * sizeof (zio_mag_cpu_t),
+	    KM_SLEEP);
+	for (c = 0; c < max_ncpus; c++) {
+		mutex_init(&zio_mag_cpu[c].zmc_zio.zm_lock, NULL,
+		    MUTEX_DEFAULT, NULL);
+		mutex_init(&zio_mag_cpu[c].zmc_transform.zm_lock, NULL,
+		    MUTEX_DEFAULT, NULL);
+	}
+
+	zio_checksum_init();
 
 	/*
 	 * For small buffers, we want a cache for each multiple of
@@ -179,6 +341,15 @@ zio_fini(void)
 		zio_data_buf_cache[c] = NULL;
 	}
 
+	for (c = 0; c < max_ncpus; c++) {
+		zio_mag_fini(&zio_mag_cpu[c].zmc_zio, zio_cache);
+		zio_mag_fini(&zio_mag_cpu[c].zmc_transform,
+		    zio_transform_cache);
+	}
+	kmem_free(zio_mag_cpu, max_ncpus * sizeof (zio_mag_cpu_t));
+	zio_mag_cpu = NULL;
+
+	kmem_cache_destroy(zio_transform_cache);
 	kmem_cache_destroy(zio_cache);
 
 	zio_inject_fini();
@@ -250,7 +421,13 @@ zio_data_buf_free(void *buf, size_t size)
 static void
 zio_push_transform(zio_t *zio, void *data, uint64_t size, uint64_t bufsize)
 {
-	zio_transform_t *zt = kmem_alloc(sizeof (zio_transform_t), KM_SLEEP);
+	zio_transform_t *zt;
+
+	if (zio->io_transform_stack == NULL)
+		zt = &zio->io_transform_base;
+	else
+		zt = zio_mag_alloc(&ZIO_MAG_CPU()->zmc_transform,
+		    zio_transform_cache);
 
 	zt->zt_data = data;
 	zt->zt_size = size;
@@ -273,7 +450,9 @@ zio_pop_transform(zio_t *zio, void **data, uint64_t *size, uint64_t *bufsize)
 	*bufsize = zt->zt_bufsize;
 
 	zio->io_transform_stack = zt->zt_next;
-	kmem_free(zt, sizeof (zio_transform_t));
+	if (zt != &zio->io_transform_base)
+		zio_mag_free(&ZIO_MAG_CPU()->zmc_transform,
+		    zio_transform_cache, zt);
 
 	if ((zt = zio->io_transform_stack) != NULL) {
 		zio->io_data = zt->zt_data;
@@ -311,8 +490,8 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp,
 	ASSERT3U(size, <=, SPA_MAXBLOCKSIZE);
 	ASSERT(P2PHASE(size, SPA_MINBLOCKSIZE) == 0);
 
-	zio = kmem_cache_alloc(zio_cache, KM_SLEEP);
-	bzero(zio, sizeof (zio_t));
+	zio = zio_mag_alloc(&ZIO_MAG_CPU()->zmc_zio, zio_cache);
+	bzero(zio, ZIO_CLEAR_SIZE);
 	zio->io_parent = pio;
 	zio->io_spa = spa;
 	zio->io_txg = txg;
@@ -335,8 +514,6 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp,
 	zio->io_timestamp = lbolt64;
 	if (pio != NULL)
 		zio->io_flags |= (pio->io_flags & ZIO_FLAG_METADATA);
-	mutex_init(&zio->io_lock, NULL, MUTEX_DEFAULT, NULL);
-	cv_init(&zio->io_cv, NULL, CV_DEFAULT, NULL);
 	zio_push_transform(zio, data, size, size);
 
 	/*
@@ -627,7 +804,8 @@ zio_phys_bp_init(vdev_t *vd, blkptr_t *bp, uint64_t offset, uint64_t size,
 	ASSERT(P2PHASE(offset, SPA_MINBLOCKSIZE) == 0);
 
 	ASSERT(offset + size <= VDEV_LABEL_START_SIZE ||
-	    offset >= vd->vdev_psize - VDEV_LABEL_END_SIZE);
+	    offset >= vd->vdev_psize - VDEV_LABEL_END_SIZE ||
+	    vd->vdev_isl2cache);
 	ASSERT3U(offset + size, <=, vd->vdev_psize);
 
 	BP_ZERO(bp);
@@ -763,9 +941,7 @@ zio_wait(zio_t *zio)
 	mutex_exit(&zio->io_lock);
 
 	error = zio->io_error;
-	mutex_destroy(&zio->io_lock);
-	cv_destroy(&zio->io_cv);
-	kmem_cache_free(zio_cache, zio);
+	zio_destroy(zio);
 
 	return (error);
 }
@@ -958,9 +1134,7 @@ zio_done(zio_t *zio)
 		cv_broadcast(&zio->io_cv);
 		mutex_exit(&zio->io_lock);
 	} else {
-		mutex_destroy(&zio->io_lock);
-		cv_destroy(&zio->io_cv);
-		kmem_cache_free(zio_cache, zio);
+		zio_destroy(zio);
 	}
 }
 
@@ -79,6 +79,17 @@ zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS] = {
 	{{zio_checksum_SHA256,	zio_checksum_SHA256},	1, 0,	"SHA256"},
 };
 
+/*
+ * Pick the fastest implementation of each checksum that has more than one.
+ * This is done once at module load, before any I/O is issued.
+ */
+void
+zio_checksum_init(void)
+{
+	fletcher_4_init();
+	sha256_init();
+}
+
 uint8_t
 zio_checksum_select(uint8_t child, uint8_t parent)
 {
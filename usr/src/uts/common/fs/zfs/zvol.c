@@ -811,7 +811,8 @@ zvol_log_write(zvol_state_t *zv, dmu_tx_t *tx, offset_t off, ssize_t len)
 		itx_t *itx = zil_itx_create(TX_WRITE, sizeof (*lr));
 
 		itx->itx_wr_state =
-		    len > zvol_immediate_write_sz ?  WR_INDIRECT : WR_NEED_COPY;
+		    len > zil_immediate_write_sz(zv->zv_zilog,
+		    zvol_immediate_write_sz) ? WR_INDIRECT : WR_NEED_COPY;
 		itx->itx_private = zv;
 		lr = (lr_write_t *)&itx->itx_lr;
 		lr->lr_foid = ZVOL_OBJ;
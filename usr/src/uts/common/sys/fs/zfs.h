@@ -262,6 +262,7 @@ extern zpool_prop_t zpool_prop_iter(zpool_prop_f, void *);
 #define	ZPOOL_CONFIG_ASIZE		"asize"
 #define	ZPOOL_CONFIG_DTL		"DTL"
 #define	ZPOOL_CONFIG_STATS		"stats"
+#define	ZPOOL_CONFIG_LAT_STATS		"lat_stats" /* not stored on disk */
 #define	ZPOOL_CONFIG_WHOLE_DISK		"whole_disk"
 #define	ZPOOL_CONFIG_ERRCOUNT		"error_count"
 #define	ZPOOL_CONFIG_NOT_PRESENT	"not_present"
@@ -274,6 +275,8 @@ extern zpool_prop_t zpool_prop_iter(zpool_prop_f, void *);
 #define	ZPOOL_CONFIG_UNSPARE		"unspare"
 #define	ZPOOL_CONFIG_PHYS_PATH		"phys_path"
 #define	ZPOOL_CONFIG_IS_LOG		"is_log"
+#define	ZPOOL_CONFIG_L2CACHE		"l2cache"
+#define	ZPOOL_CONFIG_SCRUB_RESUMED	"scrub_resumed" /* not stored on disk */
 /*
  * The persistent vdev state is stored as separate values rather than a single
  * 'vdev_state' entry.  This is because a device can be in multiple states, such
@@ -296,6 +299,7 @@ extern zpool_prop_t zpool_prop_iter(zpool_prop_f, void *);
 #define	VDEV_TYPE_MISSING		"missing"
 #define	VDEV_TYPE_SPARE			"spare"
 #define	VDEV_TYPE_LOG			"log"
+#define	VDEV_TYPE_L2CACHE		"l2cache"
 
 /*
  * This is needed in userland to report the minimum necessary device size.
@@ -351,14 +355,16 @@ typedef enum vdev_aux {
 
 /*
  * pool state.  The following states are written to disk as part of the normal
- * SPA lifecycle: ACTIVE, EXPORTED, DESTROYED, SPARE.  The remaining states are
- * software abstractions used at various levels to communicate pool state.
+ * SPA lifecycle: ACTIVE, EXPORTED, DESTROYED, SPARE, L2CACHE.  The remaining
+ * states are software abstractions used at various levels to communicate
+ * pool state.
  */
 typedef enum pool_state {
 	POOL_STATE_ACTIVE = 0,		/* In active use		*/
 	POOL_STATE_EXPORTED,		/* Explicitly exported		*/
 	POOL_STATE_DESTROYED,		/* Explicitly destroyed		*/
 	POOL_STATE_SPARE,		/* Reserved for hot spare use	*/
+	POOL_STATE_L2CACHE,		/* Level 2 ARC device		*/
 	POOL_STATE_UNINITIALIZED,	/* Internal spa_t state		*/
 	POOL_STATE_UNAVAIL,		/* Internal libzfs state	*/
 	POOL_STATE_POTENTIALLY_ACTIVE	/* Internal libzfs state	*/
@@ -374,6 +380,22 @@ typedef enum pool_scrub_type {
 	POOL_SCRUB_TYPES
 } pool_scrub_type_t;
 
+/*
+ * The position of a scrub or resilver.  It is saved in the MOS so that
+ * the scrub can resume from it when the pool is reopened, and reported
+ * as ZPOOL_CONFIG_SCRUB_RESUMED while a resumed scrub runs.
+ */
+typedef struct pool_scrub_position {
+	uint64_t	psp_type;		/* pool_scrub_type_t */
+	uint64_t	psp_mintxg;		/* blocks born after this txg */
+	uint64_t	psp_maxtxg;		/* and before this one */
+	uint64_t	psp_objset;		/* bookmark to resume from */
+	uint64_t	psp_object;
+	int64_t		psp_level;
+	uint64_t	psp_blkid;
+	uint64_t	psp_examined;		/* bytes examined before it */
+} pool_scrub_position_t;
+
 /*
  * ZIO types.  Needed to interpret vdev statistics below.
  */
@@ -412,8 +434,37 @@ typedef struct vdev_stat {
 	uint64_t	vs_scrub_errors;	/* errors during scrub	*/
 	uint64_t	vs_scrub_start;		/* UTC scrub start time	*/
 	uint64_t	vs_scrub_end;		/* UTC scrub end time	*/
+	uint64_t	vs_scrub_issued;	/* bytes read back; top	*/
 } vdev_stat_t;
 
+/*
+ * Classes of I/O for which vdev latency histograms are kept. Scrub and
+ * resilver I/O is counted separately from everything else, which is split
+ * by whether the issuer is waiting on it.
+ */
+typedef enum vdev_lat_class {
+	VDEV_LAT_SYNC_READ = 0,
+	VDEV_LAT_SYNC_WRITE,
+	VDEV_LAT_ASYNC_READ,
+	VDEV_LAT_ASYNC_WRITE,
+	VDEV_LAT_SCRUB,
+	VDEV_LAT_CLASSES
+} vdev_lat_class_t;
+
+/*
+ * Vdev latency histograms. Bucket n counts I/Os that took between 2^n and
+ * 2^(n+1) - 1 nanoseconds; the last bucket also counts anything slower.
+ * vls_queue is the time spent waiting in the vdev queue, vls_disk the time
+ * from issue to completion. Like vdev_stat_t, this is passed to userland
+ * as an nvlist uint64 array.
+ */
+#define	VDEV_LAT_BUCKETS	37	/* up to 2^37 ns, about 137 seconds */
+
+typedef struct vdev_lat_stat {
+	uint64_t	vls_queue[VDEV_LAT_CLASSES][VDEV_LAT_BUCKETS];
+	uint64_t	vls_disk[VDEV_LAT_CLASSES][VDEV_LAT_BUCKETS];
+} vdev_lat_stat_t;
+
 #define	ZFS_DRIVER	"zfs"
 #define	ZFS_DEV		"/dev/zfs"
 
@@ -488,11 +539,12 @@ typedef struct vdev_stat {
 #define	ZFS_IOC_ISCSI_PERM_CHECK    ZFS_IOC_CMD(43)
 #define	ZFS_IOC_SHARE		    ZFS_IOC_CMD(44)
 #define	ZFS_IOC_INHERIT_PROP	    ZFS_IOC_CMD(45)
+#define	ZFS_IOC_POOL_TXG_HISTORY    ZFS_IOC_CMD(46)
 /* the following constant is always the last used ioc number except
  * VERSION_CHECK.  It moves up when new ioc number are defined.  Note
  * the two __ used to prevent collision with possible other ioc names we
  * may inherit from other implementations. */
-#define ZFS_IOC__LAST_USED	    ZFS_IOC_CMD(45)
+#define ZFS_IOC__LAST_USED	    ZFS_IOC_CMD(46)
 /* special ioctl to protect against mixing userland and kernel land from
  * different implementations.  Note the two __ used to prevent collision
  * with possible other ioc names we may inherit from other
@@ -532,6 +584,35 @@ typedef enum {
 #define	ZPOOL_HIST_INT_EVENT	"history internal event"
 #define	ZPOOL_HIST_INT_STR	"history internal str"
 
+/*
+ * The phases of spa_sync(), which times each of them.  The per-phase
+ * array in a ZFS_IOC_POOL_TXG_HISTORY record is indexed by this.
+ */
+typedef enum spa_sync_phase {
+	SPA_SYNC_DEFERRED,	/* previous txg's deferred frees */
+	SPA_SYNC_CONFIG,	/* config, spares, l2cache and error log */
+	SPA_SYNC_DATASETS,	/* dirty datasets */
+	SPA_SYNC_MOS,		/* sync tasks, dsl dirs and the MOS */
+	SPA_SYNC_VDEVS,		/* space maps and the deferred-free list */
+	SPA_SYNC_UBERBLOCK,	/* vdev labels and uberblock */
+	SPA_SYNC_CLEANUP,	/* ZIL clean, space accounting, async tasks */
+	SPA_SYNC_PHASES
+} spa_sync_phase_t;
+
+/*
+ * The following are names used in the nvlist describing the pool's
+ * recently synced txgs, oldest first.
+ */
+#define	ZPOOL_TXG_RECORD	"txg record"
+#define	ZPOOL_TXG_TXG		"txg"
+#define	ZPOOL_TXG_TIME		"txg time"
+#define	ZPOOL_TXG_TOTAL		"txg total ns"
+#define	ZPOOL_TXG_PASSES	"txg passes"
+#define	ZPOOL_TXG_WRITTEN	"txg bytes written"
+#define	ZPOOL_TXG_FREED		"txg blocks freed"
+#define	ZPOOL_TXG_PHASE_NS	"txg phase ns"
+#define	ZPOOL_TXG_PASS_NS	"txg pass ns"
+
 /*
  * Flags for ZFS_IOC_VDEV_SET_STATE
  */
@@ -38,7 +38,7 @@ extern "C" {
 #define ZFS_SYSCTL_CONFIG_DPRINTF 4
 
 
-#define ZFS_FOOTPRINT_VERSION	1
+#define ZFS_FOOTPRINT_VERSION	2
 
 
 /*
@@ -52,6 +52,16 @@ typedef struct memory_stats {
 	uint32_t	maximum;
 } zfs_memory_stats_t;
 
+typedef struct hash_stats {
+	uint32_t	buckets;
+	uint32_t	elements;
+	uint32_t	locks;
+	uint32_t	resizes;
+	uint32_t	contended;
+	uint32_t	contended_max;
+	uint32_t	spare[2];
+} zfs_hash_stats_t;
+
 typedef struct kmem_cache_stats {
 	char		cache_name[32];
 	uint32_t	cache_obj_size;
@@ -67,6 +77,7 @@ typedef struct zfs_footprint_stats {
 	uint32_t		thread_count;
 	zfs_memory_stats_t	memory_stats;
 	zfs_memory_stats_t	arc_stats;
+	zfs_hash_stats_t	arc_hash_stats;
 	uint32_t		spare;
 	uint32_t		caches_count;
 	kmem_cache_stats_t	cache_stats[1];
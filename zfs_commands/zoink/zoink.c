@@ -61,6 +61,17 @@ print_memory_info(const char *mem_name, zfs_memory_stats_t *mem_stats)
 	mvaddstr(row++, 0, linebuf);
 }
 
+void
+print_hash_info(zfs_hash_stats_t *hash_stats)
+{
+	sprintf(linebuf, " ARC hash: %u/%u bufs/buckets, %u locks, "
+		"%u resizes, %u waits (max %u)",
+		hash_stats->elements, hash_stats->buckets, hash_stats->locks,
+		hash_stats->resizes, hash_stats->contended,
+		hash_stats->contended_max);
+	mvaddstr(row++, 0, linebuf);
+}
+
 void
 print_cache_info(kmem_cache_stats_t *cache_stats)
 {
@@ -153,6 +164,7 @@ main(void)
 		clear();
 		print_memory_info("ZFS footprint", &footprint->memory_stats);
 		print_memory_info("ARC footprint", &footprint->arc_stats);
+		print_hash_info(&footprint->arc_hash_stats);
 		row++;
 
 		sprintf(linebuf, "%3d threads", footprint->thread_count);